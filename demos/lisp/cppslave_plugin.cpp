@@ -0,0 +1,53 @@
+/********************************************************************
+ *   		cppslave_plugin.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Plugin version of cppslave.cpp: Counts the number of 1s in a
+ *   lisp "binary" list.  Give cppslave_plugin.so as the slave
+ *   program to have the slave servers call it directly.  Thread
+ *   safe, so it may be used with several slave plugin threads.
+ *******************************************************************/
+
+#include <simdist/plugin.h>
+
+#include <algorithm>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+extern "C" int
+simdist_evaluate(simdist_job *jobs, size_t num_jobs)
+{
+  for (size_t i = 0; i < num_jobs; i++)
+  {
+    stringstream ss;
+    ss << count(jobs[i].data, jobs[i].data + jobs[i].size, '1');
+    const string s = ss.str();
+    jobs[i].result = static_cast<char*>(malloc(s.size()));
+    if (!jobs[i].result)
+      return 1;
+    memcpy(jobs[i].result, s.data(), s.size());
+    jobs[i].result_size = s.size();
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+/********************************************************************
+ *   		control.h
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Control socket for a running master.  A thread listens on a
+ *   Unix domain socket, and for each connection reads one command
+ *   line and writes a reply, ending with a line holding OK or
+ *   ERROR and a description.  Commands:
+ *
+ *   status           Queue size, scheduling parameters and timeouts.
+ *   queue            One line per job in the queue, with its workers.
+ *   slaves           One line per slave, with its jobs in progress.
+ *   set NAME VALUE   Change jobs-per-send, slave-wait-factor,
+ *                    verbosity, verbosity-showonly or
+ *                    verbosity-dontshow.
+ *   help             List the commands.
+ *
+ *   Changes take effect the next time the parameter is used, e.g.
+ *   when a slave next takes jobs.  Evaluation is never paused,
+ *   though the queue is locked briefly for each command.  The
+ *   socket is only accessible to the owner of the process.  See
+ *   simdist_control.cpp for a client.
+ *******************************************************************/
+
+#if !defined(__CONTROL_SOCKET_H__)
+#define __CONTROL_SOCKET_H__
+
+#include "feedback.h"
+#include "jobqueue.h"
+#include "slave.h"
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+// extern FeedbackError E_CONTROL_SOCKET;
+DECLARE_FEEDBACK_ERROR(E_CONTROL_SOCKET)
+
+
+class ControlServer
+{
+  ControlServer(const ControlServer&); // Not implemented: No copy semantics.
+
+  Feedback m_fb;
+  JobQueue *m_pJobQueue;
+  std::vector<SlaveClient*> m_slaves;
+  std::string m_sPath;
+  int m_nListenFd;
+  int m_stopPipe[2];
+  pthread_t m_thread;
+  bool m_bRunning;
+      // Only touched by the server thread.
+  std::string m_sInfoShow, m_sInfoHide;
+
+  void ServeLoop();
+  void Serve(int nFd);
+  int Execute(const std::string &sCommand, std::ostream &reply, std::string &sError);
+  int Status(std::ostream &reply, std::string &sError);
+  int Queue(std::ostream &reply, std::string &sError);
+  int Slaves(std::ostream &reply, std::string &sError);
+  int Set(const std::string &sName, const std::string &sValue, std::ostream &reply, std::string &sError);
+
+  friend void *control_thread_func(void *pArg);
+public:
+  ControlServer(JobQueue *pJobQueue, const std::vector<SlaveClient*> &slaves);
+  ~ControlServer();
+
+  int Start(const std::string &sPath);
+      // Stop the thread and remove the socket.
+  int Stop();
+};
+
+
+#endif
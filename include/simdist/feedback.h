@@ -101,12 +101,31 @@
  *     <<'s additional info, he/she should also take care to insert
  *     the correct delimiters.
  * 
+ *   - Disabled info should cost next to nothing, since it is spread
+ *     all over the message paths.  The info level is checked before
+ *     anything is formatted, and a disabled info stream ignores
+ *     whatever is <<'ed to it.  The arguments are still evaluated,
+ *     so guard expensive ones with Feedback::InfoEnabled.  Info
+ *     above SIMDIST_MAX_INFO_LEVEL, if defined at compile time (e.g.
+ *     CPPFLAGS=-DSIMDIST_MAX_INFO_LEVEL=2), is never printed, and
+ *     calls with a constant level above it compile to nothing.
+ * 
  *   - The feedback library synchronizes its output through the use of
  *     a mutex.  By default, the mutex used is a class member, but
  *     this can be changed by the user by calling SetOutputMutex.  It
  *     is thus possible to install a system-wide output
  *     synchronization mutex.
  *
+ *   - Output may be made asynchronous with SetAsyncOutput.  Messages
+ *     are then formatted and time stamped by the calling thread, and
+ *     put in a bounded lock-free ring buffer.  A writer thread
+ *     empties the buffer, so that verbose output does not serialize
+ *     the threads on the output mutex.  When the buffer is full,
+ *     info is dropped and counted, while errors and warnings wait
+ *     for room.  Errors also wait until they have been written.  The
+ *     buffer is flushed on shutdown, and on a best effort basis if
+ *     the process crashes with a fatal signal.
+ *
  *     * Synchronization option 2: Install synchronized stdio
  *       wrappers.  This would be a nice solution, since this library
  *       would then work independently of whether multithreading is
@@ -134,9 +153,14 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <climits>
 
 #include <pthread.h>
 
+#if !defined(SIMDIST_MAX_INFO_LEVEL)
+#define SIMDIST_MAX_INFO_LEVEL INT_MAX
+#endif
+
 class FeedbackError
 {
   int m_nCode;
@@ -175,6 +199,7 @@ const FeedbackError& Identifier();
 
 // Forward declaration
 class Feedback;
+class FeedbackRing;
 
 
 /********************************************************************
@@ -185,23 +210,44 @@ class Feedback;
  *******************************************************************/
 class FeedbackCentral
 {
-  int m_nInfoLevel;
+      // Static, so that the level can be checked without going
+      // through Instance.  Written under m_selfMutex, and read
+      // without locking, through relaxed atomic loads and stores,
+      // which cost no more than plain ones.
+  static int m_nInfoLevel;
+      // Bumped by SetShowHide, so that Feedback objects know when
+      // their cached show/hide decision is out of date.  Accessed
+      // like m_nInfoLevel.
+  static int m_nFilterGeneration;
   FeedbackCentral(std::ostream &outputstream);
 
+      // The descriptions of registered threads are owned by the map.
+      // Each thread keeps a pointer to its own, or to its id in a
+      // thread-local buffer if it never registered, so that it can be
+      // found without locking, and unregistered threads leave nothing
+      // behind.
   typedef std::map<pthread_t, std::string> TThreadMap;
-  mutable TThreadMap m_threadDescriptions;
-  std::string GetThreadDescription() const;
+  TThreadMap m_threadDescriptions;
+  static __thread const char *m_szThreadDescription;
+  static __thread char m_szThreadId[32];
+  const char* GetThreadDescription() const;
 
   std::ostream &m_outputstream;
   mutable pthread_mutex_t m_defaultOutputMutex, *m_pOutputMutex, m_selfMutex;
 
   std::set<std::string> m_showSet, m_hideSet;
 
+      // Set while output is asynchronous.  Read without locking.
+  FeedbackRing * volatile m_pRing;
+
   void SetOutputMutex(pthread_mutex_t *pMtx = 0);
   void LockMutex(pthread_mutex_t *pMtx) const;
   void UnlockMutex(pthread_mutex_t *pMtx) const;
 
-  void WriteOutput(const std::string &sOutput) const;
+  typedef enum { raw_output, info_output, message_output, error_output } EOutputType;
+  void WriteOutput(const std::string &sOutput, EOutputType type = raw_output) const;
+  void WriteSynchronized(const std::string &sOutput) const;
+  friend class FeedbackRing;
   bool FindMatch(const std::string &sQry, const std::set<std::string> &sSet) const;
 public:
   ~FeedbackCentral();
@@ -209,7 +255,20 @@ public:
 
   void SetInfoLevel(int nLevel);
   int GetInfoLevel() const;
+  static bool InfoEnabled(int nLevel)
+  {
+    return nLevel <= SIMDIST_MAX_INFO_LEVEL && nLevel <= __atomic_load_n(&m_nInfoLevel, __ATOMIC_RELAXED);
+  }
   void SetShowHide(std::string sShow, std::string sHide);
+  static int FilterGeneration()
+  {
+    return __atomic_load_n(&m_nFilterGeneration, __ATOMIC_RELAXED);
+  }
+      // Returns (FilterGeneration() << 1) | shown for sIdentifier.
+  int ShowState(const std::string &sIdentifier) const;
+  int SetAsyncOutput(size_t nCapacity);
+  void FlushOutput() const;
+  size_t NumDropped() const;
 
   void RegisterThreadDescription(std::string sDescription);
 
@@ -225,20 +284,32 @@ public:
  *   IFeedbackStream and its descendants are a series of classes
  *   providing streaming abilities to the Feedback class.  Descendants
  *   should call their respective Error/Warning/Info function in
- *   FeedbackCentral from their destructors.
+ *   FeedbackCentral from their destructors, if the stream is active.
+ *   Inactive streams, such as disabled info, have no stringstream,
+ *   and ignore everything streamed to them.  The functions used for
+ *   info are inline, so that the compiler can see this.
  *******************************************************************/
 class IFeedbackStream
 {
+  IFeedbackStream& operator=(const IFeedbackStream&); // Not implemented.
 protected:
-  std::stringstream m_ss;
+  std::stringstream *m_pss;
   const Feedback *m_pSender;
+  std::string Str() const;
 public:
-  IFeedbackStream(const Feedback *pSender);
+  IFeedbackStream(const Feedback *pSender, bool bActive = true)
+    : m_pss(bActive ? new std::stringstream : 0), m_pSender(pSender)
+  {
+  }
   IFeedbackStream(const IFeedbackStream &rhs);
-  virtual ~IFeedbackStream();
+  virtual ~IFeedbackStream()
+  {
+    delete m_pss;
+  }
   template<class T>IFeedbackStream& operator<<(const T &t)
   {
-    m_ss << t;
+    if (m_pss)
+      *m_pss << t;
     return *this;
   }
 };
@@ -275,9 +346,15 @@ public:
 class InfoStream : public IFeedbackStream
 {
   int m_nLevel;
+  void Report() const;
 public:
+  InfoStream(const Feedback *pSender, int nLevel);
   InfoStream(const Feedback *pSender, int nLevel, const std::string &sMessage);
-  virtual ~InfoStream();
+  virtual ~InfoStream()
+  {
+    if (m_pss)
+      Report();
+  }
 };
 
 
@@ -295,6 +372,10 @@ public:
 class Feedback
 {
   std::string m_sIdentifier;
+      // Cached FeedbackCentral::ShowState for m_sIdentifier, or -1
+      // until Shown first needs it.  Accessed with relaxed atomics.
+  mutable int m_nShowState;
+  int UpdateShowState() const;
 public:
   Feedback(const std::string &sIdentifier);
   Feedback(const Feedback &rhs);
@@ -306,7 +387,17 @@ public:
   ErrorStream Error(const FeedbackError &error) const;
   ErrorStream Error(const FeedbackError &(*provider)()) const;
   WarningStream Warning(const std::string &sMessage = "") const;
-  InfoStream Info(int nLevel, const std::string &sMessage = "") const;
+  InfoStream Info(int nLevel) const
+  {
+    return InfoStream(this, nLevel);
+  }
+  InfoStream Info(int nLevel, const char *szMessage) const
+  {
+    InfoStream is(this, nLevel);
+    is << szMessage;
+    return is;
+  }
+  InfoStream Info(int nLevel, const std::string &sMessage) const;
   OutputStream Output(const std::string &sMessage = "") const;
 
   ErrorStream ErrorIfNonzero(int nCond, const FeedbackError &error) const;
@@ -315,13 +406,36 @@ public:
 
   const std::string& Identify() const;
   void SetIdentifier(const std::string &sNewIdentifier);
+      // Whether info from this object passes the show/hide filters.
+  bool Shown() const
+  {
+    int nState = __atomic_load_n(&m_nShowState, __ATOMIC_RELAXED);
+    if (nState < 0 || (nState >> 1) != FeedbackCentral::FilterGeneration())
+      nState = UpdateShowState();
+    return nState & 1;
+  }
 
   static void SetInfoLevel(int nLevel);
   static int GetInfoLevel();
+  static bool InfoEnabled(int nLevel)
+  {
+    return FeedbackCentral::InfoEnabled(nLevel);
+  }
   static void SetShowHide(const std::string &sShow, const std::string &sHide);
+      // Write output through a buffer of nCapacity messages, or
+      // synchronously if nCapacity is 0.
+  static int SetAsyncOutput(size_t nCapacity);
+  static void FlushOutput();
 };
 
 
+inline
+InfoStream::InfoStream(const Feedback *pSender, int nLevel)
+  : IFeedbackStream(pSender, FeedbackCentral::InfoEnabled(nLevel) && pSender->Shown()), m_nLevel(nLevel)
+{
+}
+
+
     // Include commonly used error codes.
 #include "errorcodes_common.h"
 #include "errorcodes_thread.h"
@@ -53,6 +53,26 @@
  *     integer (uint32_t) indicating the size of the message to
  *     come.
  *
+ *     - bytecount64: Like bytecount, but with a 64 bit size
+ *     (uint64_t), for messages of 4 GB and more.
+ *
+ *     - chunked: Each message is sent as a sequence of chunks, each
+ *     starting with a 64 bit size like in bytecount64 mode, and
+ *     ended by an empty chunk.  The writer doesn't need to know the
+ *     size of the message up front, and ReadChunk and WriteChunk
+ *     let the user pass on a message one chunk at a time, without
+ *     holding all of it in memory.  The largest chunk written CAN
+ *     be given as argument, or will default to default_chunk_size.
+ *     Chunks of any size are accepted when reading.
+ *
+ *     - file: Each message is a line "<path> <offset> <length>",
+ *     naming the file which holds the message, so that large
+ *     messages can be handed to a process on the same node without
+ *     being copied through a pipe.  The writer creates a new file
+ *     for each message, in /dev/shm if it exists and TMPDIR or /tmp
+ *     otherwise.  The reader removes the file once the message has
+ *     been read.
+ *
  *   NOTE: The EOF/BIN-EOF tags are NOT sent across the network,
  *   so you can NOT write code that is dependent on receiving a
  *   particular tag.
@@ -61,12 +81,46 @@
  *   operation should be 'atomic', in the sense that the whole
  *   block of data should be written to file, if anything.
  *
+ *     - Load maps the file into memory, rather than reading it
+ *     through a stream.
+ *
+ *     - StoreDelta splits the data in chunks, and after the first
+ *     (full) store, only appends the chunks that have changed to
+ *     <filename>.delta.  Each delta is checksummed and flushed to
+ *     disk, and Load applies the complete ones.  When the delta
+ *     file grows to half the size of the data, or the size of the
+ *     data changes, the next StoreDelta stores it all again.
+ *
+ *     - StoreAsync copies the data, and stores the copy in a
+ *     background thread.  Call WaitStore for the result.  The other
+ *     calls wait for the background store to complete first.
+ *
+ *   ResultJournal: Append-only file of job results, indexed by a hash
+ *   of the job data, so that a master restarted after a crash can
+ *   skip the jobs it has already had evaluated.  Each record holds
+ *   the job data as well as the results, so that Lookup can tell
+ *   jobs with the same hash apart.  Records are written with a
+ *   single write and carry a CRC-32, and Open replays the file,
+ *   cutting off a torn or corrupt tail.  A record which fails to be
+ *   written is cut off at once, so that later records are not lost
+ *   behind it.  Records are flushed to disk with fdatasync after
+ *   every nSyncBatch records, and on Sync and Close.  Lookup only
+ *   finds the records replayed by Open, i.e. those of earlier runs.
+ *
  *******************************************************************/
 
 #if !defined(__IO_UTILS_H__)
 #define __IO_UTILS_H__
 
 #include "feedback.h"
+#include "syncutils.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <vector>
+#include <map>
+#include <set>
 
 DECLARE_FEEDBACK_ERROR(E_IO_UTILS_READJOB)
 DECLARE_FEEDBACK_ERROR(E_IO_UTILS_WRITEJOB)
@@ -77,24 +131,35 @@ DECLARE_FEEDBACK_ERROR(E_CHECKPOINT_WRITE)
 DECLARE_FEEDBACK_ERROR(E_CHECKPOINT_RENAME)
 DECLARE_FEEDBACK_ERROR(E_CHECKPOINT_READ)
 DECLARE_FEEDBACK_ERROR(E_CHECKPOINT_CLEAR)
+DECLARE_FEEDBACK_ERROR(E_CHECKPOINT_DELTA)
+
+DECLARE_FEEDBACK_ERROR(E_JOURNAL_OPEN)
+DECLARE_FEEDBACK_ERROR(E_JOURNAL_WRITE)
+DECLARE_FEEDBACK_ERROR(E_JOURNAL_SYNC)
 
 class JobReaderWriter
 {
 public:
-  typedef enum { none, eof, bin_eof, simple, bytecount } EIOMode;
-  enum { default_simple_length = 1, default_bin_eof_length = 4 };
+  typedef enum { none, eof, bin_eof, simple, bytecount, bytecount64, chunked, file } EIOMode;
+  enum { default_simple_length = 1, default_bin_eof_length = 4, default_chunk_size = 1 << 20 };
   typedef std::istream::traits_type traits_type;
   typedef traits_type::int_type int_type;
 private:
   Feedback m_fb;
   EIOMode m_mode;
   int m_nModeArguments;
+  mutable std::string m_sLastFile;
 
-  template<class it1, class it2>
-  it1 MatchDelim(it1 dataBegin, it1 dataEnd, it2 delimBegin, it2 delimEnd) const;
   int ReadDelimData(std::istream &s, std::string &sData, const std::string &sDelim) const;
-  template<class T>
-  void IncSequence(T itBegin, T itEnd) const;
+  int_type ReadLines(std::istream &s, std::string &sData, int nNumLines) const;
+  int_type ReadByteCount(std::istream &s, uint64_t &nBytes) const;
+  int_type ReadChunkAppend(std::istream &s, std::string &sData, bool &bEnd) const;
+  int_type ReadFile(std::istream &s, std::string &sData) const;
+  int_type WriteFile(std::ostream &s, const char *pData, size_t nCount) const;
+  int_type WriteParts(std::ostream &s, const char *pHead, size_t nHead, 
+                      const char *pData, size_t nData, const char *pTail, size_t nTail) const;
+  std::string ChooseEOFTag(const char *pData, size_t nCount) const;
+  int ChooseBinTag(const char *pData, size_t nCount, std::vector<unsigned char> &tag) const;
 public:
   JobReaderWriter();
   JobReaderWriter(const std::string &sIOMode);
@@ -108,15 +173,65 @@ public:
   int_type Write(std::ostream &s, const std::string &sData) const;
   int_type Read(std::istream &s, char **ppData, size_t &nCount) const;
   int_type Write(std::ostream &s, const char *pData, size_t nCount) const;
+
+      // Chunked mode only: Read or write one chunk of a message.  An
+      // empty chunk ends the message.  WriteChunk splits data larger
+      // than the chunk size given in the mode.
+  int_type ReadChunk(std::istream &s, std::string &sChunk) const;
+  int_type WriteChunk(std::ostream &s, const char *pData, size_t nCount) const;
+
+      // File mode only: Remove the file last written, in case the
+      // reader never got to it.
+  void DiscardFile() const;
 };
 
 
 
+// CRC-32 (as in zlib).  Pass the previous return value as nCrc to
+// continue a checksum over several blocks.
+uint32_t Crc32(const char *pData, size_t nCount, uint32_t nCrc = 0);
+
+
+
 class Checkpointer
 {
+public:
+  enum { default_chunk_size = 1 << 20 };
+  static const uint32_t delta_magic = 0x31434453; // "SDC1"
+private:
+  Checkpointer(const Checkpointer&); // Not implemented: No copy semantics.
+
+      // Each delta is a header, the changed chunks, each preceded by
+      // its index, and a CRC-32 of everything before it.
+  typedef struct TDeltaHeaderVar
+  {
+    uint32_t nMagic, nBaseCrc;
+    uint64_t nChunkSize, nNumChunks, nSize;
+  } TDeltaHeader;
+
   Feedback m_fb;
   std::string m_sFilename;
 //   std::string m_sTemplate;
+  size_t m_nChunkSize;
+      // What was last stored by StoreDelta: The checksum of each
+      // chunk, the size, and the size of the delta file.  Deltas
+      // carry a checksum of the chunk checksums of the full store
+      // they apply to, m_nBaseCrc.  Cleared by the other stores.
+  mutable uint32_t m_nBaseCrc;
+  mutable uint64_t m_nStoredSize, m_nDeltaSize;
+  mutable std::vector<uint32_t> m_chunkCrcs;
+      // Background store.
+  std::vector<char> m_snapshot;
+  bool m_bAsyncDelta;
+  mutable bool m_bAsyncRunning;
+  mutable int m_nAsyncRet;
+  mutable pthread_t m_asyncThread;
+
+  std::string DeltaFilename() const;
+  int StoreFull(const char *pData, size_t nCount, bool bDeltaBase) const;
+  int StoreDeltaInt(const char *pData, size_t nCount);
+  int ApplyDeltas(char *pData, size_t nCount) const;
+  friend void *checkpoint_thread_func(void *pArg);
 public:
   Checkpointer();
   ~Checkpointer();
@@ -124,9 +239,16 @@ public:
 
   void SetFilename(const std::string &sFileName);
   std::string GetFilename() const;
+  void SetChunkSize(size_t nChunkSize);
 
   int Store(const char *pData, size_t nCount) const;
   int Store(const std::string &sData) const;
+  int StoreDelta(const char *pData, size_t nCount);
+      // Returns nonzero if the background store could not be
+      // started, or if the previous one failed.
+  int StoreAsync(const char *pData, size_t nCount, bool bDelta = true);
+      // The result of the last background store, if any.
+  int WaitStore() const;
 
   int Load(char **ppData, size_t *pnCount) const;
   int Load(std::string &sData) const;
@@ -135,4 +257,58 @@ public:
 };
 
 
+
+class ResultJournal
+{
+public:
+      // Hash and size of the job data.
+  typedef std::pair<uint64_t, uint64_t> TKey;
+private:
+  ResultJournal(const ResultJournal&); // Not implemented: No copy semantics.
+
+      // The header is followed by the job data and the results.
+  typedef struct TRecordHeaderVar
+  {
+    uint32_t nMagic, nCrc;
+    uint64_t nHash, nJobSize, nResultsSize;
+  } TRecordHeader;
+      // Offset of the job data, and size of the results, of each
+      // replayed record.
+  typedef std::map<TKey, std::pair<off_t, uint64_t> > TIndex;
+
+  Feedback m_fb;
+      // Guards the members below.
+  LockableObject m_mtx;
+  std::string m_sFilename;
+  int m_nFd;
+  int m_nSyncBatch, m_nUnsynced;
+      // Set if a failed record could not be cut off.  Nothing more is
+      // appended, since it would be lost behind it anyway.
+  bool m_bFailed;
+  TIndex m_replayed;
+  std::set<TKey> m_written;
+
+  int Replay();
+  int SyncInt();
+public:
+  static const uint32_t record_magic = 0x324a4453; // "SDJ2"
+
+  ResultJournal();
+  ~ResultJournal();
+
+  int Open(const std::string &sFilename, int nSyncBatch);
+  int Close();
+  bool IsOpen() const;
+
+  static TKey Key(const std::string &sJobData);
+
+      // Returns true if results for the job were replayed.
+  bool Lookup(const std::string &sJobData, std::string &sResults);
+  size_t NumReplayed();
+      // Only the first results for each job are recorded.
+  int Append(const std::string &sJobData, const std::string &sResults);
+  int Sync();
+};
+
+
 #endif
@@ -30,12 +30,17 @@
 
 #include "syncutils.h"
 #include "feedback.h"
+#include "misc_utils.h"
+#include "metrics.h"
+#include "trace.h"
+#include "io_utils.h"
 
 #include <pthread.h>
 #include <stdexcept>
 #include <string>
 #include <set>
 #include <list>
+#include <vector>
 
 // extern FeedbackError E_JOBQUEUE_CLOSE;
 DECLARE_FEEDBACK_ERROR(E_JOBQUEUE_CLOSE)
@@ -56,6 +61,8 @@ public:
   std::string sJobData;
   std::string sResults;
   time_t timeLastStart;
+      // When the job was queued, if tracing.
+  uint64_t nTraceQueued;
   std::set<class SlaveClient*> workers;
 
   bool operator<(const JobQueueElement &rhs) const;
@@ -65,6 +72,25 @@ public:
 
 typedef std::set<JobQueueElement> TResultSet;
 
+
+/********************************************************************
+ *   Accumulated resource usage for a set of completed jobs, as
+ *   reported by the slave servers.  Server time is the wall-clock
+ *   time spent by the servers on the jobs.
+ *******************************************************************/
+class JobStatistics
+{
+public:
+  int nNumJobs;
+  double dServerTime;
+  TResourceUsage usage;
+
+  JobStatistics();
+  void Add(double dTime, const TResourceUsage &jobUsage);
+  std::string ToString() const;
+};
+
+
 /********************************************************************
  *   Queue of jobs pending evaluation.  The plan was to inherit from
  *   std::queue, but this class lacks the necessary erase
@@ -79,6 +105,12 @@ protected:
   TResultSet m_resultSet;
   size_t m_nNumJobsPerSend;
   bool m_bAutoNumJobsPerSend;
+  float m_fWaitFactor;
+  int m_nNumTimeouts;
+  std::vector<JobStatistics> m_generationStats;
+  int m_nResultNotifyFd;
+  MetricsGauge &m_depthGauge;
+  ResultJournal *m_pJournal;
 
   JobQueue(const JobQueue &q);
 public:
@@ -94,6 +126,28 @@ public:
   const TResultSet& ResultSet() const;
   TResultSet& ResultSet();
   size_t NumJobsPerSend() const;
+  bool AutoNumJobsPerSend() const;
+      // 0 means automatic.  Takes effect from the next set of jobs
+      // taken by each slave.
+  void SetNumJobsPerSend(size_t nNumPerSend);
+  float WaitFactor() const;
+  void SetWaitFactor(float fWaitFactor);
+
+  int NumTimeouts() const;
+  void AddTimeout();
+
+  void NewGeneration();
+  void AddJobStatistics(double dTime, const TResourceUsage &usage);
+  const std::vector<JobStatistics>& GenerationStatistics() const;
+
+  void SetResultNotifyFd(int nFd);
+  void NotifyResult();
+  void UpdateDepthMetric();
+
+      // Set before the slaves are started, and not owned by the
+      // queue.  May be 0.
+  void SetJournal(ResultJournal *pJournal);
+  ResultJournal* Journal() const;
 };
   
 
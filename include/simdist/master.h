@@ -29,6 +29,7 @@
 
 #include "slave.h"
 #include "jobqueue.h"
+#include "control.h"
 
 // extern FeedbackError E_MASTER_EVALUATE;
 DECLARE_FEEDBACK_ERROR(E_MASTER_EVALUATE)
@@ -43,7 +44,11 @@ DECLARE_FEEDBACK_ERROR(E_DISTRIBUTOR_DESTROY)
  *   Evaluation distribution master.  This class fires up the slaves,
  *   and then evaluates a set of problems by distributing them to the
  *   slaves.  This happens by posting the jobs to the jobqueue, and
- *   then waiting for it to empty.
+ *   then waiting for it to empty.  Evaluate posts a whole set of
+ *   jobs at once.  Alternatively, jobs may be posted one by one
+ *   with Submit, between BeginBatch and FinishBatch, so that the
+ *   slaves can start on the first jobs while the rest are still
+ *   being produced.
  *******************************************************************/
 class Master
 {
@@ -51,9 +56,38 @@ class Master
   Feedback m_fb;
 
   int m_nIDCounter;
+
+      // Jobs in the current batch which have not yet been returned,
+      // keyed on job ID.
+  typedef struct TBatchJobVar
+  {
+    size_t nIndex;
+    std::string sData;
+  } TBatchJob;
+  typedef std::map<std::string, TBatchJob> TBatchJobMap;
+  TBatchJobMap m_batchJobs;
+  size_t m_nBatchSize, m_nBatchReplayed;
+  int m_nTimeoutsBefore;
+
+  size_t QueueJob(const std::string &sData);
 public:
   Master(JobQueue *pJobQueue);
   int Evaluate(const std::vector<std::string> &data, std::vector<std::string> &results);
+
+  int BeginBatch();
+  int Submit(const std::string &sData, size_t *pnIndex = 0);
+  int FinishBatch(std::vector<std::string> &results);
+
+      // Results of the current batch in order of completion: Take
+      // the results completed so far, as pairs of (position in
+      // batch, result).  Results taken here are not returned by
+      // FinishBatch.  If nFd is not negative, a byte is written to
+      // it whenever a result has completed, so that a caller may
+      // poll for results along with other file descriptors.
+  typedef std::vector<std::pair<size_t, std::string> > TCompletedResults;
+  int TakeCompleted(TCompletedResults &completed);
+  bool Pending();
+  int SetResultNotifyFd(int nFd);
 };
 
 /********************************************************************
@@ -71,6 +105,8 @@ class DistributorLauncher
     std::vector<std::string> slavePrograms;
     std::vector<std::string> slavesArgs;
     ThreadBarrier *pBarrier;
+    ControlServer *pControl;
+    ResultJournal *pJournal;
   } TDistributor;
 
   typedef std::map<Master*, TDistributor> TDistributorSet;
@@ -0,0 +1,144 @@
+/********************************************************************
+ *   		master_io.h
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Reader and writer threads for the standard input and output of
+ *   the master process.  The evaluation loop in master_stdio.cpp
+ *   takes jobs from a MasterReader and gives results to a
+ *   MasterWriter, and never touches the pipes itself.  This way,
+ *   the output of the master is drained while results are written,
+ *   and the master can't deadlock with simdist on two full pipes.
+ *   Both queues are bounded, so that a master which is far ahead of
+ *   the slaves, or far behind in reading results, is held back by
+ *   its pipes as before.
+ *******************************************************************/
+
+#if !defined(__MASTER_IO_H__)
+#define __MASTER_IO_H__
+
+#include "feedback.h"
+#include "syncutils.h"
+#include "io_utils.h"
+#include "metrics.h"
+
+#include <pthread.h>
+#include <string>
+#include <deque>
+
+// extern FeedbackError E_MASTERIO_READ;
+DECLARE_FEEDBACK_ERROR(E_MASTERIO_READ)
+// extern FeedbackError E_MASTERIO_WRITE;
+DECLARE_FEEDBACK_ERROR(E_MASTERIO_WRITE)
+
+
+/********************************************************************
+ *   Reads jobs from the master.  In COUNT and MARKER batch mode,
+ *   the reader also handles the batch framing, and reports the end
+ *   of each batch as an item of its own.  If a notification
+ *   descriptor is given, a byte is written to it for every item,
+ *   as for results in JobQueue.
+ *******************************************************************/
+class MasterReader
+{
+public:
+  typedef enum { job, end_of_batch, end_of_file, read_error } EItemType;
+  typedef struct TItemVar
+  {
+    EItemType type;
+    std::string sData;
+  } TItem;
+private:
+  MasterReader(const MasterReader&); // Not implemented: No copy semantics.
+
+  Feedback m_fb;
+  std::istream &m_stream;
+  const JobReaderWriter &m_rwReader;
+  std::string m_sBatchMode, m_sMarker;
+  size_t m_nCapacity;
+  int m_nNotifyFd;
+  pthread_t m_thread;
+  bool m_bRunning;
+
+      // Guarded by m_mtx.
+  LockableObject m_mtx;
+  Condition m_condNotEmpty, m_condNotFull;
+  std::deque<TItem> m_items;
+  bool m_bStop;
+
+  bool NotEmpty() const;
+  bool NotFull() const;
+  bool Push(EItemType type, const std::string &sData = "");
+  void ReadLoop();
+
+  friend void *masterreader_thread_func(void *pArg);
+public:
+  MasterReader(std::istream &stream, const JobReaderWriter &rwReader,
+               const std::string &sBatchMode, const std::string &sMarker, size_t nCapacity);
+  ~MasterReader();
+
+  int SetNotifyFd(int nFd);
+  int Start();
+      // Wait at most nTimeoutMs milliseconds (forever if negative)
+      // for the next item.  bTimedOut is set if there was none.
+  int Pop(TItem &item, int nTimeoutMs, bool &bTimedOut);
+};
+
+
+/********************************************************************
+ *   Writes results to the master.  Push blocks while the queue is
+ *   full.  Once writing has failed, e.g. because the master
+ *   process died, Push and Close return an error.
+ *******************************************************************/
+class MasterWriter
+{
+  MasterWriter(const MasterWriter&); // Not implemented: No copy semantics.
+
+  Feedback m_fb;
+  std::ostream &m_stream;
+  const JobReaderWriter &m_rwWriter;
+  size_t m_nCapacity;
+  pthread_t m_thread;
+  bool m_bRunning;
+
+      // Guarded by m_mtx.
+  LockableObject m_mtx;
+  Condition m_condNotEmpty, m_condNotFull;
+  std::deque<std::string> m_results;
+  bool m_bClosed, m_bFailed;
+
+  bool NotEmpty() const;
+  bool NotFull() const;
+  void WriteLoop();
+
+  friend void *masterwriter_thread_func(void *pArg);
+public:
+  MasterWriter(std::ostream &stream, const JobReaderWriter &rwWriter, size_t nCapacity);
+  ~MasterWriter();
+
+  int Start();
+  int Push(const std::string &sResult);
+      // Write the remaining results and stop the thread.
+  int Close();
+  bool Failed();
+};
+
+
+#endif
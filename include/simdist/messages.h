@@ -104,6 +104,17 @@
  *      - time: string.  The actual time (as opposed to cpu time) spent
  *        in the server processing the job.
  *
+ *      - status: string.  OK if the job completed, or TIMEOUT if the
+ *        job exceeded the slave job timeout.  On TIMEOUT the server
+ *        has restarted its program, the result is empty, and the
+ *        client should put the job back in the queue to be retried.
+ *
+ *      - usage: five numbers.  Resources used by the server program
+ *        while processing the job: user and system CPU seconds,
+ *        maximum resident set size in kilobytes, and the number of
+ *        voluntary and involuntary context switches.  All zero if
+ *        the server was unable to sample the usage.
+ *
  *      - size: int.  The number of bytes of data in this result.
  *   
  *      - result: string.  The output from the server evaluation program.
@@ -153,17 +164,15 @@
  *   MessageRouter.
  * 
  *   The MessageRouter sending thread (actually the
- *   MessageStreamer) inserts an EOF tag in the same manner as
- *   with here-documents; so that the second line of a message
- *   identifies the EOF-mark, this being a string not found
- *   anywhere in the message.  When reading, entire messages are
- *   read and queued waiting for a receiver.
+ *   MessageStreamer) writes the message in the chunked mode of
+ *   JobReaderWriter, so that the channels can pass large messages
+ *   on a chunk at a time.  When reading, entire messages are read
+ *   and queued waiting for a receiver.
  *
  *   Messages are read and written in the following format:
  *      LINE 1:   Server ID
- *      LINE 2:   EOF-Tag
- *      LINE 3 - n: Message
- *      LINE n+1: EOF-Tag
+ *      Message, as chunks of a 64 bit size followed by data
+ *      An empty chunk (a size of 0)
  *
  *   TODO: The server id occurs twice now, once in the actual
  *   message, and once as an argument to the send/receive functions.
@@ -0,0 +1,204 @@
+/********************************************************************
+ *   		metrics.h
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Counters, gauges and latency histograms, kept in a registry and
+ *   written to a file at regular intervals, in Prometheus text
+ *   format or as JSON.
+ *
+ *   - Metrics are registered by name, with an optional label (e.g.
+ *     slave="rank1"), and live as long as the process.  Registering
+ *     the same name and label twice returns the same metric, so keep
+ *     a pointer rather than registering in the hot path.
+ *
+ *   - Updates are lock-free (GCC __sync builtins), and do nothing
+ *     until the export has been started, so that a disabled metric
+ *     costs one load and a branch.  Callers should also check
+ *     Metrics::Enabled before computing anything expensive for a
+ *     metric, such as a time stamp.
+ *
+ *   - The file is written to a temporary file and renamed, so that
+ *     readers never see half a file.
+ *******************************************************************/
+
+#if !defined(__METRICS_H__)
+#define __METRICS_H__
+
+#include "feedback.h"
+#include "syncutils.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <map>
+
+// extern FeedbackError E_METRICS_REGISTER;
+DECLARE_FEEDBACK_ERROR(E_METRICS_REGISTER)
+// extern FeedbackError E_METRICS_EXPORT;
+DECLARE_FEEDBACK_ERROR(E_METRICS_EXPORT)
+
+class MetricsCounter;
+class MetricsGauge;
+class MetricsHistogram;
+
+
+/********************************************************************
+ *   The registry and exporter.  Singleton.
+ *******************************************************************/
+class Metrics
+{
+public:
+  typedef enum { prometheus, json } EFormat;
+private:
+  Metrics();
+  ~Metrics();
+  Metrics(const Metrics&); // Not implemented: No copy semantics.
+
+  static volatile bool m_bEnabled;
+
+  typedef enum { counter, gauge, histogram } EType;
+  typedef struct TMetricVar
+  {
+    EType type;
+    void *pMetric;
+  } TMetric;
+      // Keyed on label, i.e. "" or name="value".
+  typedef std::map<std::string, TMetric> TLabelMap;
+  typedef struct TFamilyVar
+  {
+    EType type;
+    std::string sHelp;
+    TLabelMap metrics;
+  } TFamily;
+  typedef std::map<std::string, TFamily> TFamilyMap;
+
+  Feedback m_fb;
+  std::string m_sFile;
+  EFormat m_format;
+  double m_dInterval;
+  pthread_t m_thread;
+  bool m_bRunning;
+
+      // Guarded by m_mtx.
+  mutable LockableObject m_mtx;
+  Condition m_condStop;
+  TFamilyMap m_families;
+  bool m_bStop;
+
+  void *Register(EType type, const std::string &sName, const std::string &sHelp,
+                 const std::string &sLabelName, const std::string &sLabelValue);
+  void WritePrometheus(std::ostream &s) const;
+  void WriteJson(std::ostream &s) const;
+  void ExportLoop();
+
+  friend void *metrics_thread_func(void *pArg);
+public:
+  static Metrics& Instance();
+  static bool Enabled()
+  {
+    return m_bEnabled;
+  }
+
+  MetricsCounter& Counter(const std::string &sName, const std::string &sHelp,
+                          const std::string &sLabelName = "", const std::string &sLabelValue = "");
+  MetricsGauge& Gauge(const std::string &sName, const std::string &sHelp,
+                      const std::string &sLabelName = "", const std::string &sLabelValue = "");
+  MetricsHistogram& Histogram(const std::string &sName, const std::string &sHelp,
+                              const std::string &sLabelName = "", const std::string &sLabelValue = "");
+
+      // Enable the metrics, and write them to sFile every dInterval
+      // seconds until StopExport, which writes them a last time.
+      // sFormat is PROMETHEUS or JSON.
+  int StartExport(const std::string &sFile, const std::string &sFormat, double dInterval);
+  int StopExport();
+  int Write(std::ostream &s, EFormat format) const;
+  int WriteFile() const;
+};
+
+
+class MetricsCounter
+{
+  volatile uint64_t m_nValue;
+public:
+  MetricsCounter() : m_nValue(0) {}
+  void Add(uint64_t nAmount = 1)
+  {
+    if (Metrics::Enabled())
+      __sync_fetch_and_add(&m_nValue, nAmount);
+  }
+  uint64_t Value() const
+  {
+    return m_nValue;
+  }
+};
+
+
+class MetricsGauge
+{
+  volatile int64_t m_nValue;
+public:
+  MetricsGauge() : m_nValue(0) {}
+  void Set(int64_t nValue)
+  {
+    if (Metrics::Enabled())
+      m_nValue = nValue;
+  }
+  void Add(int64_t nAmount)
+  {
+    if (Metrics::Enabled())
+      __sync_fetch_and_add(&m_nValue, nAmount);
+  }
+  int64_t Value() const
+  {
+    return m_nValue;
+  }
+};
+
+
+/********************************************************************
+ *   Histogram of durations in seconds, with fixed buckets from 100
+ *   microseconds to 1000 seconds.  The sum is kept in microseconds.
+ *******************************************************************/
+class MetricsHistogram
+{
+public:
+  static const int num_buckets = 16;
+  static const double bucket_limits[num_buckets - 1];
+private:
+      // The last bucket is +Inf.  Counts are per bucket, not
+      // cumulative.
+  volatile uint64_t m_counts[num_buckets];
+  volatile uint64_t m_nSumMicros;
+public:
+  MetricsHistogram();
+  void Observe(double dSeconds)
+  {
+    if (Metrics::Enabled())
+      Add(dSeconds);
+  }
+  void Add(double dSeconds);
+  uint64_t Count(int nBucket) const;
+  uint64_t Count() const;
+  double Sum() const;
+};
+
+
+#endif
@@ -29,9 +29,11 @@
 
 #include "feedback.h"
 #include "syncutils.h"
+#include "metrics.h"
 
 #include <vector>
 #include <functional>
+#include <sys/uio.h>
 
 //#define USE_GNU_EXT_FILEBUF 1
 
@@ -60,7 +62,9 @@ class custiobufbase : public std::streambuf
 {
 public:
       // Size of buffer and putback area inside buffer for input.
-  enum { putbacksize = 8, buffersize = 256 } EBufSize;
+      // Delimited messages are searched for in the buffer, so it
+      // should hold a good chunk of a pipe.
+  enum { putbacksize = 8, buffersize = 65536 } EBufSize;
 protected:
       // Output buffer functions
   virtual int_type overflow (int_type c);
@@ -72,9 +76,13 @@ protected:
 
   virtual ssize_t DoRead(void *pBuf, size_t nCount) = 0;
   virtual ssize_t DoWrite(const void *pBuf, size_t nCount) = 0;
+  virtual ssize_t DoWriteV(const struct iovec *pIov, int nIovCnt);
 public:
   custiobufbase();
   virtual bool is_open() const = 0;
+      // Write several buffers at once, like writev.  Returns the
+      // total number of bytes written, or -1.
+  ssize_t write_gathered(const struct iovec *pIov, int nIovCnt);
 };
 
 
@@ -82,14 +90,22 @@ public:
  *   I/O buffer intended to be connected to an open posix file
  *   descriptor.
  *
+ *   A timeout may be set, after which reads and writes will fail
+ *   instead of blocking.  While a timeout is set, the descriptor is
+ *   in non-blocking mode.
+ *
  *   NOTE: Will not automatically close the file descriptor on destroy.
  *******************************************************************/
 class fdiobuf : public custiobufbase
 {
 protected:
   int m_nFd;
+  double m_dDeadline;
+  bool m_bTimedOut;
+  int WaitReady(short nEvents);
   virtual ssize_t DoRead(void *pBuf, size_t nCount);
   virtual ssize_t DoWrite(const void *pBuf, size_t nCount);
+  virtual ssize_t DoWriteV(const struct iovec *pIov, int nIovCnt);
 public:
   fdiobuf();
   fdiobuf(int nFd);
@@ -97,6 +113,10 @@ public:
   virtual bool is_open() const;
   int close();
   int fd() const;
+      // Fail I/O that has not completed dSeconds from now.  0
+      // removes the timeout.
+  int set_timeout(double dSeconds);
+  bool timed_out() const;
 };
 
 
@@ -146,6 +166,8 @@ public:
   bool is_open() const;
   int close();
   int fd() const;
+  int set_timeout(double dSeconds);
+  bool timed_out() const;
 };
 
 class fdostream : public fdstream, public std::ostream
@@ -234,6 +256,26 @@ public:
 
 
 
+/********************************************************************
+ *   Input stream reading directly from a block of memory, such as a
+ *   received message, which a std::stringstream would first copy.
+ *   The memory must stay valid for the lifetime of the stream.
+ *******************************************************************/
+class imembuf : public std::streambuf
+{
+public:
+  imembuf(const char *pData, size_t nCount);
+};
+
+class imemstream : private imembuf, public std::istream
+{
+public:
+  imemstream(const char *pData, size_t nCount);
+  explicit imemstream(const std::string &sData);
+};
+
+
+
 /********************************************************************
  *   A memory-only pipe which implements per-thread blocking, as
  *   opposed to the per-process blocking performed by POSIX pipes.
@@ -248,10 +290,14 @@ class MemoryPipe
   size_t m_nCurBufSize;
   MemoryPipe(MemoryPipe&);
   bool m_bIsOpen;
+  MetricsGauge *m_pOccupancy;
 public:
   explicit MemoryPipe(int nBufSize = 1024);
   ssize_t Read(void *pBuf, size_t nNumBytes);
   ssize_t Write(const void *pBuf, size_t nNumBytes);
+      // Report the number of buffered bytes as a metric, labelled
+      // with sName.
+  void ExportOccupancy(const std::string &sName);
 
   void Close();
   bool IsOpen();
@@ -300,13 +346,21 @@ int CreateArgumentVector(const std::string &sArgLine, std::vector<std::string> &
  *   of child STDIN, pnFileDescriptors[1] and
  *   pnFileDescriptors[2] are the READ ends of child STDOUT and
  *   STDERR, respectively.
+ *
+ *   method selects how the child is created.  spawn_posix uses
+ *   posix_spawnp, which does not copy the page tables of the
+ *   parent, and is therefore much cheaper than fork for large
+ *   parent processes.  spawn_default is spawn_posix where
+ *   available, and spawn_fork otherwise.
  *******************************************************************/
+enum TSpawnMethod { spawn_default, spawn_fork, spawn_posix };
+
 int ConnectProcess(const std::vector<std::string> &argVec, 
                    fdostream *pWriteStdin, fdistream *pReadStdout, fdistream *pReadStderr,
-                   pid_t *pChildPid, int *pnFileDescriptors);
+                   pid_t *pChildPid, int *pnFileDescriptors, TSpawnMethod method = spawn_default);
 int ConnectProcess(const std::string &sFile, const std::string &sArgs, 
                    fdostream *pWriteStdin, fdistream *pReadStdout, fdistream *pReadStderr,
-                   pid_t *pChildPid, int *pnFileDescriptors);
+                   pid_t *pChildPid, int *pnFileDescriptors, TSpawnMethod method = spawn_default);
 
 
 /********************************************************************
@@ -316,6 +370,65 @@ int ConnectProcess(const std::string &sFile, const std::string &sArgs,
 int KillProcess(pid_t pid, const std::string &sChildName, Feedback &fb);
 
 
+/********************************************************************
+ *   Resource usage of a process.  CPU times are in seconds and
+ *   include children that the process has waited for, the maximum
+ *   resident set size is in kilobytes.  Add accumulates usage,
+ *   keeping the largest of the two resident set sizes, and Subtract
+ *   gives the usage between two samples of the same process.
+ *******************************************************************/
+struct TResourceUsage
+{
+  double dUserTime;
+  double dSystemTime;
+  long nMaxRSS;
+  long nVoluntaryCtxSwitches;
+  long nInvoluntaryCtxSwitches;
+
+  TResourceUsage();
+  TResourceUsage& Add(const TResourceUsage &usage);
+  TResourceUsage& Subtract(const TResourceUsage &usage);
+};
+
+std::ostream& operator<<(std::ostream &os, const TResourceUsage &usage);
+std::istream& operator>>(std::istream &is, TResourceUsage &usage);
+
+
+/********************************************************************
+ *   Sample the resource usage of a running process from
+ *   /proc/<pid>/stat and /proc/<pid>/status.  Unlike wait4, this
+ *   works for long-lived children which process many jobs.  Returns
+ *   nonzero if /proc is unavailable or the process is gone.
+ *******************************************************************/
+int ProcessResourceUsage(pid_t pid, TResourceUsage &usage);
+
+
+/********************************************************************
+ *   Parse a Linux CPU list, as found in /sys, e.g. "0-3,8,10-11".
+ *   The CPUs are returned in ascending order.
+ *******************************************************************/
+int ParseCpuList(const std::string &sList, std::vector<int> &cpus);
+
+
+/********************************************************************
+ *   Read the CPU topology of this host from /sys/devices/system.
+ *   One element is returned per NUMA node, holding the online CPUs
+ *   of that node.  Nodes without CPUs are left out.  If the host has
+ *   no NUMA information, all online CPUs are returned as one node.
+ *******************************************************************/
+int ReadCpuTopology(std::vector<std::vector<int> > &nodeCpus);
+
+
+/********************************************************************
+ *   Get or restrict the CPUs a process may run on.  A pid of 0
+ *   means the calling thread, and processes created by it inherit
+ *   its CPUs.  Returns nonzero and sets errno on failure, or if CPU
+ *   affinity is not supported on this platform.
+ *******************************************************************/
+int GetProcessAffinity(pid_t pid, std::vector<int> &cpus);
+int SetProcessAffinity(pid_t pid, const std::vector<int> &cpus);
+
+
 /********************************************************************
  *   Wrapper for new-style POSIX signal handling.  Based on
  *   "Computer Systems, a Programmer's Perspective", by Bryant &
@@ -0,0 +1,98 @@
+/********************************************************************
+ *   		plugin.h
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   C interface for slave plugins.  Instead of a slave program
+ *   which reads jobs on standard input and writes results on
+ *   standard output, the slave may be a shared library, which the
+ *   slave server loads with dlopen and calls directly.  This avoids
+ *   the pipes and the text framing between slave server and slave
+ *   program, which dominate the time spent on very short jobs.
+ *
+ *   A slave is treated as a plugin if its file name ends in ".so".
+ *   The slave arguments are passed to simdist_init, with the file
+ *   name of the library as argv[0].  The input and output modes are
+ *   not used, as the plugin sees the raw job data.
+ *
+ *   The plugin must export simdist_evaluate, and may export
+ *   simdist_init and simdist_shutdown.  All functions return 0 on
+ *   success.  If the slave server is told to use more than one
+ *   thread (the slave-plugin-threads option), simdist_evaluate is
+ *   called concurrently from several threads, on disjoint sets of
+ *   jobs, and must be thread safe.
+ *
+ *   A minimal plugin, built with "gcc -shared -fPIC":
+ *
+ *     #include <simdist/plugin.h>
+ *     #include <stdlib.h>
+ *     #include <string.h>
+ *
+ *     int simdist_evaluate(simdist_job *jobs, size_t num_jobs)
+ *     {
+ *       size_t i;
+ *       for (i = 0; i < num_jobs; i++)
+ *       {
+ *         jobs[i].result = malloc(jobs[i].size);
+ *         memcpy(jobs[i].result, jobs[i].data, jobs[i].size);
+ *         jobs[i].result_size = jobs[i].size;
+ *       }
+ *       return 0;
+ *     }
+ *******************************************************************/
+
+#if !defined(__PLUGIN_H__)
+#define __PLUGIN_H__
+
+#include <stddef.h>
+
+#define SIMDIST_PLUGIN_VERSION 1
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/********************************************************************
+ *   One job.  data points to the job data as received from the
+ *   master, and is only valid during the call to simdist_evaluate.
+ *   The plugin allocates result with malloc and sets result_size.
+ *   The slave server frees the result.
+ *******************************************************************/
+typedef struct simdist_job
+{
+  const char *data;
+  size_t size;
+  char *result;
+  size_t result_size;
+} simdist_job;
+
+typedef int (*simdist_init_func)(int argc, char *argv[]);
+typedef int (*simdist_evaluate_func)(simdist_job *jobs, size_t num_jobs);
+typedef void (*simdist_shutdown_func)(void);
+
+int simdist_init(int argc, char *argv[]);
+int simdist_evaluate(simdist_job *jobs, size_t num_jobs);
+void simdist_shutdown(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+/********************************************************************
+ *   		profiler.h
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Profiling of named code regions.  Declare each region once, as
+ *   a static object, and time it with a ProfileScope:
+ *
+ *     static ProfileRegion region("queue-lock-wait");
+ *     ProfileScope scope(region);
+ *
+ *   - Times are taken from the monotonic clock, in nanoseconds.
+ *
+ *   - Each thread accumulates its own counts, totals and a
+ *     histogram with four buckets per power of two, so that timing
+ *     a region takes no locks.  The report merges the threads, and
+ *     estimates percentiles from the histograms (within 12.5%).
+ *
+ *   - Until Profiler::Enable is called, a ProfileScope costs one
+ *     load and a branch.
+ *******************************************************************/
+
+#if !defined(__PROFILER_H__)
+#define __PROFILER_H__
+
+#include "syncutils.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+
+class ProfileRegion;
+
+
+class Profiler
+{
+public:
+  static const int max_regions = 64;
+      // Each power of two nanoseconds is split in four equal
+      // buckets, up to 2^40 ns (18 minutes).  The last bucket also
+      // holds anything longer.
+  static const int num_buckets = 4 * 40;
+
+  typedef struct TRegionStatsVar
+  {
+    uint64_t nCount, nTotalNs, nMaxNs;
+    uint64_t buckets[num_buckets];
+  } TRegionStats;
+private:
+  Profiler();
+  Profiler(const Profiler&); // Not implemented: No copy semantics.
+
+  static volatile bool m_bEnabled;
+
+      // The stats of one thread, which are allocated per region on
+      // first use, and never freed, so that the report may read them
+      // after the thread is gone.
+  typedef struct TThreadStatsVar
+  {
+    TRegionStats * volatile regions[max_regions];
+  } TThreadStats;
+  static __thread TThreadStats *m_pThreadStats;
+
+      // Guarded by m_mtx.
+  LockableObject m_mtx;
+  std::vector<std::string> m_regionNames;
+  std::vector<TThreadStats*> m_threads;
+
+  TRegionStats* ThreadRegion(int nRegion);
+  friend class ProfileRegion;
+  int Register(const std::string &sName);
+public:
+  static Profiler& Instance();
+  static bool Enabled()
+  {
+    return m_bEnabled;
+  }
+  static void Enable(bool bEnable = true);
+      // Nanoseconds from an arbitrary starting point.
+  static uint64_t Now();
+
+  void Add(int nRegion, uint64_t nNs);
+      // Stats for each region, merged over all threads.
+  void Merge(std::vector<std::pair<std::string, TRegionStats> > &regions);
+      // Duration in nanoseconds at fraction dQuantile (0-1) of the
+      // observations.
+  static double Percentile(const TRegionStats &stats, double dQuantile);
+  void Report(std::ostream &s);
+};
+
+
+class ProfileRegion
+{
+  int m_nIndex;
+public:
+  explicit ProfileRegion(const std::string &sName)
+    : m_nIndex(Profiler::Instance().Register(sName))
+  {
+  }
+  void Add(uint64_t nNs)
+  {
+    if (m_nIndex >= 0)
+      Profiler::Instance().Add(m_nIndex, nNs);
+  }
+};
+
+
+class ProfileScope
+{
+  ProfileRegion &m_region;
+  uint64_t m_nStart;
+  ProfileScope(const ProfileScope&); // Not implemented: No copy semantics.
+public:
+  explicit ProfileScope(ProfileRegion &region)
+    : m_region(region), m_nStart(Profiler::Enabled() ? Profiler::Now() : 0)
+  {
+  }
+  ~ProfileScope()
+  {
+    Stop();
+  }
+      // End the scope early.
+  void Stop()
+  {
+    if (m_nStart)
+      m_region.Add(Profiler::Now() - m_nStart);
+    m_nStart = 0;
+  }
+};
+
+
+#endif
@@ -35,8 +35,10 @@
 #include "syncutils.h"
 #include "feedback.h"
 #include "io_utils.h"
+#include "metrics.h"
 
 #include <pthread.h>
+#include <sys/time.h>
 
 #include <string>
 #include <vector>
@@ -100,6 +102,9 @@ class SlaveClient
 {
 protected:
   std::string m_sServer;
+      // The server given to Start.  Unlike m_sServer, which is set
+      // by the slave thread, it may be read by other threads.
+  std::string m_sName;
   pthread_t m_threadId;
   ThreadBarrier *m_pBarrier;
 
@@ -111,10 +116,19 @@ protected:
   Feedback m_fb;
   JobReaderWriter m_rw;
 
-  float m_fWaitFactor;
+      // Written by the slave thread, and read by the control thread,
+      // through relaxed atomic builtins.
   int m_nNumJobsCompleted;
   double m_dTotalWorkTime;
   time_t m_fTimeJobsTaken;
+  JobStatistics m_stats;
+
+      // Per-slave metrics are registered once the server is known.
+  MetricsCounter &m_jobsTaken, &m_jobsDuplicated, &m_jobsTimedOut, &m_resultsDiscarded;
+  MetricsCounter *m_pJobsCompleted;
+  MetricsHistogram *m_pJobLatency;
+  timeval m_tvJobsSent;
+  uint64_t m_nTraceJobsSent;
   
   int ConnectServer(const std::string &sServer, const std::string &sSlaveProgram, std::string sSlaveArgs);
   int Run(JobQueue *pJobQueue);
@@ -122,7 +136,10 @@ protected:
   int TakeJobs(bool &bJobsTaken);
   int SendJobs();
   int ReceiveJobs(bool &bShutdown);
-  int ProcessResults(const std::string &sJobID, const std::string &sResults, float fTime);
+  void JournalResults(const std::string &sJobID, const std::string &sResults);
+  int ProcessResults(const std::string &sJobID, const std::string &sResults, 
+                     float fTime, const TResourceUsage &usage);
+  int RetryJob(const std::string &sJobID);
   
   int AbortSlaves(const std::set<SlaveClient*> &workers, const std::string &sJobID);
 
@@ -141,6 +158,12 @@ public:
   int Terminate();
 
   std::string Server() const;
+      // May be called while the slave is running.
+  const std::string& Name() const;
+  int NumJobsCompleted() const;
+      // Resource usage of the jobs completed by this slave.  Only
+      // safe to call when the slave thread has finished.
+  const JobStatistics& Statistics() const;
 };
 
 
@@ -23,6 +23,13 @@
  *   Base class for communication channels doing the actual sending
  *   and receiving on the master node.  Implementations using for
  *   instance MPI or PVM should inherit from this class.
+ *
+ *   Messages are passed through the channels in parts, so that
+ *   large messages need not be held in memory at once.  By default,
+ *   the parts are joined and passed to SendMessage, and
+ *   ReceiveMessage returns a message in one part.  Implementations
+ *   that can do better override SendMessagePart and
+ *   ReceiveMessagePart.
  *******************************************************************/
 
 #if !defined(__SLAVE_CHANNEL_H__)
@@ -31,6 +38,7 @@
 #include "feedback.h"
 
 #include <iostream>
+#include <string>
 
 // extern FeedbackError E_SLAVECHANNELSENDER_THREAD;
 DECLARE_FEEDBACK_ERROR(E_SLAVECHANNELSENDER_THREAD)
@@ -50,10 +58,13 @@ DECLARE_FEEDBACK_ERROR(E_SLAVECHANNELRECEIVER_STOP)
 class SlaveChannelSender
 {
   Feedback m_fb;
+  std::string m_sMessage;
 protected:
   std::istream *m_pInChannel;
   pthread_t m_threadId;
   virtual int SendMessage(const std::string &sServer, const std::string &sMessage) = 0;
+      // bLast is set for the last part, which may be empty.
+  virtual int SendMessagePart(const std::string &sServer, const std::string &sPart, bool bLast);
 //   int CheckShutdown(const std::string &sServer, const std::string &sMessage, bool &bShutdown);
 
   template<class T> friend void* SlaveChannel_thread_func(void *pArg);
@@ -76,6 +87,8 @@ protected:
   std::ostream *m_pOutChannel;
   pthread_t m_threadId;
   virtual int ReceiveMessage(std::string &sServer, std::string &sMessage) = 0;
+      // bMore is set if more parts of the same message follow.
+  virtual int ReceiveMessagePart(std::string &sServer, std::string &sPart, bool &bMore);
 //   int CheckShutdown(const std::string &sServer, const std::string &sMessage, bool &bShutdown);
 
   template<class T> friend void* SlaveChannel_thread_func(void *pArg);
@@ -46,6 +46,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <stdint.h>
 
 // extern FeedbackError E_MPICOMMUNICATOR_SEND;
 DECLARE_FEEDBACK_ERROR(E_MPICOMMUNICATOR_SEND)
@@ -87,6 +88,13 @@ DECLARE_FEEDBACK_ERROR(E_MPIRECEIVER_RECV)
  *   TODO: Edit the pvm_stream to have similar semantics as well, with
  *   a send on destroy for the object returned by the "stream" object?
  *
+ *   Messages are sent as a sequence of MPI messages of chunk_size
+ *   bytes, ended by one that is shorter (possibly empty), so that
+ *   neither the MPI count limit nor the size of a single MPI buffer
+ *   bounds the size of a message.  The streaming operators send and
+ *   receive entire messages, while SendPart and ReceivePart let
+ *   the channels pass on one chunk at a time.
+ *
  *   Design principle: Only the functionality needed at the moment is
  *   implemented.
  *******************************************************************/
@@ -103,6 +111,12 @@ class MPICommunicatorStream
 public:
   const MPICommunicatorStream& operator<<(const std::string &s) const;
   const MPICommunicatorStream& operator>>(std::string &s) const;
+
+      // Send or receive a single MPI message, at most chunk_size
+      // bytes.  ReceivePart appends to s, and sets bMore if the
+      // message has more parts.
+  const MPICommunicatorStream& SendPart(const char *pData, size_t nCount) const;
+  const MPICommunicatorStream& ReceivePart(std::string &s, bool &bMore) const;
 };
 
 
@@ -110,6 +124,7 @@ class MPICommunicator : public MPI::Intracomm
 {
 public:
   typedef enum { singlethreaded, multithreaded } TThreadMode;
+  enum { chunk_size = 1 << 24 };
 private:
   friend class MPICommunicatorStream;
   Feedback m_fb;
@@ -140,7 +155,9 @@ class MPISender : public SlaveChannelSender
   mutable LockableObject m_rankMtx;
   MPICommunicator m_comm;
   int m_nMasterRank;
+  std::string m_sPending;
   virtual int SendMessage(const std::string &sServer, const std::string &sMessage);
+  virtual int SendMessagePart(const std::string &sServer, const std::string &sPart, bool bLast);
   int GetRank(const std::string &sServer, int &nRank);
 public:
   static const int message_tag;
@@ -158,7 +175,12 @@ class MPIReceiver : public SlaveChannelReceiver
   Feedback m_fb;
   const MPISender &m_sender;
   MPICommunicator m_comm;
+  int m_nPartRank, m_nPartTag;
+      // When the first part of the current message arrived, if
+      // tracing.
+  uint64_t m_nTraceFirstPart;
   virtual int ReceiveMessage(std::string &sServer, std::string &sMessage);
+  virtual int ReceiveMessagePart(std::string &sServer, std::string &sPart, bool &bMore);
 //   virtual int AbortReceiveMessage();
 public:
   MPIReceiver(std::ostream *pOutChannel, const MPISender &sender);
@@ -0,0 +1,97 @@
+/********************************************************************
+ *   		slave_plugin.h
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Slave server side of the plugin interface in plugin.h: Load a
+ *   plugin library and evaluate sets of jobs with it, optionally
+ *   spread over a pool of threads.
+ *******************************************************************/
+
+#if !defined(__SLAVE_PLUGIN_H__)
+#define __SLAVE_PLUGIN_H__
+
+#include "plugin.h"
+#include "feedback.h"
+#include "syncutils.h"
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// extern FeedbackError E_PLUGIN_LOAD;
+DECLARE_FEEDBACK_ERROR(E_PLUGIN_LOAD)
+// extern FeedbackError E_PLUGIN_EVALUATE;
+DECLARE_FEEDBACK_ERROR(E_PLUGIN_EVALUATE)
+
+
+/********************************************************************
+ *   True if sProgram names a plugin library rather than a program.
+ *******************************************************************/
+bool IsPlugin(const std::string &sProgram);
+
+
+/********************************************************************
+ *   A loaded plugin.  With more than one thread, Evaluate splits the
+ *   jobs in as many contiguous parts.  The calling thread evaluates
+ *   the first part, and threads from a pool started by Load
+ *   evaluate the rest.  Evaluate returns when all parts are done.
+ *******************************************************************/
+class SlavePlugin
+{
+  SlavePlugin(const SlavePlugin&); // Not implemented: No copy semantics.
+
+  Feedback m_fb;
+  std::string m_sLibrary;
+  void *m_pHandle;
+  simdist_init_func m_pInit;
+  simdist_evaluate_func m_pEvaluate;
+  simdist_shutdown_func m_pShutdown;
+
+      // Thread pool.  All members below are guarded by m_mtx.
+  std::vector<pthread_t> m_threads;
+  LockableObject m_mtx;
+  Condition m_condWork, m_condDone;
+  simdist_job *m_pJobs;
+  size_t m_nNumJobs;
+  int m_nBatch;
+  int m_nNumBusy;
+  int m_nNumFailed;
+  bool m_bStop;
+
+  bool NewBatch(int nLastBatch) const;
+  bool BatchDone() const;
+  int EvaluatePart(size_t nPart);
+  int StopThreads();
+
+  friend void *slaveplugin_thread_func(void *pArg);
+public:
+  SlavePlugin();
+  ~SlavePlugin();
+
+  int Load(const std::string &sLibrary, const std::string &sArgs, int nNumThreads);
+  int Evaluate(simdist_job *pJobs, size_t nNumJobs);
+  int Unload();
+  bool IsLoaded() const;
+  size_t NumThreads() const;
+};
+
+
+#endif
@@ -150,6 +150,13 @@ public:
     return pthread_cond_broadcast(m_pCond);
   }
 
+      // Returns ETIMEDOUT if the absolute time deadline passed
+      // without a signal.
+  int TimedWait(pthread_mutex_t *pMtx, const struct timespec &deadline)
+  {
+    return pthread_cond_timedwait(m_pCond, pMtx, &deadline);
+  }
+
   template<class Op, class OpArg>
   int Wait(pthread_mutex_t *pMtx, Op op, OpArg opArg)
   {
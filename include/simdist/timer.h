@@ -21,6 +21,8 @@
  *   ***************************************************************
  *   
  *   A simple class for reporting time spent during simulation.
+ *   Time is taken from the same monotonic clock as the profiler, so
+ *   the report has sub-second resolution.
  *******************************************************************/
 
 #if !defined(__TIMER_H__)
@@ -28,13 +30,12 @@
 
 #include <iostream>
 
-#include <sys/types.h>
-#include <time.h>
+#include <stdint.h>
 
 class Timer
 {
   bool m_bReportOnDestroy;
-  time_t m_timeStart;
+  uint64_t m_nStartNs;
   std::ostream *m_pReportStream;
 public:
   Timer(bool bReportOnDestroy = true, std::ostream *pReportStream = &std::cerr);
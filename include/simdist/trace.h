@@ -0,0 +1,132 @@
+/********************************************************************
+ *   		trace.h
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Tracing of the job life cycle, in the Chrome trace event format
+ *   read by chrome://tracing and Perfetto.
+ *
+ *   - Each span is a complete ("X") event with the time stamp and
+ *     duration in microseconds of wall-clock time, the process
+ *     (0 for the master, the MPI rank for slaves) and a small
+ *     per-thread number.  Spans which belong to one job carry the
+ *     job ID as an argument, so that a job can be followed from the
+ *     queue, through MPI and the slave, and back.
+ *
+ *   - The master writes events straight to the trace file.  Slaves
+ *     keep theirs until the next results are sent, and ship them
+ *     along with the results, so that the master writes one trace
+ *     per run.  Spans from different hosts are only as well aligned
+ *     as the clocks of the hosts.
+ *
+ *   - Until Start is called, a TraceSpan costs one load and a
+ *     branch.
+ *******************************************************************/
+
+#if !defined(__TRACE_H__)
+#define __TRACE_H__
+
+#include "feedback.h"
+#include "syncutils.h"
+
+#include <stdint.h>
+#include <string>
+#include <fstream>
+
+// extern FeedbackError E_TRACE_WRITE;
+DECLARE_FEEDBACK_ERROR(E_TRACE_WRITE)
+
+
+/********************************************************************
+ *   The event sink.  Singleton.
+ *******************************************************************/
+class Trace
+{
+  Trace();
+  ~Trace();
+  Trace(const Trace&); // Not implemented: No copy semantics.
+
+  static volatile bool m_bEnabled;
+  static volatile int m_nNextTid;
+  static __thread int m_nTid;
+
+  Feedback m_fb;
+  int m_nPid;
+  std::string m_sFile;
+
+      // Guarded by m_mtx.
+  LockableObject m_mtx;
+  std::ofstream m_file;
+  bool m_bFirstEvent;
+  std::string m_sPending;
+
+  int ThreadId(const char *szCategory);
+public:
+  static Trace& Instance();
+  static bool Enabled()
+  {
+    return m_bEnabled;
+  }
+      // Microseconds since the epoch.
+  static uint64_t Now();
+
+      // Start tracing as process nPid.  If sFile is empty, events
+      // are kept for TakePending.
+  int Start(const std::string &sFile, int nPid, const std::string &sProcessName);
+      // Finish the trace file.
+  int Stop();
+
+  void Add(const char *szName, const char *szCategory, uint64_t nStart, uint64_t nEnd,
+           const std::string &sJobID = "");
+      // Add events formatted elsewhere, as returned by TakePending.
+  void Append(const std::string &sEvents);
+  std::string TakePending();
+};
+
+
+/********************************************************************
+ *   Records a span from construction to destruction.
+ *******************************************************************/
+class TraceSpan
+{
+  const char *m_szName, *m_szCategory;
+  uint64_t m_nStart;
+  std::string m_sJobID;
+  TraceSpan(const TraceSpan&); // Not implemented: No copy semantics.
+public:
+  TraceSpan(const char *szName, const char *szCategory)
+    : m_szName(szName), m_szCategory(szCategory), m_nStart(Trace::Enabled() ? Trace::Now() : 0)
+  {
+  }
+  TraceSpan(const char *szName, const char *szCategory, const std::string &sJobID)
+    : m_szName(szName), m_szCategory(szCategory), m_nStart(Trace::Enabled() ? Trace::Now() : 0)
+  {
+    if (m_nStart)
+      m_sJobID = sJobID;
+  }
+  ~TraceSpan()
+  {
+    if (m_nStart)
+      Trace::Instance().Add(m_szName, m_szCategory, m_nStart, Trace::Now(), m_sJobID);
+  }
+};
+
+
+#endif
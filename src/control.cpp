@@ -0,0 +1,420 @@
+/********************************************************************
+ *   		control.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   See header file for description.
+ *******************************************************************/
+
+#if HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <simdist/control.h>
+#include <simdist/misc_utils.h>
+#include <simdist/options.h>
+
+#include <sstream>
+#include <limits>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// FeedbackError E_CONTROL_SOCKET("Control socket failure");
+DEFINE_FEEDBACK_ERROR(E_CONTROL_SOCKET, "Control socket failure")
+
+
+static const int max_command_length = 4096;
+    // A client which connects but doesn't send a command within this
+    // time is disconnected, so that it can't block others.
+static const int command_timeout_ms = 5000;
+
+
+void *control_thread_func(void *pArg)
+{
+  ControlServer *pServer = static_cast<ControlServer*>(pArg);
+  pServer->m_fb.RegisterThreadDescription("Control");
+  sigset_t sigSet;
+  sigfillset(&sigSet);
+  pthread_sigmask(SIG_BLOCK, &sigSet, 0);
+  pServer->ServeLoop();
+  return 0;
+}
+
+
+
+ControlServer::ControlServer(JobQueue *pJobQueue, const std::vector<SlaveClient*> &slaves)
+  : m_fb("ControlServer")
+  , m_pJobQueue(pJobQueue)
+  , m_slaves(slaves)
+  , m_nListenFd(-1)
+  , m_bRunning(false)
+{
+  m_stopPipe[0] = m_stopPipe[1] = -1;
+  if (Options::Instance().Option("verbosity-showonly", m_sInfoShow)
+      || Options::Instance().Option("verbosity-dontshow", m_sInfoHide))
+    m_fb.Warning("Failed to get verbosity filter options.  Changing one filter will clear the other.");
+}
+
+
+ControlServer::~ControlServer()
+{
+  Stop();
+}
+
+
+/********************************************************************
+ *   Refuse to take over a socket which another process answers on,
+ *   but remove one left behind by a process which died.
+ *******************************************************************/
+int
+ControlServer::Start(const std::string &sPath)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (sPath.size() >= sizeof(addr.sun_path))
+    return m_fb.Error(E_CONTROL_SOCKET) << ": The path " << sPath << " is too long for a Unix domain socket.";
+  strcpy(addr.sun_path, sPath.c_str());
+
+  if ((m_nListenFd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return m_fb.Error(E_CONTROL_SOCKET) << ": Failed to create socket: " << strerror(errno) << ".";
+  if (connect(m_nListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+  {
+    close(m_nListenFd);
+    m_nListenFd = -1;
+    return m_fb.Error(E_CONTROL_SOCKET) << ": " << sPath << " is in use by another process.";
+  }
+  unlink(sPath.c_str());
+
+  const mode_t oldMask = umask(S_IRWXG | S_IRWXO);
+  const int nBind = bind(m_nListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  umask(oldMask);
+  if (nBind || listen(m_nListenFd, 8))
+  {
+    m_fb.Error(E_CONTROL_SOCKET) << ": Failed to listen on " << sPath << ": " << strerror(errno) << ".";
+    close(m_nListenFd);
+    m_nListenFd = -1;
+    return 1;
+  }
+  m_sPath = sPath;
+
+  if (CreatePipe(m_stopPipe)
+      || pthread_create(&m_thread, 0, control_thread_func, this))
+  {
+    Stop();
+    return m_fb.Error(E_CONTROL_SOCKET) << ": Failed to create server thread.";
+  }
+  m_bRunning = true;
+  m_fb.Info(1) << "Listening for control commands on " << m_sPath << ".";
+  return 0;
+}
+
+
+int
+ControlServer::Stop()
+{
+  if (m_bRunning)
+  {
+    const char ch = 0;
+    while (write(m_stopPipe[1], &ch, 1) < 0 && errno == EINTR)
+      ;
+    pthread_join(m_thread, 0);
+    m_bRunning = false;
+  }
+  for (int nEnd = 0; nEnd < 2; nEnd++)
+    if (m_stopPipe[nEnd] >= 0)
+    {
+      close(m_stopPipe[nEnd]);
+      m_stopPipe[nEnd] = -1;
+    }
+  if (m_nListenFd >= 0)
+  {
+    close(m_nListenFd);
+    m_nListenFd = -1;
+    unlink(m_sPath.c_str());
+  }
+  return 0;
+}
+
+
+void
+ControlServer::ServeLoop()
+{
+  while (true)
+  {
+    pollfd fds[2];
+    fds[0].fd = m_stopPipe[0];
+    fds[1].fd = m_nListenFd;
+    fds[0].events = fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      m_fb.Error(E_CONTROL_SOCKET) << ": Poll failed: " << strerror(errno) << ".";
+      return;
+    }
+    if (fds[0].revents)
+      return;
+    if (fds[1].revents)
+    {
+      int nFd = accept(m_nListenFd, 0, 0);
+      if (nFd < 0)
+        continue;
+      Serve(nFd);
+      close(nFd);
+    }
+  }
+}
+
+
+/********************************************************************
+ *   Read one command line and write the reply.  The client may have
+ *   gone away by the time the reply is written, so write with
+ *   MSG_NOSIGNAL: A SIGPIPE would take down the master.
+ *******************************************************************/
+void
+ControlServer::Serve(int nFd)
+{
+  std::string sCommand;
+  while (sCommand.find('\n') == std::string::npos && sCommand.size() < static_cast<size_t>(max_command_length))
+  {
+    pollfd pfd;
+    pfd.fd = nFd;
+    pfd.events = POLLIN;
+    int nRet = poll(&pfd, 1, command_timeout_ms);
+    if (nRet < 0 && errno == EINTR)
+      continue;
+    if (nRet <= 0)
+      return;
+    char buf[256];
+    ssize_t nRead = read(nFd, buf, sizeof(buf));
+    if (nRead < 0 && errno == EINTR)
+      continue;
+    if (nRead <= 0)
+      break;
+    sCommand.append(buf, nRead);
+  }
+  sCommand = sCommand.substr(0, sCommand.find('\n'));
+  m_fb.Info(2) << "Received control command \"" << sCommand << "\".";
+
+  std::stringstream reply;
+  std::string sError;
+  if (Execute(sCommand, reply, sError))
+    reply << "ERROR " << sError << "\n";
+  else
+    reply << "OK\n";
+
+  const std::string sReply = reply.str();
+  for (size_t nPos = 0; nPos < sReply.size(); )
+  {
+    ssize_t nWritten = send(nFd, sReply.data() + nPos, sReply.size() - nPos, MSG_NOSIGNAL);
+    if (nWritten < 0 && errno == EINTR)
+      continue;
+    if (nWritten <= 0)
+      return;
+    nPos += nWritten;
+  }
+}
+
+
+int
+ControlServer::Execute(const std::string &sCommand, std::ostream &reply, std::string &sError)
+{
+  std::stringstream ss(sCommand);
+  std::string sVerb, sName, sValue;
+  ss >> sVerb >> sName;
+  std::getline(ss, sValue);
+  sValue = Trim(sValue);
+
+  if (sVerb == "status")
+    return Status(reply, sError);
+  else if (sVerb == "queue")
+    return Queue(reply, sError);
+  else if (sVerb == "slaves")
+    return Slaves(reply, sError);
+  else if (sVerb == "set")
+    return Set(sName, sValue, reply, sError);
+  else if (sVerb == "help")
+  {
+    reply << "status           Queue size, scheduling parameters and timeouts\n"
+          << "queue            One line per job in the queue: ID, age and the slaves working on it\n"
+          << "slaves           One line per slave: server, jobs completed and jobs in progress\n"
+          << "set NAME VALUE   Change jobs-per-send (0 = auto), slave-wait-factor, verbosity,\n"
+          << "                 verbosity-showonly or verbosity-dontshow\n";
+    return 0;
+  }
+  sError = "Unknown command \"" + sVerb + "\".  Try help.";
+  return 1;
+}
+
+
+int
+ControlServer::Status(std::ostream &reply, std::string &sError)
+{
+  AutoMutex mtx;
+  if (m_pJobQueue->AcquireMutex(mtx))
+  {
+    sError = "Failed to lock the job queue.";
+    return 1;
+  }
+  size_t nInProgress = 0;
+  for (JobQueue::const_iterator jit = m_pJobQueue->begin(); jit != m_pJobQueue->end(); jit++)
+    if (!jit->workers.empty())
+      nInProgress++;
+
+  reply << "jobs-queued " << m_pJobQueue->size() - nInProgress << "\n"
+        << "jobs-in-progress " << nInProgress << "\n"
+        << "jobs-per-send " << m_pJobQueue->NumJobsPerSend()
+        << (m_pJobQueue->AutoNumJobsPerSend() ? " (auto)" : "") << "\n"
+        << "slave-wait-factor " << m_pJobQueue->WaitFactor() << "\n"
+        << "timeouts " << m_pJobQueue->NumTimeouts() << "\n"
+        << "generation " << m_pJobQueue->GenerationStatistics().size() << "\n"
+        << "queue-closed " << (m_pJobQueue->Closed() ? "true" : "false") << "\n";
+  mtx.Unlock();
+
+  reply << "slaves " << m_slaves.size() << "\n"
+        << "verbosity " << Feedback::GetInfoLevel() << "\n"
+        << "verbosity-showonly " << m_sInfoShow << "\n"
+        << "verbosity-dontshow " << m_sInfoHide << "\n";
+  return 0;
+}
+
+
+int
+ControlServer::Queue(std::ostream &reply, std::string &sError)
+{
+  AutoMutex mtx;
+  if (m_pJobQueue->AcquireMutex(mtx))
+  {
+    sError = "Failed to lock the job queue.";
+    return 1;
+  }
+  const time_t now = time(0);
+  for (JobQueue::const_iterator jit = m_pJobQueue->begin(); jit != m_pJobQueue->end(); jit++)
+  {
+    reply << jit->sJobID;
+    if (jit->workers.empty())
+      reply << " queued\n";
+    else
+      reply << " in-progress " << difftime(now, jit->timeLastStart) << "s " << jit->WorkersToString() << "\n";
+  }
+  return 0;
+}
+
+
+/********************************************************************
+ *   The jobs in progress are found in the queue, which is guarded
+ *   by its mutex, rather than in the slaves, which are not.
+ *******************************************************************/
+int
+ControlServer::Slaves(std::ostream &reply, std::string &sError)
+{
+  AutoMutex mtx;
+  if (m_pJobQueue->AcquireMutex(mtx))
+  {
+    sError = "Failed to lock the job queue.";
+    return 1;
+  }
+  for (std::vector<SlaveClient*>::const_iterator sit = m_slaves.begin(); sit != m_slaves.end(); sit++)
+  {
+    std::string sJobs;
+    for (JobQueue::const_iterator jit = m_pJobQueue->begin(); jit != m_pJobQueue->end(); jit++)
+      if (jit->workers.count(*sit))
+        sJobs += " " + jit->sJobID;
+    reply << (*sit)->Name() << " completed " << (*sit)->NumJobsCompleted()
+          << " in-progress" << (sJobs.empty() ? " -" : sJobs) << "\n";
+  }
+  return 0;
+}
+
+
+int
+ControlServer::Set(const std::string &sName, const std::string &sValue, std::ostream &reply, std::string &sError)
+{
+  std::stringstream ss(sValue);
+  if (sName == "jobs-per-send" || sName == "slave-wait-factor")
+  {
+        // jobs-per-send is an int option, so accept the same range,
+        // but only digits: No sign, fraction or exponent.
+    long nJobsPerSend = 0;
+    double dWaitFactor = 0;
+    if (sName == "jobs-per-send")
+    {
+      if (sValue.empty() || sValue.find_first_not_of("0123456789") != std::string::npos
+          || !(ss >> nJobsPerSend) || nJobsPerSend > std::numeric_limits<int>::max())
+      {
+        std::stringstream ssError;
+        ssError << "Expected a whole number from 0 to " << std::numeric_limits<int>::max()
+                << " for jobs-per-send, got \"" << sValue << "\".";
+        sError = ssError.str();
+        return 1;
+      }
+    }
+    else if (!(ss >> dWaitFactor) || !ss.eof() || !(dWaitFactor >= 0))
+    {
+      sError = "Expected a non-negative number for slave-wait-factor, got \"" + sValue + "\".";
+      return 1;
+    }
+    AutoMutex mtx;
+    if (m_pJobQueue->AcquireMutex(mtx))
+    {
+      sError = "Failed to lock the job queue.";
+      return 1;
+    }
+    if (sName == "jobs-per-send")
+      m_pJobQueue->SetNumJobsPerSend(static_cast<size_t>(nJobsPerSend));
+    else
+      m_pJobQueue->SetWaitFactor(static_cast<float>(dWaitFactor));
+        // Slaves waiting to double-process a job should reconsider.
+    m_pJobQueue->Signal();
+  }
+  else if (sName == "verbosity")
+  {
+    int nLevel;
+    if (!(ss >> nLevel) || !ss.eof())
+    {
+      sError = "Expected an integer for verbosity, got \"" + sValue + "\".";
+      return 1;
+    }
+    Feedback::SetInfoLevel(nLevel);
+  }
+  else if (sName == "verbosity-showonly" || sName == "verbosity-dontshow")
+  {
+    (sName == "verbosity-showonly" ? m_sInfoShow : m_sInfoHide) = sValue;
+    Feedback::SetShowHide(m_sInfoShow, m_sInfoHide);
+  }
+  else
+  {
+    sError = "Unknown or fixed parameter \"" + sName + "\".";
+    return 1;
+  }
+  m_fb.Info(1) << "Control command: Set " << sName << " to " << sValue << ".";
+  reply << sName << " " << sValue << "\n";
+  return 0;
+}
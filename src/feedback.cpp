@@ -27,8 +27,509 @@
 #include <simdist/misc_utils.h>
 
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/time.h>
 
 int FeedbackError::m_nCodeCounter = 1;
+int FeedbackCentral::m_nInfoLevel = 0;
+int FeedbackCentral::m_nFilterGeneration = 0;
+__thread const char *FeedbackCentral::m_szThreadDescription = 0;
+__thread char FeedbackCentral::m_szThreadId[32];
+
+
+/********************************************************************
+ *   Bounded ring buffer for asynchronous output, after Dmitry
+ *   Vyukov's bounded MPMC queue.  Each slot has a sequence number,
+ *   which equals n when the slot is free for the producer claiming
+ *   position n, and n + 1 when it holds the message at position n.
+ *   Positions are claimed with compare-and-swap, by producers as
+ *   well as consumers, so that the crash handler can empty the ring
+ *   alongside the writer thread.  Messages are malloc'ed by the
+ *   producer, and freed by the writer thread.
+ *******************************************************************/
+class FeedbackRing
+{
+  typedef struct TMessageVar
+  {
+    char *pData;
+    size_t nLength;
+    timeval tv;
+    bool bStamp;
+  } TMessage;
+
+  typedef struct TSlotVar
+  {
+    volatile size_t nSeq;
+    TMessage msg;
+  } TSlot;
+
+  FeedbackRing(const FeedbackRing&); // Not implemented: No copy semantics.
+
+  const FeedbackCentral &m_central;
+  TSlot *m_pSlots;
+  size_t m_nMask;
+  long m_nUtcOffset;
+  volatile size_t m_nEnqueuePos, m_nDequeuePos, m_nDropped;
+      // Set by Stop, after which Push refuses new messages.  Pushes
+      // in progress are counted, so that Stop can wait for them to
+      // reach the ring before the writer thread drains it.
+  volatile bool m_bStopped;
+  volatile int m_nPushing;
+
+  pthread_t m_thread;
+  bool m_bRunning;
+      // Guarded by m_mutex.
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_condWork, m_condFlushed;
+  size_t m_nWritten;
+  volatile bool m_bSleeping;
+  bool m_bStop;
+
+  bool Pop(TMessage &msg);
+  bool Empty() const;
+  void Wake();
+  void Stamp(const timeval &tv, char *szStamp) const;
+  void WriteLoop();
+
+  friend void *feedbackring_thread_func(void *pArg);
+public:
+  static const size_t stamp_length = 18;
+  static const int poll_interval_ms = 10;
+
+  FeedbackRing(const FeedbackCentral &central, size_t nCapacity);
+  ~FeedbackRing();
+
+  int Start();
+  void Stop();
+  bool Push(const std::string &sOutput, bool bStamp, bool bWait);
+  bool Stopped() const
+  {
+    return m_bStopped;
+  }
+  void Flush();
+  size_t NumDropped() const;
+  void Drain(int nFd);
+};
+
+
+    // The ring emptied by the crash handler.
+static FeedbackRing * volatile pCrashRing = 0;
+
+
+/********************************************************************
+ *   Write what is left in the ring before the process dies.  Only
+ *   async-signal-safe calls are made, and nothing is freed.  The
+ *   handler is installed with SA_RESETHAND, so the signal is
+ *   delivered again with the default action on return: A fault
+ *   recurs, and abort raises SIGABRT once more.
+ *******************************************************************/
+static void
+feedback_crash_handler(int)
+{
+  FeedbackRing *pRing = pCrashRing;
+  pCrashRing = 0;
+  if (pRing)
+    pRing->Drain(STDERR_FILENO);
+}
+
+
+void *feedbackring_thread_func(void *pArg)
+{
+  sigset_t sigSet;
+  sigfillset(&sigSet);
+  pthread_sigmask(SIG_BLOCK, &sigSet, 0);
+  static_cast<FeedbackRing*>(pArg)->WriteLoop();
+  return 0;
+}
+
+
+FeedbackRing::FeedbackRing(const FeedbackCentral &central, size_t nCapacity)
+  : m_central(central)
+  , m_nUtcOffset(0)
+  , m_nEnqueuePos(0)
+  , m_nDequeuePos(0)
+  , m_nDropped(0)
+  , m_bStopped(false)
+  , m_nPushing(0)
+  , m_bRunning(false)
+  , m_nWritten(0)
+  , m_bSleeping(false)
+  , m_bStop(false)
+{
+  size_t nSize = 2;
+  while (nSize < nCapacity)
+    nSize *= 2;
+  m_nMask = nSize - 1;
+  m_pSlots = new TSlot[nSize];
+  for (size_t nSlot = 0; nSlot < nSize; nSlot++)
+    m_pSlots[nSlot].nSeq = nSlot;
+
+      // Time stamps are formatted by hand in the crash handler, so
+      // the offset to local time is taken once and for all.
+  time_t now = time(0);
+  tm tmLocal;
+  if (localtime_r(&now, &tmLocal))
+    m_nUtcOffset = tmLocal.tm_gmtoff;
+
+  pthread_mutex_init(&m_mutex, 0);
+  pthread_cond_init(&m_condWork, 0);
+  pthread_cond_init(&m_condFlushed, 0);
+}
+
+
+FeedbackRing::~FeedbackRing()
+{
+  Stop();
+  TMessage msg;
+  while (Pop(msg))
+    free(msg.pData);
+  delete[] m_pSlots;
+  pthread_cond_destroy(&m_condFlushed);
+  pthread_cond_destroy(&m_condWork);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+
+/********************************************************************
+ *   Start the writer thread.  The crash handler is installed for
+ *   fatal signals that have no handler already.
+ *******************************************************************/
+int
+FeedbackRing::Start()
+{
+  if (pthread_create(&m_thread, 0, feedbackring_thread_func, this))
+    return 1;
+  m_bRunning = true;
+
+  pCrashRing = this;
+  const int fatalSignals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+  for (size_t nSig = 0; nSig < sizeof(fatalSignals) / sizeof(fatalSignals[0]); nSig++)
+  {
+    struct sigaction saOld, sa;
+    if (sigaction(fatalSignals[nSig], 0, &saOld) || saOld.sa_handler != SIG_DFL)
+      continue;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = feedback_crash_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESETHAND;
+    sigaction(fatalSignals[nSig], &sa, 0);
+  }
+  return 0;
+}
+
+
+/********************************************************************
+ *   Refuse further messages, wait for the pushes in progress, write
+ *   the remaining messages and stop the writer thread.  A thread
+ *   waiting for room in a full ring gives up, so that the caller can
+ *   write its message synchronously instead.
+ *******************************************************************/
+void
+FeedbackRing::Stop()
+{
+  m_bStopped = true;
+  __sync_synchronize();
+  if (!m_bRunning)
+    return;
+  if (pCrashRing == this)
+    pCrashRing = 0;
+  while (m_nPushing > 0)
+  {
+    Wake();
+    sched_yield();
+  }
+
+  pthread_mutex_lock(&m_mutex);
+  m_bStop = true;
+  pthread_cond_signal(&m_condWork);
+  pthread_mutex_unlock(&m_mutex);
+  pthread_join(m_thread, 0);
+  pthread_mutex_lock(&m_mutex);
+  m_bRunning = false;
+  pthread_cond_broadcast(&m_condFlushed);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+/********************************************************************
+ *   Copy sOutput into the ring.  If the ring is full, wait for room
+ *   if bWait is set, otherwise drop the message.  Returns false if
+ *   the message was not queued, either because it was dropped, or
+ *   because the ring has been stopped.
+ *******************************************************************/
+bool
+FeedbackRing::Push(const std::string &sOutput, bool bStamp, bool bWait)
+{
+  __sync_fetch_and_add(&m_nPushing, 1);
+  if (m_bStopped)
+  {
+    __sync_fetch_and_sub(&m_nPushing, 1);
+    return false;
+  }
+
+  TMessage msg;
+  gettimeofday(&msg.tv, 0);
+  msg.bStamp = bStamp;
+  msg.nLength = sOutput.size();
+  if (!(msg.pData = static_cast<char*>(malloc(msg.nLength > 0 ? msg.nLength : 1))))
+  {
+    __sync_fetch_and_add(&m_nDropped, 1);
+    __sync_fetch_and_sub(&m_nPushing, 1);
+    return false;
+  }
+  memcpy(msg.pData, sOutput.data(), msg.nLength);
+
+  size_t nPos = m_nEnqueuePos;
+  TSlot *pSlot;
+  while (true)
+  {
+    pSlot = &m_pSlots[nPos & m_nMask];
+    size_t nSeq = pSlot->nSeq;
+    __sync_synchronize();
+    long nDiff = static_cast<long>(nSeq - nPos);
+    if (nDiff == 0)
+    {
+      if (__sync_bool_compare_and_swap(&m_nEnqueuePos, nPos, nPos + 1))
+        break;
+    }
+    else if (nDiff < 0)
+    {
+      if (!bWait || m_bStopped)
+      {
+        free(msg.pData);
+        if (!m_bStopped)
+          __sync_fetch_and_add(&m_nDropped, 1);
+        __sync_fetch_and_sub(&m_nPushing, 1);
+        return false;
+      }
+      Wake();
+      sched_yield();
+    }
+    nPos = m_nEnqueuePos;
+  }
+
+  pSlot->msg = msg;
+  __sync_synchronize();
+  pSlot->nSeq = nPos + 1;
+  __sync_synchronize();
+  if (m_bSleeping && nPos + 1 - m_nDequeuePos > (m_nMask + 1) / 2)
+    Wake();
+  __sync_fetch_and_sub(&m_nPushing, 1);
+  return true;
+}
+
+
+/********************************************************************
+ *   Take the oldest message out of the ring.  Returns false if the
+ *   ring is empty, or the oldest message is not completely written.
+ *******************************************************************/
+bool
+FeedbackRing::Pop(TMessage &msg)
+{
+  size_t nPos = m_nDequeuePos;
+  while (true)
+  {
+    TSlot *pSlot = &m_pSlots[nPos & m_nMask];
+    size_t nSeq = pSlot->nSeq;
+    __sync_synchronize();
+    long nDiff = static_cast<long>(nSeq - (nPos + 1));
+    if (nDiff == 0)
+    {
+      if (__sync_bool_compare_and_swap(&m_nDequeuePos, nPos, nPos + 1))
+      {
+        msg = pSlot->msg;
+        __sync_synchronize();
+        pSlot->nSeq = nPos + m_nMask + 1;
+        return true;
+      }
+    }
+    else if (nDiff < 0)
+      return false;
+    nPos = m_nDequeuePos;
+  }
+}
+
+
+bool
+FeedbackRing::Empty() const
+{
+  size_t nPos = m_nDequeuePos;
+  return m_pSlots[nPos & m_nMask].nSeq != nPos + 1;
+}
+
+
+void
+FeedbackRing::Wake()
+{
+  pthread_mutex_lock(&m_mutex);
+  pthread_cond_signal(&m_condWork);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+/********************************************************************
+ *   Format tv as "[hh:mm:ss.uuuuuu] " in local time, without any
+ *   library calls, since this is also used by the crash handler.
+ *   szStamp must hold stamp_length + 1 characters.
+ *******************************************************************/
+void
+FeedbackRing::Stamp(const timeval &tv, char *szStamp) const
+{
+  long nSec = (static_cast<long>(tv.tv_sec) + m_nUtcOffset) % 86400;
+  if (nSec < 0)
+    nSec += 86400;
+  const long fields[] = { nSec / 3600, nSec / 60 % 60, nSec % 60 };
+  char *pc = szStamp;
+  *pc++ = '[';
+  for (int nField = 0; nField < 3; nField++)
+  {
+    *pc++ = static_cast<char>('0' + fields[nField] / 10);
+    *pc++ = static_cast<char>('0' + fields[nField] % 10);
+    *pc++ = nField < 2 ? ':' : '.';
+  }
+  long nUSec = tv.tv_usec;
+  for (int nDigit = 5; nDigit >= 0; nDigit--, nUSec /= 10)
+    pc[nDigit] = static_cast<char>('0' + nUSec % 10);
+  pc += 6;
+  *pc++ = ']';
+  *pc++ = ' ';
+  *pc = '\0';
+}
+
+
+/********************************************************************
+ *   Writer thread: Write whatever is in the ring in one go, and
+ *   report any messages dropped since last time.  When the ring is
+ *   empty, sleep for poll_interval_ms.  Waking the writer for every
+ *   message would cost the producers a system call each, so they
+ *   only do so when the ring is half full, or to flush it.
+ *******************************************************************/
+void
+FeedbackRing::WriteLoop()
+{
+  const size_t max_batch = 1 << 16;
+  size_t nReported = 0;
+  std::string sBatch;
+  while (true)
+  {
+    sBatch.clear();
+    size_t nNumWritten = 0;
+    TMessage msg;
+    while (sBatch.size() < max_batch && Pop(msg))
+    {
+      if (msg.bStamp)
+      {
+        char szStamp[stamp_length + 1];
+        Stamp(msg.tv, szStamp);
+        sBatch.append(szStamp, stamp_length);
+      }
+      sBatch.append(msg.pData, msg.nLength);
+      free(msg.pData);
+      nNumWritten++;
+    }
+    size_t nDropped = m_nDropped;
+    if (nDropped != nReported)
+    {
+      timeval now;
+      gettimeofday(&now, 0);
+      char szStamp[stamp_length + 1];
+      Stamp(now, szStamp);
+      std::stringstream ss;
+      ss << szStamp << "Warning in thread Feedback writer from FeedbackCentral: "
+         << nDropped - nReported << " info message(s) dropped, because the output buffer was full.\n";
+      sBatch += ss.str();
+      nReported = nDropped;
+    }
+    if (!sBatch.empty())
+      m_central.WriteSynchronized(sBatch);
+
+    pthread_mutex_lock(&m_mutex);
+    if (nNumWritten > 0)
+    {
+      m_nWritten += nNumWritten;
+      pthread_cond_broadcast(&m_condFlushed);
+      pthread_mutex_unlock(&m_mutex);
+      continue;
+    }
+
+    m_bSleeping = true;
+    __sync_synchronize();
+    if (!m_bStop && Empty())
+    {
+      timeval now;
+      gettimeofday(&now, 0);
+      long int nUSec = now.tv_usec + 1000L * poll_interval_ms;
+      timespec deadline;
+      deadline.tv_sec = now.tv_sec + nUSec / 1000000L;
+      deadline.tv_nsec = (nUSec % 1000000L) * 1000L;
+      pthread_cond_timedwait(&m_condWork, &m_mutex, &deadline);
+    }
+    m_bSleeping = false;
+    bool bStop = m_bStop && Empty();
+    pthread_mutex_unlock(&m_mutex);
+    if (bStop)
+      return;
+  }
+}
+
+
+/********************************************************************
+ *   Wait until everything queued before the call has been written.
+ *******************************************************************/
+void
+FeedbackRing::Flush()
+{
+  pthread_mutex_lock(&m_mutex);
+  const size_t nTarget = m_nEnqueuePos;
+  pthread_cond_signal(&m_condWork);
+  while (m_bRunning && m_nWritten < nTarget)
+    pthread_cond_wait(&m_condFlushed, &m_mutex);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+size_t
+FeedbackRing::NumDropped() const
+{
+  return m_nDropped;
+}
+
+
+/********************************************************************
+ *   Write the remaining messages directly to nFd, for the crash
+ *   handler.  Async-signal-safe, but leaks the messages.
+ *******************************************************************/
+void
+FeedbackRing::Drain(int nFd)
+{
+  TMessage msg;
+  while (Pop(msg))
+  {
+    char szStamp[stamp_length + 1];
+    Stamp(msg.tv, szStamp);
+    const char *pParts[2] = { szStamp, msg.pData };
+    size_t nLengths[2] = { msg.bStamp ? stamp_length : 0, msg.nLength };
+    for (int nPart = 0; nPart < 2; nPart++)
+      while (nLengths[nPart] > 0)
+      {
+        ssize_t nRet = write(nFd, pParts[nPart], nLengths[nPart]);
+        if (nRet < 0 && errno == EINTR)
+          continue;
+        if (nRet <= 0)
+          return;
+        pParts[nPart] += nRet;
+        nLengths[nPart] -= nRet;
+      }
+  }
+}
+
 
 FeedbackError::FeedbackError(const std::string &sDescription)
   : m_nCode(m_nCodeCounter++), m_sDescription(sDescription)
@@ -62,8 +563,9 @@ FeedbackCentral::Instance()
 
 
 FeedbackCentral::FeedbackCentral(std::ostream &outputstream)
-    : m_nInfoLevel(0), m_outputstream(outputstream)
+    : m_outputstream(outputstream)
     , m_pOutputMutex(&m_defaultOutputMutex)
+    , m_pRing(0)
 {
   if (pthread_mutex_init(&m_defaultOutputMutex, 0) ||
       pthread_mutex_init(&m_selfMutex, 0))
@@ -73,6 +575,7 @@ FeedbackCentral::FeedbackCentral(std::ostream &outputstream)
 
 FeedbackCentral::~FeedbackCentral()
 {
+  SetAsyncOutput(0);
   pthread_mutex_destroy(&m_defaultOutputMutex);
   pthread_mutex_destroy(&m_selfMutex);
 }
@@ -137,13 +640,27 @@ FeedbackCentral::UnlockMutex(pthread_mutex_t *pMtx) const
 /********************************************************************
  *   Register a description of the current thread.  This description
  *   will be used in all subsequent output from the current thread.
- *   If no description is registered, thread id is used.
+ *   If no description is registered, thread id is used.  The
+ *   description is formatted once and for all here, see
+ *   GetThreadDescription.
+ *
+ *   !!- This assumes that pthread_t can be implicitly casted to a type
+ *       understood by stringstream::operator<<.
  *******************************************************************/
 void
 FeedbackCentral::RegisterThreadDescription(std::string sDescription)
 {
+  pthread_t thread_id = pthread_self();
+  std::stringstream ss;
+  if (sDescription.empty())
+    ss << thread_id;
+  else
+    ss << sDescription << " (id " << thread_id << ")";
+
   LockMutex(&m_selfMutex);
-  m_threadDescriptions[pthread_self()] = sDescription;
+  std::string &sThreadDescription = m_threadDescriptions[thread_id];
+  sThreadDescription = ss.str();
+  m_szThreadDescription = sThreadDescription.c_str();
   UnlockMutex(&m_selfMutex);
 }
 
@@ -156,7 +673,7 @@ void
 FeedbackCentral::SetInfoLevel(int nLevel)
 {
   LockMutex(&m_selfMutex);
-  m_nInfoLevel = nLevel;
+  __atomic_store_n(&m_nInfoLevel, nLevel, __ATOMIC_RELAXED);
   UnlockMutex(&m_selfMutex);
 }
 
@@ -164,10 +681,7 @@ FeedbackCentral::SetInfoLevel(int nLevel)
 int
 FeedbackCentral::GetInfoLevel() const
 {
-  LockMutex(&m_selfMutex);
-  int nLevel = m_nInfoLevel;
-  UnlockMutex(&m_selfMutex);
-  return nLevel;
+  return __atomic_load_n(&m_nInfoLevel, __ATOMIC_RELAXED);
 }
 
 
@@ -204,18 +718,124 @@ FeedbackCentral::SetShowHide(std::string sShow, std::string sHide)
     }
   }
 
+  __atomic_store_n(&m_nFilterGeneration, m_nFilterGeneration + 1, __ATOMIC_RELAXED);
   UnlockMutex(&m_selfMutex);
 }
 
 
+/********************************************************************
+ *   Match sIdentifier against the show/hide filters.  The result is
+ *   returned together with the filter generation it is valid for,
+ *   and cached by the Feedback objects.
+ *******************************************************************/
+int
+FeedbackCentral::ShowState(const std::string &sIdentifier) const
+{
+  LockMutex(&m_selfMutex);
+  bool bShown = (m_showSet.empty() || FindMatch(sIdentifier, m_showSet))
+    && (m_hideSet.empty() || !FindMatch(sIdentifier, m_hideSet));
+  int nState = (m_nFilterGeneration << 1) | (bShown ? 1 : 0);
+  UnlockMutex(&m_selfMutex);
+  return nState;
+}
+
+
+
+/********************************************************************
+ *   Write output through a ring buffer of nCapacity messages, emptied
+ *   by a writer thread, or synchronously if nCapacity is 0.  A ring
+ *   that is replaced is stopped and flushed, but not deleted, since
+ *   other threads may still be about to push to it.  Meant to be
+ *   called once, at startup.
+ *******************************************************************/
+int
+FeedbackCentral::SetAsyncOutput(size_t nCapacity)
+{
+  FeedbackRing *pOldRing = m_pRing;
+  m_pRing = 0;
+  __sync_synchronize();
+  if (pOldRing)
+  {
+    pOldRing->Stop();
+    pOldRing->Drain(STDERR_FILENO);
+  }
+  if (nCapacity == 0)
+    return 0;
+
+  FeedbackRing *pRing = new FeedbackRing(*this, nCapacity);
+  if (pRing->Start())
+  {
+    delete pRing;
+    WriteSynchronized("Error in feedback library: Failed to create the output writer thread.  "
+                      "Output will be synchronous.\n");
+    return 1;
+  }
+  m_pRing = pRing;
+  return 0;
+}
+
+
+/********************************************************************
+ *   Wait until all asynchronous output so far has been written.
+ *******************************************************************/
+void
+FeedbackCentral::FlushOutput() const
+{
+  FeedbackRing *pRing = m_pRing;
+  if (pRing)
+    pRing->Flush();
+}
+
+
+size_t
+FeedbackCentral::NumDropped() const
+{
+  FeedbackRing *pRing = m_pRing;
+  return pRing ? pRing->NumDropped() : 0;
+}
+
+
+/********************************************************************
+ *   All writing should go through this call.  With asynchronous
+ *   output, the string is queued, time stamped unless it is raw
+ *   output.  Info may be dropped, errors are waited for.  Otherwise,
+ *   it is written synchronously.
+ *******************************************************************/
+void  
+FeedbackCentral::WriteOutput(const std::string &sOutput, EOutputType type /*=raw_output*/) const
+{
+  FeedbackRing *pRing = m_pRing;
+  if (pRing)
+  {
+    if (pRing->Push(sOutput, type != raw_output, type != info_output))
+    {
+      if (type == error_output)
+        pRing->Flush();
+      return;
+    }
+        // A ring replaced by SetAsyncOutput may be read by a thread
+        // just before the switch.  Once it is stopped, write
+        // synchronously rather than lose the message, but only after
+        // the messages already in the ring, to keep them in order.
+    else if (!pRing->Stopped())
+    {
+      if (type == info_output)
+        return;
+    }
+    else
+      pRing->Flush();
+  }
+  WriteSynchronized(sOutput);
+}
+
 
 /********************************************************************
- *   Synchronized output.  All writing should go through this call,
- *   thus guaranteeing that the entire string is written atomically.
- *   See top of header for explanation to why we can't use syncutils.
+ *   Synchronized output, guaranteeing that the entire string is
+ *   written atomically.  See top of header for explanation to why we
+ *   can't use syncutils.
  *******************************************************************/
 void  
-FeedbackCentral::WriteOutput(const std::string &sOutput) const
+FeedbackCentral::WriteSynchronized(const std::string &sOutput) const
 {
   LockMutex(m_pOutputMutex);
   m_outputstream << sOutput << std::flush;
@@ -231,7 +851,7 @@ FeedbackCentral::Error(const Feedback *pSender, const FeedbackError &error, cons
      << " reported by " << pSender->Identify() 
      << ": " << error.Description()
      << (sAdditionalInfo.empty() ? "." : sAdditionalInfo) << "\n";
-  WriteOutput(ss.str());
+  WriteOutput(ss.str(), error_output);
   return error.Code();
 }
 
@@ -242,7 +862,7 @@ FeedbackCentral::Warning(const Feedback *pSender, const std::string &sMessage) c
   std::stringstream ss;
   ss << "Warning in thread " << GetThreadDescription() 
      << " from " << pSender->Identify() << ": " << sMessage << "\n" << std::flush;
-  WriteOutput(ss.str());
+  WriteOutput(ss.str(), message_output);
 }
 
 
@@ -265,28 +885,18 @@ FeedbackCentral::FindMatch(const std::string &sQry, const std::set<std::string>
  *   Print info if the given level is low enough.  The info check is
  *   unprotected, but since it only amounts to reading an int, not
  *   changing any memory, we take the chance.  Infolevel is checked
- *   frequently, and should be fast.  GetThreadDescription locks
- *   m_selfMutex, so unlock before calling this function.
+ *   frequently, and should be fast.  The show/hide decision is
+ *   cached by the sender.
  *******************************************************************/
 void 
 FeedbackCentral::Info(const Feedback *pSender, int nLevel, const std::string &sMessage) const
 {
-  std::string sIdentity = pSender->Identify();
-  if (nLevel <= m_nInfoLevel)
+  if (InfoEnabled(nLevel) && pSender->Shown())
   {
-    LockMutex(&m_selfMutex);
-    if ((m_showSet.empty() || FindMatch(sIdentity, m_showSet))
-        && (m_hideSet.empty() || !FindMatch(sIdentity, m_hideSet)))
-    {
-      UnlockMutex(&m_selfMutex); // Unlock before GetThreadDescription() below.
-
-      std::stringstream ss;
-      ss << "Info (" << nLevel << ") in thread " << GetThreadDescription() 
-         << " from " << sIdentity << ": " << sMessage << "\n" << std::flush;
-      WriteOutput(ss.str());
-    }
-    else
-      UnlockMutex(&m_selfMutex);
+    std::stringstream ss;
+    ss << "Info (" << nLevel << ") in thread " << GetThreadDescription() 
+       << " from " << pSender->Identify() << ": " << sMessage << "\n" << std::flush;
+    WriteOutput(ss.str(), info_output);
   }
 }
 
@@ -308,46 +918,41 @@ FeedbackCentral::Output(const Feedback */*pSender*/, const std::string &sMessage
  *   registered, the string returned reads "description (id
  *   thread_id)", otherwise it reads only "thread_id", where
  *   'description' is the description previously registered, and
- *   thread_id is the value returned from pthread_self().
- *  
- *   !!- This assumes that pthread_t can be implicitly casted to a type
- *       understood by stringstream::operator<<.
+ *   thread_id is the value returned from pthread_self().  The id of
+ *   a thread without a description is formatted on its first call,
+ *   into a thread-local buffer, without locking.
  *******************************************************************/
-std::string 
+const char*
 FeedbackCentral::GetThreadDescription() const
 {
-  pthread_t thread_id = pthread_self();
-  std::stringstream ss;
-  LockMutex(&m_selfMutex);
-  TThreadMap::const_iterator tdit = m_threadDescriptions.find(thread_id);
-  if (tdit == m_threadDescriptions.end())
-    ss << thread_id;
-  else
-    ss << tdit->second << " (id " << thread_id << ")";
-  UnlockMutex(&m_selfMutex);
-  return ss.str();
-}
-
-
-IFeedbackStream::IFeedbackStream(const Feedback *pSender)
-    : m_pSender(pSender)
-{
+  if (!m_szThreadDescription)
+  {
+    std::stringstream ss;
+    ss << pthread_self();
+    strncpy(m_szThreadId, ss.str().c_str(), sizeof(m_szThreadId) - 1);
+    m_szThreadDescription = m_szThreadId;
+  }
+  return m_szThreadDescription;
 }
 
 
 IFeedbackStream::IFeedbackStream(const IFeedbackStream &rhs)
+    : m_pss(rhs.m_pss ? new std::stringstream : 0), m_pSender(rhs.m_pSender)
 {
-  m_ss << rhs.m_ss.str();
+  if (m_pss)
+    *m_pss << rhs.m_pss->str();
 }
 
 
-IFeedbackStream::~IFeedbackStream()
+std::string
+IFeedbackStream::Str() const
 {
+  return m_pss ? m_pss->str() : std::string();
 }
 
 
 ErrorStream::ErrorStream(const Feedback *pSender, const FeedbackError &error, bool bHaveError /*=true*/)
-    : IFeedbackStream(pSender), m_error(error), m_bHaveError(bHaveError)
+    : IFeedbackStream(pSender, bHaveError), m_error(error), m_bHaveError(bHaveError)
 {
 }
 
@@ -361,57 +966,58 @@ ErrorStream::operator int() const
 ErrorStream::~ErrorStream()
 {
   if (m_bHaveError)
-    FeedbackCentral::Instance().Error(m_pSender, m_error, m_ss.str());
+    FeedbackCentral::Instance().Error(m_pSender, m_error, Str());
 }
 
 
 WarningStream::WarningStream(const Feedback *pSender, const std::string &sMessage, bool bHaveError /*=true*/)
-    : IFeedbackStream(pSender), m_bHaveError(bHaveError)
+    : IFeedbackStream(pSender, bHaveError), m_bHaveError(bHaveError)
 {
-  m_ss << sMessage;
+  *this << sMessage;
 }
 
 
 WarningStream::~WarningStream() 
 {
   if (m_bHaveError)
-    FeedbackCentral::Instance().Warning(m_pSender, m_ss.str());
+    FeedbackCentral::Instance().Warning(m_pSender, Str());
 }
 
 
 
 InfoStream::InfoStream(const Feedback *pSender, int nLevel, const std::string &sMessage)
-    : IFeedbackStream(pSender), m_nLevel(nLevel)
+    : IFeedbackStream(pSender, FeedbackCentral::InfoEnabled(nLevel)), m_nLevel(nLevel)
 {
-  m_ss << sMessage;
+  *this << sMessage;
 }
 
 
-InfoStream::~InfoStream() 
+void
+InfoStream::Report() const
 {
-  FeedbackCentral::Instance().Info(m_pSender, m_nLevel, m_ss.str());
+  FeedbackCentral::Instance().Info(m_pSender, m_nLevel, Str());
 }
 
 
 OutputStream::OutputStream(const Feedback *pSender, const std::string &sMessage)
     : IFeedbackStream(pSender)
 {
-  m_ss << sMessage;
+  *this << sMessage;
 }
 
 OutputStream::~OutputStream()
 {
-  FeedbackCentral::Instance().Output(m_pSender, m_ss.str());
+  FeedbackCentral::Instance().Output(m_pSender, Str());
 }
 
 Feedback::Feedback(const std::string &sIdentifier)
-    : m_sIdentifier(sIdentifier)
+    : m_sIdentifier(sIdentifier), m_nShowState(-1)
 {
 }
 
 
 Feedback::Feedback(const Feedback &rhs)
-    : m_sIdentifier(rhs.m_sIdentifier)
+    : m_sIdentifier(rhs.m_sIdentifier), m_nShowState(__atomic_load_n(&rhs.m_nShowState, __ATOMIC_RELAXED))
 {
 }
 
@@ -420,9 +1026,27 @@ Feedback&
 Feedback::operator =(const Feedback &rhs)
 {
   m_sIdentifier = rhs.m_sIdentifier;
+  __atomic_store_n(&m_nShowState, __atomic_load_n(&rhs.m_nShowState, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
   return *this;
 }
 
+
+/********************************************************************
+ *   Match the identifier against the show/hide filters.  Done by
+ *   Shown the first time it is called, and again if the filters or
+ *   the identifier have changed since, so that objects which never
+ *   print info, such as the temporary ones made for each message,
+ *   never take the lock.  Threads sharing the object may race to
+ *   store the state, but they store the same value.
+ *******************************************************************/
+int
+Feedback::UpdateShowState() const
+{
+  int nState = FeedbackCentral::Instance().ShowState(m_sIdentifier);
+  __atomic_store_n(&m_nShowState, nState, __ATOMIC_RELAXED);
+  return nState;
+}
+
   
 /*static*/ void
 Feedback::RegisterThreadDescription(std::string sDescription)
@@ -451,7 +1075,7 @@ Feedback::Warning(const std::string &sMessage /*=""*/) const
 
 
 InfoStream 
-Feedback::Info(int nLevel, const std::string &sMessage /*=""*/) const
+Feedback::Info(int nLevel, const std::string &sMessage) const
 {
   return InfoStream(this, nLevel, sMessage);
 }
@@ -489,6 +1113,7 @@ void
 Feedback::SetIdentifier(const std::string &sNewIdentifier)
 {
   m_sIdentifier = sNewIdentifier;
+  __atomic_store_n(&m_nShowState, -1, __ATOMIC_RELAXED);
 }
 
 
@@ -511,3 +1136,17 @@ Feedback::SetShowHide(const std::string &sShow, const std::string &sHide)
 {
   FeedbackCentral::Instance().SetShowHide(sShow, sHide);
 }
+
+
+/*static*/ int
+Feedback::SetAsyncOutput(size_t nCapacity)
+{
+  return FeedbackCentral::Instance().SetAsyncOutput(nCapacity);
+}
+
+
+/*static*/ void
+Feedback::FlushOutput()
+{
+  FeedbackCentral::Instance().FlushOutput();
+}
@@ -76,14 +76,36 @@ InitOptions(int argc, char *argv[])
   Options::Instance().Append("slave-program", new OptionString("The name of the process to be loaded on the slave side", false, ""));
   Options::Instance().Append("slave-arguments", new OptionString("Arguments sent to the slave process", false, "", 'b'));
   Options::Instance().Append("slave", new OptionString("The name of and arguments to the process to be loaded on the slave side, i.e. a concatenation of slave-program and slave-arguments", false, "", 's'));
+  Options::Instance().Append("slave-job-timeout", new OptionFloat("Wall-clock seconds a slave may spend on a single job before the slave process is killed and restarted, and the job resubmitted (0 = no timeout).", false, 0));
+  Options::Instance().Append("slave-bind", new OptionString("Pin the slave program to CPUs.  Available values are NONE, CPU [one CPU] and NUMA [all CPUs of one NUMA node]", false, "NONE"));
+  Options::Instance().Append("slave-bind-by", new OptionString("How slave programs are distributed over CPUs and NUMA nodes when slave-bind is set.  Available values are SLOT [the node-local rank given by the MPI launcher] and RANK [the MPI rank]", false, "SLOT"));
+  Options::Instance().Append("slave-plugin-threads", new OptionInt("Number of threads calling the evaluate function of a slave plugin (a slave ending in .so).  With more than one thread, set jobs-per-send to a multiple of this number", false, 1));
   Options::Instance().Append("slave-run-once", new OptionBool("The slave process must be killed and reloaded for each new evaluation (true/false).", false, false));
-  Options::Instance().Append("master-input-mode", new OptionString("How the master expects its input formatted.  Available values are SIMPLE [lines], EOF, BIN-EOF [bytes] and BYTES", false, "SIMPLE"));
+  Options::Instance().Append("master-input-mode", new OptionString("How the master expects its input formatted.  Available values are SIMPLE [lines], EOF, BIN-EOF [bytes], BYTES, BYTES64 and CHUNKED [chunk size]", false, "SIMPLE"));
+  Options::Instance().Append("master-batch-mode", new OptionString("How the end of a batch of jobs from the master is detected.  Available values are POLL [no more data within master-poll-timeout], COUNT [each batch is preceded by a line holding the number of jobs] and MARKER [each batch is followed by a job consisting of master-batch-marker]", false, "POLL"));
+  Options::Instance().Append("master-batch-marker", new OptionString("End-of-batch marker in MARKER batch mode", false, "END-OF-BATCH"));
+  Options::Instance().Append("master-poll-timeout", new OptionInt("Milliseconds without data from the master before a batch is considered complete in POLL batch mode", false, 10));
+  Options::Instance().Append("master-streaming", new OptionBool("Pass each job to the slaves as soon as it has been read from the master, rather than when the whole batch has been read (true/false).  Results are still returned in order at the end of the batch.", false, false));
+  Options::Instance().Append("master-result-order", new OptionString("Order in which results are written back to the master.  Available values are ORDERED [batches of results in the order of the jobs] and COMPLETION [each result as soon as it is ready, preceded by the tag of its job; batch mode is ignored]", false, "ORDERED"));
+  Options::Instance().Append("master-job-tags", new OptionBool("With master-result-order COMPLETION, the first word of each job is a tag to return with its result, rather than the sequence number of the job (true/false)", false, false));
+  Options::Instance().Append("master-io-queue-size", new OptionInt("Maximum number of jobs read from the master, and of results waiting to be written to it, which are buffered in simdist", false, 1024));
   Options::Instance().Append("master-output-mode", new OptionString("Similar to master-input-mode", false, "SIMPLE"));
+  Options::Instance().Append("slave-input-mode", new OptionString("How the slave program expects its input formatted, if not as given by master-output-mode.  Available values are those of master-input-mode, and FILE [each job is written to a file in /dev/shm, and the slave program is given a line holding the path, offset and length of the job, and should remove the file]", false, ""));
+  Options::Instance().Append("slave-output-mode", new OptionString("How the slave program formats its output, if not as given by master-input-mode.  Similar to slave-input-mode; in FILE mode, simdist removes the result files", false, ""));
 //   Options::Instance().Append("slave-count", new OptionInt("The number of slaves to spawn", false, 1));
   Options::Instance().Append("slave-wait-factor", new OptionFloat("How long a slave waits before taking a job already taken by another slave", false, 10));
   Options::Instance().Append("jobs-per-send", new OptionInt("How many free jobs each slave will take from the queue at once (0 = auto)", false, 0));
   Options::Instance().Append("verbosity-showonly", new OptionString("If not empty, only verbose output from modules in this comma-separated list will be printed", false, ""));
   Options::Instance().Append("verbosity-dontshow", new OptionString("If not empty, verbose output from modules in this comma-separated list will never be printed", false, ""));
+  Options::Instance().Append("verbosity-buffer", new OptionInt("If positive, informational output, warnings and errors are time stamped and written by a background thread through a buffer of this many messages, rather than by each thread in turn.  Info is dropped (and counted) when the buffer is full", false, 0));
+  Options::Instance().Append("metrics-file", new OptionString("If not empty, counters such as queue depth, jobs taken, completed and duplicated, per-slave latency and bytes transferred are written to this file by the master at regular intervals", false, ""));
+  Options::Instance().Append("metrics-format", new OptionString("Format of metrics-file: PROMETHEUS [text exposition format] or JSON", false, "PROMETHEUS"));
+  Options::Instance().Append("metrics-interval", new OptionFloat("Seconds between each write of metrics-file", false, 10));
+  Options::Instance().Append("trace-file", new OptionString("If not empty, the master writes a trace of each job through the queue, MPI, the slave servers and the slave programs to this file, in Chrome trace event format (for chrome://tracing or Perfetto)", false, ""));
+  Options::Instance().Append("profile", new OptionBool("Time regions of the master and the slave servers, such as waiting for the job queue lock, encoding and sending jobs and evaluation in the slave programs, and report calls, total and mean time and percentiles for each region to standard error at shutdown (true/false)", false, false));
+  Options::Instance().Append("result-journal", new OptionString("If not empty, the master appends the results of each job to this file, keyed by a hash of the job data.  When the master is restarted with the same journal, e.g. after a crash, jobs found in it are not evaluated again, but given the recorded results", false, ""));
+  Options::Instance().Append("result-journal-sync", new OptionInt("Flush the result journal to disk (fdatasync) after this many results.  It is also flushed at the end of each batch of jobs.  0 flushes only at the end of each batch", false, 64));
+  Options::Instance().Append("control-socket", new OptionString("If not empty, the master listens for commands on a Unix domain socket at this path, to report the state of the queue and the slaves, and to change jobs-per-send, slave-wait-factor and verbosity while running.  See simdist-control", false, ""));
   Options::Instance().Append("slave-id-tag", new OptionString("When the argument to this option is found in the list of slave process arguments, its value will be replaced with a unique identifier on each slave server.", false, "SLAVEID"));
   Options::Instance().Append("report-total-simulation-time", new OptionBool("Report total simulation time (in real time) when the distribution system shuts down (true/false).", false, false));
 
@@ -28,6 +28,7 @@
 #include <simdist/misc_utils.h>
 
 #include <cstdio>
+#include <cstdlib>
 #include <algorithm>
 #include <fstream>
 #include <functional>
@@ -36,6 +37,13 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <iostream>
+#include <sstream>
+#include <limits>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <fcntl.h>
 
 // FeedbackError E_IO_UTILS_READJOB("Failed to read job data from child process");
 DEFINE_FEEDBACK_ERROR(E_IO_UTILS_INIT, "Failed to initialize reader")
@@ -47,6 +55,10 @@ DEFINE_FEEDBACK_ERROR(E_CHECKPOINT_WRITE, "Failed to write checkpoint data to te
 DEFINE_FEEDBACK_ERROR(E_CHECKPOINT_READ, "Failed to write checkpoint data from file");
 DEFINE_FEEDBACK_ERROR(E_CHECKPOINT_RENAME, "Failed to rename temporary file to checkpoint"); 
 DEFINE_FEEDBACK_ERROR(E_CHECKPOINT_CLEAR, "Failed to clear checkpoint (i.e. unlink checkpoint file)"); 
+DEFINE_FEEDBACK_ERROR(E_CHECKPOINT_DELTA, "Failed to store checkpoint delta");
+DEFINE_FEEDBACK_ERROR(E_JOURNAL_OPEN, "Failed to open result journal");
+DEFINE_FEEDBACK_ERROR(E_JOURNAL_WRITE, "Failed to append results to result journal");
+DEFINE_FEEDBACK_ERROR(E_JOURNAL_SYNC, "Failed to flush result journal to disk");
 using namespace std;
 
 JobReaderWriter::JobReaderWriter()
@@ -94,6 +106,19 @@ JobReaderWriter::SetMode(const std::string &sIOMode)
     m_mode = eof;
   else if (sMode == "BYTES")
     m_mode = bytecount;
+  else if (sMode == "BYTES64")
+    m_mode = bytecount64;
+  else if (sMode == "CHUNKED")
+  {
+    m_mode = chunked;
+    ssMode >> m_nModeArguments;
+    if (ssMode.fail())
+      m_nModeArguments = default_chunk_size;
+    if (m_nModeArguments < 1)
+      return m_fb.Error(E_IO_UTILS_INIT) << "Invalid chunk size: " + sIOMode;
+  }
+  else if (sMode == "FILE")
+    m_mode = file;
   else if (sMode == "BIN-EOF")
   {
     m_mode = bin_eof;
@@ -126,6 +151,13 @@ JobReaderWriter::ModeToString() const
         return "EOF";
       case bytecount:
         return "BYTES";
+      case bytecount64:
+        return "BYTES64";
+      case chunked:
+        ssMode << "CHUNKED " << m_nModeArguments;
+        return ssMode.str();
+      case file:
+        return "FILE";
       case bin_eof:
         ssMode << "BIN-EOF " << m_nModeArguments;
         return ssMode.str();
@@ -137,39 +169,6 @@ JobReaderWriter::ModeToString() const
         return "Unknown";
   }
 }
-/********************************************************************
- *   Custom substring matching function.  In addition to searching
- *   data for containing delimiter, it also accepts part of the
- *   delimiter iff this is found at the very end of the data string.
- *
- *   The return value is an iterator pointing to the position where a
- *   match starts.  If no match is found, dataEnd is returned.
- *
- *   To see if the entire delimiter is found, compare length of
- *   delimiter to distance(returned iterator, dataEnd).
- *******************************************************************/
-template<class it1, class it2>
-it1
-JobReaderWriter::MatchDelim(it1 dataBegin, it1 dataEnd, it2 delimBegin, it2 delimEnd) const
-{
-  for (; dataBegin != dataEnd; dataBegin++)
-  {
-    if (*dataBegin == *delimBegin)
-    {
-      it1 dataCur = dataBegin;
-      it2 delimCur = delimBegin;
-      while (*dataCur == *delimCur)
-      {
-        if (++dataCur == dataEnd || ++delimCur == delimEnd)
-          return dataBegin;
-      }
-    }
-  }
-
-  return dataEnd;
-}
-
-
 #if defined(__INTEL_COMPILER) && __INTEL_COMPILER < 900
 #  pragma message("==================================================")
 #  pragma message("NOTE: Compiling " __FILE__ " with a special hack for old ICC compilers.")
@@ -180,43 +179,357 @@ JobReaderWriter::MatchDelim(it1 dataBegin, it1 dataEnd, it2 delimBegin, it2 deli
 #endif
 
 /********************************************************************
- *   Optimized reading function: Read as large chunks as possible each
- *   time.  We can read at most as much as the length of the delimiter
- *   at once.
+ *   Access to the get area of any stream buffer.  The protected
+ *   members are reached through pointers to members taken in a
+ *   derived class, which the language allows.  This lets
+ *   ReadDelimData search the buffered data in place, and consume
+ *   exactly up to the end of the delimiter.
+ *******************************************************************/
+struct GetArea : public std::streambuf
+{
+  static const char* Begin(std::streambuf *pBuf) { return (pBuf->*(&GetArea::gptr))(); }
+  static const char* End(std::streambuf *pBuf) { return (pBuf->*(&GetArea::egptr))(); }
+  static void Consume(std::streambuf *pBuf, size_t nCount) { (pBuf->*(&GetArea::gbump))(static_cast<int>(nCount)); }
+};
+
+
+/********************************************************************
+ *   Find the first complete occurrence of the delimiter in
+ *   [pBegin, pEnd).  memchr finds candidates for the first byte,
+ *   which are then verified.  Returns 0 if there is none.
+ *******************************************************************/
+static const char*
+FindDelim(const char *pBegin, const char *pEnd, const char *pDelim, size_t nDelimLen)
+{
+  if (static_cast<size_t>(pEnd - pBegin) < nDelimLen)
+    return 0;
+  const char *pLast = pEnd - nDelimLen;
+  for (const char *p = pBegin; p <= pLast; p++)
+  {
+    p = static_cast<const char*>(memchr(p, pDelim[0], pLast - p + 1));
+    if (!p)
+      return 0;
+    if (memcmp(p + 1, pDelim + 1, nDelimLen - 1) == 0)
+      return p;
+  }
+  return 0;
+}
+
+
+/********************************************************************
+ *   Read data up to and including the delimiter, which is not
+ *   stored.  The data buffered in the stream is searched in place,
+ *   one buffer full at a time, and bytes after the delimiter are
+ *   left in the stream for the next message.  A delimiter may start
+ *   in one buffer full and end in the next; the tail of the data
+ *   read so far is checked for this before searching each new
+ *   buffer full.  Stream buffers that don't buffer input are read
+ *   one byte at a time.
  *******************************************************************/
 int
 JobReaderWriter::ReadDelimData(std::istream &s, std::string &sData, const std::string &sDelim) const
 {
   if (sDelim.empty())
     return m_fb.Error(E_IO_UTILS_READJOB) << ": Empty delimiter.";
-  
+
   const size_t nDelimLen = sDelim.size();
-  char buf[nDelimLen + 1];
-  s.read(buf, nDelimLen);
-  if (s.gcount() != std::streamsize(nDelimLen) || s.eof() || !s.good())
-    OLD_ICC_RETURN(fb, E_IO_UTILS_READJOB, ": Reading failed while searching for trailing message delimiter (" << sDelim << ").");
-
-  int nCtr = 0;
-  char *mit;
-  while((mit = MatchDelim(buf, buf + nDelimLen, sDelim.begin(), sDelim.end())) != buf)
-  {
-    nCtr++;
-    sData.append(buf, mit - buf);
-    size_t nSubMatch = buf + nDelimLen - mit;
-    if (nSubMatch > 0)
-      memmove(buf, mit, nSubMatch);
-    s.read(buf + nSubMatch, nDelimLen - nSubMatch);
-    if (s.gcount() != std::streamsize(nDelimLen - nSubMatch) || s.eof() || !s.good())
+  const char *pDelim = sDelim.data();
+  std::streambuf *pBuf = s.rdbuf();
+  while (true)
+  {
+    if (traits_type::eq_int_type(pBuf->sgetc(), traits_type::eof()))
     {
-      buf[std::max(nDelimLen, nSubMatch + static_cast<size_t>(s.gcount()))] = 0;
+      s.setstate(std::ios::eofbit | std::ios::failbit);
       OLD_ICC_RETURN(fb, E_IO_UTILS_READJOB, ": Reading failed while searching for trailing message delimiter (" 
-                     << sDelim << ").  Last block read was: '" << &(buf[0]) << "'.");
+                     << sDelim << ") after " << sData.size() << " bytes.");
+    }
+
+    const char *pBegin = GetArea::Begin(pBuf), *pEnd = GetArea::End(pBuf);
+    if (pBegin == pEnd)
+    {
+      sData += traits_type::to_char_type(pBuf->sbumpc());
+      if (sData.size() >= nDelimLen && sData.compare(sData.size() - nDelimLen, nDelimLen, sDelim) == 0)
+      {
+        sData.resize(sData.size() - nDelimLen);
+        return 0;
+      }
+      continue;
+    }
+    const size_t nAvail = std::min<size_t>(pEnd - pBegin, std::numeric_limits<int>::max());
+    pEnd = pBegin + nAvail;
+
+        // A delimiter starting in the data already read, earliest
+        // start first.
+    for (size_t nHead = std::min(nDelimLen - 1, sData.size()); nHead > 0; nHead--)
+    {
+      const size_t nRest = nDelimLen - nHead;
+      if (nAvail < nRest 
+          || sData.compare(sData.size() - nHead, nHead, pDelim, nHead) != 0
+          || memcmp(pBegin, pDelim + nHead, nRest) != 0)
+        continue;
+      sData.resize(sData.size() - nHead);
+      GetArea::Consume(pBuf, nRest);
+      return 0;
+    }
+
+    if (const char *pMatch = FindDelim(pBegin, pEnd, pDelim, nDelimLen))
+    {
+      sData.append(pBegin, pMatch);
+      GetArea::Consume(pBuf, pMatch - pBegin + nDelimLen);
+      return 0;
     }
+    sData.append(pBegin, pEnd);
+    GetArea::Consume(pBuf, nAvail);
   }
-  return 0;
 }
     
 
+/********************************************************************
+ *   Read nNumLines lines, as many calls to std::getline would, and
+ *   join them with newlines in sData.  Newlines are searched for in
+ *   the stream buffer with memchr, and the lines appended straight
+ *   from it.  Like std::getline, the last line in the stream need
+ *   not end with a newline.  Returns eof if there are no more
+ *   messages.
+ *******************************************************************/
+JobReaderWriter::int_type
+JobReaderWriter::ReadLines(std::istream &s, std::string &sData, int nNumLines) const
+{
+  if (!s.good())
+  {
+    s.setstate(std::ios::failbit);
+    if (s.eof())
+      return traits_type::eof();
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": Stream not good.";
+  }
+
+  std::streambuf *pBuf = s.rdbuf();
+  for (int nLine = 0; nLine < nNumLines; nLine++)
+  {
+    if (nLine)
+      sData += '\n';
+    for (bool bLineRead = false; ; bLineRead = true)
+    {
+      if (traits_type::eq_int_type(pBuf->sgetc(), traits_type::eof()))
+      {
+        s.setstate(std::ios::eofbit);
+        if (bLineRead && nLine == nNumLines - 1)
+          return 0;
+        s.setstate(std::ios::failbit);
+        if (nLine == 0 && !bLineRead)
+          return traits_type::eof();
+        return m_fb.Error(E_IO_UTILS_READJOB) << ": End of file in line " << nLine + 1 << " of " 
+                                              << nNumLines << ".  No more jobs?";
+      }
+
+      const char *pBegin = GetArea::Begin(pBuf), *pEnd = GetArea::End(pBuf);
+      if (pBegin == pEnd)
+      {
+        const char ch = traits_type::to_char_type(pBuf->sbumpc());
+        if (ch == '\n')
+          break;
+        sData += ch;
+        continue;
+      }
+      const size_t nAvail = std::min<size_t>(pEnd - pBegin, std::numeric_limits<int>::max());
+      if (const char *pNewline = static_cast<const char*>(memchr(pBegin, '\n', nAvail)))
+      {
+        sData.append(pBegin, pNewline);
+        GetArea::Consume(pBuf, pNewline - pBegin + 1);
+        break;
+      }
+      sData.append(pBegin, nAvail);
+      GetArea::Consume(pBuf, nAvail);
+    }
+  }
+  return 0;
+}
+
+
+/********************************************************************
+ *   Read the byte count leading a message in bytecount mode, or a
+ *   message or chunk in bytecount64 and chunked mode.  Returns eof
+ *   if there are no more messages.
+ *******************************************************************/
+JobReaderWriter::int_type
+JobReaderWriter::ReadByteCount(std::istream &s, uint64_t &nBytes) const
+{
+  uint32_t nBytes32;
+  const std::streamsize nSize = m_mode == bytecount ? sizeof(nBytes32) : sizeof(nBytes);
+  s.read(m_mode == bytecount ? reinterpret_cast<char*>(&nBytes32) : reinterpret_cast<char*>(&nBytes), nSize);
+  if (s.gcount() == 0 && s.eof())
+    return traits_type::eof();
+  if (s.gcount() != nSize)
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": Failed to read byte count.";
+  if (m_mode == bytecount)
+    nBytes = nBytes32;
+  if (nBytes > std::numeric_limits<size_t>::max())
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": " << nBytes << " bytes is too large a message for this system.";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Read the next chunk in chunked mode, and append it to sData.
+ *   bEnd is set at the empty chunk ending the message.
+ *******************************************************************/
+JobReaderWriter::int_type
+JobReaderWriter::ReadChunkAppend(std::istream &s, std::string &sData, bool &bEnd) const
+{
+  uint64_t nBytes;
+  if (int_type nRet = ReadByteCount(s, nBytes))
+    return nRet;
+  bEnd = nBytes == 0;
+  const size_t nOffset = sData.size();
+  sData.resize(nOffset + nBytes);
+  if (nBytes > 0 && s.read(&sData[nOffset], nBytes).gcount() != static_cast<std::streamsize>(nBytes))
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": Failed to read chunk of " << nBytes << " bytes.";
+  return 0;
+}
+
+
+JobReaderWriter::int_type
+JobReaderWriter::ReadChunk(std::istream &s, std::string &sChunk) const
+{
+  if (m_mode != chunked)
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": Can't read chunks in " << ModeToString() << " mode.";
+  bool bEnd;
+  sChunk.clear();
+  return ReadChunkAppend(s, sChunk, bEnd);
+}
+
+
+JobReaderWriter::int_type
+JobReaderWriter::WriteChunk(std::ostream &s, const char *pData, size_t nCount) const
+{
+  if (m_mode != chunked)
+    return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": Can't write chunks in " << ModeToString() << " mode.";
+  const size_t nMaxChunk = m_nModeArguments > 0 ? m_nModeArguments : default_chunk_size;
+  do
+  {
+    const uint64_t nBytes = std::min(nCount, nMaxChunk);
+    if (int_type nRet = WriteParts(s, reinterpret_cast<const char*>(&nBytes), sizeof(nBytes), pData, nBytes, 0, 0))
+      return nRet;
+    pData += nBytes;
+    nCount -= nBytes;
+  }
+  while (nCount > 0);
+  return 0;
+}
+
+
+/********************************************************************
+ *   Directory for the files written in file mode.  Files in
+ *   /dev/shm stay in memory.
+ *******************************************************************/
+static std::string
+FileModeDirectory()
+{
+  struct stat st;
+  if (!stat("/dev/shm", &st) && S_ISDIR(st.st_mode) && !access("/dev/shm", W_OK))
+    return "/dev/shm";
+  const char *pTmpDir = getenv("TMPDIR");
+  return pTmpDir && *pTmpDir ? pTmpDir : "/tmp";
+}
+
+
+/********************************************************************
+ *   Read the file reference of the next message in file mode, and
+ *   then the message from the file, which is removed.  The path may
+ *   contain spaces, so the numbers are taken from the end.
+ *******************************************************************/
+JobReaderWriter::int_type
+JobReaderWriter::ReadFile(std::istream &s, std::string &sData) const
+{
+  std::string sLine;
+  if (!std::getline(s, sLine))
+  {
+    if (s.eof())
+      return traits_type::eof();
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": Failed to read file reference.";
+  }
+
+  const size_t nLengthPos = sLine.rfind(' ');
+  const size_t nOffsetPos = (nLengthPos == std::string::npos || nLengthPos == 0) 
+    ? std::string::npos : sLine.rfind(' ', nLengthPos - 1);
+  uint64_t nOffset, nLength;
+  std::stringstream ss(nOffsetPos == std::string::npos ? "" : sLine.substr(nOffsetPos));
+  if (!(ss >> nOffset >> nLength) || nOffsetPos == 0)
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": Expected \"<path> <offset> <length>\", got \"" << sLine << "\".";
+  if (nLength > std::numeric_limits<size_t>::max())
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": " << nLength << " bytes is too large a message for this system.";
+  const std::string sPath = sLine.substr(0, nOffsetPos);
+
+  int nFd = open(sPath.c_str(), O_RDONLY);
+  if (nFd < 0)
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": Failed to open " << sPath << ": " << strerror(errno) << ".";
+  sData.resize(nLength);
+  size_t nRead = 0;
+  while (nRead < nLength)
+  {
+    ssize_t nRet = pread(nFd, &sData[nRead], nLength - nRead, nOffset + nRead);
+    if (nRet < 0 && errno == EINTR)
+      continue;
+    if (nRet <= 0)
+      break;
+    nRead += nRet;
+  }
+  const int nErrno = errno;
+  close(nFd);
+  unlink(sPath.c_str());
+  if (nRead < nLength)
+    return m_fb.Error(E_IO_UTILS_READJOB) << ": Read " << nRead << " of " << nLength << " bytes at offset " 
+                                          << nOffset << " in " << sPath << ": " << strerror(nErrno) << ".";
+  return 0;
+}
+
+
+JobReaderWriter::int_type
+JobReaderWriter::WriteFile(std::ostream &s, const char *pData, size_t nCount) const
+{
+  std::string sPath = FileModeDirectory() + "/simdist-XXXXXX";
+  int nFd = mkstemp(&sPath[0]);
+  if (nFd < 0)
+    return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": Failed to create " << sPath << ": " << strerror(errno) << ".";
+
+  size_t nWritten = 0;
+  while (nWritten < nCount)
+  {
+    ssize_t nRet = write(nFd, pData + nWritten, nCount - nWritten);
+    if (nRet < 0 && errno == EINTR)
+      continue;
+    if (nRet <= 0)
+      break;
+    nWritten += nRet;
+  }
+  const int nErrno = errno;
+  if (close(nFd) || nWritten < nCount)
+  {
+    unlink(sPath.c_str());
+    return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": Wrote " << nWritten << " of " << nCount << " bytes to "
+                                           << sPath << ": " << strerror(nErrno) << ".";
+  }
+
+  m_sLastFile = sPath;
+  s << sPath << " 0 " << nCount << "\n" << std::flush;
+  if (!s.good())
+  {
+    DiscardFile();
+    return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": Failed to write reference to " << sPath << ".";
+  }
+  return 0;
+}
+
+
+void
+JobReaderWriter::DiscardFile() const
+{
+  if (!m_sLastFile.empty())
+    unlink(m_sLastFile.c_str());
+  m_sLastFile.clear();
+}
+
+
 JobReaderWriter::int_type
 JobReaderWriter::Read(std::istream &s, std::string &sData) const
 {
@@ -239,21 +552,35 @@ JobReaderWriter::Read(std::istream &s, std::string &sData) const
         }
         break;
       case bytecount:
+      case bytecount64:
         {
-          uint32_t nBytes;
-          s.read(reinterpret_cast<char*>(&nBytes), sizeof(nBytes));
-          if (s.gcount() == 0 && s.eof())
-            return traits_type::eof();
-          if (s.gcount() != sizeof(nBytes))
-            return m_fb.Error(E_IO_UTILS_READJOB) << ": Failed to read byte count.";
-          std::vector<char> v(nBytes);
-          s.read(&(v[0]), nBytes);
+              // Read straight into the string.  If sData is reused
+              // for several messages, this doesn't even allocate.
+          uint64_t nBytes;
+          if (int_type nRet = ReadByteCount(s, nBytes))
+            return nRet;
           sData.resize(nBytes);
-          std::copy(v.begin(), v.end(), sData.begin());
-          if (s.gcount() != static_cast<std::streamsize>(nBytes))
+          if (nBytes > 0 && s.read(&sData[0], nBytes).gcount() != static_cast<std::streamsize>(nBytes))
             return m_fb.Error(E_IO_UTILS_READJOB) << ": Failed to read " << nBytes << " bytes of job data.";
         }
         break;
+      case chunked:
+        {
+          bool bEnd = false;
+          for (int nChunk = 0; !bEnd; nChunk++)
+          {
+            int_type nRet = ReadChunkAppend(s, sData, bEnd);
+            if (nRet == traits_type::eof() && nChunk > 0)
+              return m_fb.Error(E_IO_UTILS_READJOB) << ": End of file after " << sData.size() << " bytes of chunked message.";
+            else if (nRet)
+              return nRet;
+          }
+        }
+        break;
+      case file:
+        if (int_type nRet = ReadFile(s, sData))
+          return nRet;
+        break;
       case bin_eof:
         {
           int nTagLen = m_nModeArguments;
@@ -274,115 +601,291 @@ JobReaderWriter::Read(std::istream &s, std::string &sData) const
           int nNumLines = m_nModeArguments;
           if (nNumLines < 1 || nNumLines > 10000)
             return m_fb.Error(E_IO_UTILS_READJOB) << "Won't obey instructions to read " << nNumLines << " lines of result data.";
-
-          std::string sLine;
-          for (int nLine = 0; nLine < nNumLines; nLine++)
-          {
-            if (!std::getline(s, sLine))
-            {
-              if (nLine == 0 && s.eof())
-                return traits_type::eof();
-              return m_fb.Error(E_IO_UTILS_READJOB) << ": No more jobs?";
-            }
-            sData += (nLine ? "\n" : "") + sLine;
-          }
+          if (int_type nRet = ReadLines(s, sData, nNumLines))
+            return nRet;
         }
         break;
       default:
         return m_fb.Error(E_IO_UTILS_READJOB) << ": Unknown message mode: " << m_mode << ".";
   }
-  m_fb.Info(4) << "Read message in " << ModeToString() << " mode: " << sData << ".";
+  if (Feedback::InfoEnabled(4))
+    m_fb.Info(4) << "Read message in " << ModeToString() << " mode: " << sData << ".";
   return 0;
 }
 
 
 /********************************************************************
- *   Increment a sequence interpreted as an unsigned number of
- *   any size.  The elements in the sequence MUST be unsigned for
- *   this algorithm to work (but I'm not quite sure how to
- *   enforce that, while still keeping the algorithm as a
- *   template.  A run-time test such as "assert(*itEnd >= 0)"
- *   gives a warning, saying that this test will always be true
- *   for unsigned numbers).
+ *   Choose the EOF tag for a message in eof mode.  The reader ends
+ *   the message at the first "\n<tag>\n" after the data starts, so
+ *   the tag must not be a whole line of the data, except the first
+ *   line, nor its unterminated last line.  "EOF" is used if
+ *   possible, otherwise "EOF-<n>" with the smallest n that is free.
+ *   With k lines after the first, at most k such tags are taken, so
+ *   only n < k + 1 need be tracked, and a single pass over the
+ *   lines finds them.
  *******************************************************************/
-template<class T>
-void
-JobReaderWriter::IncSequence(T itBegin, T itEnd) const
+std::string
+JobReaderWriter::ChooseEOFTag(const char *pData, size_t nCount) const
+{
+  const char *pEnd = pData + nCount;
+  bool bPlainTaken = false;
+  std::vector<size_t> taken;
+  for (const char *p = static_cast<const char*>(memchr(pData, '\n', nCount)); p; )
+  {
+    const char *pLine = p + 1;
+    p = static_cast<const char*>(memchr(pLine, '\n', pEnd - pLine));
+    const size_t nLen = (p ? p : pEnd) - pLine;
+    if (nLen < 3 || memcmp(pLine, "EOF", 3) != 0)
+      continue;
+    if (nLen == 3)
+      bPlainTaken = true;
+    else if (nLen > 4 && nLen <= 13 && pLine[3] == '-')
+    {
+      size_t nNum = 0, nPos = 4;
+      for (; nPos < nLen && pLine[nPos] >= '0' && pLine[nPos] <= '9'; nPos++)
+        nNum = nNum * 10 + (pLine[nPos] - '0');
+      if (nPos == nLen)
+        taken.push_back(nNum);
+    }
+  }
+  if (!bPlainTaken)
+    return "EOF";
+
+  std::vector<bool> bits(taken.size() + 1);
+  for (size_t nIdx = 0; nIdx < taken.size(); nIdx++)
+    if (taken[nIdx] < bits.size())
+      bits[taken[nIdx]] = true;
+  std::stringstream ssEOF;
+  ssEOF << "EOF-" << std::find(bits.begin(), bits.end(), false) - bits.begin();
+  return ssEOF.str();
+}
+
+
+/********************************************************************
+ *   Value of a tag made by repeating the nPeriod bytes at pTag, if
+ *   its leading nTagLen - nValueLen bytes are zero.  Otherwise, the
+ *   tag is not among the candidates, and false is returned.
+ *******************************************************************/
+static bool
+CandidateValue(const unsigned char *pTag, size_t nPeriod, size_t nTagLen, size_t nValueLen, size_t &nValue)
 {
-  if (itEnd == itBegin)
-    return;
-  itEnd--;
-  ++(*itEnd);
-  if (*itEnd == 0)
-    IncSequence(itBegin, itEnd);
+  nValue = 0;
+  for (size_t nByte = 0; nByte < nTagLen; nByte++)
+  {
+    if (nByte < nTagLen - nValueLen)
+    {
+      if (pTag[nByte % nPeriod])
+        return false;
+    }
+    else
+      nValue = (nValue << 8) | pTag[nByte % nPeriod];
+  }
+  return true;
+}
+
+
+/********************************************************************
+ *   Choose the tag for a message in bin_eof mode: The smallest tag,
+ *   taken as a big-endian number, that the reader will not find
+ *   before the end of the data.  The tag must not occur in the
+ *   data, and the data must not end with the first k bytes of a tag
+ *   that repeats with period k, for then the reader finds the tag
+ *   in the data and the trailing tag.  The latter rules out at most
+ *   one tag for each k < nTagLen.  With nWindows = nCount - nTagLen
+ *   + 1 places for a tag to occur, one of the values 0 .. nWindows +
+ *   nTagLen - 1 is free.  One pass over the data marks those of
+ *   these values that occur, which are the windows whose leading
+ *   bytes are zero, and whose trailing nValueLen bytes are small
+ *   enough.  The time is linear in the size of the data, and the
+ *   tag is the same as the first free one in a search from zero.
+ *   Returns non-zero if the tag is too short for any value to be
+ *   free.
+ *******************************************************************/
+int
+JobReaderWriter::ChooseBinTag(const char *pData, size_t nCount, std::vector<unsigned char> &tag) const
+{
+  const size_t nTagLen = tag.size();
+  const size_t nWindows = nCount >= nTagLen ? nCount - nTagLen + 1 : 0;
+  const unsigned char *pBytes = reinterpret_cast<const unsigned char*>(pData);
+  size_t nCandidates = nWindows + nTagLen;
+  if (nTagLen < sizeof(size_t))
+    nCandidates = std::min(nCandidates, static_cast<size_t>(1) << (8 * nTagLen));
+      // Values with a leading zero byte can only occur in windows
+      // starting with a zero byte.  If these are few, only that many
+      // candidates are needed, which keeps the bit set small.
+  if (nTagLen > 1 && nTagLen - 1 < sizeof(size_t))
+  {
+    const size_t nZeros = std::count(pBytes, pBytes + nWindows, 0);
+    if (nZeros + nTagLen <= static_cast<size_t>(1) << (8 * (nTagLen - 1)))
+      nCandidates = std::min(nCandidates, nZeros + nTagLen);
+  }
+  size_t nValueLen = 0;
+  for (size_t nMax = nCandidates - 1; nMax; nMax >>= 8)
+    nValueLen++;
+
+  std::vector<bool> bits(nCandidates);
+  size_t nValue;
+  for (size_t nStart = 0; nStart < nWindows; nStart++)
+  {
+        // Candidates with leading zero bytes can only occur where
+        // the data has a zero byte.
+    if (nValueLen < nTagLen)
+    {
+      const void *p = memchr(pBytes + nStart, 0, nWindows - nStart);
+      if (!p)
+        break;
+      nStart = static_cast<const unsigned char*>(p) - pBytes;
+    }
+    if (CandidateValue(pBytes + nStart, nTagLen, nTagLen, nValueLen, nValue) && nValue < nCandidates)
+      bits[nValue] = true;
+  }
+
+  for (size_t nPeriod = 1; nPeriod < nTagLen && nPeriod <= nCount; nPeriod++)
+  {
+    if (CandidateValue(pBytes + nCount - nPeriod, nPeriod, nTagLen, nValueLen, nValue) && nValue < nCandidates)
+      bits[nValue] = true;
+  }
+
+  const size_t nFree = std::find(bits.begin(), bits.end(), false) - bits.begin();
+  if (nFree == nCandidates)
+    return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": Failed to find a " << nTagLen
+                                           << " byte delimiter not already present in job data! Data was: "
+                                           << std::string(pData, nCount);
+  std::fill(tag.begin(), tag.end(), 0);
+  for (size_t nByte = 0; nByte < nValueLen; nByte++)
+    tag[nTagLen - 1 - nByte] = static_cast<unsigned char>(nFree >> (8 * nByte));
+  return 0;
+}
+
+
+/********************************************************************
+ *   Write a message as a single gathered write where the stream
+ *   supports it, so that the header, the data and the trailer are
+ *   neither concatenated in memory nor sent in separate system
+ *   calls.  Other streams get one write per part.
+ *******************************************************************/
+JobReaderWriter::int_type
+JobReaderWriter::WriteParts(std::ostream &s, const char *pHead, size_t nHead, 
+                            const char *pData, size_t nData, const char *pTail, size_t nTail) const
+{
+  if (Feedback::InfoEnabled(4))
+    m_fb.Info(4) << "Writing job data: " << std::string(pHead, nHead) 
+                 << std::string(pData, nData) << std::string(pTail, nTail);
+
+  custiobufbase *pBuf = dynamic_cast<custiobufbase*>(s.rdbuf());
+  if (pBuf && s.good())
+  {
+    struct iovec iov[3];
+    int nIov = 0;
+    const char *parts[3] = { pHead, pData, pTail };
+    const size_t sizes[3] = { nHead, nData, nTail };
+    for (int nPart = 0; nPart < 3; nPart++)
+      if (sizes[nPart] > 0)
+      {
+        iov[nIov].iov_base = const_cast<char*>(parts[nPart]);
+        iov[nIov].iov_len = sizes[nPart];
+        nIov++;
+      }
+    if (pBuf->write_gathered(iov, nIov) != static_cast<ssize_t>(nHead + nData + nTail))
+      s.setstate(std::ios::badbit);
+  }
+  else
+  {
+    s.write(pHead, nHead);
+    s.write(pData, nData);
+    s.write(pTail, nTail);
+  }
+  s.flush();
+  
+  if (!s.good())
+    return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": Output stream failure.";
+
+  return 0;
 }
 
 
 JobReaderWriter::int_type
 JobReaderWriter::Write(std::ostream &s, const std::string &sData) const
 {
-  std::string sMessage;
+  return Write(s, sData.data(), sData.size());
+}
+
+
+JobReaderWriter::int_type
+JobReaderWriter::Write(std::ostream &s, const char *pData, size_t nCount) const
+{
   switch(m_mode)
   {
       case none:
         return m_fb.Error(E_INTERNAL_LOGIC) << ": Writing mode has not been set.";
       case eof:
         {
-          std::stringstream ssEOF;
-          ssEOF << "EOF";
-          while (sData.find(ssEOF.str()) != std::string::npos)
-            ssEOF << "-" << rand();
-          sMessage = ssEOF.str() + "\n" + sData + "\n" + ssEOF.str() + "\n";
+          const std::string sHead = ChooseEOFTag(pData, nCount) + "\n", sTail = "\n" + sHead;
+          return WriteParts(s, sHead.data(), sHead.size(), pData, nCount, sTail.data(), sTail.size());
         }
-        break;
       case simple:
-        sMessage = sData + "\n";
-        break;
+        return WriteParts(s, 0, 0, pData, nCount, "\n", 1);
+      case file:
+        return WriteFile(s, pData, nCount);
       case bytecount:
         {
-          uint32_t nBytes = sData.size();
-          std::stringstream ssBytes;
-          ssBytes.write(reinterpret_cast<char*>(&nBytes), sizeof(nBytes));
-          sMessage = ssBytes.str() + sData;
+          if (nCount > std::numeric_limits<uint32_t>::max())
+            return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": " << nCount << " bytes is too large a message for BYTES mode, "
+                                                   << "use BYTES64 or CHUNKED.";
+          uint32_t nBytes = nCount;
+          return WriteParts(s, reinterpret_cast<const char*>(&nBytes), sizeof(nBytes), pData, nCount, 0, 0);
         }
-        break;
+      case bytecount64:
+        {
+          uint64_t nBytes = nCount;
+          return WriteParts(s, reinterpret_cast<const char*>(&nBytes), sizeof(nBytes), pData, nCount, 0, 0);
+        }
+      case chunked:
+        if (nCount > 0)
+        {
+          if (int_type nRet = WriteChunk(s, pData, nCount))
+            return nRet;
+        }
+        return WriteChunk(s, 0, 0);
       case bin_eof:
         {
-          int nTagLen = m_nModeArguments;
-          std::vector<unsigned char> tag(nTagLen), tagOrig = tag;
-          std::string::const_iterator mit;
-          while ((mit = MatchDelim(sData.begin(), sData.end(), tag.begin(), tag.end()))
-                 != sData.end() && std::distance(mit, sData.end()) >= static_cast<int>(tag.size()))
-          {
-            IncSequence(tag.begin(), tag.end());
-            if (tag == tagOrig)
-              return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": Failed to find a " << nTagLen 
-                                                     << " byte delimiter not already present in job data! Data was: " << sData;
-          }
-          std::string sTag;
-          sTag.resize(tag.size());
-          std::copy(tag.begin(), tag.end(), sTag.begin());
-          sMessage = sTag + sData + sTag;
+          std::vector<unsigned char> tag(m_nModeArguments);
+          if (int nRet = ChooseBinTag(pData, nCount, tag))
+            return nRet;
+          const char *pTag = reinterpret_cast<const char*>(&tag[0]);
+          return WriteParts(s, pTag, tag.size(), pData, nCount, pTag, tag.size());
         }
-        break;
       default:
         return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": Unknown input mode: " << m_mode << ".";
   }
-
-  m_fb.Info(4) << "Writing job data: " << sMessage;
-  s.write(sMessage.c_str(), sMessage.size());
-  s.flush();
-  
-  if (!s.good())
-    return m_fb.Error(E_IO_UTILS_WRITEJOB) << ": Output stream failure.";
-
-  return 0;
 }
 
 
+/********************************************************************
+ *   In the bytecount modes, the data is read straight into the
+ *   returned buffer.  Other modes read via a string.  The caller must
+ *   delete[] *ppData.
+ *******************************************************************/
 JobReaderWriter::int_type
 JobReaderWriter::Read(std::istream &s, char **ppData, size_t &nCount) const
 {
+  if (m_mode == bytecount || m_mode == bytecount64)
+  {
+    uint64_t nBytes;
+    if (int_type nRet = ReadByteCount(s, nBytes))
+      return nRet;
+    char *pData = new char[nBytes];
+    s.read(pData, nBytes);
+    if (s.gcount() != static_cast<std::streamsize>(nBytes))
+    {
+      delete[] pData;
+      return m_fb.Error(E_IO_UTILS_READJOB) << ": Failed to read " << nBytes << " bytes of job data.";
+    }
+    *ppData = pData;
+    nCount = nBytes;
+    return 0;
+  }
+
   std::string sData;
   if (int nRet = Read(s, sData))
     return nRet;
@@ -393,25 +896,74 @@ JobReaderWriter::Read(std::istream &s, char **ppData, size_t &nCount) const
 }
 
 
-JobReaderWriter::int_type
-JobReaderWriter::Write(std::ostream &s, const char *pData, size_t nCount) const
+/********************************************************************
+ *   CRC-32 (as in zlib).
+ *******************************************************************/
+uint32_t
+Crc32(const char *pData, size_t nCount, uint32_t nCrc /*=0*/)
 {
-  std::string sData;
-  sData.resize(nCount);
-  std::copy(pData, pData + nCount, sData.begin());
-  return Write(s, sData);
+  struct TCrcTable
+  {
+    uint32_t entries[256];
+    TCrcTable()
+    {
+      for (uint32_t n = 0; n < 256; n++)
+      {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+          c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        entries[n] = c;
+      }
+    }
+  };
+  static const TCrcTable table;
+
+  nCrc = ~nCrc;
+  for (size_t n = 0; n < nCount; n++)
+    nCrc = table.entries[(nCrc ^ static_cast<unsigned char>(pData[n])) & 0xff] ^ (nCrc >> 8);
+  return ~nCrc;
+}
+
+
+
+void *checkpoint_thread_func(void *pArg)
+{
+  Checkpointer *pCheck = static_cast<Checkpointer*>(pArg);
+  pCheck->m_fb.RegisterThreadDescription("Checkpoint");
+  sigset_t sigSet;
+  sigfillset(&sigSet);
+  pthread_sigmask(SIG_BLOCK, &sigSet, 0);
+  const char *pData = pCheck->m_snapshot.empty() ? "" : &pCheck->m_snapshot[0];
+  pCheck->m_nAsyncRet = (pCheck->m_bAsyncDelta 
+                         ? pCheck->StoreDeltaInt(pData, pCheck->m_snapshot.size())
+                         : pCheck->StoreFull(pData, pCheck->m_snapshot.size(), false));
+  return 0;
 }
 
 
 
 Checkpointer::Checkpointer()
     : m_fb("Checkpointer")
+    , m_nChunkSize(default_chunk_size)
+    , m_nBaseCrc(0)
+    , m_nStoredSize(0)
+    , m_nDeltaSize(0)
+    , m_bAsyncDelta(false)
+    , m_bAsyncRunning(false)
+    , m_nAsyncRet(0)
 {
 }
 
 
 Checkpointer::Checkpointer(const string sFilename)
     : m_fb("Checkpointer")
+    , m_nChunkSize(default_chunk_size)
+    , m_nBaseCrc(0)
+    , m_nStoredSize(0)
+    , m_nDeltaSize(0)
+    , m_bAsyncDelta(false)
+    , m_bAsyncRunning(false)
+    , m_nAsyncRet(0)
 {
   SetFilename(sFilename);
 }
@@ -419,13 +971,16 @@ Checkpointer::Checkpointer(const string sFilename)
 
 Checkpointer::~Checkpointer()
 {
+  WaitStore();
 }
 
 
 void
 Checkpointer::SetFilename(const string &sFilename)
 {
+  WaitStore();
   m_sFilename = sFilename;
+  m_chunkCrcs.clear();
 }
 
 
@@ -436,11 +991,34 @@ Checkpointer::GetFilename() const
 }
 
 
+void
+Checkpointer::SetChunkSize(size_t nChunkSize)
+{
+  WaitStore();
+  m_nChunkSize = std::max(nChunkSize, static_cast<size_t>(1));
+  m_chunkCrcs.clear();
+}
+
+
+std::string
+Checkpointer::DeltaFilename() const
+{
+  return m_sFilename + ".delta";
+}
+
+
+/********************************************************************
+ *   Write to a temporary file, flush it to disk and rename it to the
+ *   checkpoint, which replaces any deltas stored earlier.  With
+ *   bDeltaBase, record the checksums of the chunks, for StoreDelta to
+ *   compare against.
+ *******************************************************************/
 int
-Checkpointer::Store(const char *pData, size_t nCount) const
+Checkpointer::StoreFull(const char *pData, size_t nCount, bool bDeltaBase) const
 {
   if (m_sFilename.empty())
     return m_fb.Error(E_INTERNAL_LOGIC) << ": No checkpoint filename given.";
+  m_chunkCrcs.clear();
 
   vector<char> sTempName(m_sFilename.size() + 8, 'X');
   copy(m_sFilename.begin(), m_sFilename.end(), sTempName.begin());
@@ -450,58 +1028,323 @@ Checkpointer::Store(const char *pData, size_t nCount) const
   if (nFd == -1)
     return m_fb.Error(E_CHECKPOINT_TEMP) << ". Template was " << &(sTempName[0]);
 
-  ssize_t nWritten = write(nFd, pData, nCount);
-  if (nWritten != static_cast<ssize_t>(nCount))
-    return m_fb.Error(E_CHECKPOINT_WRITE) << ". Tried to write " << nCount 
-                                          << " chars, only " << nWritten
-                                          << " written.";
+  for (size_t nPos = 0; nPos < nCount; )
+  {
+    ssize_t nWritten = write(nFd, pData + nPos, nCount - nPos);
+    if (nWritten < 0 && errno == EINTR)
+      continue;
+    if (nWritten <= 0)
+    {
+      close(nFd);
+      unlink(&(sTempName[0]));
+      return m_fb.Error(E_CHECKPOINT_WRITE) << ". Tried to write " << nCount 
+                                            << " chars, only " << nPos
+                                            << " written.";
+    }
+    nPos += nWritten;
+  }
+  if (fsync(nFd) || close(nFd))
+  {
+    unlink(&(sTempName[0]));
+    return m_fb.Error(E_CHECKPOINT_WRITE) << ": " << strerror(errno) << ".";
+  }
 
   if (rename(&(sTempName[0]), m_sFilename.c_str()))
     return m_fb.Error(E_CHECKPOINT_RENAME) << ". Temporary name: " << &(sTempName[0])
                                            << ", checkpoint name: " << m_sFilename;
+  if (unlink(DeltaFilename().c_str()) && errno != ENOENT)
+    return m_fb.Error(E_CHECKPOINT_CLEAR) << ": Failed to remove old deltas in " << DeltaFilename() << ".";
 
+  if (bDeltaBase && nCount > 0)
+  {
+    const size_t nNumChunks = (nCount + m_nChunkSize - 1) / m_nChunkSize;
+    m_chunkCrcs.resize(nNumChunks);
+    for (size_t nChunk = 0; nChunk < nNumChunks; nChunk++)
+      m_chunkCrcs[nChunk] = Crc32(pData + nChunk * m_nChunkSize, std::min(m_nChunkSize, nCount - nChunk * m_nChunkSize));
+    m_nBaseCrc = Crc32(reinterpret_cast<const char*>(&m_chunkCrcs[0]), nNumChunks * sizeof(uint32_t));
+    m_nStoredSize = nCount;
+    m_nDeltaSize = 0;
+  }
   return 0;
 }
 
 
 int
-Checkpointer::Load(char **ppData, size_t *pnCount) const
+Checkpointer::Store(const char *pData, size_t nCount) const
 {
-  if (m_sFilename.empty())
-    return m_fb.Error(E_INTERNAL_LOGIC) << ": No checkpoint filename given.";
+  WaitStore();
+  return StoreFull(pData, nCount, false);
+}
 
-  *pnCount = 0;
-  ifstream f(m_sFilename.c_str());
-  if (!f)
+
+int
+Checkpointer::StoreDelta(const char *pData, size_t nCount)
+{
+  WaitStore();
+  return StoreDeltaInt(pData, nCount);
+}
+
+
+/********************************************************************
+ *   Append the chunks which differ from the last store to the delta
+ *   file, in one write, and flush it to disk.  If the write fails,
+ *   Load will ignore this and any later deltas, so the next store is
+ *   a full one.
+ *******************************************************************/
+int
+Checkpointer::StoreDeltaInt(const char *pData, size_t nCount)
+{
+  const size_t nNumChunks = (nCount + m_nChunkSize - 1) / m_nChunkSize;
+  if (m_chunkCrcs.empty() || nCount != m_nStoredSize)
+    return StoreFull(pData, nCount, true);
+
+  std::vector<uint32_t> chunkCrcs(nNumChunks);
+  std::vector<size_t> changed;
+  uint64_t nDeltaSize = sizeof(TDeltaHeader) + sizeof(uint32_t);
+  for (size_t nChunk = 0; nChunk < nNumChunks; nChunk++)
+  {
+    const size_t nSize = std::min(m_nChunkSize, nCount - nChunk * m_nChunkSize);
+    chunkCrcs[nChunk] = Crc32(pData + nChunk * m_nChunkSize, nSize);
+    if (chunkCrcs[nChunk] != m_chunkCrcs[nChunk])
+    {
+      changed.push_back(nChunk);
+      nDeltaSize += sizeof(uint64_t) + nSize;
+    }
+  }
+  if (changed.empty())
+    return 0;
+  if (m_nDeltaSize + nDeltaSize > nCount / 2)
+    return StoreFull(pData, nCount, true);
+
+  TDeltaHeader header;
+  header.nMagic = delta_magic;
+  header.nBaseCrc = m_nBaseCrc;
+  header.nChunkSize = m_nChunkSize;
+  header.nNumChunks = changed.size();
+  header.nSize = nCount;
+  std::string sDelta;
+  sDelta.reserve(nDeltaSize);
+  sDelta.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (size_t nChanged = 0; nChanged < changed.size(); nChanged++)
   {
-    m_fb.Info(1, "Unable to open checkpoint file.");
+    const size_t nChunk = changed[nChanged];
+    const uint64_t nIndex = nChunk;
+    sDelta.append(reinterpret_cast<const char*>(&nIndex), sizeof(nIndex));
+    sDelta.append(pData + nChunk * m_nChunkSize, std::min(m_nChunkSize, nCount - nChunk * m_nChunkSize));
+  }
+  const uint32_t nCrc = Crc32(sDelta.data(), sDelta.size());
+  sDelta.append(reinterpret_cast<const char*>(&nCrc), sizeof(nCrc));
+
+  int nFd = open(DeltaFilename().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (nFd < 0)
+  {
+    m_chunkCrcs.clear();
+    return m_fb.Error(E_CHECKPOINT_DELTA) << " " << DeltaFilename() << ": " << strerror(errno) << ".";
+  }
+  for (size_t nPos = 0; nPos < sDelta.size(); )
+  {
+    ssize_t nWritten = write(nFd, sDelta.data() + nPos, sDelta.size() - nPos);
+    if (nWritten < 0 && errno == EINTR)
+      continue;
+    if (nWritten <= 0)
+    {
+      close(nFd);
+      m_chunkCrcs.clear();
+      return m_fb.Error(E_CHECKPOINT_DELTA) << " " << DeltaFilename() << ": " << strerror(errno) << ".";
+    }
+    nPos += nWritten;
+  }
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+  if (fdatasync(nFd) || close(nFd))
+#else
+  if (fsync(nFd) || close(nFd))
+#endif
+  {
+    m_chunkCrcs.clear();
+    return m_fb.Error(E_CHECKPOINT_DELTA) << " " << DeltaFilename() << ": " << strerror(errno) << ".";
+  }
+
+  m_chunkCrcs.swap(chunkCrcs);
+  m_nDeltaSize += sDelta.size();
+  m_fb.Info(3) << "Stored " << changed.size() << " of " << nNumChunks << " chunks to " << DeltaFilename() << ".";
+  return 0;
+}
+
+
+/********************************************************************
+ *   The snapshot keeps its memory between stores, so that copying
+ *   the data costs no allocation after the first time.
+ *******************************************************************/
+int
+Checkpointer::StoreAsync(const char *pData, size_t nCount, bool bDelta /*=true*/)
+{
+  int nRet = WaitStore();
+  m_snapshot.assign(pData, pData + nCount);
+  m_bAsyncDelta = bDelta;
+  if (pthread_create(&m_asyncThread, 0, checkpoint_thread_func, this))
+    return m_fb.Error(E_CHECKPOINT_WRITE) << ": Failed to start background store.";
+  m_bAsyncRunning = true;
+  return nRet;
+}
+
+
+int
+Checkpointer::WaitStore() const
+{
+  if (!m_bAsyncRunning)
+    return 0;
+  pthread_join(m_asyncThread, 0);
+  m_bAsyncRunning = false;
+  const int nRet = m_nAsyncRet;
+  m_nAsyncRet = 0;
+  return nRet;
+}
+
+
+/********************************************************************
+ *   Map a file into memory, read-only.  Returns 1 without an error
+ *   message if the file doesn't exist.
+ *******************************************************************/
+static int
+MapFile(const Feedback &fb, const std::string &sFilename, void **ppMap, size_t *pnSize)
+{
+  int nFd = open(sFilename.c_str(), O_RDONLY);
+  if (nFd < 0 && errno == ENOENT)
     return 1;
+  if (nFd < 0)
+    return fb.Error(E_CHECKPOINT_READ) << " " << sFilename << ": " << strerror(errno) << ".";
+  struct stat st;
+  if (fstat(nFd, &st))
+  {
+    close(nFd);
+    return fb.Error(E_CHECKPOINT_READ) << " " << sFilename << ": " << strerror(errno) << ".";
+  }
+  *pnSize = st.st_size;
+  *ppMap = 0;
+  if (*pnSize > 0)
+  {
+    *ppMap = mmap(0, *pnSize, PROT_READ, MAP_PRIVATE, nFd, 0);
+    if (*ppMap == MAP_FAILED)
+    {
+      close(nFd);
+      return fb.Error(E_CHECKPOINT_READ) << ": Failed to map " << sFilename << ": " << strerror(errno) << ".";
+    }
+    madvise(*ppMap, *pnSize, MADV_SEQUENTIAL);
   }
+  close(nFd);
+  return 0;
+}
+
 
-  const streamsize block_size = 1024*10;
-  char *pData = 0;
-  streamsize nAlloced = 0, nRead = 0;
-  while (f.good())
+/********************************************************************
+ *   Apply the deltas which were stored on top of the checkpoint in
+ *   pData.  Deltas are read up to the first incomplete or corrupt
+ *   one, which is where a store was cut off.
+ *******************************************************************/
+int
+Checkpointer::ApplyDeltas(char *pData, size_t nCount) const
+{
+  void *pMap;
+  size_t nSize;
+  if (int nRet = MapFile(m_fb, DeltaFilename(), &pMap, &nSize))
+    return nRet == 1 ? 0 : nRet;
+
+  const char *pDelta = static_cast<const char*>(pMap);
+  size_t nBaseChunkSize = 0;
+  uint32_t nBaseCrc = 0;
+  size_t nPos = 0;
+  int nNumApplied = 0;
+  while (nSize - nPos >= sizeof(TDeltaHeader) + sizeof(uint32_t))
   {
-    if (nRead == nAlloced)
+    TDeltaHeader header;
+    memcpy(&header, pDelta + nPos, sizeof(header));
+    if (header.nMagic != delta_magic || header.nSize != nCount || header.nChunkSize == 0)
+      break;
+    if (header.nChunkSize != nBaseChunkSize)
+    {
+      nBaseChunkSize = static_cast<size_t>(header.nChunkSize);
+      std::vector<uint32_t> chunkCrcs((nCount + nBaseChunkSize - 1) / nBaseChunkSize);
+      for (size_t nChunk = 0; nChunk < chunkCrcs.size(); nChunk++)
+        chunkCrcs[nChunk] = Crc32(pData + nChunk * nBaseChunkSize, std::min(nBaseChunkSize, nCount - nChunk * nBaseChunkSize));
+      nBaseCrc = Crc32(reinterpret_cast<const char*>(&chunkCrcs[0]), chunkCrcs.size() * sizeof(uint32_t));
+    }
+    if (header.nBaseCrc != nBaseCrc)
+    {
+      m_fb.Info(1) << "Ignoring deltas in " << DeltaFilename() << " which were stored on top of another checkpoint.";
+      break;
+    }
+        // Find the end of the delta, and check it before applying.
+    const size_t nNumChunks = (nCount + nBaseChunkSize - 1) / nBaseChunkSize;
+    size_t nEnd = nPos + sizeof(header);
+    bool bComplete = true;
+    for (uint64_t nChanged = 0; bComplete && nChanged < header.nNumChunks; nChanged++)
+    {
+      uint64_t nChunk = 0;
+      bComplete = (nSize - nEnd >= sizeof(nChunk));
+      if (bComplete)
+      {
+        memcpy(&nChunk, pDelta + nEnd, sizeof(nChunk));
+        bComplete = nChunk < nNumChunks;
+      }
+      const size_t nChunkSize = bComplete ? std::min(nBaseChunkSize, nCount - static_cast<size_t>(nChunk) * nBaseChunkSize) : 0;
+      bComplete = bComplete && nSize - nEnd - sizeof(nChunk) >= nChunkSize;
+      nEnd += sizeof(nChunk) + nChunkSize;
+    }
+    uint32_t nCrc;
+    if (!bComplete || nSize - nEnd < sizeof(nCrc))
+      break;
+    memcpy(&nCrc, pDelta + nEnd, sizeof(nCrc));
+    if (nCrc != Crc32(pDelta + nPos, nEnd - nPos))
+      break;
+
+    for (size_t nChunkPos = nPos + sizeof(header); nChunkPos < nEnd; )
     {
-      nAlloced += block_size;
-      pData = static_cast<char*>(realloc(pData, nAlloced));
-      if (!pData)
-        return m_fb.Error(E_CHECKPOINT_READ) << " Unable to allocate more memory (asked for " 
-                                             << nAlloced << " bytes).";
+      uint64_t nChunk;
+      memcpy(&nChunk, pDelta + nChunkPos, sizeof(nChunk));
+      const size_t nChunkSize = std::min(nBaseChunkSize, nCount - static_cast<size_t>(nChunk) * nBaseChunkSize);
+      memcpy(pData + static_cast<size_t>(nChunk) * nBaseChunkSize, pDelta + nChunkPos + sizeof(nChunk), nChunkSize);
+      nChunkPos += sizeof(nChunk) + nChunkSize;
     }
-    f.read(pData + nRead, nAlloced - nRead);
-    nRead += f.gcount();
+    nPos = nEnd + sizeof(nCrc);
+    nNumApplied++;
   }
+  if (nPos < nSize)
+    m_fb.Warning() << "Ignoring " << nSize - nPos << " bytes of incomplete or corrupt deltas at the end of " << DeltaFilename() << ".";
+  m_fb.Info(2) << "Applied " << nNumApplied << " deltas from " << DeltaFilename() << ".";
+  munmap(pMap, nSize);
+  return 0;
+}
+
 
-  if (nRead <= 0)
+int
+Checkpointer::Load(char **ppData, size_t *pnCount) const
+{
+  WaitStore();
+  if (m_sFilename.empty())
+    return m_fb.Error(E_INTERNAL_LOGIC) << ": No checkpoint filename given.";
+
+  *pnCount = 0;
+  void *pMap;
+  size_t nSize;
+  if (int nRet = MapFile(m_fb, m_sFilename, &pMap, &nSize))
+  {
+    if (nRet == 1)
+      m_fb.Info(1, "Unable to open checkpoint file.");
+    return nRet;
+  }
+  if (nSize == 0)
     return m_fb.Error(E_CHECKPOINT_READ) << " Checkpoint file exists, but no data could be read" ;
 
-  *ppData = new char[nRead];
-  memcpy(*ppData, pData, nRead);
-  free(pData);
-  *pnCount = nRead;
+  char *pData = new char[nSize];
+  memcpy(pData, pMap, nSize);
+  munmap(pMap, nSize);
+  if (int nRet = ApplyDeltas(pData, nSize))
+  {
+    delete[] pData;
+    return nRet;
+  }
+  *ppData = pData;
+  *pnCount = nSize;
   return 0;
 }
 
@@ -516,25 +1359,331 @@ Checkpointer::Store(const std::string &sData) const
 int
 Checkpointer::Load(std::string &sData) const
 {
-  char *pBuf = 0;
-  size_t nCount;
-  if (int nRet = Load(&pBuf, &nCount))
+  WaitStore();
+  if (m_sFilename.empty())
+    return m_fb.Error(E_INTERNAL_LOGIC) << ": No checkpoint filename given.";
+
+  void *pMap;
+  size_t nSize;
+  if (int nRet = MapFile(m_fb, m_sFilename, &pMap, &nSize))
+  {
+    if (nRet == 1)
+      m_fb.Info(1, "Unable to open checkpoint file.");
     return nRet;
+  }
+  if (nSize == 0)
+    return m_fb.Error(E_CHECKPOINT_READ) << " Checkpoint file exists, but no data could be read" ;
 
-  sData.resize(nCount);
-  copy(pBuf, pBuf + nCount, sData.begin());
-  return 0;
+  sData.assign(static_cast<const char*>(pMap), nSize);
+  munmap(pMap, nSize);
+  return ApplyDeltas(&sData[0], nSize);
 }
 
 
 int
 Checkpointer::Clear() const
 {
+  WaitStore();
+  m_chunkCrcs.clear();
   if (!m_sFilename.empty())
   {
     int nRet = unlink(m_sFilename.c_str());
     if (nRet == -1 && errno != ENOENT)
       return m_fb.Error(E_CHECKPOINT_CLEAR);
+    nRet = unlink(DeltaFilename().c_str());
+    if (nRet == -1 && errno != ENOENT)
+      return m_fb.Error(E_CHECKPOINT_CLEAR);
   }
   return 0; 
 }
+
+
+
+ResultJournal::ResultJournal()
+    : m_fb("ResultJournal")
+    , m_mtx("ResultJournal-mutex")
+    , m_nFd(-1)
+    , m_nSyncBatch(0)
+    , m_nUnsynced(0)
+    , m_bFailed(false)
+{
+}
+
+
+ResultJournal::~ResultJournal()
+{
+  Close();
+}
+
+
+/********************************************************************
+ *   Read exactly nCount bytes at nOffset.  Returns nonzero on error
+ *   or end of file.
+ *******************************************************************/
+static int
+ReadAt(int nFd, char *pData, size_t nCount, off_t nOffset)
+{
+  while (nCount > 0)
+  {
+    ssize_t nRead = pread(nFd, pData, nCount, nOffset);
+    if (nRead < 0 && errno == EINTR)
+      continue;
+    if (nRead <= 0)
+      return 1;
+    pData += nRead;
+    nCount -= nRead;
+    nOffset += nRead;
+  }
+  return 0;
+}
+
+
+int
+ResultJournal::Open(const std::string &sFilename, int nSyncBatch)
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_MUTEX_LOCK);
+  if (m_nFd >= 0)
+    return m_fb.Error(E_JOURNAL_OPEN) << ": The journal " << m_sFilename << " is already open.";
+
+  m_nFd = open(sFilename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (m_nFd < 0)
+    return m_fb.Error(E_JOURNAL_OPEN) << " " << sFilename << ": " << strerror(errno) << ".";
+  m_sFilename = sFilename;
+  m_nSyncBatch = nSyncBatch;
+  m_nUnsynced = 0;
+  m_bFailed = false;
+  if (int nRet = Replay())
+  {
+    close(m_nFd);
+    m_nFd = -1;
+    return nRet;
+  }
+  m_fb.Info(1) << "Replayed results of " << m_replayed.size() << " jobs from the result journal " << sFilename << ".";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Index the records in the file.  Reading stops at the first
+ *   record that is incomplete or fails its checksum, which is where
+ *   the last run was cut off, and the file is truncated there so
+ *   that new records follow the last good one.
+ *******************************************************************/
+int
+ResultJournal::Replay()
+{
+  struct stat st;
+  if (fstat(m_nFd, &st))
+    return m_fb.Error(E_JOURNAL_OPEN) << " " << m_sFilename << ": " << strerror(errno) << ".";
+
+  off_t nOffset = 0;
+  std::string sBody;
+  while (st.st_size - nOffset >= static_cast<off_t>(sizeof(TRecordHeader)))
+  {
+    TRecordHeader header;
+    const uint64_t nLeft = st.st_size - nOffset - sizeof(header);
+    if (ReadAt(m_nFd, reinterpret_cast<char*>(&header), sizeof(header), nOffset)
+        || header.nMagic != record_magic
+        || header.nJobSize > nLeft || header.nResultsSize > nLeft - header.nJobSize)
+      break;
+    sBody.resize(header.nJobSize + header.nResultsSize);
+    if (!sBody.empty() && ReadAt(m_nFd, &sBody[0], sBody.size(), nOffset + sizeof(header)))
+      break;
+    const char *pFields = reinterpret_cast<const char*>(&header.nHash);
+    uint32_t nCrc = Crc32(pFields, sizeof(header) - (pFields - reinterpret_cast<const char*>(&header)));
+    if (Crc32(sBody.data(), sBody.size(), nCrc) != header.nCrc)
+      break;
+        // Records are only appended once per job, but keep the first
+        // in case a file was concatenated from several runs.  A job
+        // whose key is taken by a different job is evaluated again.
+    m_replayed.insert(std::make_pair(TKey(header.nHash, header.nJobSize),
+                                     std::make_pair(nOffset + static_cast<off_t>(sizeof(header)), header.nResultsSize)));
+    nOffset += sizeof(header) + sBody.size();
+  }
+
+  if (nOffset < st.st_size)
+  {
+    m_fb.Warning() << "Discarding " << st.st_size - nOffset << " bytes of incomplete or corrupt records at offset " 
+                   << nOffset << " of the result journal " << m_sFilename << ".";
+    if (ftruncate(m_nFd, nOffset))
+      return m_fb.Error(E_JOURNAL_OPEN) << ": Failed to truncate " << m_sFilename << ": " << strerror(errno) << ".";
+  }
+  return 0;
+}
+
+
+int
+ResultJournal::Close()
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_MUTEX_LOCK);
+  if (m_nFd < 0)
+    return 0;
+  int nRet = SyncInt();
+  if (close(m_nFd) && !nRet)
+    nRet = m_fb.Error(E_JOURNAL_SYNC) << ": close failed: " << strerror(errno) << ".";
+  m_nFd = -1;
+  m_replayed.clear();
+  m_written.clear();
+  return nRet;
+}
+
+
+bool
+ResultJournal::IsOpen() const
+{
+  return m_nFd >= 0;
+}
+
+
+/********************************************************************
+ *   64 bit FNV-1a hash of the job data, paired with its size.  Only
+ *   used to find the record, which is then compared to the job.
+ *******************************************************************/
+/*static*/ ResultJournal::TKey
+ResultJournal::Key(const std::string &sJobData)
+{
+  uint64_t nHash = 14695981039346656037ULL;
+  for (std::string::const_iterator it = sJobData.begin(); it != sJobData.end(); it++)
+  {
+    nHash ^= static_cast<unsigned char>(*it);
+    nHash *= 1099511628211ULL;
+  }
+  return TKey(nHash, sJobData.size());
+}
+
+
+bool
+ResultJournal::Lookup(const std::string &sJobData, std::string &sResults)
+{
+  const TKey key = Key(sJobData);
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+  {
+    m_fb.Error(E_MUTEX_LOCK);
+    return false;
+  }
+  TIndex::const_iterator itRecord = m_replayed.find(key);
+  if (m_nFd < 0 || itRecord == m_replayed.end())
+    return false;
+  std::string sBody(sJobData.size() + itRecord->second.second, '\0');
+  if (!sBody.empty() && ReadAt(m_nFd, &sBody[0], sBody.size(), itRecord->second.first))
+  {
+    m_fb.Warning() << "Failed to read replayed results from the result journal " << m_sFilename << ".";
+    return false;
+  }
+  if (sBody.compare(0, sJobData.size(), sJobData) != 0)
+  {
+    m_fb.Info(2) << "A job in the result journal " << m_sFilename << " has the same hash as a new job.  "
+                 << "The new job is evaluated.";
+    return false;
+  }
+  sResults.assign(sBody, sJobData.size(), std::string::npos);
+  return true;
+}
+
+
+size_t
+ResultJournal::NumReplayed()
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return 0;
+  return m_replayed.size();
+}
+
+
+/********************************************************************
+ *   The record is built in memory and written with a single call,
+ *   so that a crash leaves at most one incomplete record at the end.
+ *   If the write fails, the file is truncated to where the record
+ *   began.
+ *******************************************************************/
+int
+ResultJournal::Append(const std::string &sJobData, const std::string &sResults)
+{
+  const TKey key = Key(sJobData);
+  TRecordHeader header;
+  header.nMagic = record_magic;
+  header.nHash = key.first;
+  header.nJobSize = key.second;
+  header.nResultsSize = sResults.size();
+  const char *pFields = reinterpret_cast<const char*>(&header.nHash);
+  uint32_t nCrc = Crc32(pFields, sizeof(header) - (pFields - reinterpret_cast<const char*>(&header)));
+  nCrc = Crc32(sJobData.data(), sJobData.size(), nCrc);
+  header.nCrc = Crc32(sResults.data(), sResults.size(), nCrc);
+
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_MUTEX_LOCK);
+  if (m_nFd < 0)
+    return m_fb.Error(E_JOURNAL_WRITE) << ": The journal is not open.";
+  if (m_bFailed)
+    return m_fb.Error(E_JOURNAL_WRITE) << ": The journal " << m_sFilename << " is disabled after an earlier error.";
+  if (m_replayed.count(key) || !m_written.insert(key).second)
+    return 0;
+
+  std::string sRecord(reinterpret_cast<const char*>(&header), sizeof(header));
+  sRecord.reserve(sizeof(header) + sJobData.size() + sResults.size());
+  sRecord += sJobData;
+  sRecord += sResults;
+      // The file is only appended to under the mutex, so this is
+      // where the record will begin.
+  const off_t nStart = lseek(m_nFd, 0, SEEK_END);
+  for (size_t nPos = 0; nPos < sRecord.size(); )
+  {
+    ssize_t nWritten = write(m_nFd, sRecord.data() + nPos, sRecord.size() - nPos);
+    if (nWritten < 0 && errno == EINTR)
+      continue;
+    if (nWritten <= 0)
+    {
+      const int nErrno = nWritten < 0 ? errno : ENOSPC;
+      m_written.erase(key);
+      if (nPos > 0 && (nStart < 0 || ftruncate(m_nFd, nStart)))
+      {
+        m_bFailed = true;
+        return m_fb.Error(E_JOURNAL_WRITE) << " " << m_sFilename << ": " << strerror(nErrno)
+                                          << ", and the partial record could not be removed.  "
+                                          << "No more results will be recorded.";
+      }
+      return m_fb.Error(E_JOURNAL_WRITE) << " " << m_sFilename << ": " << strerror(nErrno) << ".";
+    }
+    nPos += nWritten;
+  }
+
+  if (++m_nUnsynced >= m_nSyncBatch && m_nSyncBatch > 0)
+    return SyncInt();
+  return 0;
+}
+
+
+int
+ResultJournal::Sync()
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_MUTEX_LOCK);
+  return SyncInt();
+}
+
+
+/********************************************************************
+ *   Call with the mutex held.
+ *******************************************************************/
+int
+ResultJournal::SyncInt()
+{
+  if (m_nFd < 0 || m_nUnsynced == 0)
+    return 0;
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+  if (fdatasync(m_nFd))
+#else
+  if (fsync(m_nFd))
+#endif
+    return m_fb.Error(E_JOURNAL_SYNC) << " " << m_sFilename << ": " << strerror(errno) << ".";
+  m_nUnsynced = 0;
+  return 0;
+}
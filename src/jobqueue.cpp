@@ -30,11 +30,13 @@
 
 #include <simdist/options.h>
 
+#include <sstream>
 #include <cstring>
 #include <cassert>
 #include <cmath>
 #include <sys/errno.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 // FeedbackError E_JOBQUEUE_CLOSE("Failed to close the queue");
 DEFINE_FEEDBACK_ERROR(E_JOBQUEUE_CLOSE, "Failed to close the queue");
@@ -62,6 +64,45 @@ JobQueueElement::WorkersToString() const
 }
 
 
+JobStatistics::JobStatistics()
+  : nNumJobs(0)
+  , dServerTime(0)
+{
+}
+
+
+void
+JobStatistics::Add(double dTime, const TResourceUsage &jobUsage)
+{
+  nNumJobs++;
+  dServerTime += dTime;
+  usage.Add(jobUsage);
+}
+
+
+/********************************************************************
+ *   The CPU utilization is the CPU time divided by the server time.
+ *   Values well below 100% indicate that the slave program is
+ *   waiting for I/O, or that the slave servers are oversubscribed.
+ *******************************************************************/
+std::string
+JobStatistics::ToString() const
+{
+  std::stringstream ss;
+  const double dCPUTime = usage.dUserTime + usage.dSystemTime;
+  ss << nNumJobs << " job(s), " << dServerTime << " s server time, "
+     << usage.dUserTime << " s user, " << usage.dSystemTime << " s system";
+  if (dServerTime > 0)
+    ss << " (" << 100 * dCPUTime / dServerTime << "% CPU)";
+  ss << ", max RSS " << usage.nMaxRSS << " kB, "
+     << usage.nVoluntaryCtxSwitches << " voluntary and "
+     << usage.nInvoluntaryCtxSwitches << " involuntary context switches";
+  if (nNumJobs)
+    ss << ", " << dServerTime / nNumJobs << " s per job";
+  return ss.str();
+}
+
+
 JobQueue::JobQueue()
   : LockableObject("Jobqueue-mutex")
   , m_pSemaphore(new pthread_cond_t)
@@ -69,6 +110,11 @@ JobQueue::JobQueue()
   , m_fb("JobQueue")
   , m_nNumJobsPerSend(1)
   , m_bAutoNumJobsPerSend(false)
+  , m_fWaitFactor(100)
+  , m_nNumTimeouts(0)
+  , m_nResultNotifyFd(-1)
+  , m_depthGauge(Metrics::Instance().Gauge("simdist_queue_jobs", "Jobs in the job queue, including jobs being processed"))
+  , m_pJournal(0)
 {
       //!!- No error handling.  Problems will arise if
       //initialization fails.  Consider moving to separate class
@@ -86,7 +132,9 @@ JobQueue::JobQueue()
     else
       m_nNumJobsPerSend = static_cast<size_t>(nNumPerSend);
   }
-  
+  if (Options::Instance().Option("slave-wait-factor", m_fWaitFactor))
+    m_fb.Warning("Failed to get option slave-wait-factor, will default to ") 
+      << m_fWaitFactor;
 }
 
 
@@ -122,6 +170,107 @@ JobQueue::ResultSet() const
 }
 
 
+/********************************************************************
+ *   The number of jobs which have timed out on a slave server and
+ *   been put back in the queue, counted since the queue was created.
+ *
+ *   Call from within mutex lock.
+ *******************************************************************/
+int
+JobQueue::NumTimeouts() const
+{
+  return m_nNumTimeouts;
+}
+
+void
+JobQueue::AddTimeout()
+{
+  m_nNumTimeouts++;
+}
+
+
+/********************************************************************
+ *   Statistics for jobs completed by the slaves, one element per
+ *   generation (i.e. per call to Master::Evaluate).  Jobs which
+ *   complete before the first generation starts are counted in the
+ *   first.
+ *
+ *   Call from within mutex lock.
+ *******************************************************************/
+void
+JobQueue::NewGeneration()
+{
+  m_generationStats.push_back(JobStatistics());
+}
+
+void
+JobQueue::AddJobStatistics(double dTime, const TResourceUsage &usage)
+{
+  if (m_generationStats.empty())
+    NewGeneration();
+  m_generationStats.back().Add(dTime, usage);
+}
+
+const std::vector<JobStatistics>&
+JobQueue::GenerationStatistics() const
+{
+  return m_generationStats;
+}
+
+
+/********************************************************************
+ *   Write a byte to the result notification descriptor, if any, to
+ *   tell a waiting master that a result has been added to the
+ *   result set.  The descriptor should be non-blocking, as a full
+ *   pipe already means there is a notification pending.
+ *
+ *   Call from within mutex lock.
+ *******************************************************************/
+void
+JobQueue::SetResultNotifyFd(int nFd)
+{
+  m_nResultNotifyFd = nFd;
+}
+
+void
+JobQueue::NotifyResult()
+{
+  if (m_nResultNotifyFd >= 0)
+  {
+    const char ch = 0;
+    while (write(m_nResultNotifyFd, &ch, 1) < 0 && errno == EINTR)
+      ;
+  }
+}
+
+
+/********************************************************************
+ *   Set the queue depth metric.  Call after adding or removing jobs.
+ *
+ *   Call from within mutex lock.
+ *******************************************************************/
+void
+JobQueue::UpdateDepthMetric()
+{
+  if (Metrics::Enabled())
+    m_depthGauge.Set(size());
+}
+
+
+void
+JobQueue::SetJournal(ResultJournal *pJournal)
+{
+  m_pJournal = pJournal;
+}
+
+
+ResultJournal*
+JobQueue::Journal() const
+{
+  return m_pJournal;
+}
+
+
 /********************************************************************
  *   Returns a bool indicating whether the queue has been closed or
  *   not.  A queue is initially open, and may be closed by a call to
@@ -257,3 +406,42 @@ JobQueue::NumJobsPerSend() const
   return m_nNumJobsPerSend;
 }
 
+
+bool
+JobQueue::AutoNumJobsPerSend() const
+{
+  return m_bAutoNumJobsPerSend;
+}
+
+
+/********************************************************************
+ *   Change the number of jobs per send while running.  Call while
+ *   the queue is locked.
+ *******************************************************************/
+void
+JobQueue::SetNumJobsPerSend(size_t nNumPerSend)
+{
+  m_bAutoNumJobsPerSend = (nNumPerSend == 0);
+  if (!m_bAutoNumJobsPerSend)
+    m_nNumJobsPerSend = nNumPerSend;
+}
+
+
+/********************************************************************
+ *   How long a slave waits before taking a job already taken by
+ *   another slave, as a factor of its average time per job.  Call
+ *   while the queue is locked.
+ *******************************************************************/
+float
+JobQueue::WaitFactor() const
+{
+  return m_fWaitFactor;
+}
+
+
+void
+JobQueue::SetWaitFactor(float fWaitFactor)
+{
+  m_fWaitFactor = fWaitFactor;
+}
+
@@ -22,6 +22,14 @@
  *   
  *   Log any of standard input, output and/or error of a process to
  *   file.
+ *
+ *   On Linux, data read from a pipe is passed on without copying it
+ *   through user space: tee duplicates it into the destination (or
+ *   the log, or a spare pipe), and splice moves the same bytes on to
+ *   the other.  Where the kernel refuses (e.g. standard input is a
+ *   terminal, or a file system can't be spliced to), logio falls
+ *   back to read and write.  The pipes are enlarged with
+ *   F_SETPIPE_SZ, so that each call moves more data.
  *******************************************************************/
 
 #include <iostream>
@@ -45,32 +53,32 @@
 
 using namespace std;
 
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+#define LOGIO_SPLICE 1
+#endif
+
 static bool bVerbose = false;
 static bool bVeryVerbose = false;
 static string sProgramName;
 static bool bBinary = false;
 static bool bZip = false;
 static bool bDebug = false;
+static bool bCopy = false;
+static int nPipeSize = 1 << 20;
 
 class Log {
   bool m_bLog;
   string m_sFilename;
   string m_sDirection;
-  fdostream *m_pfLog;
+  int m_nFd;
   pid_t m_nZipPid;
   bool m_bLogOwner;
 public:
   Log(string sDir)
       : m_bLog(false), m_sDirection(sDir)
-      , m_pfLog(0), m_nZipPid(0), m_bLogOwner(false)
+      , m_nFd(-1), m_nZipPid(0), m_bLogOwner(false)
   {}
 
-  ~Log()
-  {
-    if (m_bLogOwner && m_pfLog)
-      delete m_pfLog;
-  }
-
   bool
   IsLogging() const
   {
@@ -111,21 +119,22 @@ public:
   void
   LogToSameStream(const Log &rhs)
   {
-    m_pfLog = rhs.m_pfLog;
+    m_nFd = rhs.m_nFd;
     m_bLogOwner = false;
   }
 
+      // The log file, or the pipe to gzip.
   void
-  SetLogStream(fdostream *ps)
+  SetLogFd(int nFd)
   {
-    m_pfLog = ps;
+    m_nFd = nFd;
     m_bLogOwner = true;
   }
 
-  fdostream*
-  LogStream()
+  int
+  LogFd() const
   {
-    return m_pfLog;
+    return m_nFd;
   }
 
   void
@@ -133,7 +142,7 @@ public:
   {
     if (IsLogging() && m_bLogOwner)
     {
-      LogStream()->close();
+      close(m_nFd);
       if (bZip)
       {
             // Give gzip time to finish up
@@ -163,18 +172,26 @@ parse_args(int argc, char *argv[])
     {"very-verbose" , no_argument, 0, 'V'},
     {"zip"          , no_argument, 0, 'z'},
     {"debug"        , no_argument, 0, 'd'},
+    {"copy"         , no_argument, 0, 'c'},
+    {"pipe-size"    , required_argument, 0, 'p'},
     { 0 }};
  
   int ch;
       // Add a + to the opstring to avoid permuting the option string.
       // This is necessary when logging processes with options.
-  while ((ch = getopt_long(argc, argv, "+be:i:o:vVz", opts, 0)) != -1)
+  while ((ch = getopt_long(argc, argv, "+bcde:i:o:p:vVz", opts, 0)) != -1)
   {
     switch (ch)
     {
         case 'b':
           bBinary = true;
           break;
+        case 'c':
+          bCopy = true;
+          break;
+        case 'p':
+          nPipeSize = atoi(optarg);
+          break;
         case 'd':
           bDebug = true;
           break;
@@ -273,12 +290,13 @@ OpenLogs()
       {
             // Replace log fd with write end of gzip pipe in parent.
         close(fd[0]);
+        close(nFdOut);
         log.SetZipPid(nZipPid);
-        log.SetLogStream(new fdostream(fd[1]));
+        log.SetLogFd(fd[1]);
       }
     }
     else
-      log.SetLogStream(new fdostream(nFdOut));
+      log.SetLogFd(nFdOut);
 
     if (bVerbose)
       cerr << sProgramName << ": Logging " << log.Direction() << " data to " << log.Filename() << ".\n";
@@ -287,26 +305,82 @@ OpenLogs()
 }
 
 
+/********************************************************************
+ *   A stream passed on by logio: Data read from nFdIn is written to
+ *   nFdOut, and to the log, if any.  With bZeroCopy, nFdIn is a pipe,
+ *   and data is tee'd into nFdTee and spliced to nFdSplice.  If
+ *   neither the destination nor the log is a pipe, the data is tee'd
+ *   into a spare pipe and spliced from there to the log.
+ *******************************************************************/
+typedef struct TPipeVar
+{
+  Log *pLog;
+  int nFdIn;
+  string sDescIn;
+  int nFdOut;
+  string sDescOut;
+  bool bZeroCopy;
+  int nFdTee, nFdSplice;
+  int sparePipe[2];
+} TPipe;
+
+
+static bool
+IsPipe(int nFd)
+{
+  struct stat st;
+  return nFd >= 0 && !fstat(nFd, &st) && S_ISFIFO(st.st_mode);
+}
+
+
+static void
+SetPipeSize(int nFd, const string &sDesc)
+{
+#if defined(F_SETPIPE_SZ)
+  if (nPipeSize > 0 && IsPipe(nFd) && fcntl(nFd, F_SETPIPE_SZ, nPipeSize) == -1 && bVerbose)
+    cerr << sProgramName << ": Failed to set the size of the " << sDesc << " pipe to " << nPipeSize 
+         << " bytes. System error message: " << strerror(errno) << ".\n";
+#endif
+}
+
+
+static int
+WriteAll(int nFd, const char *pData, size_t nCount)
+{
+  while (nCount > 0)
+  {
+    ssize_t nWritten = write(nFd, pData, nCount);
+    if (nWritten < 0 && errno == EINTR)
+      continue;
+    if (nWritten <= 0)
+      return 1;
+    pData += nWritten;
+    nCount -= nWritten;
+  }
+  return 0;
+}
+
+
+/********************************************************************
+ *   Pass on one buffer full through user space.
+ *******************************************************************/
 ssize_t
-Shuffle(int nFdIn, int nFdOut, Log &log)
+ShuffleCopy(TPipe &pipe)
 {
-  static const size_t nReadMax = 1024;
-  char szBuf[nReadMax];
-  ssize_t nNumRead = read(nFdIn, szBuf, nReadMax);
+  static const size_t nReadMax = 1 << 16;
+  static char szBuf[nReadMax];
+  Log &log = *pipe.pLog;
+  ssize_t nNumRead = read(pipe.nFdIn, szBuf, nReadMax);
   if (nNumRead > 0)
   {
-    if (log.IsLogging())
+    if (log.IsLogging() && WriteAll(log.LogFd(), szBuf, nNumRead))
     {
-      if (!log.LogStream()->write(szBuf, nNumRead))
-      {
-        cerr << "Failed to write " << nNumRead << " bytes to " << log.Direction()
-             << " log file " << log.Filename() << ".\n";
-        return ssize_t(-1);
-      }
-      log.LogStream()->flush();
+      cerr << "Failed to write " << nNumRead << " bytes to " << log.Direction()
+           << " log file " << log.Filename() << ".\n System error message: " << strerror(errno) << ".\n";
+      return ssize_t(-1);
     }
 
-    if (write(nFdOut, szBuf, nNumRead) != nNumRead)
+    if (WriteAll(pipe.nFdOut, szBuf, nNumRead))
     {
       cerr << "Failed to write " << nNumRead << " bytes to " << log.Direction()
            << ".\n System error message: " << strerror(errno) << ".\n";
@@ -315,7 +389,7 @@ Shuffle(int nFdIn, int nFdOut, Log &log)
   }
 
   if (nNumRead == -1)
-    cerr << "Failed to read from descriptor " << nFdIn
+    cerr << "Failed to read from descriptor " << pipe.nFdIn
          << " (the data read should have been shuffled on to " << log.Direction()
          << ".\n System error message: " << strerror(errno) << ".\n";
 
@@ -323,19 +397,99 @@ Shuffle(int nFdIn, int nFdOut, Log &log)
 }
 
 
+#if LOGIO_SPLICE
+/********************************************************************
+ *   Move exactly nCount bytes from the pipe nFdIn to nFdOut.  If the
+ *   kernel can't splice to nFdOut, the rest is copied.
+ *******************************************************************/
+static int
+SpliceAll(int nFdIn, int nFdOut, size_t nCount)
+{
+  static char szBuf[1 << 16];
+  bool bSplice = true;
+  while (nCount > 0)
+  {
+    ssize_t nMoved;
+    if (bSplice)
+    {
+      nMoved = splice(nFdIn, 0, nFdOut, 0, nCount, SPLICE_F_MOVE);
+      if (nMoved < 0 && (errno == EINVAL || errno == ENOSYS))
+      {
+        bSplice = false;
+        continue;
+      }
+    }
+    else
+    {
+      nMoved = read(nFdIn, szBuf, min(nCount, sizeof(szBuf)));
+      if (nMoved > 0 && WriteAll(nFdOut, szBuf, nMoved))
+        return 1;
+    }
+    if (nMoved < 0 && errno == EINTR)
+      continue;
+    if (nMoved <= 0)
+      return 1;
+    nCount -= nMoved;
+  }
+  return 0;
+}
+#endif
 
-class Poller
+
+/********************************************************************
+ *   Pass on the data available on the input.  Returns the number of
+ *   bytes passed on, 0 at end of file and -1 on error.
+ *******************************************************************/
+ssize_t
+Shuffle(TPipe &pipe)
 {
+#if LOGIO_SPLICE
+  if (!pipe.bZeroCopy)
+    return ShuffleCopy(pipe);
+
+  Log &log = *pipe.pLog;
+  const size_t nMax = (nPipeSize > 0 ? nPipeSize : 1 << 16);
+  ssize_t nMoved;
+  do
+  {
+    nMoved = (log.IsLogging() 
+              ? tee(pipe.nFdIn, pipe.nFdTee, nMax, 0)
+              : splice(pipe.nFdIn, 0, pipe.nFdOut, 0, nMax, SPLICE_F_MOVE));
+  }
+  while (nMoved < 0 && errno == EINTR);
+  if (nMoved < 0 && (errno == EINVAL || errno == ENOSYS))
+  {
+    if (bVerbose)
+      cerr << sProgramName << ": Unable to " << (log.IsLogging() ? "tee" : "splice") << " " << pipe.sDescIn 
+           << " to " << pipe.sDescOut << ". Copying the data instead.\n";
+    pipe.bZeroCopy = false;
+    return ShuffleCopy(pipe);
+  }
+  if (nMoved < 0)
+    cerr << "Failed to pass on data from " << pipe.sDescIn << " to " << pipe.sDescOut
+         << ".\n System error message: " << strerror(errno) << ".\n";
+  if (nMoved <= 0 || !log.IsLogging())
+    return nMoved;
 
-  typedef struct TPipeVar
+      // The data is now in the tee pipe, and still in the input.
+  if (SpliceAll(pipe.nFdIn, pipe.nFdSplice, nMoved)
+      || (pipe.sparePipe[0] >= 0 && SpliceAll(pipe.sparePipe[0], log.LogFd(), nMoved)))
   {
-    Log *pLog;
-    int nFdIn;
-    string sDescIn;
-    int nFdOut;
-    string sDescOut;
-  } TPipe;
+    cerr << "Failed to pass on " << nMoved << " bytes from " << pipe.sDescIn << " to " << pipe.sDescOut 
+         << " and the " << log.Direction() << " log file " << log.Filename() 
+         << ".\n System error message: " << strerror(errno) << ".\n";
+    return ssize_t(-1);
+  }
+  return nMoved;
+#else
+  return ShuffleCopy(pipe);
+#endif
+}
+
 
+
+class Poller
+{
   vector<TPipe> m_pipes;
 
   vector<pollfd> CreatePollFds() const
@@ -358,6 +512,16 @@ class Poller
   }
 
 
+  void
+  ClosePipe(vector<TPipe>::iterator itPipe)
+  {
+    for (int nEnd = 0; nEnd < 2; nEnd++)
+      if (itPipe->sparePipe[nEnd] >= 0)
+        close(itPipe->sparePipe[nEnd]);
+    m_pipes.erase(itPipe);
+  }
+
+
 public:
   void
   AddListenedPipe(Log *pLog, int nFdIn, string sDescIn, int nFdOut, string sDescOut)
@@ -368,6 +532,41 @@ public:
     p.sDescIn = sDescIn;
     p.nFdOut = nFdOut;
     p.sDescOut = sDescOut;
+    p.nFdTee = p.nFdSplice = -1;
+    p.sparePipe[0] = p.sparePipe[1] = -1;
+    SetPipeSize(nFdIn, sDescIn);
+    SetPipeSize(nFdOut, sDescOut);
+
+        // Tee into whichever of the destination and the log is a
+        // pipe, and splice to the other.
+    p.bZeroCopy = !bCopy && IsPipe(nFdIn);
+#if LOGIO_SPLICE
+    if (p.bZeroCopy && pLog->IsLogging())
+    {
+      SetPipeSize(pLog->LogFd(), pLog->Direction() + " log");
+      if (IsPipe(nFdOut))
+      {
+        p.nFdTee = nFdOut;
+        p.nFdSplice = pLog->LogFd();
+      }
+      else if (IsPipe(pLog->LogFd()))
+      {
+        p.nFdTee = pLog->LogFd();
+        p.nFdSplice = nFdOut;
+      }
+      else if (pipe(p.sparePipe) == 0)
+      {
+        SetPipeSize(p.sparePipe[1], "spare");
+        p.nFdTee = p.sparePipe[1];
+        p.nFdSplice = nFdOut;
+      }
+      else
+        p.bZeroCopy = false;
+    }
+#endif
+    if (bVerbose)
+      cerr << sProgramName << ": Passing " << sDescIn << " to " << sDescOut 
+           << (p.bZeroCopy ? " without copying.\n" : " by copying.\n");
     m_pipes.push_back(p);
   }
 
@@ -427,14 +626,14 @@ public:
         }
         if (bVeryVerbose)
           cerr << "Reading possible from " << itPipe->sDescIn << ".  Passing and logging data.\n";
-        ssize_t nNumMoved = Shuffle(itPipe->nFdIn, itPipe->nFdOut, *(itPipe->pLog));
+        ssize_t nNumMoved = Shuffle(*itPipe);
         if (nNumMoved == 0) // indicates end-of-file on a regular file
         {
           if (bVerbose)
             cerr << "Reached end-of-file on " << itPipe->sDescIn << ".\n";
           if (itPipe->nFdOut != 2)
             close(itPipe->nFdOut);
-          m_pipes.erase(itPipe);
+          ClosePipe(itPipe);
         }
         return (nNumMoved == -1 ? 1 : 0);
       }
@@ -452,7 +651,7 @@ public:
         if (nFdOther > 2)
           close(nFdOther);
             // Erase the closed pipe, so we don't poll it again.
-        m_pipes.erase(itPipe);
+        ClosePipe(itPipe);
       }
           // Only process one returned event at a time.
       return 0;
@@ -478,6 +677,8 @@ main(int argc, char *argv[])
          << "-o, --output-log filename\tLog standard output from process to given file.\n"
          << "-e, --error-log filename\tLog standard error from process to given file.\n"
          << "-z, --zip\tCompress logged data with gzip.\n"
+         << "-p, --pipe-size bytes\tEnlarge the pipes to this size, if allowed (default " << nPipeSize << ", 0 leaves them alone).\n"
+         << "-c, --copy\tCopy the data through logio, rather than splicing it between pipes.\n"
          << "-v, --verbose \tPrint some diagnostics.\n"
          << "-V, --very-verbose \tPrint more diagnostics.\n"
          << "-d, --debug \tPause after launch and print process ID of parent and child processes, so a debugger may be attached.\n";
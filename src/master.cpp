@@ -26,9 +26,11 @@
 #include <simdist/master.h>
 #include <simdist/options.h>
 #include <simdist/misc_utils.h>
+#include <simdist/profiler.h>
 
 #include <sstream>
 #include <memory>
+#include <set>
 
 // FeedbackError E_MASTER_EVALUATE("Failed to evaluate data set");
 DEFINE_FEEDBACK_ERROR(E_MASTER_EVALUATE, "Failed to evaluate data set")
@@ -42,90 +44,252 @@ DEFINE_FEEDBACK_ERROR(E_CHILD_SETUP, "Failed to load child process")
 
 
 Master::Master(JobQueue *pJobQueue)
-    : m_pJobQueue(pJobQueue), m_fb("Master"), m_nIDCounter(0)
+    : m_pJobQueue(pJobQueue), m_fb("Master"), m_nIDCounter(0), m_nBatchSize(0), m_nBatchReplayed(0), m_nTimeoutsBefore(0)
 {
 }
 
 
+/********************************************************************
+ *   Start a new batch of jobs.  Jobs are added with Submit, and
+ *   FinishBatch waits for all of them to complete.  The slaves start
+ *   working on each job as soon as it is submitted.
+ *******************************************************************/
 int
-Master::Evaluate(const std::vector<std::string> &data, std::vector<std::string> &results)
+Master::BeginBatch()
 {
-  static const int info_interval_secs = 10;
-
   AutoMutex mtx;
   if (m_pJobQueue->AcquireMutex(mtx))
     return m_fb.Error(E_MUTEX_LOCK);
 
   m_pJobQueue->ResultSet().clear();
+  m_pJobQueue->NewGeneration();
+  m_nTimeoutsBefore = m_pJobQueue->NumTimeouts();
+  m_batchJobs.clear();
+  m_nBatchSize = 0;
+  m_nBatchReplayed = 0;
+  return 0;
+}
 
-      // Map job ID to position in vector
-  typedef std::map<std::string, size_t> TJobIDMap;
-  TJobIDMap jobIDs, jobIDsBackup;
 
-  for (size_t i = 0; i < data.size(); i++)
+/********************************************************************
+ *   Add a job to the current batch.  Call with the queue locked.
+ *   New jobs are placed in front of the jobs that are already being
+ *   processed, which TakeJobs keeps at the back of the queue, so
+ *   that idle slaves pick them up rather than double-processing a
+ *   job.  Jobs with results in the result journal of an earlier run
+ *   go straight to the result set.
+ *******************************************************************/
+size_t
+Master::QueueJob(const std::string &sData)
+{
+  JobQueueElement job;
+  job.sJobData = sData;
+  job.nTraceQueued = Trace::Enabled() ? Trace::Now() : 0;
+      // Create a system-wide unique job ID.
+  std::stringstream ssID;
+  ssID << this << "-" << ++m_nIDCounter;
+  job.sJobID = ssID.str();
+  TBatchJob &batchJob = m_batchJobs[job.sJobID];
+  batchJob.nIndex = m_nBatchSize;
+  batchJob.sData = sData;
+
+  ResultJournal *pJournal = m_pJobQueue->Journal();
+  if (pJournal && pJournal->Lookup(sData, job.sResults))
+  {
+    m_pJobQueue->ResultSet().insert(job);
+    m_pJobQueue->NotifyResult();
+    m_nBatchReplayed++;
+    m_fb.Info(3, "Job " + job.sJobID + " replayed from the result journal: " + job.sJobData);
+    return m_nBatchSize++;
+  }
+
+  JobQueue::iterator itPos = m_pJobQueue->end();
+  while (itPos != m_pJobQueue->begin())
   {
-    JobQueueElement job;
-    job.sJobData = data[i];
-        // Create a system-wide unique job ID.
-    std::stringstream ssID;
-    ssID << this << "-" << ++m_nIDCounter;
-    job.sJobID = ssID.str();
-    jobIDs[job.sJobID] = i;
-    m_pJobQueue->push_back(job);
-    m_fb.Info(3, "Adding job " + job.sJobID + " to job queue: " + job.sJobData);
+    JobQueue::iterator itPrev = itPos;
+    if ((--itPrev)->workers.empty())
+      break;
+    itPos = itPrev;
   }
+  m_pJobQueue->insert(itPos, job);
+  m_pJobQueue->UpdateDepthMetric();
+  m_fb.Info(3, "Adding job " + job.sJobID + " to job queue: " + job.sJobData);
+  return m_nBatchSize++;
+}
 
+
+int
+Master::Submit(const std::string &sData, size_t *pnIndex /*=0*/)
+{
+  static ProfileRegion regionLockWait("queue-lock-wait");
+  AutoMutex mtx;
+  ProfileScope scopeLockWait(regionLockWait);
+  if (m_pJobQueue->AcquireMutex(mtx))
+    return m_fb.Error(E_MUTEX_LOCK);
+  scopeLockWait.Stop();
+  size_t nIndex = QueueJob(sData);
+  if (pnIndex)
+    *pnIndex = nIndex;
   if (m_pJobQueue->Signal())
     return m_fb.Error(E_MASTER_EVALUATE) << ", couldn't wake up slaves.";
+  return 0;
+}
+
 
+/********************************************************************
+ *   Wait for all jobs in the current batch to complete, and return
+ *   the results in the order the jobs were submitted.
+ *******************************************************************/
+int
+Master::FinishBatch(std::vector<std::string> &results)
+{
+  static const int info_interval_secs = 10;
+  TraceSpan span("Master::FinishBatch", "Master");
+
+  AutoMutex mtx;
+  if (m_pJobQueue->AcquireMutex(mtx))
+    return m_fb.Error(E_MUTEX_LOCK);
+
+  results.assign(m_nBatchSize, std::string());
   while(!m_pJobQueue->empty())
   {
     if (m_pJobQueue->Wait(info_interval_secs))
       return m_fb.Error(E_MASTER_EVALUATE) << ". Wait failed";
     if (!m_pJobQueue->empty())
       m_fb.Info(3) << "Processing... " << m_pJobQueue->size() 
-              << " out of " << data.size() << " jobs remaining";
+              << " out of " << m_nBatchSize << " jobs remaining, "
+              << m_pJobQueue->NumTimeouts() - m_nTimeoutsBefore << " timeout(s) so far";
   }
 
-  jobIDsBackup = jobIDs; // This copy is taken in order to check for duplicates in result set.
+  if (int nTimeouts = m_pJobQueue->NumTimeouts() - m_nTimeoutsBefore)
+    m_fb.Warning() << nTimeouts << " job(s) timed out on the slave servers and were resubmitted.";
+  if (m_nBatchReplayed)
+    m_fb.Info(1) << m_nBatchReplayed << " of " << m_nBatchSize << " job(s) were replayed from the result journal.";
+
+  TBatchJobMap jobs;
+  jobs.swap(m_batchJobs);
+  std::set<std::string> jobIDsDone; // In order to check for duplicates in result set.
   TResultSet &rs = m_pJobQueue->ResultSet();
   for(TResultSet::const_iterator itResult = rs.begin(); itResult != rs.end(); itResult++)
   {
-    TJobIDMap::iterator itJob = jobIDs.find(itResult->sJobID);
-    if (itJob == jobIDs.end())
+    TBatchJobMap::iterator itJob = jobs.find(itResult->sJobID);
+    if (itJob == jobs.end())
     {
-      TJobIDMap::iterator itJobBackup = jobIDsBackup.find(itResult->sJobID);
-      if (itJobBackup != jobIDsBackup.end())
+      if (jobIDsDone.count(itResult->sJobID))
         return m_fb.Error(E_INTERNAL_LOGIC) << "Result set contains duplicates";
       m_fb.Warning() << "Spurious result:  Result ID " << itResult->sJobID << " not found.  Discarded";
       continue;
     }
-    results[itJob->second] = itResult->sResults;
-    jobIDs.erase(itJob);
+    results[itJob->second.nIndex] = itResult->sResults;
+    jobIDsDone.insert(itJob->first);
+    jobs.erase(itJob);
   }
+  rs.clear();
   
   mtx.Unlock();
+
+      // The batch is complete, so make sure its results survive a
+      // crash in the next one.
+  if (m_pJobQueue->Journal() && m_pJobQueue->Journal()->Sync())
+    m_fb.Warning() << "Failed to flush the result journal.";
   
-  if (!jobIDs.empty())
+  if (!jobs.empty())
   {
     m_fb.Warning() << "Not all jobs were successfully evaluated, although the job queue was empty.  "
-                   << "Re-evaluating " << jobIDs.size() << " jobs..";
-    std::vector<std::string> data2(jobIDs.size()), results2(jobIDs.size());
+                   << "Re-evaluating " << jobs.size() << " jobs..";
+    std::vector<std::string> data2(jobs.size()), results2(jobs.size());
     int i = 0;
-    TJobIDMap::const_iterator itJob = jobIDs.begin();
-    for (; itJob != jobIDs.end(); itJob++, i++)
-      data2[i] = data[itJob->second];
+    TBatchJobMap::const_iterator itJob = jobs.begin();
+    for (; itJob != jobs.end(); itJob++, i++)
+      data2[i] = itJob->second.sData;
 
     if (Evaluate(data2, results2))
       return m_fb.Error(E_MASTER_EVALAGAIN);
 
-    for (itJob = jobIDs.begin(), i = 0; itJob != jobIDs.end(); itJob++, i++)
-      results[itJob->second] = results2[i];
+    for (itJob = jobs.begin(), i = 0; itJob != jobs.end(); itJob++, i++)
+      results[itJob->second.nIndex] = results2[i];
+  }
+  return 0;
+}
+
+
+int
+Master::TakeCompleted(TCompletedResults &completed)
+{
+  completed.clear();
+  AutoMutex mtx;
+  if (m_pJobQueue->AcquireMutex(mtx))
+    return m_fb.Error(E_MUTEX_LOCK);
+
+  TResultSet &rs = m_pJobQueue->ResultSet();
+  TResultSet::iterator itResult = rs.begin();
+  while (itResult != rs.end())
+  {
+    TBatchJobMap::iterator itJob = m_batchJobs.find(itResult->sJobID);
+    if (itJob == m_batchJobs.end())
+    {
+      itResult++;
+      continue;
+    }
+    completed.push_back(std::make_pair(itJob->second.nIndex, itResult->sResults));
+    m_batchJobs.erase(itJob);
+    rs.erase(itResult++);
   }
   return 0;
 }
 
 
+/********************************************************************
+ *   True if jobs are still queued, i.e. more results may complete
+ *   without further calls to Submit.
+ *******************************************************************/
+bool
+Master::Pending()
+{
+  AutoMutex mtx;
+  if (m_pJobQueue->AcquireMutex(mtx))
+  {
+    m_fb.Error(E_MUTEX_LOCK);
+    return false;
+  }
+  return !m_pJobQueue->empty();
+}
+
+
+int
+Master::SetResultNotifyFd(int nFd)
+{
+  AutoMutex mtx;
+  if (m_pJobQueue->AcquireMutex(mtx))
+    return m_fb.Error(E_MUTEX_LOCK);
+  m_pJobQueue->SetResultNotifyFd(nFd);
+  return 0;
+}
+
+
+int
+Master::Evaluate(const std::vector<std::string> &data, std::vector<std::string> &results)
+{
+  TraceSpan span("Master::Evaluate", "Master");
+  if (BeginBatch())
+    return m_fb.Error(E_MASTER_EVALUATE);
+
+  static ProfileRegion regionLockWait("queue-lock-wait");
+  AutoMutex mtx;
+  ProfileScope scopeLockWait(regionLockWait);
+  if (m_pJobQueue->AcquireMutex(mtx))
+    return m_fb.Error(E_MUTEX_LOCK);
+  scopeLockWait.Stop();
+  for (size_t i = 0; i < data.size(); i++)
+    QueueJob(data[i]);
+  if (m_pJobQueue->Signal())
+    return m_fb.Error(E_MASTER_EVALUATE) << ", couldn't wake up slaves.";
+  mtx.Unlock();
+
+  return FinishBatch(results);
+}
+
+
 
 DistributorLauncher::DistributorLauncher()
     : m_fb("DistributorLauncher")
@@ -158,6 +322,20 @@ DistributorLauncher::CreateDistributor(const std::vector<std::string> &servers,
   std::auto_ptr<JobQueue> jobQueue(new JobQueue());
   std::auto_ptr<ThreadBarrier> barrier(new ThreadBarrier());
 
+  std::string sJournal;
+  int nJournalSync;
+  if (Options::Instance().Option("result-journal", sJournal)
+      || Options::Instance().Option("result-journal-sync", nJournalSync))
+    return m_fb.Error(E_DISTRIBUTOR_CREATESLAVES) << ": Failed to get the result-journal options.";
+  std::auto_ptr<ResultJournal> journal;
+  if (!sJournal.empty())
+  {
+    journal.reset(new ResultJournal());
+    if (journal->Open(sJournal, nJournalSync))
+      return m_fb.Error(E_DISTRIBUTOR_CREATESLAVES) << ": Failed to open the result journal.";
+    jobQueue->SetJournal(journal.get());
+  }
+
   TDistributor d;
   d.servers = servers;
   d.slavePrograms = slavePrograms;
@@ -166,10 +344,22 @@ DistributorLauncher::CreateDistributor(const std::vector<std::string> &servers,
   if (SlaveClientFactory::Instance().CreateSlaves(d.servers, d.slavePrograms, d.slavesArgs, d.slaves, jobQueue.get(), barrier.get()))
     return m_fb.Error(E_DISTRIBUTOR_CREATESLAVES);
 
+  std::string sControlSocket;
+  if (Options::Instance().Option("control-socket", sControlSocket))
+    return m_fb.Error(E_DISTRIBUTOR_CREATESLAVES) << ": Failed to get the control-socket option.";
+  d.pControl = 0;
+  if (!sControlSocket.empty())
+  {
+    d.pControl = new ControlServer(jobQueue.get(), d.slaves);
+    if (d.pControl->Start(sControlSocket))
+      m_fb.Warning() << "Failed to open the control socket.  Continuing without it.";
+  }
+
   *ppNewMaster = new Master(jobQueue.get());
 
   d.pJobQueue = jobQueue.release();
   d.pBarrier = barrier.release();
+  d.pJournal = journal.release();
   m_distributors[*ppNewMaster] = d;
   return 0;
 }
@@ -217,6 +407,9 @@ DistributorLauncher::DestroyDistributor(Master *pMaster)
   else
   {
     TDistributor &d = itDist->second;
+        // The control server refers to the slaves and the queue.
+    delete d.pControl;
+    d.pControl = 0;
     if (d.pJobQueue->Close()
         || d.pJobQueue->Signal())
       return m_fb.Error(E_DISTRIBUTOR_DESTROY);
@@ -238,6 +431,15 @@ DistributorLauncher::DestroyDistributor(Master *pMaster)
     }
     m_fb.Info(1) << "All slaves have completed successfully.";
 
+    for (std::vector<SlaveClient*>::const_iterator sit = d.slaves.begin();
+         sit != d.slaves.end(); sit++)
+      m_fb.Info(1) << "Job statistics for " << (*sit)->Server() << ": " 
+                   << (*sit)->Statistics().ToString() << ".";
+    const std::vector<JobStatistics> &genStats = d.pJobQueue->GenerationStatistics();
+    for (size_t nGen = 0; nGen < genStats.size(); nGen++)
+      m_fb.Info(1) << "Job statistics for generation " << nGen + 1 << ": " 
+                   << genStats[nGen].ToString() << ".";
+
         // Delete slaves
     for (std::vector<SlaveClient*>::iterator sit = d.slaves.begin();
          sit != d.slaves.end(); sit++)
@@ -246,6 +448,9 @@ DistributorLauncher::DestroyDistributor(Master *pMaster)
     delete itDist->first;
     delete d.pJobQueue;
     delete d.pBarrier;
+    if (d.pJournal && d.pJournal->Close())
+      m_fb.Warning() << "Failed to close the result journal.";
+    delete d.pJournal;
     m_distributors.erase(itDist);
   }
   return 0;
@@ -0,0 +1,415 @@
+/********************************************************************
+ *   		master_io.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   See header file for description.
+ *******************************************************************/
+
+#if HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <simdist/master_io.h>
+#include <simdist/errorcodes_thread.h>
+
+#include <functional>
+#include <sstream>
+#include <cerrno>
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+
+// FeedbackError E_MASTERIO_READ("Failed to read from master");
+DEFINE_FEEDBACK_ERROR(E_MASTERIO_READ, "Failed to read from master")
+// FeedbackError E_MASTERIO_WRITE("Failed to write to master");
+DEFINE_FEEDBACK_ERROR(E_MASTERIO_WRITE, "Failed to write to master")
+
+
+/********************************************************************
+ *   The master I/O threads must not receive SIGPIPE, which is
+ *   handled by a long jump in the main thread.  A failed write is
+ *   reported through MasterWriter::Failed instead.
+ *******************************************************************/
+static void
+BlockSigPipe()
+{
+  sigset_t sigSet;
+  sigemptyset(&sigSet);
+  sigaddset(&sigSet, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigSet, 0);
+}
+
+
+void *masterreader_thread_func(void *pArg)
+{
+  MasterReader *pReader = static_cast<MasterReader*>(pArg);
+  pReader->m_fb.RegisterThreadDescription("Masterreader");
+  BlockSigPipe();
+  pReader->ReadLoop();
+  return 0;
+}
+
+
+void *masterwriter_thread_func(void *pArg)
+{
+  MasterWriter *pWriter = static_cast<MasterWriter*>(pArg);
+  pWriter->m_fb.RegisterThreadDescription("Masterwriter");
+  BlockSigPipe();
+  pWriter->WriteLoop();
+  return 0;
+}
+
+
+
+MasterReader::MasterReader(std::istream &stream, const JobReaderWriter &rwReader,
+                           const std::string &sBatchMode, const std::string &sMarker, size_t nCapacity)
+  : m_fb("MasterReader")
+  , m_stream(stream)
+  , m_rwReader(rwReader)
+  , m_sBatchMode(sBatchMode)
+  , m_sMarker(sMarker)
+  , m_nCapacity(nCapacity > 0 ? nCapacity : 1)
+  , m_nNotifyFd(-1)
+  , m_bRunning(false)
+  , m_mtx("MasterReader-mutex")
+  , m_bStop(false)
+{
+}
+
+
+/********************************************************************
+ *   At the end of a normal run, the thread has already stopped at
+ *   end-of-file from the master.  Otherwise, it may be blocked
+ *   reading from a master that is still alive, and is cancelled.
+ *******************************************************************/
+MasterReader::~MasterReader()
+{
+  if (!m_bRunning)
+    return;
+
+  AutoMutex mtx;
+  if (!m_mtx.AcquireMutex(mtx))
+  {
+    m_bStop = true;
+    m_condNotFull.Broadcast();
+    mtx.Unlock();
+  }
+  pthread_cancel(m_thread);
+  pthread_join(m_thread, 0);
+}
+
+
+int
+MasterReader::SetNotifyFd(int nFd)
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_MASTERIO_READ);
+  m_nNotifyFd = nFd;
+  return 0;
+}
+
+
+int
+MasterReader::Start()
+{
+  if (pthread_create(&m_thread, 0, masterreader_thread_func, this))
+    return m_fb.Error(E_MASTERIO_READ) << ": Failed to create reader thread.";
+  m_bRunning = true;
+  return 0;
+}
+
+
+bool
+MasterReader::NotEmpty() const
+{
+  return !m_items.empty();
+}
+
+
+bool
+MasterReader::NotFull() const
+{
+  return m_bStop || m_items.size() < m_nCapacity;
+}
+
+
+/********************************************************************
+ *   Queue an item, waiting for room if necessary.  Returns false if
+ *   the reader has been told to stop.
+ *******************************************************************/
+bool
+MasterReader::Push(EItemType type, const std::string &sData /*=""*/)
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return false;
+  if (m_condNotFull.Wait(mtx.GetLockedMutex(), std::mem_fun(&MasterReader::NotFull), this))
+  {
+    m_fb.Error(E_COND_WAIT);
+    return false;
+  }
+  if (m_bStop)
+    return false;
+
+  m_items.push_back(TItem());
+  m_items.back().type = type;
+  m_items.back().sData = sData;
+  m_condNotEmpty.Signal();
+  const int nNotifyFd = m_nNotifyFd;
+  mtx.Unlock();
+
+  if (nNotifyFd >= 0)
+  {
+    const char ch = 0;
+    while (write(nNotifyFd, &ch, 1) < 0 && errno == EINTR)
+      ;
+  }
+  return true;
+}
+
+
+void
+MasterReader::ReadLoop()
+{
+  MetricsCounter &bytesReceived = Metrics::Instance().Counter("simdist_transport_bytes_received_total",
+                                                              "Bytes received by each transport", "transport", "master");
+  while (true)
+  {
+    size_t nNumJobs = 0;
+    if (m_sBatchMode == "COUNT")
+    {
+      std::string sCount;
+      if (!std::getline(m_stream, sCount))
+      {
+        Push(end_of_file);
+        return;
+      }
+      std::stringstream ss(sCount);
+      if (!(ss >> nNumJobs))
+      {
+        m_fb.Error(E_MASTERIO_READ) << ": Expected the number of jobs in the next batch from master, got \""
+                                    << sCount << "\".";
+        Push(read_error);
+        return;
+      }
+    }
+
+    for (size_t nJob = 0; m_sBatchMode != "COUNT" || nJob < nNumJobs; nJob++)
+    {
+      std::string sJob;
+      JobReaderWriter::int_type nRet = m_rwReader.Read(m_stream, sJob);
+      if (nRet == JobReaderWriter::traits_type::eof())
+      {
+        Push(end_of_file);
+        return;
+      }
+      else if (nRet)
+      {
+        m_fb.Error(E_MASTERIO_READ) << ": Error while reading job " << nJob << " of batch.";
+        Push(read_error);
+        return;
+      }
+      if (m_sBatchMode == "MARKER" && sJob == m_sMarker)
+        break;
+      bytesReceived.Add(sJob.size());
+      if (!Push(job, sJob))
+        return;
+    }
+
+    if (m_sBatchMode != "POLL" && !Push(end_of_batch))
+      return;
+  }
+}
+
+
+int
+MasterReader::Pop(TItem &item, int nTimeoutMs, bool &bTimedOut)
+{
+  bTimedOut = false;
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_MASTERIO_READ);
+
+  if (nTimeoutMs < 0)
+  {
+    if (m_condNotEmpty.Wait(mtx.GetLockedMutex(), std::mem_fun(&MasterReader::NotEmpty), this))
+      return m_fb.Error(E_COND_WAIT);
+  }
+  else
+  {
+    timeval now;
+    gettimeofday(&now, 0);
+    long int nUSec = now.tv_usec + 1000L * nTimeoutMs;
+    timespec deadline;
+    deadline.tv_sec = now.tv_sec + nUSec / 1000000L;
+    deadline.tv_nsec = (nUSec % 1000000L) * 1000L;
+    while (m_items.empty())
+    {
+      int nRet = m_condNotEmpty.TimedWait(mtx.GetLockedMutex(), deadline);
+      if (nRet == ETIMEDOUT)
+        break;
+      else if (nRet)
+        return m_fb.Error(E_COND_WAIT);
+    }
+    if (m_items.empty())
+    {
+      bTimedOut = true;
+      return 0;
+    }
+  }
+
+  item.type = m_items.front().type;
+  item.sData.swap(m_items.front().sData);
+  m_items.pop_front();
+  m_condNotFull.Signal();
+  return 0;
+}
+
+
+
+MasterWriter::MasterWriter(std::ostream &stream, const JobReaderWriter &rwWriter, size_t nCapacity)
+  : m_fb("MasterWriter")
+  , m_stream(stream)
+  , m_rwWriter(rwWriter)
+  , m_nCapacity(nCapacity > 0 ? nCapacity : 1)
+  , m_bRunning(false)
+  , m_mtx("MasterWriter-mutex")
+  , m_bClosed(false)
+  , m_bFailed(false)
+{
+}
+
+
+MasterWriter::~MasterWriter()
+{
+  Close();
+}
+
+
+int
+MasterWriter::Start()
+{
+  if (pthread_create(&m_thread, 0, masterwriter_thread_func, this))
+    return m_fb.Error(E_MASTERIO_WRITE) << ": Failed to create writer thread.";
+  m_bRunning = true;
+  return 0;
+}
+
+
+bool
+MasterWriter::NotEmpty() const
+{
+  return m_bClosed || !m_results.empty();
+}
+
+
+bool
+MasterWriter::NotFull() const
+{
+  return m_bFailed || m_results.size() < m_nCapacity;
+}
+
+
+int
+MasterWriter::Push(const std::string &sResult)
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_MASTERIO_WRITE);
+  if (m_condNotFull.Wait(mtx.GetLockedMutex(), std::mem_fun(&MasterWriter::NotFull), this))
+    return m_fb.Error(E_COND_WAIT);
+  if (m_bFailed)
+    return m_fb.Error(E_MASTERIO_WRITE) << ": An earlier write failed.";
+  m_results.push_back(sResult);
+  m_condNotEmpty.Signal();
+  return 0;
+}
+
+
+void
+MasterWriter::WriteLoop()
+{
+  MetricsCounter &bytesSent = Metrics::Instance().Counter("simdist_transport_bytes_sent_total",
+                                                          "Bytes sent by each transport", "transport", "master");
+  while (true)
+  {
+    AutoMutex mtx;
+    if (m_mtx.AcquireMutex(mtx))
+      return;
+    if (m_condNotEmpty.Wait(mtx.GetLockedMutex(), std::mem_fun(&MasterWriter::NotEmpty), this))
+    {
+      m_fb.Error(E_COND_WAIT);
+      return;
+    }
+    if (m_results.empty())
+      return;
+    std::string sResult;
+    sResult.swap(m_results.front());
+    m_results.pop_front();
+    m_condNotFull.Signal();
+    mtx.Unlock();
+
+    if (m_rwWriter.Write(m_stream, sResult))
+    {
+      m_fb.Warning("Failed to write results to master, assuming master process has died.");
+      if (m_mtx.AcquireMutex(mtx))
+        return;
+      m_bFailed = true;
+      m_results.clear();
+      m_condNotFull.Broadcast();
+      return;
+    }
+    bytesSent.Add(sResult.size());
+  }
+}
+
+
+int
+MasterWriter::Close()
+{
+  if (!m_bRunning)
+    return 0;
+
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_MASTERIO_WRITE);
+  m_bClosed = true;
+  m_condNotEmpty.Signal();
+  mtx.Unlock();
+
+  pthread_join(m_thread, 0);
+  m_bRunning = false;
+  if (m_bFailed)
+    return m_fb.Error(E_MASTERIO_WRITE);
+  return 0;
+}
+
+
+bool
+MasterWriter::Failed()
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return true;
+  return m_bFailed;
+}
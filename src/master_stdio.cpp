@@ -22,13 +22,28 @@
  *   
  *   Stub to run master node using standard input/output.
  *
- *   This piece should be rewritten to process input and output
- *   separately.  In the case where the master process is slow in
+ *   By default (POLL batch mode), the end of a batch is detected
+ *   when no more data has arrived from the master process within a
+ *   timeout.  In the case where the master process is slow in
  *   producing output, the poll may time out even though we have
  *   not reached the end of the batch.  This will lead to
  *   suboptimal processing of the jobs in the batch, since a)
  *   jobs can't be grouped optimally, and b) in the worst case,
- *   some slaves may be running idle.
+ *   some slaves may be running idle.  A fast master, on the other
+ *   hand, waits for the timeout at the end of every batch.  Masters
+ *   which can announce the number of jobs in a batch (COUNT mode)
+ *   or mark its end (MARKER mode) avoid both problems.
+ *
+ *   With master-result-order COMPLETION, there are no batches: Jobs
+ *   are passed on to the slaves as they are read, and each result
+ *   is written back as soon as it is ready, preceded by the tag of
+ *   its job and a space.  The tag is either the first word of the
+ *   job line (master-job-tags) or the sequence number of the job,
+ *   counting from 0.
+ *
+ *   The pipes to and from the master are handled by separate
+ *   reader and writer threads (see master_io.h), so that master
+ *   I/O overlaps with the distributed evaluation.
  *******************************************************************/
 
 
@@ -39,14 +54,21 @@
 
 #include <simdist/timer.h>
 #include <simdist/master.h>
+#include <simdist/master_io.h>
 
 #include <simdist/io_utils.h>
 #include <simdist/misc_utils.h>
+#include <simdist/metrics.h>
+#include <simdist/trace.h>
+#include <simdist/profiler.h>
 #include <simdist/options.h>
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <map>
 #include <cassert>
+#include <cerrno>
 
 #include <sys/types.h>
 #include <unistd.h>
@@ -54,6 +76,7 @@
 #include <signal.h>
 #include <setjmp.h>
 #include <poll.h>
+#include <fcntl.h>
 
 // FeedbackError E_MASTERMAIN_LOOPSETUP("Evaluation loop setup failed");
 DEFINE_FEEDBACK_ERROR(E_MASTERMAIN_LOOPSETUP, "Evaluation loop setup failed")
@@ -150,6 +173,302 @@ SignalPipe(int)
 }
 
 
+/********************************************************************
+ *   Pass a job read from the master on to the slaves immediately,
+ *   starting a new batch with the first job.
+ *******************************************************************/
+int
+StreamJob(Feedback &fb, Master *pMaster, const std::vector<std::string> &data, const std::string &sJob)
+{
+  if ((data.empty() && pMaster->BeginBatch())
+      || pMaster->Submit(sJob))
+    return fb.Error(E_MASTERMAIN_LOOP) << ": Failed to pass job " << data.size() << " on to the slaves.";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Collect one batch of jobs in COUNT or MARKER batch mode.  bEOF
+ *   is set if the master closed its output before the end of the
+ *   batch.  If pStreamTo is given, each job is submitted to it as
+ *   soon as it has been read.
+ *******************************************************************/
+int 
+ReadFramedBatch(Feedback &fb, MasterReader &reader, Master *pStreamTo,
+                std::vector<std::string> &data, bool &bEOF)
+{
+  data.clear();
+  bEOF = false;
+
+  MasterReader::TItem item;
+  bool bTimedOut;
+  while (true)
+  {
+    if (reader.Pop(item, -1, bTimedOut))
+      return fb.Error(E_MASTERMAIN_LOOP);
+    if (item.type == MasterReader::end_of_batch)
+      return 0;
+    else if (item.type == MasterReader::end_of_file)
+    {
+      if (!data.empty())
+        fb.Warning() << "End-of-file from master in the middle of a batch. Discarding " 
+                     << data.size() << " job(s).";
+      bEOF = true;
+      return 0;
+    }
+    else if (item.type == MasterReader::read_error)
+      return fb.Error(E_MASTERMAIN_LOOP) << "Error while reading job " << data.size() << " of batch from master.";
+
+    if (pStreamTo && StreamJob(fb, pStreamTo, data, item.sData))
+      return fb.Error(E_MASTERMAIN_LOOP);
+    data.push_back(item.sData);
+  }
+}
+
+
+/********************************************************************
+ *   Evaluation loop for COUNT and MARKER batch mode.  Each batch is
+ *   evaluated as soon as it has been read.
+ *******************************************************************/
+int
+RunFramedLoop(Feedback &fb, Master *pMaster, MasterReader &reader, MasterWriter &writer, bool bStreaming)
+{
+  std::vector<std::string> data, results;
+  size_t nBatch = 0;
+  bool bEOF = false;
+  while (true)
+  {
+    if (ReadFramedBatch(fb, reader, bStreaming ? pMaster : 0, data, bEOF))
+      return fb.Error(E_MASTERMAIN_LOOP) << ": Failed to read batch " << nBatch << " from master.";
+    if (bEOF)
+    {
+      fb.Info(1) << "End-of-file when reading batch " << nBatch << " from master."
+                 << "  Assuming the simulation is complete.";
+      return 0;
+    }
+
+    fb.Info(2) << "Read " << data.size() << " jobs in batch " << nBatch << " from master, now sending data for evaluation...";
+    results.resize(data.size());
+    if (!data.empty() && (bStreaming ? pMaster->FinishBatch(results) : pMaster->Evaluate(data, results)))
+      return fb.Error(E_MASTERMAIN_LOOP) << "Distributed evaluation failed.";
+    for (size_t nJ = 0; nJ < results.size(); nJ++)
+      if (writer.Push(results[nJ]))
+        return fb.Error(E_MASTERMAIN_LOOP) << ": Failed to write results to master.";
+    fb.Info(2) << "Results of batch " << nBatch << " queued for writing to master.";
+    nBatch++;
+  }
+}
+
+
+/********************************************************************
+ *   Evaluation loop for POLL batch mode.  Wait indefinitely for the
+ *   first job, then wait for nPollTimeout milliseconds before
+ *   assuming there will be no more data coming in this batch.
+ *
+ *   In the case where the master process is slow in producing
+ *   output, the timeout may occur when only part of a batch has
+ *   been written.  The rest is then treated as a new batch, and
+ *   the master sees no difference, as the results are returned in
+ *   the same order.  Results are queued for writing as soon as
+ *   they are ready: The writer thread makes sure that a master
+ *   which is still busy writing jobs can't deadlock with us.
+ *******************************************************************/
+int
+RunPollLoop(Feedback &fb, Master *pMaster, MasterReader &reader, MasterWriter &writer, 
+            int nPollTimeout, bool bStreaming)
+{
+  typedef std::vector<std::string> TDataVec;
+  TDataVec data, results;
+  size_t nJob = 0, nBatch = 0, nTotal = 0;
+  while (true)
+  {
+    int nTimeout = data.empty() ? -1 : nPollTimeout;
+    fb.Info(3, "Waiting for data, timeout is ") << nTimeout << "...";
+    MasterReader::TItem item;
+    bool bTimedOut;
+    if (reader.Pop(item, nTimeout, bTimedOut))
+      return fb.Error(E_MASTERMAIN_LOOP);
+
+    if (!bTimedOut)
+    {
+      if (item.type == MasterReader::end_of_file)
+      {
+        fb.Info(1) << "End-of-file when reading job " << nJob << " in batch " << nBatch 
+                   << " (i.e. job " << nTotal << " in total) from master."
+                   << "  Assuming the simulation is complete.";
+        if (!data.empty())
+          fb.Warning() << "End-of-file from master in the middle of a batch. Discarding " 
+                       << data.size() << " job(s).";
+        return 0;
+      }
+      else if (item.type != MasterReader::job)
+        return fb.Error(E_MASTERMAIN_LOOP) << "Error while reading job " << nJob << " in batch " << nBatch 
+                                           << " (i.e. job " << nTotal << " in total) from master.";
+
+      if (bStreaming && StreamJob(fb, pMaster, data, item.sData))
+        return fb.Error(E_MASTERMAIN_LOOP);
+      data.push_back(item.sData);
+      nJob++;
+      nTotal++;
+    }
+    else
+    {
+      fb.Info(2) << "Read " << data.size() << " jobs from master via stdin, now sending data for evaluation...\n";
+      results.resize(data.size());
+      if (bStreaming ? pMaster->FinishBatch(results) : pMaster->Evaluate(data, results))
+        return fb.Error(E_MASTERMAIN_LOOP) << "Distributed evaluation failed.";
+      for (size_t nJ = 0; nJ < results.size(); nJ++)
+        if (writer.Push(results[nJ]))
+          return fb.Error(E_MASTERMAIN_LOOP) << ": Failed to write results to master.";
+      fb.Info(2) << "Results queued for writing to master.\n";
+      data.clear();    
+      nBatch++;
+      nJob = 0;
+    }
+  }
+}
+
+
+/********************************************************************
+ *   Write the results taken from pMaster to the master process,
+ *   each preceded by the tag of its job.
+ *******************************************************************/
+int
+WriteTaggedResults(Feedback &fb, MasterWriter &writer, const Master::TCompletedResults &completed, 
+                   std::map<size_t, std::string> &tags)
+{
+  for (size_t nResult = 0; nResult < completed.size(); nResult++)
+  {
+    std::map<size_t, std::string>::iterator itTag = tags.find(completed[nResult].first);
+    if (itTag == tags.end())
+      return fb.Error(E_MASTERMAIN_LOOP) << ": Result for unknown job number " << completed[nResult].first << ".";
+    if (writer.Push(itTag->second + " " + completed[nResult].second))
+      return fb.Error(E_MASTERMAIN_LOOP) << ": Failed to write result for job " << itTag->second << " to master.";
+    tags.erase(itTag);
+  }
+  return 0;
+}
+
+
+/********************************************************************
+ *   Evaluation loop for the COMPLETION result order.  Both the
+ *   reader and the job queue announce new items on a pipe, so that
+ *   jobs from the master and completed results can be waited for
+ *   together.  Once the master has closed its output, wait for the
+ *   remaining results, and let FinishBatch deal with any jobs that
+ *   were lost.
+ *******************************************************************/
+int
+RunCompletionLoop(Feedback &fb, Master *pMaster, MasterReader &reader, MasterWriter &writer, bool bJobTags)
+{
+  int notifyPipe[2];
+  if (pipe(notifyPipe) 
+      || fcntl(notifyPipe[0], F_SETFL, O_NONBLOCK) 
+      || fcntl(notifyPipe[1], F_SETFL, O_NONBLOCK))
+    return fb.Error(E_MASTERMAIN_LOOPSETUP) << ": Failed to create notification pipe.";
+  if (pMaster->BeginBatch() 
+      || pMaster->SetResultNotifyFd(notifyPipe[1])
+      || reader.SetNotifyFd(notifyPipe[1]))
+    return fb.Error(E_MASTERMAIN_LOOPSETUP) << ": Failed to start evaluation.";
+
+  std::map<size_t, std::string> tags;
+  Master::TCompletedResults completed;
+  size_t nTotal = 0;
+  bool bEOF = false;
+  int nRet = 0;
+  while (!nRet)
+  {
+        // Jobs the reader queued before the notification pipe was
+        // set are picked up on the first pass, before any poll.
+    MasterReader::TItem item;
+    bool bTimedOut = false;
+    while (!nRet && !bEOF && !(nRet = reader.Pop(item, 0, bTimedOut)) && !bTimedOut)
+    {
+      if (item.type == MasterReader::end_of_file)
+      {
+        fb.Info(1) << "End-of-file after " << nTotal << " jobs from master.  Waiting for " 
+                   << tags.size() << " outstanding result(s).";
+        bEOF = true;
+        break;
+      }
+      else if (item.type != MasterReader::job)
+      {
+        nRet = fb.Error(E_MASTERMAIN_LOOP) << "Error while reading job " << nTotal << " from master.";
+        break;
+      }
+
+      std::string sTag;
+      if (bJobTags)
+      {
+        std::string::size_type nSep = item.sData.find_first_of(" \t");
+        sTag = item.sData.substr(0, nSep);
+        item.sData.erase(0, nSep == std::string::npos ? nSep : nSep + 1);
+      }
+      else
+      {
+        std::stringstream ss;
+        ss << nTotal;
+        sTag = ss.str();
+      }
+
+      size_t nIndex;
+      if (pMaster->Submit(item.sData, &nIndex))
+      {
+        nRet = fb.Error(E_MASTERMAIN_LOOP) << ": Failed to pass job " << sTag << " on to the slaves.";
+        break;
+      }
+      tags[nIndex] = sTag;
+      nTotal++;
+    }
+    if (nRet)
+      break;
+
+    if (pMaster->TakeCompleted(completed)
+        || WriteTaggedResults(fb, writer, completed, tags))
+    {
+      nRet = fb.Error(E_MASTERMAIN_LOOP);
+      break;
+    }
+    if (!completed.empty())
+      fb.Info(3) << "Queued " << completed.size() << " result(s) for the master, " 
+                 << tags.size() << " job(s) outstanding.";
+
+    if (bEOF && (tags.empty() || !pMaster->Pending()))
+      break;
+
+    pollfd pfd;
+    pfd.fd = notifyPipe[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, bEOF ? 1000 : -1) < 0 && errno != EINTR)
+      nRet = fb.Error(E_MASTERMAIN_LOOP) << ": Unexpected error in poll.";
+    char buf[256];
+    while (read(notifyPipe[0], buf, sizeof(buf)) > 0)
+      ;
+  }
+
+  pMaster->SetResultNotifyFd(-1);
+  reader.SetNotifyFd(-1);
+  close(notifyPipe[0]);
+  close(notifyPipe[1]);
+  if (nRet)
+    return nRet;
+
+      // Results which completed after the last notification, and
+      // results of jobs which had to be evaluated again.
+  std::vector<std::string> results;
+  if (pMaster->FinishBatch(results))
+    return fb.Error(E_MASTERMAIN_LOOP) << "Distributed evaluation failed.";
+  completed.clear();
+  for (std::map<size_t, std::string>::const_iterator itTag = tags.begin(); itTag != tags.end(); itTag++)
+    completed.push_back(std::make_pair(itTag->first, results[itTag->first]));
+  if (WriteTaggedResults(fb, writer, completed, tags))
+    return fb.Error(E_MASTERMAIN_LOOP);
+  fb.Info(1) << "Evaluated " << nTotal << " jobs in order of completion.";
+  return 0;
+}
+
+
 int RunEvalLoop(int nNumSlaves, fdostream &masterWriteStdin, fdistream &masterReadStdout)
 {
   
@@ -180,114 +499,56 @@ int RunEvalLoop(int nNumSlaves, fdostream &masterWriteStdin, fdistream &masterRe
   pthread_sigmask(SIG_UNBLOCK, &sigSet, 0);
   Signal(SIGPIPE, SignalPipe);
   
-  std::string sMasterInputMode, sMasterOutputMode;
-  int nMasterOutputLines, nMasterInputLines;
+  std::string sMasterInputMode, sMasterOutputMode, sBatchMode, sBatchMarker, sResultOrder;
+  int nPollTimeout, nQueueSize;
+  bool bStreaming, bJobTags;
   if (Options::Instance().Option("master-input-mode", sMasterInputMode)
-      || Options::Instance().Option("master-output-mode", sMasterOutputMode))
+      || Options::Instance().Option("master-streaming", bStreaming)
+      || Options::Instance().Option("master-output-mode", sMasterOutputMode)
+      || Options::Instance().Option("master-batch-mode", sBatchMode)
+      || Options::Instance().Option("master-batch-marker", sBatchMarker)
+      || Options::Instance().Option("master-poll-timeout", nPollTimeout)
+      || Options::Instance().Option("master-result-order", sResultOrder)
+      || Options::Instance().Option("master-job-tags", bJobTags)
+      || Options::Instance().Option("master-io-queue-size", nQueueSize))
     return fb.Error(E_MASTERMAIN_LOOPSETUP) << ": Failed to get the necessary options.";
+  if (sBatchMode != "POLL" && sBatchMode != "COUNT" && sBatchMode != "MARKER")
+    return fb.Error(E_MASTERMAIN_LOOPSETUP) << ": Unknown master batch mode " << sBatchMode 
+                                            << ". Should be POLL, COUNT or MARKER.";
+  if (sResultOrder != "ORDERED" && sResultOrder != "COMPLETION")
+    return fb.Error(E_MASTERMAIN_LOOPSETUP) << ": Unknown master result order " << sResultOrder 
+                                            << ". Should be ORDERED or COMPLETION.";
+  if (sResultOrder == "COMPLETION")
+    sBatchMode = "POLL"; // No framing, just jobs.
 
   JobReaderWriter rwWriter(sMasterInputMode), rwReader(sMasterOutputMode);
 
 //   fb.Warning("DEBUG: Main taking a break...");
 //   sleep(10);
 //   fb.Warning("DEBUG: Break over!");
-  size_t nJob = 0, nBatch = 0, nTotal = 0;
-  pollfd pfd;
-  pfd.fd = masterReadStdout.fd();
-  pfd.events = POLLIN;
+  MasterReader reader(masterReadStdout, rwReader, sBatchMode, sBatchMarker, nQueueSize);
+  MasterWriter writer(masterWriteStdin, rwWriter, nQueueSize);
+  if (reader.Start() || writer.Start())
+    return fb.Error(E_MASTERMAIN_LOOPSETUP) << ": Failed to start master I/O threads.";
+
+  int nRet;
+  if (sResultOrder == "COMPLETION")
+    nRet = RunCompletionLoop(fb, pMaster, reader, writer, bJobTags);
+  else if (sBatchMode == "POLL")
+    nRet = RunPollLoop(fb, pMaster, reader, writer, nPollTimeout, bStreaming);
+  else
+    nRet = RunFramedLoop(fb, pMaster, reader, writer, bStreaming);
 
-  typedef std::vector<std::string> TDataVec;
-  TDataVec data, results;
-  while (masterReadStdout.good())
+  if (writer.Close() || nRet)
   {
-        // Read jobs as long as there is pending data coming from
-        // the master.  Wait indefinitely for the first job, then
-        // wait for 10 milliseconds before assuming there will be
-        // no more data coming in this batch.  Data is not only
-        // buffered in the pipe, it may also be buffered in the
-        // fdstream::streambuf.  This means that data may be
-        // available even though poll does not indicate anything
-        // more to read from the stream.
-    int nAvail = masterReadStdout.rdbuf()->in_avail(), nPollRet = -1;
-    assert(nAvail >= 0);
-    if (nAvail == 0)
-    {
-          // If only data is empty, we may have processed the
-          // first portion of a batch.  Check for more input, but
-          // don't wait indefinitely.
-      int nTimeout = (data.empty() && results.empty()) ? -1 : 10;
-      fb.Info(3, "Polling for data, timeout is ") << nTimeout << "...";
-      pfd.revents = 0;
-      nPollRet = poll(&pfd, 1, nTimeout);
-      fb.Info(3, "Poll returned ") << nPollRet << " (timeout " << nTimeout << ").";
-          // nPollRet > 0 means returned events, i.e. data
-          // available.
-    }
-    if (nAvail > 0 || nPollRet > 0)
+    if (writer.Failed())
     {
-      fb.Info(3, "Reading job data from master...");
-      string sJob;
-      JobReaderWriter::int_type nRet = rwReader.Read(masterReadStdout, sJob);
-      if (nRet == JobReaderWriter::traits_type::eof())
-      {
-        fb.Info(1) << ": End-of-file when reading job " << nJob << " in batch " << nBatch 
-                   << " (i.e. job " << nTotal << " in total) from master."
-                   << "  Assuming the simulation is complete.";
-        break;
-      }
-      else if (nRet)
-        return fb.Error(E_MASTERMAIN_LOOP) << "Error while reading job " << nJob << " in batch " << nBatch 
-                                           << " (i.e. job " << nTotal << " in total) from master.";
-
-      data.push_back(sJob);
-      nJob++;
-      nTotal++;
+      fb.Warning("Writing to master failed, assuming master process has died.  "
+                 "Shutting down distribution system.");
+      master_pid = 0;
+      DistributorLauncher::Instance().DestroyDistributor(pMaster);
     }
-        // nPollRet == 0 means timeout, i.e. no more data coming.
-        // Send for eval.  However, do not print out the results
-        // immediately.  It is possible that the current job set
-        // is only part of a batch (in the process of being)
-        // written from the master.  In this case, the remaining
-        // data were probably written while evaluation took
-        // place.  Trying to write results may cause both pipes
-        // to fill up, which results in a deadlock.  Instead,
-        // keep evaluating and stack up the results until no more
-        // data has appeared during the last evaluation step.
-        // This is not 100% safe, but it is still rather likely
-        // to work.  The 100% alternative is to revert to batch
-        // options: simple/lines, EOF or poll.
-    else if (nPollRet == 0)
-    {
-      if (!data.empty())
-      {
-        fb.Info(2) << "Read " << data.size() << " jobs from master via stdin, now sending data for evaluation...\n";
-        TDataVec newResults(data.size());
-        if (pMaster->Evaluate(data, newResults))
-          return fb.Error(E_MASTERMAIN_LOOP) << "Distributed evaluation failed.";
-        copy(newResults.begin(), newResults.end(), back_inserter(results));
-        fb.Info(2, "Results received!");
-      }
-      else
-      {
-        fb.Info(2) << "Writing " << results.size() << " results to master..";
-
-        for (size_t nJ = 0; nJ < results.size(); nJ++)
-        {
-          if (rwWriter.Write(masterWriteStdin, results[nJ]))
-            return fb.Error(E_MASTERMAIN_LOOP) << ": Failed to write results to master.";
-        }
-
-        fb.Info(2) << "Results written to master.\n";
-        results.clear();
-      }
-      data.clear();    
-      nBatch++;
-      nJob = 0;
-    } 
-        // Finally, nPollRet < 0 means error.
-    else
-      return fb.Error(E_MASTERMAIN_LOOP) << "Unexpected error in poll (value returned is "
-                                         << nPollRet << ").";
+    return fb.Error(E_MASTERMAIN_LOOP);
   }
   
   fb.Info(1, "Simulation complete. Shutting down slaves...");
@@ -312,17 +573,31 @@ master_main(int argc, char *argv[])
   pthread_sigmask(SIG_BLOCK, &sigSet, 0);
 
   Feedback fb("Master main");
-  int nInfoLevel;
-  std::string sInfoShow, sInfoHide;
-  bool bReportTime;
+  int nInfoLevel, nInfoBuffer;
+  std::string sInfoShow, sInfoHide, sMetricsFile, sMetricsFormat, sTraceFile;
+  float fMetricsInterval;
+  bool bReportTime, bProfile;
   if (Options::Instance().Option("verbosity", nInfoLevel)
       || Options::Instance().Option("verbosity-showonly", sInfoShow)
       || Options::Instance().Option("verbosity-dontshow", sInfoHide)
-      || Options::Instance().Option("report-total-simulation-time", bReportTime))
+      || Options::Instance().Option("verbosity-buffer", nInfoBuffer)
+      || Options::Instance().Option("report-total-simulation-time", bReportTime)
+      || Options::Instance().Option("metrics-file", sMetricsFile)
+      || Options::Instance().Option("metrics-format", sMetricsFormat)
+      || Options::Instance().Option("metrics-interval", fMetricsInterval)
+      || Options::Instance().Option("trace-file", sTraceFile)
+      || Options::Instance().Option("profile", bProfile))
     return fb.Error(E_MASTERMAIN_SETUP) << ": Unable to get system verbosity options.";
   fb.SetInfoLevel(nInfoLevel);
   fb.SetShowHide(sInfoShow, sInfoHide);
+  if (nInfoBuffer > 0)
+    fb.SetAsyncOutput(nInfoBuffer);
   timer.ReportOnDestroy(bReportTime);
+  Profiler::Enable(bProfile);
+  if (!sMetricsFile.empty() && Metrics::Instance().StartExport(sMetricsFile, sMetricsFormat, fMetricsInterval))
+    return fb.Error(E_MASTERMAIN_SETUP) << ": Unable to start exporting metrics.";
+  if (!sTraceFile.empty() && Trace::Instance().Start(sTraceFile, 0, "Master"))
+    return fb.Error(E_MASTERMAIN_SETUP) << ": Unable to start tracing.";
 
       // Create signal forwarding thread
   pthread_t sigThread;
@@ -337,8 +612,12 @@ master_main(int argc, char *argv[])
 
       // Create two pipes, input pipe and output pipe, and connect to
       // streams.  For Pvm, this is necessary since we fork later
-      // on. For MPI, we just do it to get blocking on read.
-  MemoryPipe pipeInput, pipeOutput;
+      // on. For MPI, we just do it to get blocking on read.  Large
+      // messages pass through in chunks, so let the pipes hold as
+      // much as the streams read at a time.
+  MemoryPipe pipeInput(custiobufbase::buffersize), pipeOutput(custiobufbase::buffersize);
+  pipeInput.ExportOccupancy("input");
+  pipeOutput.ExportOccupancy("output");
   mpistream pipeInputRead(&pipeInput), pipeOutputRead(&pipeOutput);
   mpostream pipeInputWrite(&pipeInput), pipeOutputWrite(&pipeOutput);
 
@@ -396,10 +675,14 @@ master_main(int argc, char *argv[])
 
       // Only kill the master process if something goes wrong,
       // otherwise let it die a natural death.
-  if (int nRet = RunEvalLoop(nNumSlaves, masterWriteStdin, masterReadStdout))
+      // If the master process died, the evaluation loop has already
+      // shut down the slaves, and master_pid is 0.  Let the message
+      // passing subsystem go down normally in that case.
+  int nEvalRet = RunEvalLoop(nNumSlaves, masterWriteStdin, masterReadStdout);
+  if (nEvalRet && master_pid)
   {
     KillProcess(master_pid, sMaster, fb);
-    return nRet;
+    return nEvalRet;
   }
 
 //       // Sleep to see if the slaves will go down because we leave the mpi subsystem time enough to pass on TERMINATE messages...
@@ -413,6 +696,17 @@ master_main(int argc, char *argv[])
   pthread_join(sender.GetThreadId(), 0);
   fb.Info(2, "MPI message sender stopped and joined.");
   pthread_join(MessageRouter::Instance().GetReceiverThreadId(), 0);
+  Metrics::Instance().StopExport();
+  Trace::Instance().Stop();
+  if (Profiler::Enabled())
+  {
+    std::stringstream ssReport;
+    ssReport << "Profile of master:\n";
+    Profiler::Instance().Report(ssReport);
+    std::cerr << ssReport.str();
+  }
+  if (nEvalRet)
+    return nEvalRet;
   fb.Info(2, "Message router stopped and joined.  Waiting for master program to finish.");
   pid_t waitRet = wait(0);
   if (waitRet != master_pid)
@@ -24,6 +24,8 @@
  *******************************************************************/
 
 #include <simdist/messages.h>
+#include <simdist/io_utils.h>
+#include <simdist/misc_utils.h>
 #include <iostream>
 #include <cstdlib>
 
@@ -386,7 +388,7 @@ MessageRouter::CheckShutdown(const std::string &sServer, const std::string &sMes
 {
   bShutdown = false;
 
-  std::stringstream ss(sMessage);
+  imemstream ss(sMessage);
   std::string sTag, sServerMsg;
   std::getline(ss, sTag);
   std::getline(ss, sServerMsg);
@@ -477,59 +479,25 @@ MessageStreamer::MessageStreamer()
 int 
 MessageStreamer::StreamEncode(std::ostream &s, const std::string &sServer, const std::string &sMessage)
 {
-      // Stream in the first EOF.  When simply assigning, it is
-      // overwritten by the subsequent stream op.
-  std::stringstream ssEOF;
-  ssEOF << "EOF";
-  while (sMessage.find(ssEOF.str()) != std::string::npos)
-    ssEOF << "-" << rand();
-
-  s << sServer << std::endl << ssEOF.str().c_str() << std::endl;
-  s << sMessage << std::endl;
-  s << ssEOF.str().c_str() << std::endl << std::flush;
-
-  if (s.good())
-    return 0;
-  return m_fb.Error(E_MESSAGESTREAMER_SEND) << ": Stream not good after write.";
+  s << sServer << "\n";
+  if (JobReaderWriter(JobReaderWriter::chunked).Write(s, sMessage) || !s.good())
+    return m_fb.Error(E_MESSAGESTREAMER_SEND) << ": Stream not good after write.";
+  return 0;
 }
 
 
 int 
 MessageStreamer::StreamDecode(std::istream &s, std::string &sServer, std::string &sMessage)
 {
-  bool bEOFReached = false;
-  std::string sEOF, sLine;
-
-//   m_fb.Info(2, "sleeeeping..");
-//   sleep(10);
   m_fb.Info(3, "reading..");
 
-  s >> sServer >> sEOF;
-
-  m_fb.Info(4, "About to read message from ") << sServer << " until next EOF-mark: " << sEOF << ".";
+  if (!std::getline(s, sServer))
+    return m_fb.Error(E_MESSAGESTREAMER_READ) << ", no more messages.";
 
-      // Chomp off newline after sEOF
-  std::getline(s, sLine);
-
-  int nLineCtr = 0;
-  while (std::getline(s, sLine))
-  {
-    m_fb.Info(4, "read line: ") << sLine;
-    if (sLine == sEOF)
-    {
-      bEOFReached = true;
-      break;
-    }
-    else
-    {
-      if (nLineCtr++) // Can't test on sMessage.empty(). See comment in utils/ReadJob.
-        sMessage += "\n";
-      sMessage += sLine;
-    }
-  }
+  m_fb.Info(4, "About to read message from ") << sServer << ".";
 
-  if (!bEOFReached)
-    return m_fb.Error(E_MESSAGESTREAMER_READ) << ", EOF mark never reached.";
+  if (JobReaderWriter(JobReaderWriter::chunked).Read(s, sMessage))
+    return m_fb.Error(E_MESSAGESTREAMER_READ) << ", message from " << sServer << " is incomplete.";
 
   m_fb.Info(4) << "Received message from " << sServer << ":\n" << sMessage << ".";
 
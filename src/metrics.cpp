@@ -0,0 +1,437 @@
+/********************************************************************
+ *   		metrics.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   See header file for description.
+ *******************************************************************/
+
+#if HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <simdist/metrics.h>
+#include <simdist/misc_utils.h>
+#include <simdist/errorcodes_thread.h>
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <signal.h>
+#include <sys/time.h>
+
+// FeedbackError E_METRICS_REGISTER("Failed to register metric");
+DEFINE_FEEDBACK_ERROR(E_METRICS_REGISTER, "Failed to register metric")
+// FeedbackError E_METRICS_EXPORT("Failed to export metrics");
+DEFINE_FEEDBACK_ERROR(E_METRICS_EXPORT, "Failed to export metrics")
+
+
+volatile bool Metrics::m_bEnabled = false;
+
+const double MetricsHistogram::bucket_limits[MetricsHistogram::num_buckets - 1] =
+  { 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 50, 100, 500, 1000 };
+
+
+MetricsHistogram::MetricsHistogram()
+  : m_nSumMicros(0)
+{
+  for (int nBucket = 0; nBucket < num_buckets; nBucket++)
+    m_counts[nBucket] = 0;
+}
+
+
+void
+MetricsHistogram::Add(double dSeconds)
+{
+  int nBucket = 0;
+  while (nBucket < num_buckets - 1 && dSeconds > bucket_limits[nBucket])
+    nBucket++;
+  __sync_fetch_and_add(&m_counts[nBucket], 1);
+  __sync_fetch_and_add(&m_nSumMicros, static_cast<uint64_t>(dSeconds > 0 ? dSeconds * 1e6 : 0));
+}
+
+
+uint64_t
+MetricsHistogram::Count(int nBucket) const
+{
+  return m_counts[nBucket];
+}
+
+
+uint64_t
+MetricsHistogram::Count() const
+{
+  uint64_t nCount = 0;
+  for (int nBucket = 0; nBucket < num_buckets; nBucket++)
+    nCount += m_counts[nBucket];
+  return nCount;
+}
+
+
+double
+MetricsHistogram::Sum() const
+{
+  return m_nSumMicros / 1e6;
+}
+
+
+
+void *metrics_thread_func(void *pArg)
+{
+  Metrics *pMetrics = static_cast<Metrics*>(pArg);
+  pMetrics->m_fb.RegisterThreadDescription("Metrics");
+  sigset_t sigSet;
+  sigfillset(&sigSet);
+  pthread_sigmask(SIG_BLOCK, &sigSet, 0);
+  pMetrics->ExportLoop();
+  return 0;
+}
+
+
+Metrics::Metrics()
+  : m_fb("Metrics")
+  , m_format(prometheus)
+  , m_dInterval(10)
+  , m_bRunning(false)
+  , m_mtx("Metrics-mutex")
+  , m_bStop(false)
+{
+}
+
+
+/********************************************************************
+ *   The metrics themselves are never deleted, since threads which
+ *   are still running at exit may update them until the very end.
+ *******************************************************************/
+Metrics::~Metrics()
+{
+  StopExport();
+}
+
+
+Metrics&
+Metrics::Instance()
+{
+  static Metrics instance;
+  return instance;
+}
+
+
+/********************************************************************
+ *   Find or create the metric sName with the given label.  A name
+ *   may only be used for one type of metric.
+ *******************************************************************/
+void *
+Metrics::Register(EType type, const std::string &sName, const std::string &sHelp,
+                  const std::string &sLabelName, const std::string &sLabelValue)
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+  {
+    m_fb.Error(E_METRICS_REGISTER) << ": " << sName << ".";
+    return 0;
+  }
+  TFamilyMap::iterator itFamily = m_families.find(sName);
+  if (itFamily == m_families.end())
+  {
+    itFamily = m_families.insert(std::make_pair(sName, TFamily())).first;
+    itFamily->second.type = type;
+    itFamily->second.sHelp = sHelp;
+  }
+  else if (itFamily->second.type != type)
+  {
+    m_fb.Error(E_METRICS_REGISTER) << ": " << sName << " is already registered as another type of metric.";
+    return 0;
+  }
+
+  const std::string sLabel = sLabelName.empty() ? "" : sLabelName + "=\"" + sLabelValue + "\"";
+  TLabelMap::iterator itMetric = itFamily->second.metrics.find(sLabel);
+  if (itMetric != itFamily->second.metrics.end())
+    return itMetric->second.pMetric;
+
+  TMetric metric;
+  metric.type = type;
+  if (type == counter)
+    metric.pMetric = new MetricsCounter;
+  else if (type == gauge)
+    metric.pMetric = new MetricsGauge;
+  else
+    metric.pMetric = new MetricsHistogram;
+  itFamily->second.metrics[sLabel] = metric;
+  return metric.pMetric;
+}
+
+
+/********************************************************************
+ *   On failure, the metric returned is a dummy which is never
+ *   exported, so that callers need not check.
+ *******************************************************************/
+MetricsCounter&
+Metrics::Counter(const std::string &sName, const std::string &sHelp,
+                 const std::string &sLabelName /*=""*/, const std::string &sLabelValue /*=""*/)
+{
+  static MetricsCounter dummy;
+  void *pMetric = Register(counter, sName, sHelp, sLabelName, sLabelValue);
+  return pMetric ? *static_cast<MetricsCounter*>(pMetric) : dummy;
+}
+
+
+MetricsGauge&
+Metrics::Gauge(const std::string &sName, const std::string &sHelp,
+               const std::string &sLabelName /*=""*/, const std::string &sLabelValue /*=""*/)
+{
+  static MetricsGauge dummy;
+  void *pMetric = Register(gauge, sName, sHelp, sLabelName, sLabelValue);
+  return pMetric ? *static_cast<MetricsGauge*>(pMetric) : dummy;
+}
+
+
+MetricsHistogram&
+Metrics::Histogram(const std::string &sName, const std::string &sHelp,
+                   const std::string &sLabelName /*=""*/, const std::string &sLabelValue /*=""*/)
+{
+  static MetricsHistogram dummy;
+  void *pMetric = Register(histogram, sName, sHelp, sLabelName, sLabelValue);
+  return pMetric ? *static_cast<MetricsHistogram*>(pMetric) : dummy;
+}
+
+
+int
+Metrics::StartExport(const std::string &sFile, const std::string &sFormat, double dInterval)
+{
+  if (m_bRunning)
+    return m_fb.Error(E_METRICS_EXPORT) << ": The export has already been started.";
+  if (sFormat == "PROMETHEUS")
+    m_format = prometheus;
+  else if (sFormat == "JSON")
+    m_format = json;
+  else
+    return m_fb.Error(E_METRICS_EXPORT) << ": Unknown format \"" << sFormat
+                                        << "\".  Available formats are PROMETHEUS and JSON.";
+  m_sFile = sFile;
+  m_dInterval = dInterval > 0 ? dInterval : 10;
+  m_bStop = false;
+  m_bEnabled = true;
+  if (pthread_create(&m_thread, 0, metrics_thread_func, this))
+  {
+    m_bEnabled = false;
+    return m_fb.Error(E_METRICS_EXPORT) << ": Failed to create export thread.";
+  }
+  m_bRunning = true;
+  m_fb.Info(1) << "Writing metrics to " << m_sFile << " every " << m_dInterval << " seconds.";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Stop the export thread, and write the final values.  The
+ *   metrics stay enabled, as other threads may still be updating
+ *   them.
+ *******************************************************************/
+int
+Metrics::StopExport()
+{
+  if (!m_bRunning)
+    return 0;
+
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_METRICS_EXPORT);
+  m_bStop = true;
+  m_condStop.Signal();
+  mtx.Unlock();
+
+  pthread_join(m_thread, 0);
+  m_bRunning = false;
+  return WriteFile();
+}
+
+
+void
+Metrics::ExportLoop()
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return;
+  while (!m_bStop)
+  {
+    timeval now;
+    gettimeofday(&now, 0);
+    long int nUSec = now.tv_usec + static_cast<long int>(m_dInterval * 1e6);
+    timespec deadline;
+    deadline.tv_sec = now.tv_sec + nUSec / 1000000L;
+    deadline.tv_nsec = (nUSec % 1000000L) * 1000L;
+    int nRet = 0;
+    while (!m_bStop && nRet != ETIMEDOUT)
+      if ((nRet = m_condStop.TimedWait(mtx.GetLockedMutex(), deadline)) && nRet != ETIMEDOUT)
+      {
+        m_fb.Error(E_COND_WAIT);
+        return;
+      }
+    if (m_bStop)
+      break;
+    mtx.Unlock();
+    WriteFile();
+    if (m_mtx.AcquireMutex(mtx))
+      return;
+  }
+}
+
+
+/********************************************************************
+ *   Write to a temporary file next to m_sFile, and rename it.
+ *******************************************************************/
+int
+Metrics::WriteFile() const
+{
+  const std::string sTemp = m_sFile + ".tmp";
+  {
+    std::ofstream file(sTemp.c_str());
+    if (!file)
+      return m_fb.Error(E_METRICS_EXPORT) << ": Failed to open " << sTemp << ": " << strerror(errno) << ".";
+    if (Write(file, m_format))
+      return m_fb.Error(E_METRICS_EXPORT);
+    file.close();
+    if (!file)
+      return m_fb.Error(E_METRICS_EXPORT) << ": Failed to write " << sTemp << ".";
+  }
+  if (rename(sTemp.c_str(), m_sFile.c_str()))
+    return m_fb.Error(E_METRICS_EXPORT) << ": Failed to rename " << sTemp << " to "
+                                        << m_sFile << ": " << strerror(errno) << ".";
+  return 0;
+}
+
+
+int
+Metrics::Write(std::ostream &s, EFormat format) const
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_METRICS_EXPORT);
+  s.precision(10);
+  if (format == prometheus)
+    WritePrometheus(s);
+  else
+    WriteJson(s);
+  return s.good() ? 0 : 1;
+}
+
+
+/********************************************************************
+ *   Prometheus text exposition format.  Histogram buckets are
+ *   cumulative, with an le label.
+ *******************************************************************/
+void
+Metrics::WritePrometheus(std::ostream &s) const
+{
+  static const char *type_names[] = { "counter", "gauge", "histogram" };
+  for (TFamilyMap::const_iterator itFamily = m_families.begin(); itFamily != m_families.end(); itFamily++)
+  {
+    const std::string &sName = itFamily->first;
+    s << "# HELP " << sName << " " << itFamily->second.sHelp << "\n"
+      << "# TYPE " << sName << " " << type_names[itFamily->second.type] << "\n";
+    for (TLabelMap::const_iterator itMetric = itFamily->second.metrics.begin();
+         itMetric != itFamily->second.metrics.end(); itMetric++)
+    {
+      const std::string &sLabel = itMetric->first;
+      const std::string sLabels = sLabel.empty() ? "" : "{" + sLabel + "}";
+      if (itFamily->second.type == counter)
+        s << sName << sLabels << " " << static_cast<MetricsCounter*>(itMetric->second.pMetric)->Value() << "\n";
+      else if (itFamily->second.type == gauge)
+        s << sName << sLabels << " " << static_cast<MetricsGauge*>(itMetric->second.pMetric)->Value() << "\n";
+      else
+      {
+        const MetricsHistogram *pHist = static_cast<MetricsHistogram*>(itMetric->second.pMetric);
+        const std::string sPrefix = sName + "_bucket{" + (sLabel.empty() ? "" : sLabel + ",") + "le=\"";
+        uint64_t nCumulative = 0;
+        for (int nBucket = 0; nBucket < MetricsHistogram::num_buckets; nBucket++)
+        {
+          nCumulative += pHist->Count(nBucket);
+          s << sPrefix;
+          if (nBucket < MetricsHistogram::num_buckets - 1)
+            s << MetricsHistogram::bucket_limits[nBucket];
+          else
+            s << "+Inf";
+          s << "\"} " << nCumulative << "\n";
+        }
+        s << sName << "_sum" << sLabels << " " << pHist->Sum() << "\n"
+          << sName << "_count" << sLabels << " " << nCumulative << "\n";
+      }
+    }
+  }
+}
+
+
+/********************************************************************
+ *   One JSON object, with the time of writing (seconds since the
+ *   epoch) and an array of
+ *   metrics.  Histogram buckets are given per bucket, not
+ *   cumulatively, as [upper limit, count] pairs, where the last
+ *   limit is null (+Inf).  Label values are written as they are, so
+ *   they must not contain quotes or backslashes.
+ *******************************************************************/
+void
+Metrics::WriteJson(std::ostream &s) const
+{
+  static const char *type_names[] = { "counter", "gauge", "histogram" };
+  timeval now;
+  gettimeofday(&now, 0);
+  s << "{\"timestamp\": " << now.tv_sec << ", \"metrics\": [";
+  bool bFirst = true;
+  for (TFamilyMap::const_iterator itFamily = m_families.begin(); itFamily != m_families.end(); itFamily++)
+  {
+    for (TLabelMap::const_iterator itMetric = itFamily->second.metrics.begin();
+         itMetric != itFamily->second.metrics.end(); itMetric++)
+    {
+      s << (bFirst ? "\n" : ",\n") << "  {\"name\": \"" << itFamily->first << "\", \"type\": \""
+        << type_names[itFamily->second.type] << "\", \"labels\": {";
+      const std::string &sLabel = itMetric->first;
+      std::string::size_type nEq = sLabel.find('=');
+      if (nEq != std::string::npos)
+        s << "\"" << sLabel.substr(0, nEq) << "\": " << sLabel.substr(nEq + 1);
+      s << "}, ";
+      bFirst = false;
+
+      if (itFamily->second.type == counter)
+        s << "\"value\": " << static_cast<MetricsCounter*>(itMetric->second.pMetric)->Value() << "}";
+      else if (itFamily->second.type == gauge)
+        s << "\"value\": " << static_cast<MetricsGauge*>(itMetric->second.pMetric)->Value() << "}";
+      else
+      {
+        const MetricsHistogram *pHist = static_cast<MetricsHistogram*>(itMetric->second.pMetric);
+        s << "\"count\": " << pHist->Count() << ", \"sum\": " << pHist->Sum() << ", \"buckets\": [";
+        for (int nBucket = 0; nBucket < MetricsHistogram::num_buckets; nBucket++)
+        {
+          s << (nBucket ? ", [" : "[");
+          if (nBucket < MetricsHistogram::num_buckets - 1)
+            s << MetricsHistogram::bucket_limits[nBucket];
+          else
+            s << "null";
+          s << ", " << pHist->Count(nBucket) << "]";
+        }
+        s << "]}";
+      }
+    }
+  }
+  s << "\n]}\n";
+}
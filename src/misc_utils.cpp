@@ -23,12 +23,20 @@
  *   See header file for description.
  *******************************************************************/
 
+#if HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
 #include <simdist/misc_utils.h>
 
 #include <set>
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <limits>
+#include <algorithm>
+#include <iterator>
 #include <cassert>
 
 #include <unistd.h>
@@ -38,9 +46,17 @@
 #include <sys/fcntl.h>
 #include <errno.h>
 #include <poll.h>
+#include <sched.h>
+#include <time.h>
 #include <cassert>
 #include <cstring>
 
+#if HAVE_SPAWN_H && HAVE_POSIX_SPAWNP
+#include <spawn.h>
+#define USE_POSIX_SPAWN 1
+extern char **environ;
+#endif
+
 // FeedbackError E_UTILS_PIPE("Failed to create pipe");
 DEFINE_FEEDBACK_ERROR(E_UTILS_PIPE, "Failed to create pipe")
 // FeedbackError E_UTILS_CONNECT("Failed to launch and/connect to child process");
@@ -90,6 +106,35 @@ custiobufbase::xsputn(const char *s, std::streamsize num)
 
 
 
+/********************************************************************
+ *   Default gathered write, one DoWrite per buffer.  Buffers which
+ *   can write several blocks in one system call override DoWriteV.
+ *******************************************************************/
+ssize_t
+custiobufbase::DoWriteV(const struct iovec *pIov, int nIovCnt)
+{
+  ssize_t nTotal = 0;
+  for (int nIov = 0; nIov < nIovCnt; nIov++)
+  {
+    ssize_t nWritten = DoWrite(pIov[nIov].iov_base, pIov[nIov].iov_len);
+    if (nWritten != static_cast<ssize_t>(pIov[nIov].iov_len))
+      return -1;
+    nTotal += nWritten;
+  }
+  return nTotal;
+}
+
+
+ssize_t
+custiobufbase::write_gathered(const struct iovec *pIov, int nIovCnt)
+{
+  if (!is_open())
+    return -1;
+  return DoWriteV(pIov, nIovCnt);
+}
+
+
+
 custiobufbase::int_type
 custiobufbase::underflow()
 {
@@ -188,13 +233,13 @@ custiobufbase::xsgetn(char* s, std::streamsize nNum)
 
 
 fdiobuf::fdiobuf()
-    : m_nFd(-1)
+    : m_nFd(-1), m_dDeadline(0), m_bTimedOut(false)
 {
 }
 
 
 fdiobuf::fdiobuf(int nFd)
-    : m_nFd(nFd)
+    : m_nFd(nFd), m_dDeadline(0), m_bTimedOut(false)
 {
 }
 
@@ -202,6 +247,12 @@ void
 fdiobuf::set_fd(int nFd)
 {
   m_nFd = nFd;
+  m_dDeadline = 0;
+  m_bTimedOut = false;
+      // Discard any input buffered from the previous descriptor.
+  setg(m_szBuf + putbacksize, 
+       m_szBuf + putbacksize,
+       m_szBuf + putbacksize);
 }
 
 
@@ -228,12 +279,86 @@ fdiobuf::fd() const
 }
 
 
+static double
+MonotonicSeconds()
+{
+#if HAVE_CLOCK_GETTIME
+  struct timespec ts;
+  if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+  return time(0);
+}
+
+
+int
+fdiobuf::set_timeout(double dSeconds)
+{
+  if (!is_open())
+    return -1;
+
+  m_bTimedOut = false;
+  m_dDeadline = (dSeconds > 0 ? MonotonicSeconds() + dSeconds : 0);
+
+  int nFlags = fcntl(m_nFd, F_GETFL);
+  if (nFlags == -1)
+    return -1;
+  nFlags = (m_dDeadline ? nFlags | O_NONBLOCK : nFlags & ~O_NONBLOCK);
+  return fcntl(m_nFd, F_SETFL, nFlags) == -1 ? -1 : 0;
+}
+
+
+bool
+fdiobuf::timed_out() const
+{
+  return m_bTimedOut;
+}
+
+
+/********************************************************************
+ *   Block until the descriptor is ready for nEvents, or the
+ *   deadline has passed.  Returns immediately if no timeout is
+ *   set.
+ *******************************************************************/
+int
+fdiobuf::WaitReady(short nEvents)
+{
+  while (m_dDeadline)
+  {
+    double dRemaining = m_dDeadline - MonotonicSeconds();
+    if (dRemaining <= 0)
+    {
+      m_bTimedOut = true;
+      errno = ETIMEDOUT;
+      return -1;
+    }
+
+    struct pollfd pfd = { m_nFd, nEvents, 0 };
+    int nReady = poll(&pfd, 1, static_cast<int>(dRemaining * 1000) + 1);
+    if (nReady > 0)
+      return 0;
+    if (nReady == -1 && errno != EINTR)
+      return -1;
+  }
+  return 0;
+}
+
+
 ssize_t
 fdiobuf::DoRead(void *pBuf, size_t nCount)
 {
   if (!is_open())
     return -1;
-  return ::read(m_nFd, pBuf, nCount);
+
+  ssize_t nRead;
+  do
+  {
+    if (WaitReady(POLLIN))
+      return -1;
+    nRead = ::read(m_nFd, pBuf, nCount);
+  }
+  while (nRead == -1 && m_dDeadline && (errno == EAGAIN || errno == EINTR));
+  return nRead;
 }
 
 
@@ -242,7 +367,72 @@ fdiobuf::DoWrite(const void *pBuf, size_t nCount)
 {
   if (!is_open())
     return -1;
-  return ::write(m_nFd, pBuf, nCount);
+  if (!m_dDeadline)
+    return ::write(m_nFd, pBuf, nCount);
+
+      // Non-blocking mode: Keep writing until all the data is
+      // written or the deadline passes.
+  const char *pData = static_cast<const char*>(pBuf);
+  size_t nWritten = 0;
+  while (nWritten < nCount)
+  {
+    if (WaitReady(POLLOUT))
+      return -1;
+    ssize_t nRet = ::write(m_nFd, pData + nWritten, nCount - nWritten);
+    if (nRet == -1)
+    {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+      return -1;
+    }
+    nWritten += nRet;
+  }
+  return nWritten;
+}
+
+
+/********************************************************************
+ *   Write all the buffers with as few calls to writev as possible,
+ *   resuming after partial writes.  The buffer list is copied to
+ *   the stack, so that partial writes can be resumed without
+ *   allocating memory; longer lists are written one by one.
+ *******************************************************************/
+ssize_t
+fdiobuf::DoWriteV(const struct iovec *pIov, int nIovCnt)
+{
+  enum { max_iov = 16 };
+  if (!is_open())
+    return -1;
+  if (nIovCnt > max_iov)
+    return custiobufbase::DoWriteV(pIov, nIovCnt);
+
+  struct iovec iov[max_iov];
+  std::copy(pIov, pIov + nIovCnt, iov);
+  const size_t nIov = nIovCnt;
+  size_t nFirst = 0;
+  ssize_t nTotal = 0;
+  while (nFirst < nIov)
+  {
+    if (WaitReady(POLLOUT))
+      return -1;
+    ssize_t nRet = ::writev(m_nFd, iov + nFirst, static_cast<int>(nIov - nFirst));
+    if (nRet == -1)
+    {
+      if (errno == EINTR || (m_dDeadline && errno == EAGAIN))
+        continue;
+      return -1;
+    }
+    nTotal += nRet;
+    size_t nDone = nRet;
+    while (nFirst < nIov && nDone >= iov[nFirst].iov_len)
+      nDone -= iov[nFirst++].iov_len;
+    if (nFirst < nIov)
+    {
+      iov[nFirst].iov_base = static_cast<char*>(iov[nFirst].iov_base) + nDone;
+      iov[nFirst].iov_len -= nDone;
+    }
+  }
+  return nTotal;
 }
 
 
@@ -348,6 +538,20 @@ fdstream::is_open() const
 }
 
 
+int
+fdstream::set_timeout(double dSeconds)
+{
+  return m_buf.set_timeout(dSeconds);
+}
+
+
+bool
+fdstream::timed_out() const
+{
+  return m_buf.timed_out();
+}
+
+
 fdostream::fdostream(int nFd)
     : fdstream(nFd), std::ostream(&m_buf)
 {
@@ -539,11 +743,41 @@ mpistream::mpistream()
 
 
 
+imembuf::imembuf(const char *pData, size_t nCount)
+{
+      // The get area pointers are non-const, but the buffer is only
+      // ever read.
+  char *p = const_cast<char*>(pData);
+  setg(p, p, p + nCount);
+}
+
+
+imemstream::imemstream(const char *pData, size_t nCount)
+    : imembuf(pData, nCount), std::istream(static_cast<imembuf*>(this))
+{
+}
+
+
+imemstream::imemstream(const std::string &sData)
+    : imembuf(sData.data(), sData.size()), std::istream(static_cast<imembuf*>(this))
+{
+}
+
+
 MemoryPipe::MemoryPipe(int nBufSize)
     : m_condBufData()
     , m_condBufSpace()
     , m_buf(nBufSize), m_nCurBufSize(0), m_bIsOpen(true)
+    , m_pOccupancy(0)
+{
+}
+
+
+void
+MemoryPipe::ExportOccupancy(const std::string &sName)
 {
+  m_pOccupancy = &Metrics::Instance().Gauge("simdist_memory_pipe_bytes", "Bytes buffered in each memory pipe",
+                                            "pipe", sName);
 }
 
 
@@ -596,6 +830,8 @@ MemoryPipe::Read(void *pBuf, size_t nNumBytes)
     pBuf = static_cast<char*>(pBuf) + nReadNow;
     m_nCurBufSize -= nReadNow;
     memmove(&(m_buf[0]), &(m_buf[nReadNow]), m_nCurBufSize);
+    if (m_pOccupancy)
+      m_pOccupancy->Set(m_nCurBufSize);
         // Up the "free space in buffer" semaphore, since we have
         // removed data.
     m_condBufSpace.Signal();
@@ -634,6 +870,8 @@ MemoryPipe::Write(const void *pBuf, size_t nNumBytes)
     pBuf = static_cast<const char*>(pBuf) + nWrittenNow;
     m_nCurBufSize += nWrittenNow;
     nBytesWritten += nWrittenNow;
+    if (m_pOccupancy)
+      m_pOccupancy->Set(m_nCurBufSize);
         // Up the "data in buffer" semaphore if 0
     m_condBufData.Signal();
   }
@@ -938,15 +1176,86 @@ CreateArgumentVector(const std::string &sArgLine, std::vector<std::string> &argv
 int 
 ConnectProcess(const std::string &sFile, const std::string &sArgs, 
                fdostream *pWriteStdin, fdistream *pReadStdout, fdistream *pReadStderr,
-               pid_t *pChildPid, int *pnFileDescriptors)
+               pid_t *pChildPid, int *pnFileDescriptors, TSpawnMethod method /*=spawn_default*/)
 {
   Feedback fb("ConnectProcess utility routine");
   std::vector<std::string> argVec;
   if (CreateArgumentVector(sArgs, argVec))
     return fb.Error(E_UTILS_CONNECT) << ": Failed to parse child process argument line.";
   argVec.insert(argVec.begin(), sFile);
-  return ConnectProcess(argVec, pWriteStdin, pReadStdout, pReadStderr, pChildPid, pnFileDescriptors);
+  return ConnectProcess(argVec, pWriteStdin, pReadStdout, pReadStderr, pChildPid, pnFileDescriptors, method);
+}
+
+
+#if defined(USE_POSIX_SPAWN)
+/********************************************************************
+ *   Launch the child process with posix_spawnp.  The file actions
+ *   perform the same dup2/close sequence as the child branch of
+ *   the fork code in ConnectProcess below, and the signal mask is
+ *   cleared the same way.  glibc implements posix_spawn with
+ *   clone(CLONE_VM|CLONE_VFORK), so the parent page tables are
+ *   never copied and the cost of launching a child does not grow
+ *   with the resident set of the parent.
+ *
+ *   bDup tells which of the stdio descriptors of the child to
+ *   connect to the pipes.
+ *******************************************************************/
+static int
+SpawnProcess(const std::vector<std::string> &argVec, const bool bDup[3],
+             const int nChildStdIn[2], const int nChildStdOut[2], const int nChildStdErr[2],
+             pid_t &nPid, Feedback &fb)
+{
+  std::vector<char*> argv(argVec.size() + 1, 0);
+  for (size_t n = 0; n < argVec.size(); n++)
+    argv[n] = const_cast<char*>(argVec[n].c_str());
+
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  if (int nErr = posix_spawn_file_actions_init(&actions))
+    return fb.Error(E_UTILS_CONNECT) << ": Failed to initialize spawn file actions. System error message: " 
+                                     << strerror(nErr) << ".";
+  if (int nErr = posix_spawnattr_init(&attr))
+  {
+    posix_spawn_file_actions_destroy(&actions);
+    return fb.Error(E_UTILS_CONNECT) << ": Failed to initialize spawn attributes. System error message: " 
+                                     << strerror(nErr) << ".";
+  }
+
+  const int *pPipes[3] = { nChildStdIn, nChildStdOut, nChildStdErr };
+  int nErr = 0;
+  for (int nFd = 0; nFd < 3 && !nErr; nFd++)
+    if (bDup[nFd])
+      nErr = posix_spawn_file_actions_adddup2(&actions, pPipes[nFd][nFd == 0 ? 0 : 1], nFd);
+  for (int nPipe = 0; nPipe < 3 && !nErr; nPipe++)
+    if (!(nErr = posix_spawn_file_actions_addclose(&actions, pPipes[nPipe][0])))
+      nErr = posix_spawn_file_actions_addclose(&actions, pPipes[nPipe][1]);
+
+      // Unblock all signals with blocking inherited from parent.
+  sigset_t sigSet;
+  sigemptyset(&sigSet);
+  short nFlags = POSIX_SPAWN_SETSIGMASK;
+#if defined(POSIX_SPAWN_USEVFORK)
+      // Ignored by newer glibc versions, which always use vfork
+      // semantics, but needed by older ones.
+  nFlags |= POSIX_SPAWN_USEVFORK;
+#endif
+  if (!nErr)
+    nErr = posix_spawnattr_setsigmask(&attr, &sigSet);
+  if (!nErr)
+    nErr = posix_spawnattr_setflags(&attr, nFlags);
+  int nRet = 0;
+  if (nErr)
+    nRet = fb.Error(E_UTILS_CONNECT) << ": Failed to set up spawn attributes. System error message: " 
+                                     << strerror(nErr) << ".";
+  else if ((nErr = posix_spawnp(&nPid, argv[0], &actions, &attr, &(argv[0]), environ)))
+    nRet = fb.Error(E_UTILS_CONNECT) << ": Failed to spawn child process " << argv[0] 
+                                     << ". System error message: " << strerror(nErr) << ".";
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  return nRet;
 }
+#endif
 
 // This one only prints out info
 // #define PIDPIPE(x) std::cerr << "Pid " << getpid() << ": created pipe " << #x << "; fds " << x[0] << " and " << x[1] << "\n" << std::flush
@@ -956,7 +1265,7 @@ ConnectProcess(const std::string &sFile, const std::string &sArgs,
 int 
 ConnectProcess(const std::vector<std::string> &argVec, 
                fdostream *pWriteStdin, fdistream *pReadStdout, fdistream *pReadStderr,
-               pid_t *pChildPid, int *pnFileDescriptors)
+               pid_t *pChildPid, int *pnFileDescriptors, TSpawnMethod method /*=spawn_default*/)
 {
   Feedback fb("ConnectProcess utility routine");
   
@@ -1001,13 +1310,40 @@ ConnectProcess(const std::vector<std::string> &argVec,
   fcntl(nChildStdOut[0], F_SETFD, 1);
   fcntl(nChildStdErr[0], F_SETFD, 1);
 
-  pid_t nPid = fork();
-  if (pChildPid && nPid)
-    *pChildPid = nPid;
+      // Only connect the child stdio descriptors if we have a pipe
+      // on the parent end.
+  const bool bDup[3] = { pnFileDescriptors || pWriteStdin, 
+                         pnFileDescriptors || pReadStdout, 
+                         pnFileDescriptors || pReadStderr };
+
+  if (method == spawn_default)
+    method = spawn_posix;
+#if !defined(USE_POSIX_SPAWN)
+  method = spawn_fork;
+#endif
 
-  if (nPid == -1)
+  pid_t nPid = -1;
+  if (method == spawn_posix)
+  {
+#if defined(USE_POSIX_SPAWN)
+    if (int nRet = SpawnProcess(argVec, bDup, nChildStdIn, nChildStdOut, nChildStdErr, nPid, fb))
+    {
+      close(nChildStdIn[0]);
+      close(nChildStdIn[1]);
+      close(nChildStdOut[0]);
+      close(nChildStdOut[1]);
+      close(nChildStdErr[0]);
+      close(nChildStdErr[1]);
+      return nRet;
+    }
+#endif
+  }
+  else if ((nPid = fork()) == -1)
     return fb.Error(E_UTILS_CONNECT) << ": Failed to fork. System error message: " << strerror(errno) << ".";
 
+  if (pChildPid && nPid)
+    *pChildPid = nPid;
+
   if (nPid)
   {
     if (pReadStdout)
@@ -1018,9 +1354,9 @@ ConnectProcess(const std::vector<std::string> &argVec,
       pReadStderr->set_fd(nChildStdErr[0]);
     
         // If pnFileDescriptors is also 0, we may close the unused
-        // pipes.  The equivalent test is performed below for the
-        // child; only dup2'ing standard communications channels if
-        // the inverse of one of the tests below holds.
+        // pipes.  The equivalent test is performed for the child
+        // through bDup; only dup2'ing standard communications
+        // channels if the inverse of one of the tests below holds.
     if (!pnFileDescriptors)
     {
       if (!pWriteStdin)
@@ -1037,9 +1373,9 @@ ConnectProcess(const std::vector<std::string> &argVec,
   else
   {
         // Only dup2 if we have a pipe on the parent end (see above).
-    if (((pnFileDescriptors || pWriteStdin) && dup2(nChildStdIn[0], 0) == -1)
-        || ((pnFileDescriptors || pReadStdout) && dup2(nChildStdOut[1], 1) == -1)
-        || ((pnFileDescriptors || pReadStderr) && dup2(nChildStdErr[1], 2) == -1))
+    if ((bDup[0] && dup2(nChildStdIn[0], 0) == -1)
+        || (bDup[1] && dup2(nChildStdOut[1], 1) == -1)
+        || (bDup[2] && dup2(nChildStdErr[1], 2) == -1))
       return fb.Error(E_UTILS_CONNECT) << ": Failed to connect pipes for I/O communication "
                                        << "with parent process to stdio descriptors.";
     close(nChildStdIn[0]);
@@ -1133,6 +1469,222 @@ KillProcess(pid_t pid, const std::string &sChildName, Feedback &fb)
 }
 
 
+TResourceUsage::TResourceUsage()
+  : dUserTime(0)
+  , dSystemTime(0)
+  , nMaxRSS(0)
+  , nVoluntaryCtxSwitches(0)
+  , nInvoluntaryCtxSwitches(0)
+{
+}
+
+
+TResourceUsage&
+TResourceUsage::Add(const TResourceUsage &usage)
+{
+  dUserTime += usage.dUserTime;
+  dSystemTime += usage.dSystemTime;
+  nMaxRSS = std::max(nMaxRSS, usage.nMaxRSS);
+  nVoluntaryCtxSwitches += usage.nVoluntaryCtxSwitches;
+  nInvoluntaryCtxSwitches += usage.nInvoluntaryCtxSwitches;
+  return *this;
+}
+
+
+TResourceUsage&
+TResourceUsage::Subtract(const TResourceUsage &usage)
+{
+  dUserTime -= usage.dUserTime;
+  dSystemTime -= usage.dSystemTime;
+  nVoluntaryCtxSwitches -= usage.nVoluntaryCtxSwitches;
+  nInvoluntaryCtxSwitches -= usage.nInvoluntaryCtxSwitches;
+  return *this;
+}
+
+
+/********************************************************************
+ *   Whitespace-separated, as used in the RESULTS message.
+ *******************************************************************/
+std::ostream& 
+operator<<(std::ostream &os, const TResourceUsage &usage)
+{
+  return os << usage.dUserTime << " " << usage.dSystemTime << " " << usage.nMaxRSS << " "
+            << usage.nVoluntaryCtxSwitches << " " << usage.nInvoluntaryCtxSwitches;
+}
+
+
+std::istream& 
+operator>>(std::istream &is, TResourceUsage &usage)
+{
+  return is >> usage.dUserTime >> usage.dSystemTime >> usage.nMaxRSS
+            >> usage.nVoluntaryCtxSwitches >> usage.nInvoluntaryCtxSwitches;
+}
+
+
+int
+ProcessResourceUsage(pid_t pid, TResourceUsage &usage)
+{
+  usage = TResourceUsage();
+
+  std::stringstream ssPath;
+  ssPath << "/proc/" << pid << "/";
+  std::ifstream stat((ssPath.str() + "stat").c_str());
+  std::string sStat;
+  if (!std::getline(stat, sStat))
+    return 1;
+
+      // The command name in field 2 may contain spaces, so start
+      // parsing after its closing parenthesis.  utime, stime, cutime
+      // and cstime are then the 12th to 15th fields.
+  std::string::size_type nPos = sStat.rfind(')');
+  if (nPos == std::string::npos)
+    return 1;
+  std::stringstream ssStat(sStat.substr(nPos + 1));
+  std::string sField;
+  for (int nField = 0; nField < 11; nField++)
+    ssStat >> sField;
+  long nTicks[4];
+  for (int nField = 0; nField < 4; nField++)
+    ssStat >> nTicks[nField];
+  if (!ssStat)
+    return 1;
+  const double dTickSecs = 1.0 / sysconf(_SC_CLK_TCK);
+  usage.dUserTime = (nTicks[0] + nTicks[2]) * dTickSecs;
+  usage.dSystemTime = (nTicks[1] + nTicks[3]) * dTickSecs;
+
+  std::ifstream status((ssPath.str() + "status").c_str());
+  std::string sKey;
+  while (status >> sKey)
+  {
+    if (sKey == "VmHWM:")
+      status >> usage.nMaxRSS;
+    else if (sKey == "voluntary_ctxt_switches:")
+      status >> usage.nVoluntaryCtxSwitches;
+    else if (sKey == "nonvoluntary_ctxt_switches:")
+      status >> usage.nInvoluntaryCtxSwitches;
+    status.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+  return 0;
+}
+
+int
+ParseCpuList(const std::string &sList, std::vector<int> &cpus)
+{
+  cpus.clear();
+  std::stringstream ss(sList);
+  std::string sRange;
+  while (std::getline(ss, sRange, ','))
+  {
+    sRange = Trim(sRange);
+    if (sRange.empty())
+      continue;
+    int nFirst, nLast;
+    char chDash;
+    std::stringstream ssRange(sRange);
+    if (!(ssRange >> nFirst))
+      return 1;
+    if (ssRange >> chDash)
+    {
+      if (chDash != '-' || !(ssRange >> nLast) || nLast < nFirst)
+        return 1;
+    }
+    else
+      nLast = nFirst;
+    for (int nCpu = nFirst; nCpu <= nLast; nCpu++)
+      cpus.push_back(nCpu);
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return 0;
+}
+
+
+static int
+ReadCpuListFile(const std::string &sFile, std::vector<int> &cpus)
+{
+  std::ifstream file(sFile.c_str());
+  std::string sList;
+  if (!std::getline(file, sList))
+    return 1;
+  return ParseCpuList(sList, cpus);
+}
+
+
+int
+ReadCpuTopology(std::vector<std::vector<int> > &nodeCpus)
+{
+  static const std::string sys_dir = "/sys/devices/system/";
+  nodeCpus.clear();
+
+  std::vector<int> online;
+  if (ReadCpuListFile(sys_dir + "cpu/online", online))
+  {
+    long nNumCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nNumCpus <= 0)
+      return 1;
+    for (int nCpu = 0; nCpu < nNumCpus; nCpu++)
+      online.push_back(nCpu);
+  }
+
+  std::vector<int> nodes;
+  if (!ReadCpuListFile(sys_dir + "node/online", nodes))
+  {
+    for (size_t nNode = 0; nNode < nodes.size(); nNode++)
+    {
+      std::stringstream ssFile;
+      ssFile << sys_dir << "node/node" << nodes[nNode] << "/cpulist";
+      std::vector<int> cpus, onlineCpus;
+      if (ReadCpuListFile(ssFile.str(), cpus))
+        continue;
+      std::set_intersection(cpus.begin(), cpus.end(), online.begin(), online.end(), 
+                            std::back_inserter(onlineCpus));
+      if (!onlineCpus.empty())
+        nodeCpus.push_back(onlineCpus);
+    }
+  }
+
+  if (nodeCpus.empty())
+    nodeCpus.push_back(online);
+  return 0;
+}
+
+
+int
+GetProcessAffinity(pid_t pid, std::vector<int> &cpus)
+{
+  cpus.clear();
+#if HAVE_SCHED_SETAFFINITY
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  if (sched_getaffinity(pid, sizeof(cpuSet), &cpuSet))
+    return -1;
+  for (int nCpu = 0; nCpu < CPU_SETSIZE; nCpu++)
+    if (CPU_ISSET(nCpu, &cpuSet))
+      cpus.push_back(nCpu);
+  return 0;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+
+int
+SetProcessAffinity(pid_t pid, const std::vector<int> &cpus)
+{
+#if HAVE_SCHED_SETAFFINITY
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (size_t nCpu = 0; nCpu < cpus.size(); nCpu++)
+    if (cpus[nCpu] >= 0 && cpus[nCpu] < CPU_SETSIZE)
+      CPU_SET(cpus[nCpu], &cpuSet);
+  return sched_setaffinity(pid, sizeof(cpuSet), &cpuSet);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 
 int
 Signal(int nSignal, void (*pHandler) (int), void (**ppOldHandler) (int) /*=0*/)
@@ -0,0 +1,247 @@
+/********************************************************************
+ *   		profiler.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   See header file for description.
+ *******************************************************************/
+
+#if HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <simdist/profiler.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <cstring>
+
+#include <time.h>
+#include <sys/time.h>
+
+
+volatile bool Profiler::m_bEnabled = false;
+__thread Profiler::TThreadStats *Profiler::m_pThreadStats = 0;
+
+
+/********************************************************************
+ *   Bucket of a duration: Four per power of two, split on the two
+ *   bits below the highest set bit.
+ *******************************************************************/
+static int
+Bucket(uint64_t nNs)
+{
+  if (nNs < 4)
+    return static_cast<int>(nNs);
+  const int nHighBit = 63 - __builtin_clzll(nNs);
+  const int nBucket = 4 * nHighBit + static_cast<int>((nNs >> (nHighBit - 2)) & 3);
+  return std::min(nBucket, Profiler::num_buckets - 1);
+}
+
+
+/********************************************************************
+ *   The middle of a bucket, in nanoseconds.
+ *******************************************************************/
+static double
+BucketMiddle(int nBucket)
+{
+  if (nBucket < 8)
+    return nBucket;
+  const double dBase = static_cast<double>(static_cast<uint64_t>(1) << (nBucket / 4));
+  return dBase * (1 + (nBucket % 4 + 0.5) / 4);
+}
+
+
+
+Profiler::Profiler()
+  : m_mtx("Profiler-mutex")
+{
+}
+
+
+Profiler&
+Profiler::Instance()
+{
+  static Profiler instance;
+  return instance;
+}
+
+
+void
+Profiler::Enable(bool bEnable /*=true*/)
+{
+  m_bEnabled = bEnable;
+}
+
+
+uint64_t
+Profiler::Now()
+{
+#if HAVE_CLOCK_GETTIME
+  struct timespec ts;
+  if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+  timeval tv;
+  gettimeofday(&tv, 0);
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000000 + tv.tv_usec * 1000;
+}
+
+
+/********************************************************************
+ *   Returns the index of the region, or -1 if there are too many.
+ *******************************************************************/
+int
+Profiler::Register(const std::string &sName)
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return -1;
+  std::vector<std::string>::iterator itName = std::find(m_regionNames.begin(), m_regionNames.end(), sName);
+  if (itName != m_regionNames.end())
+    return static_cast<int>(itName - m_regionNames.begin());
+  if (m_regionNames.size() >= static_cast<size_t>(max_regions))
+    return -1;
+  m_regionNames.push_back(sName);
+  return static_cast<int>(m_regionNames.size()) - 1;
+}
+
+
+/********************************************************************
+ *   The first time a thread uses a region, its stats are allocated
+ *   and published to the report under the lock.  After that, only
+ *   this thread writes them.
+ *******************************************************************/
+Profiler::TRegionStats*
+Profiler::ThreadRegion(int nRegion)
+{
+  if (m_pThreadStats && m_pThreadStats->regions[nRegion])
+    return m_pThreadStats->regions[nRegion];
+
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return 0;
+  if (!m_pThreadStats)
+  {
+    m_pThreadStats = new TThreadStats;
+    memset(m_pThreadStats, 0, sizeof(TThreadStats));
+    m_threads.push_back(m_pThreadStats);
+  }
+  TRegionStats *pStats = new TRegionStats;
+  memset(pStats, 0, sizeof(TRegionStats));
+  m_pThreadStats->regions[nRegion] = pStats;
+  return pStats;
+}
+
+
+void
+Profiler::Add(int nRegion, uint64_t nNs)
+{
+  TRegionStats *pStats = ThreadRegion(nRegion);
+  if (!pStats)
+    return;
+  pStats->nCount++;
+  pStats->nTotalNs += nNs;
+  if (nNs > pStats->nMaxNs)
+    pStats->nMaxNs = nNs;
+  pStats->buckets[Bucket(nNs)]++;
+}
+
+
+/********************************************************************
+ *   Threads may still be adding to their stats, so the merged
+ *   counts are approximate while the program is running.
+ *******************************************************************/
+void
+Profiler::Merge(std::vector<std::pair<std::string, TRegionStats> > &regions)
+{
+  regions.clear();
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return;
+  for (size_t nRegion = 0; nRegion < m_regionNames.size(); nRegion++)
+  {
+    TRegionStats merged;
+    memset(&merged, 0, sizeof(merged));
+    for (size_t nThread = 0; nThread < m_threads.size(); nThread++)
+    {
+      const TRegionStats *pStats = m_threads[nThread]->regions[nRegion];
+      if (!pStats)
+        continue;
+      merged.nCount += pStats->nCount;
+      merged.nTotalNs += pStats->nTotalNs;
+      merged.nMaxNs = std::max(merged.nMaxNs, pStats->nMaxNs);
+      for (int nBucket = 0; nBucket < num_buckets; nBucket++)
+        merged.buckets[nBucket] += pStats->buckets[nBucket];
+    }
+    if (merged.nCount > 0)
+      regions.push_back(std::make_pair(m_regionNames[nRegion], merged));
+  }
+}
+
+
+double
+Profiler::Percentile(const TRegionStats &stats, double dQuantile)
+{
+  uint64_t nCount = 0;
+  for (int nBucket = 0; nBucket < num_buckets; nBucket++)
+    nCount += stats.buckets[nBucket];
+  if (nCount == 0)
+    return 0;
+  const double dRank = dQuantile * nCount;
+  uint64_t nSeen = 0;
+  for (int nBucket = 0; nBucket < num_buckets; nBucket++)
+    if ((nSeen += stats.buckets[nBucket]) >= dRank && stats.buckets[nBucket])
+      return std::min(BucketMiddle(nBucket), static_cast<double>(stats.nMaxNs));
+  return stats.nMaxNs;
+}
+
+
+/********************************************************************
+ *   One line per region, with times in microseconds.
+ *******************************************************************/
+void
+Profiler::Report(std::ostream &s)
+{
+  std::vector<std::pair<std::string, TRegionStats> > regions;
+  Merge(regions);
+
+  const std::ios::fmtflags oldFlags = s.flags();
+  const std::streamsize nOldPrecision = s.precision();
+  s << std::fixed << std::setprecision(1)
+    << std::left << std::setw(24) << "region" << std::right
+    << std::setw(10) << "calls" << std::setw(14) << "total (ms)" << std::setw(12) << "mean (us)"
+    << std::setw(12) << "p50 (us)" << std::setw(12) << "p90 (us)" << std::setw(12) << "p99 (us)"
+    << std::setw(12) << "max (us)" << "\n";
+  for (size_t nRegion = 0; nRegion < regions.size(); nRegion++)
+  {
+    const TRegionStats &stats = regions[nRegion].second;
+    s << std::left << std::setw(24) << regions[nRegion].first << std::right
+      << std::setw(10) << stats.nCount
+      << std::setw(14) << stats.nTotalNs / 1e6
+      << std::setw(12) << stats.nTotalNs / 1e3 / stats.nCount
+      << std::setw(12) << Percentile(stats, 0.5) / 1e3
+      << std::setw(12) << Percentile(stats, 0.9) / 1e3
+      << std::setw(12) << Percentile(stats, 0.99) / 1e3
+      << std::setw(12) << stats.nMaxNs / 1e3 << "\n";
+  }
+  s.flags(oldFlags);
+  s.precision(nOldPrecision);
+}
@@ -0,0 +1,143 @@
+/********************************************************************
+ *   		simdist_control.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Send a command to the control socket of a running simdist
+ *   master (see control.h), and print the reply.  The exit status
+ *   is 0 if the master answered OK.
+ *******************************************************************/
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+static string sProgramName, sSocket;
+
+
+int
+parse_args(int argc, char *argv[])
+{
+  struct option opts[] = {
+    {"socket"       , required_argument, 0, 's'},
+    { 0 }};
+
+  if (const char *szSocket = getenv("SIMDIST_CONTROL_SOCKET"))
+    sSocket = szSocket;
+
+  int ch;
+  while ((ch = getopt_long(argc, argv, "+s:", opts, 0)) != -1)
+  {
+    switch (ch)
+    {
+        case 's':
+          sSocket = optarg;
+          break;
+        default:
+          return 1;
+    }
+  }
+  return sSocket.empty();
+}
+
+
+
+int
+main(int argc, char *argv[])
+{
+  sProgramName = argv[0];
+  if (parse_args(argc, argv) || argc - optind < 1)
+  {
+    cerr << "Usage: " << sProgramName << " [options] command [arguments]\n"
+         << "Send a command to a running simdist master, started with --control-socket.\n"
+         << "Commands: status, queue, slaves, set NAME VALUE, help.\n"
+         << "\nOptions:\n"
+         << "-s, --socket path\tPath of the control socket.  Defaults to $SIMDIST_CONTROL_SOCKET.\n";
+    return 1;
+  }
+
+  string sCommand = argv[optind];
+  for (int nArg = optind + 1; nArg < argc; nArg++)
+    sCommand += string(" ") + argv[nArg];
+  sCommand += "\n";
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (sSocket.size() >= sizeof(addr.sun_path))
+  {
+    cerr << sProgramName << ": Socket path too long: " << sSocket << "\n";
+    return 1;
+  }
+  strcpy(addr.sun_path, sSocket.c_str());
+
+  int nFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (nFd < 0 || connect(nFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)))
+  {
+    cerr << sProgramName << ": Failed to connect to " << sSocket << ": " << strerror(errno) << "\n";
+    return 1;
+  }
+  for (size_t nPos = 0; nPos < sCommand.size(); )
+  {
+    ssize_t nWritten = write(nFd, sCommand.data() + nPos, sCommand.size() - nPos);
+    if (nWritten < 0 && errno == EINTR)
+      continue;
+    if (nWritten <= 0)
+    {
+      cerr << sProgramName << ": Failed to send command: " << strerror(errno) << "\n";
+      return 1;
+    }
+    nPos += nWritten;
+  }
+
+  string sReply;
+  char buf[4096];
+  ssize_t nRead;
+  while ((nRead = read(nFd, buf, sizeof(buf))) != 0)
+  {
+    if (nRead < 0 && errno == EINTR)
+      continue;
+    if (nRead < 0)
+    {
+      cerr << sProgramName << ": Failed to read reply: " << strerror(errno) << "\n";
+      return 1;
+    }
+    sReply.append(buf, nRead);
+  }
+  close(nFd);
+
+      // The last line is the status.
+  string::size_type nStatus = sReply.rfind('\n', sReply.size() > 1 ? sReply.size() - 2 : 0);
+  nStatus = (nStatus == string::npos ? 0 : nStatus + 1);
+  cout << sReply.substr(0, nStatus);
+  if (sReply.compare(nStatus, 3, "OK\n") == 0)
+    return 0;
+  cerr << (sReply.empty() ? "No reply from master.\n" : sReply.substr(nStatus));
+  return 1;
+}
@@ -27,6 +27,7 @@
 
 #include <simdist/options.h>
 #include <simdist/misc_utils.h>
+#include <simdist/profiler.h>
 
 #include <cassert>
 #include <string>
@@ -65,7 +66,7 @@ DEFINE_FEEDBACK_ERROR(E_SLAVECLIENT_PROCESSRESULTS, "Failed to process job resul
 DEFINE_FEEDBACK_ERROR(E_SLAVECLIENT_TERMINATE, "Failed to terminate slave")
 
 
-static const int message_version = 2;
+static const int message_version = 5;
 
 SlaveClientFactory::SlaveClientFactory()
     : m_fb("SlaveClientFactory")
@@ -155,14 +156,17 @@ SlaveClient::SlaveClient()
     : m_pBarrier(0)
     , m_pJobQueue(0)
     , m_fb("SlaveClient")
-    , m_rw(JobReaderWriter::bytecount)
-    , m_fWaitFactor(100)
+    , m_rw(JobReaderWriter::bytecount64)
     , m_nNumJobsCompleted(0)
     , m_dTotalWorkTime(0)
+    , m_jobsTaken(Metrics::Instance().Counter("simdist_jobs_taken_total", "Jobs sent to slaves, including duplicates"))
+    , m_jobsDuplicated(Metrics::Instance().Counter("simdist_jobs_duplicated_total", "Jobs sent to a slave while already being processed by another"))
+    , m_jobsTimedOut(Metrics::Instance().Counter("simdist_jobs_timed_out_total", "Jobs that timed out on a slave and were resubmitted"))
+    , m_resultsDiscarded(Metrics::Instance().Counter("simdist_results_discarded_total", "Results received for jobs already completed by another slave"))
+    , m_pJobsCompleted(0)
+    , m_pJobLatency(0)
+    , m_nTraceJobsSent(0)
 {
-  if (Options::Instance().Option("slave-wait-factor", m_fWaitFactor))
-    m_fb.Warning("Failed to get option slave-wait-factor, will default to ") 
-      << m_fWaitFactor;
 }
 
 
@@ -213,6 +217,7 @@ SlaveClient::Start(const std::string &sServer, const std::string &sEvalProgram,
  // before thread starts.
   TSlaveClientThreadData td = { sServer, sEvalProgram, sSlaveArgs, pJobQueue, this, pBarrier }, *ptd = new TSlaveClientThreadData;
   (*ptd) = td;
+  m_sName = sServer;
 
       // Create with small stack to avoid excessive use of memory.
   const int stack_size_bytes = 1024 * 50;
@@ -274,6 +279,11 @@ SlaveClient::ConnectServer(const std::string &sServer, const std::string &sSlave
   }
 
   m_fb.SetIdentifier(m_fb.Identify() + "-" + sServer);
+  m_pJobsCompleted = &Metrics::Instance().Counter("simdist_slave_jobs_completed_total",
+                                                  "Jobs completed by each slave", "slave", sServer);
+  m_pJobLatency = &Metrics::Instance().Histogram("simdist_slave_job_latency_seconds",
+                                                 "Time from sending a set of jobs to a slave until each result is received",
+                                                 "slave", sServer);
   m_fb.Info(2) << "Successfully connected to " << sServer << "!"; 
   return 0;
 }
@@ -291,12 +301,15 @@ SlaveClient::Run(JobQueue *pJobQueue)
 {
   m_pJobQueue = pJobQueue;
 
+  static ProfileRegion regionLockWait("queue-lock-wait");
   bool bQueueClosed = false;
   while (!bQueueClosed)
   {
     AutoMutex mtx;
+    ProfileScope scopeLockWait(regionLockWait);
     if (pJobQueue->AcquireMutex(mtx))
       return m_fb.Error(E_SLAVECLIENT_WAITQUEUE);
+    scopeLockWait.Stop();
     while (pJobQueue->empty() && !(bQueueClosed = pJobQueue->Closed()))
       pJobQueue->Wait();
 
@@ -341,6 +354,9 @@ SlaveClient::Run(JobQueue *pJobQueue)
 int
 SlaveClient::TakeJobs(bool &bJobsTaken)
 {
+  static ProfileRegion region("take-jobs");
+  ProfileScope scope(region);
+  TraceSpan span("SlaveClient::TakeJobs", "SlaveClient");
   if (m_pJobQueue->empty())
     return m_fb.Error(E_INTERNAL_LOGIC) << "Job queue is empty in TakeJobs routine.";
 
@@ -348,7 +364,7 @@ SlaveClient::TakeJobs(bool &bJobsTaken)
   if (!pJob->workers.empty())
   {
     double dAvgTime = ((m_nNumJobsCompleted && m_dTotalWorkTime) ? m_dTotalWorkTime / m_nNumJobsCompleted : 1);
-    double dWait = dAvgTime * m_fWaitFactor * m_pJobQueue->NumJobsPerSend();
+    double dWait = dAvgTime * m_pJobQueue->WaitFactor() * m_pJobQueue->NumJobsPerSend();
     dWait -= difftime(time(0), pJob->timeLastStart);
     if (dWait > 0)
     {
@@ -360,9 +376,12 @@ SlaveClient::TakeJobs(bool &bJobsTaken)
       return 0;
     }
     else
+    {
       m_fb.Info(2) << "Now double-processing job " + pJob->sJobID 
                    << ", which is currently being processed by "
                    << pJob->workers.size() << " other slave(s): " + pJob->WorkersToString() + ".";
+      m_jobsDuplicated.Add();
+    }
   }
   
   bJobsTaken = true;
@@ -372,8 +391,13 @@ SlaveClient::TakeJobs(bool &bJobsTaken)
     return m_fb.Error(E_INTERNAL_LOGIC) << ": Slave tried to take a new job from queue, while still processing one or more old ones (have "
                                         << m_currentJobs.size() << " jobs, should have at most " << m_pJobQueue->NumJobsPerSend() << ").";
 
+  const uint64_t nTraceNow = Trace::Enabled() ? Trace::Now() : 0;
   do
   {
+        // The time spent in the queue is traced for the first slave
+        // to take the job.
+    if (nTraceNow && pJob->nTraceQueued && pJob->workers.empty())
+      Trace::Instance().Add("queued", "SlaveClient", pJob->nTraceQueued, nTraceNow, pJob->sJobID);
     pJob->workers.insert(this);
     pJob->timeLastStart = m_fTimeJobsTaken;
     m_currentJobs[pJob->sJobID] = *pJob;
@@ -383,6 +407,7 @@ SlaveClient::TakeJobs(bool &bJobsTaken)
   } 
   while (m_currentJobs.size() < m_pJobQueue->NumJobsPerSend()
          && pJob->workers.empty()); // This also takes care of the situation where this slave has taken all jobs in the queue.
+  m_jobsTaken.Add(m_currentJobs.size());
 
   m_fb.Info(3) << "Took " << m_currentJobs.size() << " job(s) from job queue.";
   return 0;
@@ -397,6 +422,9 @@ SlaveClient::TakeJobs(bool &bJobsTaken)
 int 
 SlaveClient::SendJobs()
 {
+  TraceSpan span("SlaveClient::SendJobs", "SlaveClient");
+  static ProfileRegion regionEncode("send-encode"), regionSend("send");
+  ProfileScope scopeEncode(regionEncode);
   std::stringstream ss;
   ss << "JOB" << "\n" 
      << m_sServer << "\n" 
@@ -406,6 +434,12 @@ SlaveClient::SendJobs()
     ss << jit->first << "\n";
     m_rw.Write(ss, jit->second.sJobData);
   }
+  scopeEncode.Stop();
+  if (Metrics::Enabled())
+    gettimeofday(&m_tvJobsSent, 0);
+  if (Trace::Enabled())
+    m_nTraceJobsSent = Trace::Now();
+  ProfileScope scopeSend(regionSend);
   return m_mp.Send(m_sServer, ss.str());
 }
  
@@ -422,8 +456,11 @@ SlaveClient::ReceiveJobs(bool &bShutdown)
   std::string sMessage;
   if (m_mp.Receive(m_sServer, sMessage))
     return m_fb.Error(E_SLAVECLIENT_RECEIVE);
+  TraceSpan span("SlaveClient::ReceiveJobs", "SlaveClient");
+  static ProfileRegion region("receive-decode");
+  ProfileScope scope(region);
 
-  std::stringstream ss(sMessage);
+  imemstream ss(sMessage);
   std::string sTag, sServer;
   ss >> sTag >> sServer;
   if (sServer != m_sServer)
@@ -433,22 +470,60 @@ SlaveClient::ReceiveJobs(bool &bShutdown)
 
   if (sTag == "RESULTS")
   {
-    int nNumResults;
+    int nNumResults, nNumCompleted = 0;
     ss >> nNumResults;
     for (int nRes = 0; nRes < nNumResults; nRes++)
     {
-      std::string sJobID, sResults, sTime, sLine;
+      std::string sJobID, sResults, sStatus, sLine;
       float fTime;
-      ss >> sJobID >> fTime;
+      TResourceUsage usage;
+      ss >> sJobID >> fTime >> sStatus >> usage;
       std::getline(ss, sLine); // Chomp endline
-      if (m_rw.Read(ss, sResults)
-          || ProcessResults(sJobID, sResults, fTime))
+      if (m_rw.Read(ss, sResults))
         return m_fb.Error(E_SLAVECLIENT_RECEIVE); 
+      if (Trace::Enabled() && m_nTraceJobsSent)
+        Trace::Instance().Add("job", "SlaveClient", m_nTraceJobsSent, Trace::Now(), sJobID);
+      if (sStatus == "TIMEOUT")
+      {
+        if (RetryJob(sJobID))
+          return m_fb.Error(E_SLAVECLIENT_RECEIVE); 
+      }
+      else if (sStatus != "OK")
+        return m_fb.Error(E_SLAVECLIENT_RECEIVE) 
+          << ", unknown status \"" << sStatus << "\" for job " << sJobID << ".";
+      else
+      {
+        JournalResults(sJobID, sResults);
+        if (ProcessResults(sJobID, sResults, fTime, usage))
+          return m_fb.Error(E_SLAVECLIENT_RECEIVE); 
+        nNumCompleted++;
+      }
+    }
+        // Spans recorded on the slave follow the results, if the
+        // slave is tracing.
+    std::string sTraceTag;
+    if (ss >> sTraceTag && sTraceTag == "TRACE")
+    {
+      std::string sEvents, sLine;
+      std::getline(ss, sLine); // Chomp endline
+      if (m_rw.Read(ss, sEvents))
+        return m_fb.Error(E_SLAVECLIENT_RECEIVE) << ", failed to read trace events.";
+      if (Trace::Enabled())
+        Trace::Instance().Append(sEvents);
+    }
+    if (Metrics::Enabled() && nNumCompleted > 0)
+    {
+      timeval now;
+      gettimeofday(&now, 0);
+      double dLatency = (now.tv_sec - m_tvJobsSent.tv_sec) + (now.tv_usec - m_tvJobsSent.tv_usec) / 1e6;
+      m_pJobsCompleted->Add(nNumCompleted);
+      for (int nRes = 0; nRes < nNumCompleted; nRes++)
+        m_pJobLatency->Observe(dLatency);
     }
         // Update average processing time.  Note that this is
         // different from processing time spent on the server, as
         // recorded in the job messages.
-    m_nNumJobsCompleted += nNumResults;
+    __atomic_fetch_add(&m_nNumJobsCompleted, nNumCompleted, __ATOMIC_RELAXED);
     m_dTotalWorkTime += difftime(time(0), m_fTimeJobsTaken);
     return 0;
   } 
@@ -482,24 +557,48 @@ SlaveClient::ReceiveJobs(bool &bShutdown)
 
 
 
+/********************************************************************
+ *   Record the results in the result journal, if any, before the
+ *   master gets to see them.  The journal is written outside the
+ *   queue lock, so the other slaves are not held up by the disk.
+ *   Failing to record results is reported, but evaluation goes on.
+ *******************************************************************/
+void
+SlaveClient::JournalResults(const std::string &sJobID, const std::string &sResults)
+{
+  ResultJournal *pJournal = m_pJobQueue->Journal();
+  TJobMap::const_iterator jit = m_currentJobs.find(sJobID);
+  if (pJournal && jit != m_currentJobs.end() && pJournal->Append(jit->second.sJobData, sResults))
+    m_fb.Warning() << "Failed to record the results of job " << sJobID << " in the result journal.";
+}
+
+
 /********************************************************************
  *   Process received results from server: Add results to result set,
  *   and abort all other slaves working on the same job.
  *******************************************************************/
 int 
-SlaveClient::ProcessResults(const std::string &sJobID, const std::string &sResults, float fTime)
+SlaveClient::ProcessResults(const std::string &sJobID, const std::string &sResults, 
+                            float fTime, const TResourceUsage &usage)
 {
   TJobMap::const_iterator jit = m_currentJobs.find(sJobID);
   if (jit == m_currentJobs.end())
   {
     m_fb.Info(1) << "Received results from a job with an ID not in the list of current jobs.";
+    m_resultsDiscarded.Add();
     return 0;
   }
   m_currentJobs.erase(sJobID);
+  m_stats.Add(fTime, usage);
 
+  static ProfileRegion regionLockWait("queue-lock-wait"), region("process-results");
   AutoMutex mtx;
+  ProfileScope scopeLockWait(regionLockWait);
   if (m_pJobQueue->AcquireMutex(mtx))
     return m_fb.Error(E_SLAVECLIENT_PROCESSRESULTS) << ", couldn't lock job queue.";
+  scopeLockWait.Stop();
+  ProfileScope scope(region);
+  m_pJobQueue->AddJobStatistics(fTime, usage);
 
       // Find job in queue, since the set of workers may have changed
       // since we took the job.
@@ -519,9 +618,11 @@ SlaveClient::ProcessResults(const std::string &sJobID, const std::string &sResul
           // Store results
       job_it->workers.clear();
       m_pJobQueue->ResultSet().insert(*job_it);
+      m_pJobQueue->NotifyResult();
 
           // Remove job from job queue
       m_pJobQueue->erase(job_it);
+      m_pJobQueue->UpdateDepthMetric();
       
           // Wake up the master if necessary
       if (m_pJobQueue->empty())
@@ -535,6 +636,42 @@ SlaveClient::ProcessResults(const std::string &sJobID, const std::string &sResul
       // simply means that two servers completed processing the same
       // job.
   m_fb.Info(2) << "Received results for a job not found in job queue. Job ID: " << sJobID;
+  m_resultsDiscarded.Add();
+  return 0;
+}
+
+
+/********************************************************************
+ *   A job timed out on the slave server, which has restarted its
+ *   slave process.  Put the job back at the front of the queue, so
+ *   that it is retried by the next available slave.
+ *******************************************************************/
+int
+SlaveClient::RetryJob(const std::string &sJobID)
+{
+  m_currentJobs.erase(sJobID);
+
+  AutoMutex mtx;
+  if (m_pJobQueue->AcquireMutex(mtx))
+    return m_fb.Error(E_SLAVECLIENT_PROCESSRESULTS) << ", couldn't lock job queue.";
+
+  for(JobQueue::iterator job_it = m_pJobQueue->begin(); job_it != m_pJobQueue->end(); job_it++)
+  {
+    if (sJobID == job_it->sJobID)
+    {
+      job_it->workers.erase(this);
+      m_pJobQueue->AddTimeout();
+      m_jobsTimedOut.Add();
+      m_fb.Warning("Job ") << sJobID << " timed out on server " << m_sServer 
+                           << ", resubmitting job.";
+      m_pJobQueue->splice(m_pJobQueue->begin(), *m_pJobQueue, job_it);
+      m_pJobQueue->Signal();
+      return 0;
+    }
+  }
+      // The job has been completed by another slave in the meantime.
+  m_fb.Info(2) << "Job " << sJobID << " timed out on server " << m_sServer 
+               << ", but has already been completed by another slave.";
   return 0;
 }
 
@@ -593,6 +730,27 @@ SlaveClient::Server() const
 }
 
 
+const std::string&
+SlaveClient::Name() const
+{
+  return m_sName;
+}
+
+
+int
+SlaveClient::NumJobsCompleted() const
+{
+  return __atomic_load_n(&m_nNumJobsCompleted, __ATOMIC_RELAXED);
+}
+
+
+const JobStatistics&
+SlaveClient::Statistics() const
+{
+  return m_stats;
+}
+
+
 //===========================================================================
 
 
@@ -25,6 +25,7 @@
 
 #include <simdist/slave_channel.h>
 #include <simdist/messages.h>
+#include <simdist/io_utils.h>
 #include <cstdlib>
 
 // FeedbackError E_SLAVECHANNELSENDER_THREAD("Failed to create thread running slave send channel loop");
@@ -94,27 +95,42 @@ SlaveChannelSender::SetInputChannel(std::istream *pIc)
 }
 
 
+int
+SlaveChannelSender::SendMessagePart(const std::string &sServer, const std::string &sPart, bool bLast)
+{
+  m_sMessage += sPart;
+  if (!bLast)
+    return 0;
+  int nRet = SendMessage(sServer, m_sMessage);
+  m_sMessage.clear();
+  return nRet;
+}
+
+
+/********************************************************************
+ *   Pass on messages from the input channel one chunk at a time.
+ *   The format is described in messages.h.  Shutdown messages are
+ *   small, so looking at the first chunk is enough.
+ *******************************************************************/
 int 
 SlaveChannelSender::Run()
 {
-  std::string sServer;
+  const JobReaderWriter rw(JobReaderWriter::chunked);
+  std::string sServer, sPart;
   while (std::getline(*m_pInChannel, sServer))
   {
-    std::string sEOF, sLine, sMessage;
-    std::getline(*m_pInChannel, sEOF);
-    int nLineCtr = 0;
-    while (std::getline(*m_pInChannel, sLine))
+    bool bShutdown = false;
+    for (bool bFirst = true; ; bFirst = false)
     {
-      if (sLine == sEOF)
+      if (rw.ReadChunk(*m_pInChannel, sPart))
+        return m_fb.Error(E_SLAVECHANNELSENDER_RUN) << ": Failed to read message to " << sServer << ".";
+      if (bFirst && MessageRouter::Instance().CheckShutdown(sServer, sPart, bShutdown))
+        return m_fb.Error(E_SLAVECHANNELSENDER_RUN);
+      if (SendMessagePart(sServer, sPart, sPart.empty()))
+        return m_fb.Error(E_SLAVECHANNELSENDER_RUN);
+      if (sPart.empty())
         break;
-      sMessage += (nLineCtr++ ? "\n" : "") + sLine; // Can't test on sMessage.empty(). See comment in utils/ReadJob.
     }
-    if (SendMessage(sServer, sMessage))
-      return m_fb.Error(E_SLAVECHANNELSENDER_RUN);
-    
-    bool bShutdown;
-    if (MessageRouter::Instance().CheckShutdown(sServer, sMessage, bShutdown))
-      return m_fb.Error(E_SLAVECHANNELSENDER_RUN);
     if (bShutdown)
       break;
   }
@@ -166,36 +182,38 @@ SlaveChannelReceiver::SetOutputChannel(std::ostream *pOc)
 }
 
 
+int
+SlaveChannelReceiver::ReceiveMessagePart(std::string &sServer, std::string &sPart, bool &bMore)
+{
+  bMore = false;
+  return ReceiveMessage(sServer, sPart);
+}
+
+
 int
 SlaveChannelReceiver::Run()
 {
   m_fb.Info(2, "Starting Run loop.");
-  std::string sServer, sMessage;
-  while (!ReceiveMessage(sServer, sMessage))
+  const JobReaderWriter rw(JobReaderWriter::chunked);
+  std::string sServer, sPart;
+  bool bFirst = true, bMore, bShutdown = false;
+  while (!ReceiveMessagePart(sServer, sPart, bMore))
   {
-    std::stringstream ssEOF;
-    ssEOF << "EOF";
-    while (sMessage.find(ssEOF.str()) != std::string::npos)
-      ssEOF << "-" << rand();
-
-//     m_fb.Info(3) << "Received a message from " << sServer << ":" << sMessage << ".";
-//     m_fb.Info(4) << "The message received was: " << sMessage << ".";
-    
-    *m_pOutChannel << sServer << "\n" 
-                   << ssEOF.str() << "\n"
-                   << sMessage << "\n"
-                   << ssEOF.str() << "\n";
-    m_pOutChannel->flush();
-    if (!m_pOutChannel->good())
+    if (bFirst)
+    {
+      if (MessageRouter::Instance().CheckShutdown(sServer, sPart, bShutdown))
+        return m_fb.Error(E_SLAVECHANNELRECEIVER_RUN);
+      *m_pOutChannel << sServer << "\n";
+    }
+    if ((!sPart.empty() && rw.WriteChunk(*m_pOutChannel, sPart.data(), sPart.size()))
+        || (!bMore && rw.WriteChunk(*m_pOutChannel, 0, 0)))
       return m_fb.Error(E_SLAVECHANNELRECEIVER_WRITE);
+    bFirst = !bMore;
+    if (bMore)
+      continue;
     m_fb.Info(3) << "Message received and passed on.";
-
-    bool bShutdown;
-    if (MessageRouter::Instance().CheckShutdown(sServer, sMessage, bShutdown))
-      return m_fb.Error(E_SLAVECHANNELRECEIVER_RUN);
     if (bShutdown)
       break;
   }
   return 0;
 }
-
@@ -25,7 +25,10 @@
 
 #include <simdist/slave_mpi.h>
 #include <simdist/messages.h>
+#include <simdist/metrics.h>
+#include <simdist/trace.h>
 
+#include <algorithm>
 #include <time.h>
 #include <cstdlib>
 
@@ -108,14 +111,33 @@ MPICommunicatorStream::MPICommunicatorStream (MPICommunicator &c, int nRank, int
 
 const MPICommunicatorStream& 
 MPICommunicatorStream::operator<<(const std::string &s) const
+{
+  m_comm.m_fb.Info(4) << "Sending the following MPI-message to rank " << m_nRank << ":\n" << s;
+  for (size_t nPos = 0; ; nPos += MPICommunicator::chunk_size)
+  {
+    const size_t nCount = std::min(s.size() - nPos, static_cast<size_t>(MPICommunicator::chunk_size));
+    SendPart(s.data() + nPos, nCount);
+    if (nCount < MPICommunicator::chunk_size || !m_comm.good())
+      break;
+  }
+  return *this;
+}
+
+
+const MPICommunicatorStream& 
+MPICommunicatorStream::SendPart(const char *pData, size_t nCount) const
 {
   AutoMutex mtx;
   try {
-    m_comm.m_fb.Info(4) << "Sending the following MPI-message to rank " << m_nRank << ":\n" << s;
     if (m_comm.Mutex().AcquireMutex(mtx))
       m_comm.m_fb.Error(E_MPICOMMUNICATOR_SEND);
     else
-      m_comm.Send(s.c_str(), static_cast<int>(s.size()), MPI::CHAR, m_nRank, m_nTag);
+    {
+      m_comm.Send(pData, static_cast<int>(nCount), MPI::CHAR, m_nRank, m_nTag);
+      static MetricsCounter &bytesSent = Metrics::Instance().Counter("simdist_transport_bytes_sent_total",
+                                                                    "Bytes sent by each transport", "transport", "mpi");
+      bytesSent.Add(nCount);
+    }
   } catch (MPI::Exception e) {
     if (m_comm.good())
     {
@@ -187,7 +209,8 @@ MPICommunicatorStream::SingleThreadedReceive(std::string &s) const
  *   This receive function is made for use with multithreaded
  *   access to the MPI library.  Instead of blocking on a
  *   receive, it will repeatedly perform a protected probe,
- *   followed by a sleep, until a message arrives.
+ *   followed by a sleep, until a message arrives.  The message is
+ *   received straight into the end of s.
  *******************************************************************/
 const MPICommunicatorStream& 
 MPICommunicatorStream::MultiThreadedReceive(std::string &s) const
@@ -212,19 +235,45 @@ MPICommunicatorStream::MultiThreadedReceive(std::string &s) const
   }
 
   m_comm.SetLastRecvRankTag(status.Get_source(), status.Get_tag());
-      // Add terminating 0
-  std::vector<char> v(status.Get_count(MPI::CHAR));
-  m_comm.Recv(&(v[0]), static_cast<int>(v.size()), MPI::CHAR, m_nRank, m_nTag);
-  s.assign(reinterpret_cast<const char*>(&v[0]), v.size()); // Use assign in case of non-text message.
+      // Receive the probed message, not just any message matching
+      // m_nRank and m_nTag, which may be MPI::ANY_SOURCE: Another
+      // message may have arrived from a different source since the
+      // probe.
+  const size_t nOld = s.size(), nCount = status.Get_count(MPI::CHAR);
+  s.resize(nOld + nCount);
+  m_comm.Recv(s.empty() ? 0 : &s[0] + nOld, static_cast<int>(nCount), MPI::CHAR, status.Get_source(), status.Get_tag());
   return *this;
 }
 
 
+/********************************************************************
+ *   Receive all the parts of the next message.  Once the first part
+ *   has arrived, the rest are received from the same source and
+ *   with the same tag; MPI keeps messages between two processes in
+ *   order.
+ *******************************************************************/
 const MPICommunicatorStream& 
 MPICommunicatorStream::operator>>(std::string &s) const
 {
-  s.clear(); // Must clear for recursion to work correctly in single threaded mode.
+  s.clear();
+  bool bMore;
+  ReceivePart(s, bMore);
+  if (bMore)
+  {
+    int nRank, nTag;
+    m_comm.GetLastRecvRankTag(nRank, nTag);
+    MPICommunicatorStream part(m_comm, nRank, nTag);
+    while (bMore)
+      part.ReceivePart(s, bMore);
+  }
+  return *this;
+}
 
+
+const MPICommunicatorStream& 
+MPICommunicatorStream::ReceivePart(std::string &s, bool &bMore) const
+{
+  const size_t nOld = s.size();
   try {
     if (m_comm.m_threadMode != MPICommunicator::singlethreaded
         && m_comm.m_threadMode != MPICommunicator::multithreaded)
@@ -237,9 +286,13 @@ MPICommunicatorStream::operator>>(std::string &s) const
                         << "threaded mode from rank " << m_nRank 
                         << (m_nRank == MPI::ANY_SOURCE ? " (MPI::ANY_SOURCE)." : ".");
     if (m_comm.m_threadMode == MPICommunicator::singlethreaded)
-      return SingleThreadedReceive(s);
+    {
+      std::string sPart; // Must be empty for recursion to work correctly.
+      SingleThreadedReceive(sPart);
+      s += sPart;
+    }
     else
-      return MultiThreadedReceive(s);
+      MultiThreadedReceive(s);
 
   } catch (MPI::Exception e) {
     if (m_comm.good())
@@ -251,6 +304,10 @@ MPICommunicatorStream::operator>>(std::string &s) const
         << ". Description: " << e.Get_error_string() << ".";
     }
   }
+  bMore = m_comm.good() && s.size() - nOld == MPICommunicator::chunk_size;
+  static MetricsCounter &bytesReceived = Metrics::Instance().Counter("simdist_transport_bytes_received_total",
+                                                                      "Bytes received by each transport", "transport", "mpi");
+  bytesReceived.Add(s.size() - nOld);
   return *this;
 }
 
@@ -297,6 +354,7 @@ MPISender::SendMessage(const std::string &sServer, const std::string &sMessage)
 
   m_fb.Info(4) << "About to send message to server " << sServer << ", with rank " << nRank << ".";
 
+  TraceSpan span("MPISender::SendMessage", "MPI");
   m_comm(nRank, message_tag) << sMessage;
   if (!m_comm.good())
     return m_fb.Error(E_MPISENDER_SEND);
@@ -304,6 +362,47 @@ MPISender::SendMessage(const std::string &sServer, const std::string &sMessage)
 }
 
 
+/********************************************************************
+ *   Pass on the parts from the input channel in MPI chunks as they
+ *   fill up, so that at most one chunk of a message is held here.
+ *******************************************************************/
+int
+MPISender::SendMessagePart(const std::string &sServer, const std::string &sPart, bool bLast)
+{
+  if (!m_comm.good())
+    return m_fb.Error(E_MPISENDERRECEIVER_COMM);
+
+  m_sPending += sPart;
+  if (m_sPending.size() < MPICommunicator::chunk_size && !bLast)
+    return 0;
+
+  int nRank;
+  if (GetRank(sServer, nRank))
+  {
+    m_fb.Warning() << "Unable to send message to server " << sServer 
+                   << ": Could not get rank (ID) for that server. Message discarded.";
+    m_sPending.clear();
+    return 0;
+  }
+
+  TraceSpan span("MPISender::SendMessagePart", "MPI");
+  size_t nPos = 0;
+  for (; m_sPending.size() - nPos >= MPICommunicator::chunk_size; nPos += MPICommunicator::chunk_size)
+    m_comm(nRank, message_tag).SendPart(m_sPending.data() + nPos, MPICommunicator::chunk_size);
+  if (bLast)
+  {
+    m_comm(nRank, message_tag).SendPart(m_sPending.data() + nPos, m_sPending.size() - nPos);
+    m_sPending.clear();
+  }
+  else
+    m_sPending.erase(0, nPos);
+
+  if (!m_comm.good())
+    return m_fb.Error(E_MPISENDER_SEND);
+  return 0;
+}
+
+
 /********************************************************************
  *   Return the server id corresponding to rank nRank.
  *
@@ -386,6 +485,8 @@ MPISender::GetRank(const std::string &sServer, int &nRank)
 
 MPIReceiver::MPIReceiver(std::ostream *pOutChannel, const MPISender &sender)
     : SlaveChannelReceiver(pOutChannel), m_fb("MPIReceiver"), m_sender(sender)
+    , m_nPartRank(MPI::ANY_SOURCE), m_nPartTag(MPI::ANY_TAG)
+    , m_nTraceFirstPart(0)
 {
 }
 
@@ -414,6 +515,44 @@ MPIReceiver::ReceiveMessage(std::string &sServer, std::string &sMessage)
 }
 
 
+/********************************************************************
+ *   Receive the next MPI chunk.  The first chunk of a message may
+ *   come from any slave, the rest from the same one.  The trace
+ *   span runs from the arrival of the first chunk to the last, as
+ *   the wait for the first chunk is mostly idle time.
+ *******************************************************************/
+int 
+MPIReceiver::ReceiveMessagePart(std::string &sServer, std::string &sPart, bool &bMore)
+{
+  if (!m_comm.good())
+    return m_fb.Error(E_MPISENDERRECEIVER_COMM);
+
+  const bool bFirstPart = (m_nPartRank == MPI::ANY_SOURCE);
+  sPart.clear();
+  m_comm(m_nPartRank, m_nPartTag).ReceivePart(sPart, bMore);
+  if (!m_comm.good())
+    return m_fb.Error(E_MPIRECEIVER_RECV);
+
+  if (Trace::Enabled())
+  {
+    const uint64_t nNow = Trace::Now();
+    if (bFirstPart)
+      m_nTraceFirstPart = nNow;
+    if (!bMore && m_nTraceFirstPart)
+      Trace::Instance().Add("MPIReceiver::ReceiveMessagePart", "MPI", m_nTraceFirstPart, nNow);
+  }
+
+  int nRank, nTag;
+  m_comm.GetLastRecvRankTag(nRank, nTag);
+  m_nPartRank = bMore ? nRank : MPI::ANY_SOURCE;
+  m_nPartTag = bMore ? nTag : MPI::ANY_TAG;
+  if (m_sender.GetServer(nRank, sServer))
+    return m_fb.Error(E_MPIRECEIVER_RECV) << ": Received a message from unknown sender.";
+
+  return 0;
+}
+
+
 // int 
 // MPIReceiver::AbortReceiveMessage()
 // {
@@ -0,0 +1,325 @@
+/********************************************************************
+ *   		slave_plugin.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   See header file for description.
+ *******************************************************************/
+
+#if HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <simdist/slave_plugin.h>
+#include <simdist/misc_utils.h>
+#include <simdist/errorcodes_thread.h>
+
+#include <functional>
+#include <memory>
+#include <cassert>
+
+#if HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+
+// FeedbackError E_PLUGIN_LOAD("Failed to load slave plugin");
+DEFINE_FEEDBACK_ERROR(E_PLUGIN_LOAD, "Failed to load slave plugin")
+// FeedbackError E_PLUGIN_EVALUATE("Slave plugin failed to evaluate jobs");
+DEFINE_FEEDBACK_ERROR(E_PLUGIN_EVALUATE, "Slave plugin failed to evaluate jobs")
+
+
+bool
+IsPlugin(const std::string &sProgram)
+{
+  static const std::string suffix = ".so";
+  return sProgram.size() > suffix.size()
+    && sProgram.compare(sProgram.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+
+typedef struct TSlavePluginThreadDataVar
+{
+  SlavePlugin *pPlugin;
+  size_t nPart;
+} TSlavePluginThreadData;
+
+
+/********************************************************************
+ *   Pool thread: Wait for a new batch, evaluate this thread's part
+ *   of it, and report back.  Runs until StopThreads is called.
+ *******************************************************************/
+void *slaveplugin_thread_func(void *pArg)
+{
+  std::auto_ptr<TSlavePluginThreadData> ptd(static_cast<TSlavePluginThreadData*>(pArg));
+  SlavePlugin *pPlugin = ptd->pPlugin;
+  pPlugin->m_fb.RegisterThreadDescription("Slaveplugin");
+
+  int nLastBatch = 0;
+  while (true)
+  {
+    AutoMutex mtx;
+    if (pPlugin->m_mtx.AcquireMutex(mtx))
+      return reinterpret_cast<void*>(1);
+    if (pPlugin->m_condWork.Wait(mtx.GetLockedMutex(),
+                                 std::bind1st(std::mem_fun(&SlavePlugin::NewBatch), pPlugin), nLastBatch))
+    {
+      pPlugin->m_fb.Error(E_COND_WAIT);
+      return reinterpret_cast<void*>(1);
+    }
+    if (pPlugin->m_bStop)
+      return 0;
+    nLastBatch = pPlugin->m_nBatch;
+    mtx.Unlock();
+
+    int nRet = pPlugin->EvaluatePart(ptd->nPart);
+
+    if (pPlugin->m_mtx.AcquireMutex(mtx))
+      return reinterpret_cast<void*>(1);
+    if (nRet)
+      pPlugin->m_nNumFailed++;
+    if (--pPlugin->m_nNumBusy == 0)
+      pPlugin->m_condDone.Signal();
+  }
+}
+
+
+
+SlavePlugin::SlavePlugin()
+  : m_fb("SlavePlugin")
+  , m_pHandle(0)
+  , m_pInit(0)
+  , m_pEvaluate(0)
+  , m_pShutdown(0)
+  , m_mtx("SlavePlugin-mutex")
+  , m_pJobs(0)
+  , m_nNumJobs(0)
+  , m_nBatch(0)
+  , m_nNumBusy(0)
+  , m_nNumFailed(0)
+  , m_bStop(false)
+{
+}
+
+
+SlavePlugin::~SlavePlugin()
+{
+  Unload();
+}
+
+
+/********************************************************************
+ *   Load the library, look up its functions and call simdist_init
+ *   with the plugin arguments.  Then start nNumThreads - 1 pool
+ *   threads.
+ *******************************************************************/
+int
+SlavePlugin::Load(const std::string &sLibrary, const std::string &sArgs, int nNumThreads)
+{
+  if (m_pHandle)
+    return m_fb.Error(E_PLUGIN_LOAD) << ": A plugin (" << m_sLibrary << ") is already loaded.";
+
+#if HAVE_DLFCN_H
+  m_sLibrary = sLibrary;
+  dlerror();
+  if (!(m_pHandle = dlopen(sLibrary.c_str(), RTLD_NOW | RTLD_LOCAL)))
+    return m_fb.Error(E_PLUGIN_LOAD) << ": " << dlerror();
+
+      // Casting from void* to a function pointer is not allowed in
+      // ISO C++, so go via size_t as dlsym users have always done.
+  m_pInit = reinterpret_cast<simdist_init_func>(reinterpret_cast<size_t>(dlsym(m_pHandle, "simdist_init")));
+  m_pEvaluate = reinterpret_cast<simdist_evaluate_func>(reinterpret_cast<size_t>(dlsym(m_pHandle, "simdist_evaluate")));
+  m_pShutdown = reinterpret_cast<simdist_shutdown_func>(reinterpret_cast<size_t>(dlsym(m_pHandle, "simdist_shutdown")));
+  if (!m_pEvaluate)
+  {
+    Unload();
+    return m_fb.Error(E_PLUGIN_LOAD) << ": " << sLibrary << " does not export simdist_evaluate.";
+  }
+
+  std::vector<std::string> args;
+  if (CreateArgumentVector(sLibrary + (sArgs.empty() ? "" : " " + sArgs), args))
+  {
+    Unload();
+    return m_fb.Error(E_PLUGIN_LOAD) << ": Failed to split plugin arguments: " << sArgs << ".";
+  }
+  std::vector<char*> argv;
+  for (size_t nArg = 0; nArg < args.size(); nArg++)
+    argv.push_back(&args[nArg][0]);
+  argv.push_back(0);
+
+  if (m_pInit && m_pInit(static_cast<int>(args.size()), &argv[0]))
+  {
+    m_pShutdown = 0;
+    Unload();
+    return m_fb.Error(E_PLUGIN_LOAD) << ": simdist_init in " << sLibrary << " failed.";
+  }
+
+  m_bStop = false;
+  for (int nThread = 1; nThread < nNumThreads; nThread++)
+  {
+    TSlavePluginThreadData *ptd = new TSlavePluginThreadData;
+    ptd->pPlugin = this;
+    ptd->nPart = nThread;
+    pthread_t thread;
+    if (pthread_create(&thread, 0, slaveplugin_thread_func, ptd))
+    {
+      delete ptd;
+      Unload();
+      return m_fb.Error(E_PLUGIN_LOAD) << ": Failed to create thread number " << nThread << ".";
+    }
+    m_threads.push_back(thread);
+  }
+
+  m_fb.Info(1) << "Loaded slave plugin " << sLibrary << " with "
+               << NumThreads() << " evaluation thread(s).";
+  return 0;
+#else
+  return m_fb.Error(E_PLUGIN_LOAD) << ": Shared library support (dlopen) is not available on this system.";
+#endif
+}
+
+
+/********************************************************************
+ *   Evaluate part nPart of the current batch.  The parts split the
+ *   batch as evenly as possible.  Threads with an empty part don't
+ *   call the plugin.
+ *******************************************************************/
+int
+SlavePlugin::EvaluatePart(size_t nPart)
+{
+  const size_t nNumParts = NumThreads();
+  const size_t nBegin = m_nNumJobs * nPart / nNumParts;
+  const size_t nEnd = m_nNumJobs * (nPart + 1) / nNumParts;
+  if (nBegin == nEnd)
+    return 0;
+  return m_pEvaluate(m_pJobs + nBegin, nEnd - nBegin);
+}
+
+
+bool
+SlavePlugin::NewBatch(int nLastBatch) const
+{
+  return m_bStop || m_nBatch != nLastBatch;
+}
+
+
+bool
+SlavePlugin::BatchDone() const
+{
+  return m_nNumBusy == 0;
+}
+
+
+int
+SlavePlugin::Evaluate(simdist_job *pJobs, size_t nNumJobs)
+{
+  if (!m_pEvaluate)
+    return m_fb.Error(E_PLUGIN_EVALUATE) << ": No plugin loaded.";
+
+  if (m_threads.empty())
+  {
+    if (m_pEvaluate(pJobs, nNumJobs))
+      return m_fb.Error(E_PLUGIN_EVALUATE) << ": simdist_evaluate returned an error.";
+    return 0;
+  }
+
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_PLUGIN_EVALUATE);
+  m_pJobs = pJobs;
+  m_nNumJobs = nNumJobs;
+  m_nNumBusy = static_cast<int>(m_threads.size());
+  m_nNumFailed = 0;
+  m_nBatch++;
+  if (m_condWork.Broadcast())
+    return m_fb.Error(E_COND_BROADCAST);
+  mtx.Unlock();
+
+  int nRet = EvaluatePart(0);
+
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_PLUGIN_EVALUATE);
+  if (m_condDone.Wait(mtx.GetLockedMutex(), std::mem_fun(&SlavePlugin::BatchDone), this))
+    return m_fb.Error(E_COND_WAIT);
+
+  if (nRet || m_nNumFailed)
+    return m_fb.Error(E_PLUGIN_EVALUATE) << ": simdist_evaluate returned an error in "
+                                         << m_nNumFailed + (nRet ? 1 : 0) << " thread(s).";
+  return 0;
+}
+
+
+int
+SlavePlugin::StopThreads()
+{
+  if (m_threads.empty())
+    return 0;
+
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_PLUGIN_EVALUATE);
+  m_bStop = true;
+  m_condWork.Broadcast();
+  mtx.Unlock();
+
+  for (size_t nThread = 0; nThread < m_threads.size(); nThread++)
+    pthread_join(m_threads[nThread], 0);
+  m_threads.clear();
+  return 0;
+}
+
+
+/********************************************************************
+ *   Stop the thread pool, call simdist_shutdown and unload the
+ *   library.  Safe to call when nothing is loaded.
+ *******************************************************************/
+int
+SlavePlugin::Unload()
+{
+  int nRet = StopThreads();
+#if HAVE_DLFCN_H
+  if (m_pHandle)
+  {
+    if (m_pShutdown)
+      m_pShutdown();
+    if (dlclose(m_pHandle))
+      nRet = m_fb.Error(E_PLUGIN_LOAD) << ": Failed to unload " << m_sLibrary << ": " << dlerror();
+  }
+#endif
+  m_pHandle = 0;
+  m_pInit = 0;
+  m_pEvaluate = 0;
+  m_pShutdown = 0;
+  return nRet;
+}
+
+
+bool
+SlavePlugin::IsLoaded() const
+{
+  return m_pHandle != 0;
+}
+
+
+size_t
+SlavePlugin::NumThreads() const
+{
+  return m_threads.size() + 1;
+}
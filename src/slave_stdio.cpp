@@ -32,18 +32,25 @@
 #include <simdist/slave_mpi.h>
 
 #include <simdist/slave_stdio.h>
+#include <simdist/slave_plugin.h>
 //#include <simdist/slave_pvm.h>
 #include <simdist/messages.h>
 #include <simdist/io_utils.h>
 #include <simdist/misc_utils.h>
 #include <simdist/options.h>
+#include <simdist/trace.h>
+#include <simdist/profiler.h>
 
 #include <sys/types.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <cstring>
+#include <cstdlib>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
 
 // #include <setjmp.h>
 
@@ -67,7 +74,9 @@ typedef struct TJobDataVar
   std::string sJobID;
   std::string sData;
   std::string sResults;
-  int nTime;
+  double dTime;
+  bool bTimedOut;
+  TResourceUsage usage;
 //   TJobDataVar() 
 //   {}
 } TJobData;
@@ -77,6 +86,8 @@ typedef std::vector<TJobDataVar> TJobDataset;
 std::string sSlaveId;
 std::string sChildName;
 pid_t child_pid = 0;
+std::vector<int> childCpus;
+volatile sig_atomic_t bChildTimedOut = 0;
 
 // void atexit_kill_slave()
 // {
@@ -134,6 +145,9 @@ static void
 SignalAbort(int nSignal)
 {
   Feedback fb(sSlaveId + " signal handler");
+  if (nSignal == SIGPIPE && bChildTimedOut)
+        // The child is about to be restarted after a job timeout.
+    return;
   if (nSignal == SIGPIPE)
   {
     fb.Warning("Received SIGPIPE signal on host ") 
@@ -173,7 +187,7 @@ CheckConnectMessage(Feedback &fb, std::stringstream &ss, std::string &sServer,
   if (sTag != "CONNECT")
     return fb.Error(E_SLAVEMAIN_MSG) << ": " << "Expected CONNECT message, got message saying \"" + sTag + "\".";
 
-  const int expected_version = 2;
+  const int expected_version = 5;
   if (nVersion != expected_version)
     return fb.Error(E_SLAVEMAIN_MSG) 
       << ": " << "Expected CONNECT message version " 
@@ -215,17 +229,244 @@ ConnectSlave(Feedback &fb, MPICommunicator &comm, const std::string &sProgram, c
     child_pid = 0;
   }
 
-  return ConnectProcess(sProgram, sArgs, &slaveWriteStdin, &slaveReadStdout, 0, &child_pid, 0);
+      // Pin this thread while launching the child, so that the
+      // child inherits the CPUs from the very start.
+  std::vector<int> ownCpus;
+  bool bPinned = false;
+  if (!childCpus.empty())
+  {
+    if (GetProcessAffinity(0, ownCpus) || SetProcessAffinity(0, childCpus))
+      fb.Warning() << "Failed to pin " << sProgram << " to CPUs. System error message: " 
+                   << strerror(errno) << ".";
+    else
+      bPinned = true;
+  }
+
+  bChildTimedOut = 0;
+  int nRet = ConnectProcess(sProgram, sArgs, &slaveWriteStdin, &slaveReadStdout, 0, &child_pid, 0);
+  if (bPinned && SetProcessAffinity(0, ownCpus))
+    fb.Warning() << "Failed to restore the CPU affinity of the slave server. System error message: " 
+                 << strerror(errno) << ".";
+  if (nRet)
+    return nRet;
+  slaveWriteStdin.clear();
+  slaveReadStdout.clear();
+  return 0;
+}
+
+
+/********************************************************************
+ *   Evaluate a set of jobs with a slave plugin, which works directly
+ *   on the job data buffers.  The plugin runs inside the slave
+ *   server, so resource usage is sampled for the whole server
+ *   process and shared evenly between the jobs, as is the time.
+ *   Failures are reported by SlavePlugin::Evaluate.
+ *******************************************************************/
+int
+EvaluatePluginJobs(SlavePlugin &plugin, TJobDataset &jobData)
+{
+  if (jobData.empty())
+    return 0;
+
+  std::vector<simdist_job> jobs(jobData.size());
+  for (size_t nJob = 0; nJob < jobs.size(); nJob++)
+  {
+    jobs[nJob].data = jobData[nJob].sData.data();
+    jobs[nJob].size = jobData[nJob].sData.size();
+    jobs[nJob].result = 0;
+    jobs[nJob].result_size = 0;
+  }
+
+  TResourceUsage usageStart, usage;
+  bool bUsage = !ProcessResourceUsage(getpid(), usageStart);
+  timeval tvStart, tvEnd;
+  gettimeofday(&tvStart, 0);
+  int nRet = plugin.Evaluate(&jobs[0], jobs.size());
+  gettimeofday(&tvEnd, 0);
+  if (bUsage && !ProcessResourceUsage(getpid(), usage))
+    usage.Subtract(usageStart);
+  else
+    usage = TResourceUsage();
+
+  const double dNumJobs = static_cast<double>(jobs.size());
+  const double dTime = (tvEnd.tv_sec - tvStart.tv_sec) + (tvEnd.tv_usec - tvStart.tv_usec) * 1e-6;
+  usage.dUserTime /= dNumJobs;
+  usage.dSystemTime /= dNumJobs;
+  usage.nVoluntaryCtxSwitches /= jobs.size();
+  usage.nInvoluntaryCtxSwitches /= jobs.size();
+  for (size_t nJob = 0; nJob < jobs.size(); nJob++)
+  {
+    if (jobs[nJob].result)
+    {
+      jobData[nJob].sResults.assign(jobs[nJob].result, jobs[nJob].result_size);
+      free(jobs[nJob].result);
+    }
+    jobData[nJob].dTime = dTime / dNumJobs;
+    jobData[nJob].usage = usage;
+  }
+  return nRet;
+}
+
+
+/********************************************************************
+ *   The node-local index of this process, as given by the MPI
+ *   launcher.  Returns nonzero if the launcher doesn't tell.
+ *******************************************************************/
+int
+LocalSlot(int &nSlot)
+{
+  static const char *local_rank_vars[] = 
+    { "OMPI_COMM_WORLD_LOCAL_RANK", "MPI_LOCALRANKID", "MV2_COMM_WORLD_LOCAL_RANK", 
+      "PMI_LOCAL_RANK", "SLURM_LOCALID", 0 };
+  for (const char **ppVar = local_rank_vars; *ppVar; ppVar++)
+    if (const char *szValue = getenv(*ppVar))
+    {
+      std::stringstream ss(szValue);
+      if (ss >> nSlot && nSlot >= 0)
+        return 0;
+    }
+  return 1;
+}
+
+
+/********************************************************************
+ *   Choose the CPUs the slave program will be pinned to, according
+ *   to the slave-bind and slave-bind-by options.  Slots are spread
+ *   round-robin over the NUMA nodes, so that neighbouring slots end
+ *   up on different nodes and share as little memory bandwidth as
+ *   possible.  With CPU binding, each slot gets one CPU within its
+ *   node.  Memory is not bound explicitly, but the kernel's default
+ *   first-touch policy allocates it on the node of the pinned CPUs.
+ *******************************************************************/
+int
+ComputePlacement(Feedback &fb, MPICommunicator &comm, std::vector<int> &cpus)
+{
+  cpus.clear();
+  std::string sBind, sBindBy;
+  if (Options::Instance().Option("slave-bind", sBind)
+      || Options::Instance().Option("slave-bind-by", sBindBy))
+    return fb.Error(E_SLAVEMAIN_SETUP) << ": Unable to extract the CPU binding options.";
+
+  if (sBind == "NONE")
+    return 0;
+  if (sBind != "CPU" && sBind != "NUMA")
+    return fb.Error(E_SLAVEMAIN_SETUP) << ": Unknown value of slave-bind: " << sBind 
+                                       << ". Should be NONE, CPU or NUMA.";
+
+  int nSlot;
+  if (sBindBy == "RANK")
+    nSlot = comm.Get_rank();
+  else if (sBindBy == "SLOT")
+  {
+    if (LocalSlot(nSlot))
+    {
+      nSlot = comm.Get_rank();
+      fb.Warning() << "The MPI launcher did not provide a node-local rank. Binding by MPI rank (" 
+                   << nSlot << ") instead.";
+    }
+  }
+  else
+    return fb.Error(E_SLAVEMAIN_SETUP) << ": Unknown value of slave-bind-by: " << sBindBy 
+                                       << ". Should be SLOT or RANK.";
+
+  std::vector<std::vector<int> > nodeCpus;
+  if (ReadCpuTopology(nodeCpus))
+  {
+    fb.Warning() << "Unable to read the CPU topology of host " << Hostname() 
+                 << ". The slave program will not be pinned.";
+    return 0;
+  }
+
+  const size_t nNode = nSlot % nodeCpus.size();
+  const std::vector<int> &node = nodeCpus[nNode];
+  if (sBind == "NUMA")
+    cpus = node;
+  else
+    cpus.push_back(node[(nSlot / nodeCpus.size()) % node.size()]);
+
+  std::stringstream ssCpus;
+  for (size_t nCpu = 0; nCpu < cpus.size(); nCpu++)
+    ssCpus << (nCpu ? "," : "") << cpus[nCpu];
+  fb.Info(1) << "Slot " << nSlot << " on host " << Hostname() << " (" << nodeCpus.size() 
+             << " NUMA node(s)): binding slave program to NUMA node index " << nNode 
+             << ", CPU(s) " << ssCpus.str() << ".";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Pass one job to the child process and read back the results.
+ *   If dTimeout is positive and the job has not completed within
+ *   dTimeout seconds, the job is marked as timed out and the child
+ *   is restarted, so that it is ready for the next job.  The
+ *   resources used by the child are sampled before and after the
+ *   job, and the difference is stored with the job.
+ *******************************************************************/
+int
+EvaluateJob(Feedback &fb, MPICommunicator &comm, const std::string &sProgram, const std::string &sArgs,
+            fdostream &slaveWriteStdin, fdistream &slaveReadStdout, 
+            const JobReaderWriter &rwWriter, const JobReaderWriter &rwReader, 
+            double dTimeout, TJobData &job)
+{
+  if (dTimeout > 0 
+      && (slaveWriteStdin.set_timeout(dTimeout) || slaveReadStdout.set_timeout(dTimeout)))
+    return fb.Error(E_SLAVEMAIN_LAUNCH) << ": Failed to set job timeout on pipes to child process. "
+                                        << "System error message: " << strerror(errno) << ".";
+
+  static ProfileRegion regionEval("child-eval"), regionWrite("child-write"), regionRead("child-read");
+  ProfileScope scope(regionEval);
+  TraceSpan span("EvaluateJob", "Slave", job.sJobID);
+  TResourceUsage usageStart;
+  bool bUsage = !ProcessResourceUsage(child_pid, usageStart);
+  timeval tvStart, tvEnd;
+  gettimeofday(&tvStart, 0);
+  int nRet;
+  {
+    ProfileScope scopeWrite(regionWrite);
+    TraceSpan spanWrite("write job to child", "Slave", job.sJobID);
+    nRet = rwWriter.Write(slaveWriteStdin, job.sData);
+  }
+  if (!nRet)
+  {
+        // Includes the evaluation itself, as the child answers when
+        // it is done.
+    ProfileScope scopeRead(regionRead);
+    TraceSpan spanRead("read results from child", "Slave", job.sJobID);
+    nRet = rwReader.Read(slaveReadStdout, job.sResults);
+  }
+  gettimeofday(&tvEnd, 0);
+  job.dTime = (tvEnd.tv_sec - tvStart.tv_sec) + (tvEnd.tv_usec - tvStart.tv_usec) * 1e-6;
+  if (bUsage && !ProcessResourceUsage(child_pid, job.usage))
+    job.usage.Subtract(usageStart);
+  else
+    fb.Info(3) << "Unable to sample resource usage of process " << child_pid << " for job " << job.sJobID << ".";
+
+  if (slaveWriteStdin.timed_out() || slaveReadStdout.timed_out())
+  {
+    bChildTimedOut = 1;
+    fb.Warning() << "Job " << job.sJobID << " timed out after " << dTimeout 
+                 << " seconds on host " << Hostname() << ". Restarting " << sProgram << ".";
+    job.bTimedOut = true;
+    job.sResults.clear();
+    rwWriter.DiscardFile();
+    return ConnectSlave(fb, comm, sProgram, sArgs, slaveWriteStdin, slaveReadStdout);
+  }
+
+  return nRet;
 }
 
 
 int 
 GetNextJob(Feedback &fb, MPICommunicator &comm, std::string &sMessage, bool &bTerminate)
 {
-  if (int nRet = GetMessage(fb, comm, sMessage))
-    return nRet;
+  static ProfileRegion region("wait-for-job");
+  {
+    ProfileScope scope(region);
+    if (int nRet = GetMessage(fb, comm, sMessage))
+      return nRet;
+  }
 
-  std::stringstream ss(sMessage);
+  imemstream ss(sMessage);
   std::string sTag;
   std::getline(ss, sTag);
 
@@ -249,8 +490,11 @@ ExtractJobData(Feedback &fb, JobReaderWriter &rw,
                const std::string &sMessage, TJobDataset &jobData)
 {
   assert(jobData.empty());
+  static ProfileRegion region("extract-jobs");
+  ProfileScope scope(region);
+  TraceSpan span("ExtractJobData", "Slave");
 
-  std::stringstream ss(sMessage);
+  imemstream ss(sMessage);
   std::string sServer, sJob, sChomp;
   std::getline(ss, sJob);
   assert(sJob == "JOB"); // Should be checked by GetNextJob.
@@ -286,6 +530,9 @@ SendResults(Feedback &fb, JobReaderWriter &rw, MPICommunicator &comm,
 {
   fb.Info(3) << "Server " << sServer << " sending results of " 
              << jobData.size() << " jobs.";
+  TraceSpan span("SendResults", "Slave");
+  static ProfileRegion regionEncode("result-encode"), regionSend("send-results");
+  ProfileScope scopeEncode(regionEncode);
              
   std::stringstream ss;
   ss << "RESULTS\n" 
@@ -294,10 +541,21 @@ SendResults(Feedback &fb, JobReaderWriter &rw, MPICommunicator &comm,
   for (TJobDataset::const_iterator jit = jobData.begin(); jit != jobData.end(); jit++)
   {
     ss << jit->sJobID << "\n"
-       << jit->nTime << "\n";
+       << jit->dTime << "\n"
+       << (jit->bTimedOut ? "TIMEOUT" : "OK") << "\n"
+       << jit->usage << "\n";
     rw.Write(ss, jit->sResults);
   }
+      // Ship the spans recorded since the last results.  The master
+      // ignores anything after the results unless it is tracing.
+  if (Trace::Enabled())
+  {
+    ss << "TRACE\n";
+    rw.Write(ss, Trace::Instance().TakePending());
+  }
+  scopeEncode.Stop();
 
+  ProfileScope scopeSend(regionSend);
   comm(nServerRank, nTag) << ss.str();
 
   if (!comm.good())
@@ -312,17 +570,38 @@ int
 slave_main_int(MPICommunicator &comm, Feedback &fb, int argc, char *argv[])
 {
   bool bRunOnce;
-  int nInfoLevel;
-  std::string sInfoShow, sInfoHide;
+  int nInfoLevel, nInfoBuffer;
+  float fJobTimeout;
+  std::string sInfoShow, sInfoHide, sInputModeOption, sOutputModeOption, sTraceFile;
+  bool bProfile;
   if (Options::Instance().Option("slave-run-once", bRunOnce)
+      || Options::Instance().Option("slave-input-mode", sInputModeOption)
+      || Options::Instance().Option("slave-output-mode", sOutputModeOption)
+      || Options::Instance().Option("slave-job-timeout", fJobTimeout)
       || Options::Instance().Option("slave-verbosity", nInfoLevel)
       || Options::Instance().Option("verbosity-showonly", sInfoShow)
-      || Options::Instance().Option("verbosity-dontshow", sInfoHide))
+      || Options::Instance().Option("verbosity-dontshow", sInfoHide)
+      || Options::Instance().Option("verbosity-buffer", nInfoBuffer)
+      || Options::Instance().Option("trace-file", sTraceFile)
+      || Options::Instance().Option("profile", bProfile))
     return fb.Error(E_SLAVEMAIN_SETUP) << ": Unable to extract the necessary options.";
   fb.SetInfoLevel(nInfoLevel);
   fb.SetShowHide(sInfoShow, sInfoHide);
+  if (nInfoBuffer > 0)
+    fb.SetAsyncOutput(nInfoBuffer);
+      // The trace file is written by the master.  Slaves send their
+      // spans with the results.
+  if (!sTraceFile.empty())
+  {
+    std::stringstream ssName;
+    ssName << "Slave " << comm.Get_rank() << " on " << Hostname();
+    Trace::Instance().Start("", comm.Get_rank(), ssName.str());
+  }
+  Profiler::Enable(bProfile);
 
   int nRet;
+  if ((nRet = ComputePlacement(fb, comm, childCpus)))
+    return nRet;
 
   std::string sMessage;
   if ((nRet = GetMessage(fb, comm, sMessage)))
@@ -336,14 +615,37 @@ slave_main_int(MPICommunicator &comm, Feedback &fb, int argc, char *argv[])
   std::stringstream ss(sMessage);
   if ((nRet = CheckConnectMessage(fb, ss, sServer, sSlaveInputMode, sSlaveOutputMode, sProgram, sArgs)))
     return nRet;
+  if (!sInputModeOption.empty())
+    sSlaveInputMode = sInputModeOption;
+  if (!sOutputModeOption.empty())
+    sSlaveOutputMode = sOutputModeOption;
 
   fdostream slaveWriteStdin;
   fdistream slaveReadStdout;
+  SlavePlugin plugin;
+  const bool bPlugin = IsPlugin(sProgram);
 
-  if ((nRet = ConnectSlave(fb, comm, sProgram, sArgs, slaveWriteStdin, slaveReadStdout)))
+  if (bPlugin)
+  {
+    int nNumThreads;
+    if (Options::Instance().Option("slave-plugin-threads", nNumThreads))
+      return fb.Error(E_SLAVEMAIN_SETUP) << ": Unable to extract the slave-plugin-threads option.";
+    if (fJobTimeout > 0)
+      fb.Warning() << "The slave job timeout is not supported for slave plugins, and will be ignored.";
+    if (bRunOnce)
+      fb.Warning() << "The slave-run-once option is not supported for slave plugins, and will be ignored.";
+        // Pin the whole slave server, so that the plugin threads
+        // inherit the CPUs.
+    if (!childCpus.empty() && SetProcessAffinity(0, childCpus))
+      fb.Warning() << "Failed to pin slave server to CPUs. System error message: " 
+                   << strerror(errno) << ".";
+    if ((nRet = plugin.Load(sProgram, sArgs, std::max(nNumThreads, 1))))
+      return fb.Error(E_SLAVEMAIN_LAUNCH) << ": Failed to load slave plugin " << sProgram << ".";
+  }
+  else if ((nRet = ConnectSlave(fb, comm, sProgram, sArgs, slaveWriteStdin, slaveReadStdout)))
     return nRet;
 
-  JobReaderWriter rwIntern(JobReaderWriter::bytecount), rwWriter(sSlaveInputMode), rwReader(sSlaveOutputMode);
+  JobReaderWriter rwIntern(JobReaderWriter::bytecount64), rwWriter(sSlaveInputMode), rwReader(sSlaveOutputMode);
 
 //   atexit(atexit_kill_slave);
 
@@ -386,27 +688,33 @@ slave_main_int(MPICommunicator &comm, Feedback &fb, int argc, char *argv[])
     if ((nRet = ExtractJobData(fb, rwIntern, sMessage, jobData)))
       return nRet;
 
-    for (TJobDataset::iterator jit = jobData.begin(); jit != jobData.end(); jit++)
+    if (bPlugin)
     {
-      int nTimeStart = time(0);
-      if ((nRet = rwWriter.Write(slaveWriteStdin, jit->sData)))
+      static ProfileRegion region("plugin-eval");
+      ProfileScope scope(region);
+      TraceSpan span("EvaluatePluginJobs", "Slave");
+      if ((nRet = EvaluatePluginJobs(plugin, jobData)))
         return nRet;
-      
-      if ((nRet = rwReader.Read(slaveReadStdout, jit->sResults)))
-        return nRet;
-      jit->nTime = time(0) - nTimeStart;
     }
+    else
+      for (TJobDataset::iterator jit = jobData.begin(); jit != jobData.end(); jit++)
+        if ((nRet = EvaluateJob(fb, comm, sProgram, sArgs, slaveWriteStdin, slaveReadStdout, 
+                                rwWriter, rwReader, fJobTimeout, *jit)))
+          return nRet;
 
     if ((nRet = SendResults(fb, rwIntern, comm, nServerRank, nTag, sServer, jobData)))
       return nRet;
 
-    if (bRunOnce && (nRet = ConnectSlave(fb, comm, sProgram, sArgs, slaveWriteStdin, slaveReadStdout)))
+    if (bRunOnce && !bPlugin && (nRet = ConnectSlave(fb, comm, sProgram, sArgs, slaveWriteStdin, slaveReadStdout)))
       return nRet;
   }
 
   if (nRet)
     return nRet;
 
+  if (bPlugin)
+    return plugin.Unload();
+
       // Close to terminate slave process
   slaveWriteStdin.close();
   sleep(1);
@@ -439,6 +747,13 @@ slave_main(int argc, char *argv[])
   nMainRet = slave_main_int(comm, fb, argc, argv);
   fb.Info(1) << "Slave server on host " << Hostname() << ", pid "
              << getpid() << " returned from main loop with code " << nMainRet << ".";
+  if (Profiler::Enabled())
+  {
+    std::stringstream ssReport;
+    ssReport << "Profile of slave " << comm.Get_rank() << " on " << Hostname() << ":\n";
+    Profiler::Instance().Report(ssReport);
+    std::cerr << ssReport.str();
+  }
 
   if (nMainRet != 0 || nJmpRet != 0)
     fb.Warning("An error has occurred on host " + Hostname() + "."); // + ".  The system will now stop and wait for MPI to kill it.");
@@ -25,9 +25,15 @@
 
 #include <iostream>
 #include <vector>
+#include <map>
+#include <string>
+#include <sstream>
 #include <pthread.h>
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <sys/time.h>
 #include <simdist/feedback.h>
 #include <simdist/errorcodes_thread.h>
 
@@ -72,16 +78,262 @@ void* thread_func(void *)
   return 0;
 }
 
+double seconds()
+{
+  timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/********************************************************************
+ *   Time info calls below the info level, which should cost a few
+ *   nanoseconds each, since nothing is formatted.
+ *******************************************************************/
+int benchmark(int nNumCalls)
+{
+  Feedback fb("Benchmark");
+  FeedbackCentral::Instance().SetInfoLevel(default_info_level);
+
+  double dStart = seconds();
+  for (int nCall = 0; nCall < nNumCalls; nCall++)
+    fb.Info(4) << "Disabled message number " << nCall << " of " << nNumCalls << ".";
+  double dStreamed = seconds() - dStart;
+
+  dStart = seconds();
+  for (int nCall = 0; nCall < nNumCalls; nCall++)
+    fb.Info(4, "Disabled message");
+  double dMessage = seconds() - dStart;
+
+  dStart = seconds();
+  for (int nCall = 0; nCall < nNumCalls; nCall++)
+    if (fb.InfoEnabled(4))
+      fb.Info(4) << "Disabled message number " << nCall << ".";
+  double dChecked = seconds() - dStart;
+
+  cout << "Disabled info, " << nNumCalls << " calls:\n"
+       << "  Info(4) << ...:         " << dStreamed * 1e9 / nNumCalls << " ns/call\n"
+       << "  Info(4, message):       " << dMessage * 1e9 / nNumCalls << " ns/call\n"
+       << "  if (InfoEnabled(4)) ...: " << dChecked * 1e9 / nNumCalls << " ns/call\n";
+  return 0;
+}
+
+/********************************************************************
+ *   Time info which is printed, from nNumThreads threads, with
+ *   synchronous and asynchronous output.  Redirect stderr.
+ *******************************************************************/
+struct benchvar {
+  int nNumCalls;
+} bd;
+
+void* bench_thread_func(void *)
+{
+  Feedback fb("Benchmark");
+  for (int nCall = 0; nCall < bd.nNumCalls; nCall++)
+    fb.Info(1) << "Message number " << nCall << " of " << bd.nNumCalls << ".";
+  return 0;
+}
+
+int benchmark_output(int nNumThreads, int nNumCalls)
+{
+  FeedbackCentral::Instance().SetInfoLevel(default_info_level);
+  bd.nNumCalls = nNumCalls;
+  const size_t buffers[] = { 0, 1024, 65536 };
+  for (size_t nBuffer = 0; nBuffer < sizeof(buffers) / sizeof(buffers[0]); nBuffer++)
+  {
+    Feedback::SetAsyncOutput(buffers[nBuffer]);
+    double dStart = seconds();
+    vector<pthread_t> vtid(nNumThreads);
+    for (int nThr = 0; nThr < nNumThreads; nThr++)
+      pthread_create(&vtid[nThr], 0, bench_thread_func, 0);
+    for (int nThr = 0; nThr < nNumThreads; nThr++)
+      pthread_join(vtid[nThr], 0);
+    double dCalls = seconds() - dStart;
+    Feedback::FlushOutput();
+    double dFlushed = seconds() - dStart;
+    size_t nDropped = FeedbackCentral::Instance().NumDropped();
+    Feedback::SetAsyncOutput(0);
+    cout << "Info from " << nNumThreads << " thread(s), buffer " << buffers[nBuffer] << ": "
+         << dCalls * 1e9 / (nNumThreads * nNumCalls) << " ns/call, "
+         << dFlushed << " s until written, " << nDropped << " dropped\n";
+  }
+  return 0;
+}
+
+/********************************************************************
+ *   Time printed info with show/hide filters.  Hidden info should
+ *   cost next to nothing, and shown info little more than without
+ *   filters.
+ *******************************************************************/
+int benchmark_filters(int nNumThreads, int nNumCalls)
+{
+  FeedbackCentral::Instance().SetInfoLevel(default_info_level);
+  bd.nNumCalls = nNumCalls;
+  const char *filters[][2] = { { "", "" }, { "Master*,Slave*,Bench*", "Bench*x,Client*" }, { "", "Bench*" } };
+  for (size_t nFilter = 0; nFilter < sizeof(filters) / sizeof(filters[0]); nFilter++)
+  {
+    Feedback::SetShowHide(filters[nFilter][0], filters[nFilter][1]);
+    double dStart = seconds();
+    vector<pthread_t> vtid(nNumThreads);
+    for (int nThr = 0; nThr < nNumThreads; nThr++)
+      pthread_create(&vtid[nThr], 0, bench_thread_func, 0);
+    for (int nThr = 0; nThr < nNumThreads; nThr++)
+      pthread_join(vtid[nThr], 0);
+    double dCalls = seconds() - dStart;
+    cout << "Info from " << nNumThreads << " thread(s), show \"" << filters[nFilter][0] 
+         << "\", hide \"" << filters[nFilter][1] << "\": "
+         << dCalls * 1e9 / (nNumThreads * nNumCalls) << " ns/call\n";
+  }
+  return 0;
+}
+
+/********************************************************************
+ *   Whether sLine begins with a time stamp, "[hh:mm:ss.uuuuuu] ".
+ *******************************************************************/
+bool has_stamp(const string &sLine)
+{
+  const char *szFormat = "[dd:dd:dd.dddddd] ";
+  if (sLine.size() < strlen(szFormat))
+    return false;
+  for (size_t n = 0; szFormat[n]; n++)
+    if (szFormat[n] == 'd' ? !isdigit(static_cast<unsigned char>(sLine[n])) : sLine[n] != szFormat[n])
+      return false;
+  return true;
+}
+
+/********************************************************************
+ *   Check the lines of sOutput holding sTag, followed by a number:
+ *   For each thread, the numbers must run from 0 to nCount - 1, in
+ *   order.  If bStamped, the lines must have time stamps.  Returns
+ *   the number of threads, or -1 on error.
+ *******************************************************************/
+int check_sequence(const string &sOutput, const string &sTag, int nCount, bool bStamped)
+{
+  map<string, int> next; // Keyed on thread.
+  stringstream ss(sOutput);
+  string sLine;
+  while (getline(ss, sLine))
+  {
+    string::size_type nTag = sLine.find(sTag);
+    if (nTag == string::npos)
+      continue;
+    string::size_type nThread = sLine.find("in thread "), nFrom = sLine.find(" from ", nThread);
+    if (nThread == string::npos || nFrom == string::npos || (bStamped && !has_stamp(sLine)))
+    {
+      cerr << "Malformed line: " << sLine << "\n";
+      return -1;
+    }
+    nThread += strlen("in thread ");
+    int &nNext = next[sLine.substr(nThread, nFrom - nThread)];
+    if (atoi(sLine.c_str() + nTag + sTag.size()) != nNext++)
+    {
+      cerr << "Expected \"" << sTag << nNext - 1 << "\", got: " << sLine << "\n";
+      return -1;
+    }
+  }
+  for (map<string, int>::const_iterator it = next.begin(); it != next.end(); it++)
+    if (it->second != nCount)
+    {
+      cerr << "Thread " << it->first << " wrote " << it->second << " \"" << sTag << "\" lines, expected " << nCount << ".\n";
+      return -1;
+    }
+  return static_cast<int>(next.size());
+}
+
+/********************************************************************
+ *   Every message must be written once and in order, with a time
+ *   stamp, when nothing is dropped.  Warnings written while the
+ *   output is switched between rings must not be lost or reordered.
+ *   The output is captured by pointing std::cerr at a string.
+ *******************************************************************/
+const int num_async_warnings = 100, num_switch_threads = 4, num_switch_warnings = 2000;
+
+void* switch_thread_func(void *)
+{
+  Feedback fb("Switch-tester");
+  for (int nMsg = 0; nMsg < num_switch_warnings; nMsg++)
+    fb.Warning() << "Switch warning " << nMsg << ".";
+  return 0;
+}
+
+int test_async()
+{
+  Feedback fb("Async-tester");
+  FeedbackCentral::Instance().SetInfoLevel(default_info_level);
+  stringstream ssOutput;
+  streambuf *pOldBuf = cerr.rdbuf(ssOutput.rdbuf());
+
+  size_t nDropped = 0;
+  int nRet = Feedback::SetAsyncOutput(16);
+  if (!nRet)
+  {
+    for (int nMsg = 0; nMsg < num_async_warnings; nMsg++)
+    {
+      fb.Warning() << "Async warning " << nMsg << ".";
+      fb.Info(5) << "Never printed.";
+    }
+    fb.Error(E_SOME_ERROR) << ": Errors are written before Error returns.";
+    nDropped = FeedbackCentral::Instance().NumDropped();
+
+    vector<pthread_t> vtid(num_switch_threads);
+    for (int nThr = 0; nThr < num_switch_threads; nThr++)
+      pthread_create(&vtid[nThr], 0, switch_thread_func, 0);
+    const size_t buffers[] = { 4, 0, 16, 2 };
+    for (int nSwitch = 0; nSwitch < 200; nSwitch++)
+      Feedback::SetAsyncOutput(buffers[nSwitch % (sizeof(buffers) / sizeof(buffers[0]))]);
+    for (int nThr = 0; nThr < num_switch_threads; nThr++)
+      pthread_join(vtid[nThr], 0);
+    Feedback::SetAsyncOutput(0);
+  }
+  cerr.rdbuf(pOldBuf);
+  if (nRet)
+    return nRet;
+
+  const string sOutput = ssOutput.str();
+  const string::size_type nError = sOutput.find("Errors are written before Error returns.");
+  const string::size_type nErrorLine = sOutput.rfind('\n', nError);
+  if (nDropped != 0
+      || check_sequence(sOutput, "Async warning ", num_async_warnings, true) != 1
+      || check_sequence(sOutput, "Switch warning ", num_switch_warnings, false) != num_switch_threads
+      || sOutput.find("Never printed.") != string::npos
+      || nError == string::npos
+      || !has_stamp(sOutput.substr(nErrorLine == string::npos ? 0 : nErrorLine + 1)))
+  {
+    cerr << "Asynchronous output test failed!\n";
+    return 1;
+  }
+
+  Feedback::SetAsyncOutput(16);
+  fb.Info(1) << "Asynchronous output test complete.  This is flushed on shutdown.";
+  return 0;
+}
+
 int main(int argc, char *argv[])
 {
-  
+  if (argc > 1 && !strcmp(argv[1], "--benchmark"))
+    return benchmark(argc > 2 ? atoi(argv[2]) : 10000000);
+  if (argc > 1 && !strcmp(argv[1], "--benchmark-output"))
+    return benchmark_output(argc > 2 ? atoi(argv[2]) : 4, argc > 3 ? atoi(argv[3]) : 100000);
+  if (argc > 1 && !strcmp(argv[1], "--benchmark-filters"))
+    return benchmark_filters(argc > 2 ? atoi(argv[2]) : 4, argc > 3 ? atoi(argv[3]) : 100000);
+  if (argc > 1 && !strcmp(argv[1], "--async"))
+    return test_async();
+
   if (argc != 1 && argc < 3)
   { 
     cerr << "Usage: " << argv[0] << " [num_threads num_reps [info-level] ]\n"
+         << "       " << argv[0] << " --benchmark [num_calls]\n"
+         << "       " << argv[0] << " --benchmark-output [num_threads [num_calls]] 2>/dev/null\n"
+         << "       " << argv[0] << " --benchmark-filters [num_threads [num_calls]] 2>/dev/null\n"
+         << "       " << argv[0] << " --async\n"
          << "Spawn num_threads threads, each printing a bunch of info "
          << "num_reps times.  Default 1 for both.  "
          << "Optionally specify info level as third argument.  Default is " 
-         << default_info_level << ".\n";
+         << default_info_level << ".\n"
+         << "With --benchmark, time num_calls (default 10000000) info calls "
+         << "below the info level.  With --benchmark-output, time info which is "
+         << "printed, with synchronous and asynchronous output.  With --benchmark-filters, "
+         << "time info with show/hide filters.  With --async, check "
+         << "the output written through the asynchronous output buffer.\n";
     return 1;
   }
 
@@ -0,0 +1,719 @@
+/********************************************************************
+ *   		test_job_io.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Tests for JobReaderWriter: Round trips through a pipe in all
+ *   message modes, and the number of memory allocations per
+ *   message in bytecount mode, counted by replacing the global
+ *   operator new.  With --max-mb, also measure the read throughput
+ *   for payloads from 1 KB up to the given size.
+ *******************************************************************/
+
+#include <simdist/io_utils.h>
+#include <simdist/misc_utils.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#include <iomanip>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+
+using namespace std;
+
+static size_t nNumAllocs = 0;
+int nSeed = 1;
+int nMaxMegabytes = 0;
+
+void* operator new(size_t nSize) throw(std::bad_alloc)
+{
+  nNumAllocs++;
+  if (void *p = malloc(nSize ? nSize : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t nSize) throw(std::bad_alloc)
+{
+  return operator new(nSize);
+}
+
+void operator delete(void *p) throw()
+{
+  free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+  free(p);
+}
+
+
+/********************************************************************
+ *   Payload with all byte values, and with the default bin_eof
+ *   tag (four zero bytes) in it, to force a search for another.
+ *******************************************************************/
+string
+MakePayload(size_t nSize)
+{
+  string s(nSize, 0);
+  for (size_t nIdx = 0; nIdx < nSize; nIdx++)
+    s[nIdx] = static_cast<char>(rand() % 256);
+  if (nSize >= 8)
+    s.replace(nSize / 2, 4, 4, '\0');
+  return s;
+}
+
+
+int
+TestRoundTrip()
+{
+  const char *modes[] = { "BYTES", "BYTES64", "CHUNKED", "CHUNKED 7", 
+                          "BIN-EOF", "BIN-EOF 8", "EOF", "FILE", "SIMPLE", "SIMPLE 3" };
+  const size_t sizes[] = { 0, 1, 7, 100, 4096, 20000 };
+  int fds[2];
+  if (pipe(fds))
+  {
+    cerr << "Failed to create pipe.\n";
+    return 1;
+  }
+  fdostream out(fds[1]);
+  fdistream in(fds[0]);
+
+  for (size_t nMode = 0; nMode < sizeof(modes) / sizeof(modes[0]); nMode++)
+  {
+    JobReaderWriter rw(modes[nMode]);
+    const bool bText = string(modes[nMode]).find("SIMPLE") == 0;
+    for (size_t nSize = 0; nSize < sizeof(sizes) / sizeof(sizes[0]); nSize++)
+    {
+      string sData;
+      if (bText)
+      {
+            // Text mode: As many lines as the mode says, no binary.
+        const int nLines = string(modes[nMode]) == "SIMPLE" ? 1 : 3;
+        for (int nLine = 0; nLine < nLines; nLine++)
+          sData += (nLine ? "\n" : "") + string(sizes[nSize], 'a' + nLine);
+      }
+      else
+        sData = MakePayload(sizes[nSize]);
+
+      string sRead;
+      if (rw.Write(out, sData) || rw.Read(in, sRead) || sRead != sData)
+      {
+        cerr << "Round trip of " << sizes[nSize] << " bytes failed in " << modes[nMode] << " mode.\n";
+        return 1;
+      }
+
+      char *pRead = 0;
+      size_t nRead = 0;
+      if (rw.Write(out, sData.data(), sData.size()) || rw.Read(in, &pRead, nRead)
+          || string(pRead, nRead) != sData)
+      {
+        cerr << "Round trip of " << sizes[nSize] << " bytes via char buffers failed in "
+             << modes[nMode] << " mode.\n";
+        delete[] pRead;
+        return 1;
+      }
+      delete[] pRead;
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  cerr << "Round trip test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Stream buffer over a string, which hands out the data in get
+ *   areas of nChunk bytes.  With nChunk zero, there is no get area
+ *   at all, as in an unbuffered stream buffer.
+ *******************************************************************/
+class chunkbuf : public std::streambuf
+{
+  string m_sData;
+  size_t m_nPos, m_nChunk;
+protected:
+  virtual int_type underflow()
+  {
+    if (m_nPos >= m_sData.size())
+      return traits_type::eof();
+    if (m_nChunk == 0)
+      return traits_type::to_int_type(m_sData[m_nPos]);
+    const size_t nLen = std::min(m_nChunk, m_sData.size() - m_nPos);
+    char *p = &m_sData[m_nPos];
+    setg(p, p, p + nLen);
+    m_nPos += nLen;
+    return traits_type::to_int_type(*p);
+  }
+  virtual int_type uflow()
+  {
+    if (m_nChunk > 0)
+      return std::streambuf::uflow();
+    if (m_nPos >= m_sData.size())
+      return traits_type::eof();
+    return traits_type::to_int_type(m_sData[m_nPos++]);
+  }
+public:
+  chunkbuf(const string &sData, size_t nChunk)
+    : m_sData(sData), m_nPos(0), m_nChunk(nChunk) {}
+};
+
+
+/********************************************************************
+ *   The delimiter search must find delimiters that straddle the
+ *   boundary between two get areas, and must not be fooled by
+ *   partial delimiters.  The payload is full of prefixes of the
+ *   default bin_eof tag (four zero bytes), and of the EOF mode
+ *   delimiter, and is read through get areas of many sizes.
+ *******************************************************************/
+int
+TestDelimSearch()
+{
+  const char *modes[] = { "BIN-EOF", "EOF" };
+  for (size_t nMode = 0; nMode < sizeof(modes) / sizeof(modes[0]); nMode++)
+  {
+    JobReaderWriter rw(modes[nMode]);
+    string sData;
+    for (int nPart = 0; nPart < 50; nPart++)
+      sData += string(rand() % 4, '\0') + "\nTAG" + string(1 + rand() % 5, 'x');
+    std::stringstream ss;
+    const string sTwice = sData + "tail";
+    if (rw.Write(ss, sData) || rw.Write(ss, sTwice))
+      return 1;
+
+    for (size_t nChunk = 0; nChunk < 12; nChunk++)
+    {
+      chunkbuf buf(ss.str(), nChunk);
+      istream in(&buf);
+      string sRead1, sRead2;
+      if (rw.Read(in, sRead1) || rw.Read(in, sRead2) || sRead1 != sData || sRead2 != sTwice)
+      {
+        cerr << "Delimiter search failed in " << modes[nMode] << " mode with get areas of "
+             << nChunk << " bytes.\n";
+        return 1;
+      }
+    }
+  }
+  cerr << "Delimiter search test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   In simple mode, lines are found in get areas of any size, empty
+ *   lines included, and the last line need not end with a newline.
+ *   Running out of lines within a message is an error, while running
+ *   out between messages is end of file.
+ *******************************************************************/
+int
+TestLineSearch()
+{
+  JobReaderWriter rw("SIMPLE 2");
+  for (size_t nChunk = 0; nChunk < 12; nChunk++)
+  {
+    chunkbuf buf("first\n\nsecond line\nlast", nChunk);
+    istream in(&buf);
+    string sRead1, sRead2, sRead3;
+    if (rw.Read(in, sRead1) || rw.Read(in, sRead2) || sRead1 != "first\n" || sRead2 != "second line\nlast"
+        || rw.Read(in, sRead3) != JobReaderWriter::traits_type::eof())
+    {
+      cerr << "Line search failed with get areas of " << nChunk << " bytes.\n";
+      return 1;
+    }
+
+    chunkbuf bufShort("one line\n", nChunk);
+    istream inShort(&bufShort);
+    int nRet = rw.Read(inShort, sRead1);
+    if (!nRet || nRet == JobReaderWriter::traits_type::eof())
+    {
+      cerr << "Reading half a message should fail with get areas of " << nChunk << " bytes.\n";
+      return 1;
+    }
+  }
+  cerr << "Line search test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   The bin_eof tag must be the smallest value, as a big-endian
+ *   number, that is found first right after the payload, also when
+ *   the payload ends with part of the tag.  Checked against a
+ *   brute force search, on payloads made of few distinct bytes so
+ *   that most small tags are taken.  In eof mode, payloads full of
+ *   candidate tag lines must survive a round trip.
+ *******************************************************************/
+int
+TestTagChoice()
+{
+  for (size_t nTagLen = 1; nTagLen <= 3; nTagLen++)
+  {
+    std::stringstream ssMode;
+    ssMode << "BIN-EOF " << nTagLen;
+    JobReaderWriter rw(ssMode.str());
+    for (int nTest = 0; nTest < 200; nTest++)
+    {
+      string sData(rand() % 300, 0);
+      for (size_t nIdx = 0; nIdx < sData.size(); nIdx++)
+        sData[nIdx] = static_cast<char>(rand() % (nTagLen == 1 ? 40 : 3));
+
+      string sExpected(nTagLen, 0);
+      while ((sData + sExpected).find(sExpected) != sData.size())
+        for (size_t nIdx = nTagLen; nIdx-- > 0 && ++sExpected[nIdx] == 0; )
+          ;
+      std::stringstream ss;
+      string sRead;
+      if (rw.Write(ss, sData) || ss.str().substr(0, nTagLen) != sExpected
+          || rw.Read(ss, sRead) || sRead != sData)
+      {
+        cerr << "Wrong tag chosen, or round trip failed, for a " << sData.size()
+             << " byte payload in " << ssMode.str() << " mode.\n";
+        return 1;
+      }
+    }
+  }
+
+      // Tags 0 .. 0x7f are taken, and so is 0x80, which the old
+      // search missed.
+  string sHigh(string(3, '\0') + '\x80');
+  for (int nByte = 0; nByte < 0x80; nByte++)
+    sHigh += string(3, '\0') + static_cast<char>(nByte);
+  std::stringstream ssHigh;
+  string sReadHigh;
+  JobReaderWriter rwHigh("BIN-EOF");
+  if (rwHigh.Write(ssHigh, sHigh) || rwHigh.Read(ssHigh, sReadHigh) || sReadHigh != sHigh)
+  {
+    cerr << "Round trip failed for a payload with tags above 0x7f in BIN-EOF mode.\n";
+    return 1;
+  }
+
+  string sAll;
+  for (int nByte = 0; nByte < 256; nByte++)
+    sAll += static_cast<char>(nByte);
+  std::stringstream ssFull;
+  if (!JobReaderWriter("BIN-EOF 1").Write(ssFull, sAll))
+  {
+    cerr << "Found a one byte tag for a payload with all byte values.\n";
+    return 1;
+  }
+
+  JobReaderWriter rw("EOF");
+  const char *lasts[] = { "", "\nEOF", "\nEOF-57", "\nEOF-" };
+  for (size_t nLast = 0; nLast < sizeof(lasts) / sizeof(lasts[0]); nLast++)
+  {
+    std::stringstream ssData;
+    ssData << "EOF\nEOF";
+    for (int nTag = 99; nTag >= 0; nTag--)
+      ssData << "\nEOF-" << nTag << "\nEOF-" << nTag << "x";
+    ssData << lasts[nLast];
+    std::stringstream ss;
+    string sRead;
+    if (rw.Write(ss, ssData.str()) || rw.Read(ss, sRead) || sRead != ssData.str())
+    {
+      cerr << "Round trip failed for payload with EOF tags in EOF mode.\n";
+      return 1;
+    }
+  }
+  cerr << "Tag choice test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   A message written chunk by chunk in chunked mode must read back
+ *   as one message, and a message written in one go must read back
+ *   chunk by chunk, in pieces no larger than the chunk size.
+ *******************************************************************/
+int
+TestChunks()
+{
+  JobReaderWriter rw("CHUNKED 1000");
+  const string sData = MakePayload(10000);
+  std::stringstream ss;
+  for (size_t nPos = 0; nPos < sData.size(); nPos += 3000)
+    if (rw.WriteChunk(ss, sData.data() + nPos, std::min<size_t>(3000, sData.size() - nPos)))
+      return 1;
+  if (rw.WriteChunk(ss, 0, 0) || rw.Write(ss, sData))
+    return 1;
+
+  string sRead, sChunk, sJoined;
+  if (rw.Read(ss, sRead) || sRead != sData)
+  {
+    cerr << "Message written in chunks failed to read back.\n";
+    return 1;
+  }
+  size_t nChunks = 0;
+  do
+  {
+    if (rw.ReadChunk(ss, sChunk) || sChunk.size() > 1000)
+    {
+      cerr << "Failed to read chunk " << nChunks << ".\n";
+      return 1;
+    }
+    sJoined += sChunk;
+    nChunks++;
+  }
+  while (!sChunk.empty());
+  if (sJoined != sData || nChunks != 11)
+  {
+    cerr << "Message read in " << nChunks << " chunks differs from the one written.\n";
+    return 1;
+  }
+
+  if (!JobReaderWriter("BYTES").ReadChunk(ss, sChunk))
+  {
+    cerr << "Reading chunks should fail in bytecount mode.\n";
+    return 1;
+  }
+  cerr << "Chunk test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   In file mode, the reader takes the message at the given offset,
+ *   also from a path with spaces, and removes the file.  A file
+ *   which is never read is removed by DiscardFile.
+ *******************************************************************/
+int
+TestFileMode()
+{
+  JobReaderWriter rw("FILE");
+  char szFile[] = "/tmp/simdist test XXXXXX";
+  int nFd = mkstemp(szFile);
+  if (nFd < 0 || write(nFd, "header payload", 14) != 14)
+  {
+    cerr << "Failed to create " << szFile << ".\n";
+    return 1;
+  }
+  close(nFd);
+  std::stringstream ss;
+  ss << szFile << " 7 7\n";
+  string sRead;
+  if (rw.Read(ss, sRead) || sRead != "payload" || access(szFile, F_OK) == 0)
+  {
+    cerr << "Failed to read message at offset 7 in \"" << szFile << "\".\n";
+    unlink(szFile);
+    return 1;
+  }
+
+  std::stringstream ssUnread;
+  string sReference;
+  if (rw.Write(ssUnread, string("unread")) || !getline(ssUnread, sReference))
+    return 1;
+  const string sPath = sReference.substr(0, sReference.find(' '));
+  const bool bWritten = access(sPath.c_str(), F_OK) == 0;
+  rw.DiscardFile();
+  if (!bWritten || access(sPath.c_str(), F_OK) == 0)
+  {
+    cerr << "File " << sPath << " was not " << (bWritten ? "discarded" : "written") << ".\n";
+    return 1;
+  }
+
+  std::stringstream ssBad("no numbers here\n");
+  if (!rw.Read(ssBad, sRead))
+  {
+    cerr << "Malformed file reference should fail to read.\n";
+    return 1;
+  }
+  cerr << "File mode test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   In bytecount mode, writing should not allocate at all, reading
+ *   into a reused string should not allocate either, and reading
+ *   into a char buffer should allocate the buffer only.
+ *******************************************************************/
+int
+TestAllocations()
+{
+  const size_t nMessages = 50, nSize = 16384;
+  int fds[2];
+  if (pipe(fds))
+  {
+    cerr << "Failed to create pipe.\n";
+    return 1;
+  }
+  fdostream out(fds[1]);
+  fdistream in(fds[0]);
+  JobReaderWriter rw("BYTES");
+  const string sData = MakePayload(nSize);
+  string sRead;
+  sRead.reserve(nSize);
+
+  size_t nWriteAllocs = 0, nReadAllocs = 0, nBufAllocs = 0;
+  for (size_t nMsg = 0; nMsg < nMessages; nMsg++)
+  {
+    size_t nBefore = nNumAllocs;
+    if (rw.Write(out, sData))
+      return 1;
+    nWriteAllocs += nNumAllocs - nBefore;
+
+    nBefore = nNumAllocs;
+    if (rw.Read(in, sRead))
+      return 1;
+    nReadAllocs += nNumAllocs - nBefore;
+
+    if (rw.Write(out, sData))
+      return 1;
+    char *pRead;
+    size_t nRead;
+    nBefore = nNumAllocs;
+    if (rw.Read(in, &pRead, nRead))
+      return 1;
+    nBufAllocs += nNumAllocs - nBefore;
+    delete[] pRead;
+
+    if (sRead != sData)
+    {
+      cerr << "Message " << nMsg << " was corrupted.\n";
+      return 1;
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  cerr << "Allocations per " << nSize << " byte message in bytecount mode: "
+       << double(nWriteAllocs) / nMessages << " when writing, "
+       << double(nReadAllocs) / nMessages << " when reading into a string, "
+       << double(nBufAllocs) / nMessages << " when reading into a char buffer.\n";
+  if (nWriteAllocs > 0 || nReadAllocs > 0 || nBufAllocs > nMessages)
+  {
+    cerr << "Too many allocations!\n";
+    return 1;
+  }
+  cerr << "Allocation test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Write and read throughput for delimited and bytecount messages.
+ *   For each payload size, enough messages to make up 64 MB (at
+ *   least one) are written to a temporary file, which is then read
+ *   back.  The payloads are random, so EOF mode sees a newline,
+ *   the first byte of its delimiter, every 256 bytes on average.
+ *******************************************************************/
+double
+Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+int
+Benchmark()
+{
+  const char *modes[] = { "EOF", "BIN-EOF", "BYTES", "FILE" };
+  const size_t nTotal = 64 << 20;
+  char szFile[] = "/tmp/test-job-io-XXXXXX";
+  int nFd = mkstemp(szFile);
+  if (nFd < 0)
+  {
+    cerr << "Failed to create temporary file.\n";
+    return 1;
+  }
+  unlink(szFile);
+
+  cerr << setw(10) << "Payload";
+  for (size_t nMode = 0; nMode < sizeof(modes) / sizeof(modes[0]); nMode++)
+    cerr << setw(16) << modes[nMode];
+  cerr << "   (MB/s write/read)\n";
+
+  for (size_t nSize = 1024; nSize <= (static_cast<size_t>(nMaxMegabytes) << 20); nSize *= 10)
+  {
+    const string sData = MakePayload(nSize);
+    const size_t nMessages = std::max<size_t>(1, nTotal / nSize);
+    cerr << setw(9) << nSize / 1024 << "K" << flush;
+    for (size_t nMode = 0; nMode < sizeof(modes) / sizeof(modes[0]); nMode++)
+    {
+      JobReaderWriter rw(modes[nMode]);
+      string sRead;
+      if (ftruncate(nFd, 0) || lseek(nFd, 0, SEEK_SET))
+        return 1;
+      fdostream out(nFd);
+      double dStart = Now();
+      for (size_t nMsg = 0; nMsg < nMessages; nMsg++)
+        if (rw.Write(out, sData))
+          return 1;
+      const double dWriteSecs = Now() - dStart;
+      if (lseek(nFd, 0, SEEK_SET))
+        return 1;
+
+      fdistream in(nFd);
+      dStart = Now();
+      for (size_t nMsg = 0; nMsg < nMessages; nMsg++)
+      {
+        if (rw.Read(in, sRead) || sRead.size() != nSize)
+        {
+          cerr << "\nFailed to read message " << nMsg << " in " << modes[nMode] << " mode.\n";
+          return 1;
+        }
+      }
+      const double dReadSecs = Now() - dStart, dMegabytes = nMessages * double(nSize) / (1 << 20);
+      std::stringstream ssCell;
+      ssCell << fixed << setprecision(0) << dMegabytes / dWriteSecs << "/" << dMegabytes / dReadSecs;
+      cerr << setw(16) << ssCell.str() << flush;
+    }
+    cerr << "\n";
+  }
+  close(nFd);
+  cerr << "Benchmark complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Lines per second read in simple mode, for short lines and for
+ *   genomes of 10000 numbers on one line.
+ *******************************************************************/
+int
+BenchmarkLines()
+{
+  const char *modes[] = { "SIMPLE", "SIMPLE 10" };
+  const size_t lengths[] = { 16, 1000, 50000 };
+  const size_t nTotal = 64 << 20;
+  char szFile[] = "/tmp/test-job-io-XXXXXX";
+  int nFd = mkstemp(szFile);
+  if (nFd < 0)
+  {
+    cerr << "Failed to create temporary file.\n";
+    return 1;
+  }
+  unlink(szFile);
+
+  cerr << setw(10) << "Line";
+  for (size_t nMode = 0; nMode < sizeof(modes) / sizeof(modes[0]); nMode++)
+    cerr << setw(16) << modes[nMode];
+  cerr << "   (lines/s)\n";
+
+  for (size_t nLength = 0; nLength < sizeof(lengths) / sizeof(lengths[0]); nLength++)
+  {
+    const size_t nLines = nTotal / lengths[nLength];
+    string sLine(lengths[nLength] - 1, '0');
+    for (size_t nPos = 1; nPos < sLine.size(); nPos += 5)
+      sLine[nPos] = ' ';
+    sLine += '\n';
+    if (ftruncate(nFd, 0) || lseek(nFd, 0, SEEK_SET))
+      return 1;
+    {
+      fdostream out(nFd);
+      for (size_t nLine = 0; nLine < nLines; nLine++)
+        out.write(sLine.data(), sLine.size());
+    }
+
+    cerr << setw(10) << lengths[nLength] << flush;
+    for (size_t nMode = 0; nMode < sizeof(modes) / sizeof(modes[0]); nMode++)
+    {
+      JobReaderWriter rw(modes[nMode]);
+      const size_t nLinesPerMessage = nMode == 0 ? 1 : 10;
+      if (lseek(nFd, 0, SEEK_SET))
+        return 1;
+      fdistream in(nFd);
+      string sRead;
+      const double dStart = Now();
+      for (size_t nMsg = 0; nMsg < nLines / nLinesPerMessage; nMsg++)
+      {
+        if (rw.Read(in, sRead) || sRead.size() != nLinesPerMessage * sLine.size() - 1)
+        {
+          cerr << "\nFailed to read message " << nMsg << " in " << modes[nMode] << " mode.\n";
+          return 1;
+        }
+      }
+      std::stringstream ssCell;
+      ssCell << scientific << setprecision(2) << (nLines / nLinesPerMessage) * nLinesPerMessage / (Now() - dStart);
+      cerr << setw(16) << ssCell.str() << flush;
+    }
+    cerr << "\n";
+  }
+  close(nFd);
+  cerr << "Line benchmark complete.\n\n";
+  return 0;
+}
+
+
+int
+parse_arguments(int argc, char *argv[])
+{
+  struct option opts[] = {
+    {"seed"  , required_argument, 0, 's'},
+    {"max-mb", required_argument, 0, 'm'},
+    { 0 }};
+
+  int ch;
+  while ((ch = getopt_long(argc, argv, "+s:m:", opts, 0)) != -1)
+  {
+    switch (ch)
+    {
+        case 's':
+          nSeed = atoi(optarg);
+          break;
+        case 'm':
+          nMaxMegabytes = atoi(optarg);
+          break;
+        default:
+          std::cerr << "Unregonized option: " << static_cast<char>(optopt) << ".\n";
+          return 1;
+    }
+  }
+  return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  if (parse_arguments(argc, argv))
+  {
+    cerr << "Usage: " << argv[0] << " [--seed n] [--max-mb n]\n";
+    return 1;
+  }
+  srand(nSeed);
+
+  if (TestRoundTrip() ||
+      TestDelimSearch() ||
+      TestLineSearch() ||
+      TestTagChoice() ||
+      TestChunks() ||
+      TestFileMode() ||
+      TestAllocations() ||
+      (nMaxMegabytes > 0 && (Benchmark() || BenchmarkLines())))
+  {
+    cerr << "One or more tests FAILED!\n";
+    return 1;
+  }
+
+  cerr << "All tests completed successfully.\n";
+  return 0;
+}
@@ -24,6 +24,10 @@
  *******************************************************************/
 
 #include <simdist/misc_utils.h>
+#include <simdist/metrics.h>
+#include <simdist/trace.h>
+#include <simdist/profiler.h>
+#include <simdist/io_utils.h>
 #include <simdist/mathutils.h>
 #include <simdist/ref_ptr.h>
 #include <getopt.h>
@@ -32,6 +36,8 @@
 
 #include <cmath>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <functional>
 #include <iterator>
 #include <algorithm>
@@ -39,7 +45,10 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/timeb.h>
 #include <cstring>
 #include <cstdio>
@@ -482,6 +491,435 @@ TestTrim()
 }
 
 
+/********************************************************************
+ *   Test ParseCpuList() on lists in the format used in /sys, and
+ *   print the CPU topology of this host.
+ *******************************************************************/
+int
+TestCpuList()
+{
+  vector<int> cpus;
+  if (ParseCpuList("0-3,8, 10-11,2", cpus) || cpus.size() != 7
+      || cpus[0] != 0 || cpus[3] != 3 || cpus[4] != 8 || cpus[6] != 11)
+  {
+    cerr << "Failed to parse CPU list!\n";
+    return 1;
+  }
+  if (!ParseCpuList("3-1", cpus) || !ParseCpuList("0-x", cpus))
+  {
+    cerr << "Malformed CPU list parsed without error!\n";
+    return 1;
+  }
+
+  vector<vector<int> > nodeCpus;
+  if (ReadCpuTopology(nodeCpus) || nodeCpus.empty())
+  {
+    cerr << "Failed to read CPU topology!\n";
+    return 1;
+  }
+  for (size_t nNode = 0; nNode < nodeCpus.size(); nNode++)
+  {
+    cerr << "NUMA node " << nNode << ": CPUs ";
+    copy(nodeCpus[nNode].begin(), nodeCpus[nNode].end(), ostream_iterator<int>(cerr, " "));
+    cerr << "\n";
+  }
+  cerr << "CPU list test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Test that metrics are ignored until the export is started, and
+ *   check the exported values.  The export stays enabled, so run
+ *   this last.
+ *******************************************************************/
+int
+TestMetrics()
+{
+  MetricsCounter &counter = Metrics::Instance().Counter("test_total", "Test counter");
+  MetricsHistogram &histogram = Metrics::Instance().Histogram("test_seconds", "Test histogram", "test", "a");
+  counter.Add(5);
+  if (counter.Value() != 0 || &counter != &Metrics::Instance().Counter("test_total", ""))
+  {
+    cerr << "Metric was updated before the export was started, or registered twice!\n";
+    return 1;
+  }
+
+  stringstream ssFileName;
+  ssFileName << "/tmp/test_misc_utils_metrics." << getpid();
+  const string sFile = ssFileName.str();
+  if (Metrics::Instance().StartExport(sFile, "PROMETHEUS", 3600))
+    return 1;
+  counter.Add(5);
+  histogram.Observe(0.0002);
+  histogram.Observe(2);
+  histogram.Observe(2000);
+
+  stringstream ssProm, ssJson;
+  if (Metrics::Instance().Write(ssProm, Metrics::prometheus)
+      || Metrics::Instance().Write(ssJson, Metrics::json)
+      || Metrics::Instance().StopExport())
+    return 1;
+  if (bVerbose)
+    cerr << ssProm.str() << ssJson.str();
+  const char *expected[] = { "test_total 5\n", 
+                             "test_seconds_bucket{test=\"a\",le=\"0.0001\"} 0\n",
+                             "test_seconds_bucket{test=\"a\",le=\"0.0005\"} 1\n",
+                             "test_seconds_bucket{test=\"a\",le=\"5\"} 2\n",
+                             "test_seconds_bucket{test=\"a\",le=\"+Inf\"} 3\n",
+                             "test_seconds_count{test=\"a\"} 3\n" };
+  for (size_t nExp = 0; nExp < sizeof(expected) / sizeof(expected[0]); nExp++)
+    if (ssProm.str().find(expected[nExp]) == string::npos)
+    {
+      cerr << "Missing \"" << expected[nExp] << "\" in Prometheus output:\n" << ssProm.str();
+      return 1;
+    }
+  if (ssJson.str().find("{\"name\": \"test_total\", \"type\": \"counter\", \"labels\": {}, \"value\": 5}") == string::npos)
+  {
+    cerr << "Unexpected JSON output:\n" << ssJson.str();
+    return 1;
+  }
+
+  ifstream file(sFile.c_str());
+  stringstream ssFile;
+  ssFile << file.rdbuf();
+  unlink(sFile.c_str());
+  if (ssFile.str() != ssProm.str())
+  {
+    cerr << "Metrics file differs from the metrics written!\n";
+    return 1;
+  }
+  cerr << "Metrics test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Test that spans are only recorded while tracing, and are kept
+ *   for shipping when there is no trace file, as on a slave.
+ *******************************************************************/
+int
+TestTrace()
+{
+  {
+    TraceSpan span("before", "Test", "job-0");
+  }
+  if (!Trace::Instance().TakePending().empty())
+  {
+    cerr << "Span recorded before tracing was started!\n";
+    return 1;
+  }
+
+  if (Trace::Instance().Start("", 7, "Test \"process\""))
+    return 1;
+  {
+    TraceSpan span("during", "Test", "job-1");
+  }
+  string sEvents = Trace::Instance().TakePending();
+  if (bVerbose)
+    cerr << sEvents;
+  if (sEvents.find("{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 7, \"args\": {\"name\": \"Test \\\"process\\\"\"}}\n") != 0
+      || sEvents.find("\"name\": \"thread_name\"") == string::npos
+      || sEvents.find("{\"name\": \"during\", \"cat\": \"Test\", \"ph\": \"X\", \"ts\": ") == string::npos
+      || sEvents.find("\"pid\": 7, \"tid\": 0, \"args\": {\"job\": \"job-1\"}}\n") == string::npos
+      || sEvents.find("before") != string::npos
+      || !Trace::Instance().TakePending().empty())
+  {
+    cerr << "Unexpected trace events:\n" << sEvents;
+    return 1;
+  }
+  cerr << "Trace test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Durations 1..1000 us are added to one region from two threads.
+ *   The merged counts must be exact, and the percentiles within the
+ *   resolution of the histogram.
+ *******************************************************************/
+void*
+ProfileThread(void *pArg)
+{
+  ProfileRegion &region = *static_cast<ProfileRegion*>(pArg);
+  for (uint64_t nUs = 1; nUs <= 1000; nUs++)
+    region.Add(nUs * 1000);
+  return 0;
+}
+
+
+int
+TestProfiler()
+{
+  static ProfileRegion region("test-region");
+  {
+    ProfileScope scope(region);
+  }
+  vector<pair<string, Profiler::TRegionStats> > regions;
+  Profiler::Instance().Merge(regions);
+  if (!regions.empty())
+  {
+    cerr << "Region timed before profiling was enabled!\n";
+    return 1;
+  }
+
+  pthread_t threads[2];
+  for (int nThread = 0; nThread < 2; nThread++)
+    if (pthread_create(&threads[nThread], 0, ProfileThread, &region))
+      return 1;
+  for (int nThread = 0; nThread < 2; nThread++)
+    pthread_join(threads[nThread], 0);
+
+  Profiler::Instance().Merge(regions);
+  if (regions.size() != 1 || regions[0].first != "test-region")
+  {
+    cerr << "Expected one merged profiler region!\n";
+    return 1;
+  }
+  const Profiler::TRegionStats &stats = regions[0].second;
+  const double dQuantiles[] = { 0.5, 0.9, 0.99 };
+  for (size_t nQuant = 0; nQuant < sizeof(dQuantiles) / sizeof(dQuantiles[0]); nQuant++)
+  {
+    const double dExpected = dQuantiles[nQuant] * 1e6, dActual = Profiler::Percentile(stats, dQuantiles[nQuant]);
+    if (fabs(dActual - dExpected) > 0.125 * dExpected)
+    {
+      cerr << "Percentile " << dQuantiles[nQuant] << " was " << dActual << " ns, expected about " << dExpected << ".\n";
+      return 1;
+    }
+  }
+  if (stats.nCount != 2000 || stats.nTotalNs != 2 * 500500000ULL || stats.nMaxNs != 1000000)
+  {
+    cerr << "Wrong profiler counts: " << stats.nCount << " calls, " 
+         << stats.nTotalNs << " ns in total and " << stats.nMaxNs << " ns at most.\n";
+    return 1;
+  }
+
+  Profiler::Enable();
+  {
+    ProfileScope scope(region);
+  }
+  Profiler::Enable(false);
+  Profiler::Instance().Merge(regions);
+  if (regions[0].second.nCount != 2001)
+  {
+    cerr << "Scope not timed after profiling was enabled!\n";
+    return 1;
+  }
+  if (bVerbose)
+    Profiler::Instance().Report(cerr);
+  cerr << "Profiler test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Results are replayed on the next open, a torn record at the end
+ *   is cut off, and a corrupt record ends the replay.
+ *******************************************************************/
+int
+TestResultJournal()
+{
+  stringstream ssFileName;
+  ssFileName << "/tmp/test_misc_utils_journal." << getpid();
+  const string sFile = ssFileName.str();
+  unlink(sFile.c_str());
+
+  ResultJournal journal;
+  string sResults;
+  if (journal.Open(sFile, 2)
+      || journal.Append("job 1", "results 1")
+      || journal.Append("job 2", string("results\0 2", 10))
+      || journal.Append("job 1", "other results")
+      || journal.Append("job 3", "")
+      || journal.Lookup("job 1", sResults)
+      || journal.Close())
+  {
+    cerr << "Failed to write result journal, or found results written in the same run!\n";
+    return 1;
+  }
+
+  if (journal.Open(sFile, 0)
+      || journal.NumReplayed() != 3
+      || !journal.Lookup("job 1", sResults) || sResults != "results 1"
+      || !journal.Lookup("job 2", sResults) || sResults != string("results\0 2", 10)
+      || !journal.Lookup("job 3", sResults) || !sResults.empty()
+      || journal.Lookup("job 4", sResults)
+      || journal.Append("job 4", "results 4")
+      || journal.Close())
+  {
+    cerr << "Unexpected results replayed from the result journal!\n";
+    return 1;
+  }
+
+  struct stat st;
+  stat(sFile.c_str(), &st);
+  const off_t nSize = st.st_size;
+  if (truncate(sFile.c_str(), nSize - 1)
+      || journal.Open(sFile, 0)
+      || journal.NumReplayed() != 3
+      || journal.Lookup("job 4", sResults)
+      || journal.Close()
+      || stat(sFile.c_str(), &st)
+      || st.st_size != nSize - static_cast<off_t>(32 + 5 + 9))
+  {
+    cerr << "Torn record at the end of the result journal was not cut off!\n";
+    return 1;
+  }
+
+      // Flip a bit in the results of the second record.
+  int nFd = open(sFile.c_str(), O_RDWR);
+  char ch;
+  const off_t nOffset = 32 + 5 + 9 + 32 + 5 + 3;
+  if (nFd < 0 || pread(nFd, &ch, 1, nOffset) != 1)
+    return 1;
+  ch ^= 1;
+  if (pwrite(nFd, &ch, 1, nOffset) != 1)
+    return 1;
+  close(nFd);
+  if (journal.Open(sFile, 0)
+      || journal.NumReplayed() != 1
+      || !journal.Lookup("job 1", sResults)
+      || journal.Close())
+  {
+    cerr << "Corrupt record in the result journal was replayed!\n";
+    return 1;
+  }
+
+      // A record for a different job with the same hash and size as
+      // "job 5" must not be taken for it.
+  const ResultJournal::TKey key = ResultJournal::Key("job 5");
+  const string sOtherJob = "jo\nb5", sOtherResults = "other results";
+  uint64_t fields[3] = { key.first, key.second, sOtherResults.size() };
+  uint32_t nCrc = Crc32(reinterpret_cast<const char*>(fields), sizeof(fields));
+  nCrc = Crc32((sOtherJob + sOtherResults).data(), sOtherJob.size() + sOtherResults.size(), nCrc);
+  const uint32_t prefix[2] = { ResultJournal::record_magic, nCrc };
+  const string sRecord = string(reinterpret_cast<const char*>(prefix), sizeof(prefix))
+    + string(reinterpret_cast<const char*>(fields), sizeof(fields)) + sOtherJob + sOtherResults;
+  nFd = open(sFile.c_str(), O_WRONLY | O_APPEND);
+  if (nFd < 0 || write(nFd, sRecord.data(), sRecord.size()) != static_cast<ssize_t>(sRecord.size()))
+    return 1;
+  close(nFd);
+  if (journal.Open(sFile, 0)
+      || journal.NumReplayed() != 2
+      || journal.Lookup("job 5", sResults)
+      || journal.Close())
+  {
+    cerr << "Result journal replayed the results of a different job with the same hash!\n";
+    return 1;
+  }
+
+      // A record which fails to be written must not hide the ones
+      // written after it.
+  stat(sFile.c_str(), &st);
+  struct rlimit oldLimit, limit;
+  getrlimit(RLIMIT_FSIZE, &oldLimit);
+  limit = oldLimit;
+  limit.rlim_cur = st.st_size + 100;
+  void (*oldHandler)(int) = signal(SIGXFSZ, SIG_IGN);
+  setrlimit(RLIMIT_FSIZE, &limit);
+  const bool bOpenFailed = journal.Open(sFile, 0);
+  const bool bLargeFailed = !bOpenFailed && journal.Append("job 6", string(1000, 'x'));
+  const bool bSmallFailed = !bOpenFailed && journal.Append("job 7", "results 7");
+  setrlimit(RLIMIT_FSIZE, &oldLimit);
+  signal(SIGXFSZ, oldHandler);
+  if (bOpenFailed || !bLargeFailed || bSmallFailed
+      || journal.Close()
+      || journal.Open(sFile, 0)
+      || !journal.Lookup("job 7", sResults) || sResults != "results 7"
+      || journal.Lookup("job 6", sResults)
+      || journal.Close())
+  {
+    cerr << "Failed record in the result journal was not cut off!\n";
+    return 1;
+  }
+  unlink(sFile.c_str());
+  cerr << "Result journal test complete.\n\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Delta and background stores must load back the data stored,
+ *   ignoring a torn delta at the end and deltas on top of another
+ *   checkpoint.
+ *******************************************************************/
+int
+TestCheckpointer()
+{
+  stringstream ssFileName;
+  ssFileName << "/tmp/test_misc_utils_checkpoint." << getpid();
+  const string sFile = ssFileName.str(), sDeltaFile = sFile + ".delta";
+  Checkpointer check(sFile);
+  check.SetChunkSize(16);
+
+  string sData(200, 'a'), sLoaded;
+  struct stat st;
+  if (check.StoreDelta(sData.data(), sData.size())
+      || stat(sDeltaFile.c_str(), &st) == 0)
+  {
+    cerr << "First delta store was not a full store!\n";
+    return 1;
+  }
+  sData[20] = 'b';
+  sData[199] = 'c';
+  if (check.StoreDelta(sData.data(), sData.size())
+      || stat(sDeltaFile.c_str(), &st)
+      || st.st_size != 32 + 2 * (8 + 16) - 8 + 4
+      || check.Load(sLoaded) || sLoaded != sData)
+  {
+    cerr << "Delta store failed, or wrote too much!\n";
+    return 1;
+  }
+  sData[40] = 'd';
+  const string sExpected = sData;
+  if (check.StoreAsync(sData.data(), sData.size()))
+    return 1;
+  sData[41] = 'e';
+  if (check.WaitStore()
+      || check.Load(sLoaded) || sLoaded != sExpected)
+  {
+    cerr << "Background store failed, or stored data changed after the call!\n";
+    return 1;
+  }
+
+  {
+    ofstream delta(sDeltaFile.c_str(), ios::app);
+    delta << "SDC1 torn";
+  }
+  char *pLoaded = 0;
+  size_t nLoaded;
+  if (check.Load(&pLoaded, &nLoaded) || string(pLoaded, nLoaded) != sExpected)
+  {
+    cerr << "Torn delta was not ignored!\n";
+    return 1;
+  }
+  delete[] pLoaded;
+
+  const string sStale = sDeltaFile + ".stale";
+  rename(sDeltaFile.c_str(), sStale.c_str());
+  sData.assign(200, 'x');
+  if (check.Store(sData) || rename(sStale.c_str(), sDeltaFile.c_str())
+      || check.Load(sLoaded) || sLoaded != sData)
+  {
+    cerr << "Deltas on top of another checkpoint were applied!\n";
+    return 1;
+  }
+
+  sData.resize(100);
+  if (check.StoreDelta(sData.data(), sData.size())
+      || stat(sDeltaFile.c_str(), &st) == 0
+      || check.Load(sLoaded) || sLoaded != sData
+      || check.Clear()
+      || stat(sFile.c_str(), &st) == 0)
+  {
+    cerr << "Store after a change of size was not a full store!\n";
+    return 1;
+  }
+  cerr << "Checkpointer test complete.\n\n";
+  return 0;
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -506,7 +944,13 @@ main(int argc, char *argv[])
       TestFdStreams(argc, argv) ||
       TestWildcardMatch() || 
       TestFdStreams2() ||
-      TestTrim())
+      TestTrim() ||
+      TestCpuList() ||
+      TestMetrics() ||
+      TestTrace() ||
+      TestProfiler() ||
+      TestResultJournal() ||
+      TestCheckpointer())
   {
     cerr << "One or more tests FAILED!\n";
     return 1;
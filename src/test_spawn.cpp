@@ -0,0 +1,237 @@
+/********************************************************************
+ *   		test_spawn.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   Test the process creation methods of ConnectProcess, and
+ *   compare the time it takes to launch a child with fork and
+ *   posix_spawn as the resident set of the parent grows.
+ *******************************************************************/
+
+#include <simdist/misc_utils.h>
+#include <getopt.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+int nIterations = 50;
+int nMaxMegabytes = 1024;
+
+int
+parse_arguments(int argc, char *argv[])
+{
+  struct option opts[] = {
+    {"iterations", required_argument, 0, 'i'},
+    {"max-mb"    , required_argument, 0, 'm'},
+    { 0 }};
+
+  int ch;
+  while ((ch = getopt_long(argc, argv, "+i:m:", opts, 0)) != -1)
+  {
+    switch (ch)
+    {
+        case 'i':
+          nIterations = atoi(optarg);
+          break;
+        case 'm':
+          nMaxMegabytes = atoi(optarg);
+          break;
+        default:
+          std::cerr << "Unregonized option: " << static_cast<char>(optopt) << ".\n";
+          return 1;
+    }
+  }
+  return 0;
+}
+
+
+double
+Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+const char*
+MethodName(TSpawnMethod method)
+{
+  return method == spawn_fork ? "fork" : "posix_spawn";
+}
+
+
+/********************************************************************
+ *   Launch cat with each method, and check that data written to
+ *   its standard input comes back on standard output.
+ *******************************************************************/
+int
+TestEcho(TSpawnMethod method)
+{
+  fdostream childWrite;
+  fdistream childRead;
+  pid_t pid;
+  if (ConnectProcess("cat", "", &childWrite, &childRead, 0, &pid, 0, method))
+  {
+    cerr << "Failed to connect to cat using " << MethodName(method) << ".\n";
+    return 1;
+  }
+
+  const string sLine = "The quick brown fox jumps over the lazy dog";
+  childWrite << sLine << "\n" << flush;
+  string sEcho;
+  getline(childRead, sEcho);
+  childWrite.close();
+  childRead.close();
+  waitpid(pid, 0, 0);
+
+  if (sEcho != sLine)
+  {
+    cerr << "Echo test with " << MethodName(method) << " failed! Wrote '"
+         << sLine << "', read '" << sEcho << "'.\n";
+    return 1;
+  }
+  cerr << "Echo test with " << MethodName(method) << " passed.\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   A program that doesn't exist should be reported as an error
+ *   in the parent.  With fork, the error surfaces in the child
+ *   instead, so only posix_spawn is tested.
+ *******************************************************************/
+int
+TestMissingProgram()
+{
+  cerr << "Launching a nonexistent program, expect an error message...\n";
+  if (!ConnectProcess("./__no_such_program__", "", 0, 0, 0, 0, 0, spawn_posix))
+  {
+    cerr << "posix_spawn of a nonexistent program did not report an error!\n";
+    return 1;
+  }
+  cerr << "Missing program test passed.\n";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Time nIterations launches of /bin/true.  The spawn time is
+ *   the time spent inside ConnectProcess, the total time also
+ *   includes waiting for the child to exit.
+ *******************************************************************/
+int
+TimeSpawn(TSpawnMethod method, double &dSpawn, double &dTotal)
+{
+  dSpawn = dTotal = 0;
+  for (int nIt = 0; nIt < nIterations; nIt++)
+  {
+    pid_t pid;
+    double dStart = Now();
+    if (ConnectProcess("/bin/true", "", 0, 0, 0, &pid, 0, method))
+      return 1;
+    double dSpawned = Now();
+    waitpid(pid, 0, 0);
+    dSpawn += dSpawned - dStart;
+    dTotal += Now() - dStart;
+  }
+  dSpawn /= nIterations;
+  dTotal /= nIterations;
+  return 0;
+}
+
+
+int
+Benchmark()
+{
+  const TSpawnMethod methods[] = { spawn_fork, spawn_posix };
+  cout << setw(10) << "RSS (MB)" << setw(14) << "method"
+       << setw(16) << "spawn (us)" << setw(16) << "total (us)" << "\n";
+
+  vector<char*> blocks;
+  int nAllocated = 0;
+  for (int nMegabytes = 0; nMegabytes <= nMaxMegabytes; nMegabytes = (nMegabytes ? nMegabytes * 4 : 16))
+  {
+        // Grow the resident set by touching every page of the new
+        // memory.
+    size_t nBytes = static_cast<size_t>(nMegabytes - nAllocated) << 20;
+    if (nBytes)
+    {
+      char *pBlock = static_cast<char*>(malloc(nBytes));
+      if (!pBlock)
+      {
+        cerr << "Failed to allocate " << nMegabytes << " MB.\n";
+        break;
+      }
+      memset(pBlock, 1, nBytes);
+      blocks.push_back(pBlock);
+      nAllocated = nMegabytes;
+    }
+
+    for (size_t nMethod = 0; nMethod < sizeof(methods) / sizeof(methods[0]); nMethod++)
+    {
+      double dSpawn, dTotal;
+      if (TimeSpawn(methods[nMethod], dSpawn, dTotal))
+      {
+        cerr << "Failed to launch child process using " << MethodName(methods[nMethod]) << ".\n";
+        return 1;
+      }
+      cout << setw(10) << nMegabytes << setw(14) << MethodName(methods[nMethod])
+           << setw(16) << fixed << setprecision(1) << dSpawn * 1e6
+           << setw(16) << dTotal * 1e6 << "\n";
+    }
+  }
+
+  for (size_t nBlock = 0; nBlock < blocks.size(); nBlock++)
+    free(blocks[nBlock]);
+  return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  if (parse_arguments(argc, argv))
+  {
+    cerr << "Usage: " << argv[0] << " [--iterations n] [--max-mb n]\n";
+    return 1;
+  }
+
+  if (TestEcho(spawn_fork) ||
+      TestEcho(spawn_posix) ||
+      TestMissingProgram() ||
+      Benchmark())
+  {
+    cerr << "One or more tests FAILED!\n";
+    return 1;
+  }
+
+  cerr << "All tests completed successfully.\n";
+  return 0;
+}
@@ -24,6 +24,7 @@
  *******************************************************************/
 
 #include <simdist/timer.h>
+#include <simdist/profiler.h>
 #include <iostream>
 #include <sstream>
 
@@ -53,16 +54,14 @@ Timer::ReportOnDestroy(bool bReport, std::ostream *pReportStream /*=&std::cerr*/
 void
 Timer::Reset()
 {
-  time(&m_timeStart);
+  m_nStartNs = Profiler::Now();
 }
 
 
 double
 Timer::Elapsed() const
 {
-  time_t timeNow;
-  time(&timeNow);
-  return difftime(timeNow, m_timeStart);
+  return (Profiler::Now() - m_nStartNs) / 1e9;
 }
 
 
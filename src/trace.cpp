@@ -0,0 +1,221 @@
+/********************************************************************
+ *   		trace.cpp
+ *   Created on Mon Oct 19 2026 by Boye A. Hoeverstad.
+ *   Copyright 2009 Boye A. Hoeverstad
+ *
+ *   This file is part of Simdist.
+ *
+ *   Simdist is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Simdist is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Simdist.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   ***************************************************************
+ *
+ *   See header file for description.
+ *******************************************************************/
+
+#if HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <simdist/trace.h>
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/time.h>
+
+// FeedbackError E_TRACE_WRITE("Failed to write trace");
+DEFINE_FEEDBACK_ERROR(E_TRACE_WRITE, "Failed to write trace")
+
+
+volatile bool Trace::m_bEnabled = false;
+volatile int Trace::m_nNextTid = 0;
+__thread int Trace::m_nTid = -1;
+
+
+/********************************************************************
+ *   Quote s as a JSON string.  Job IDs and process names are plain
+ *   text, so only quotes, backslashes and control characters need
+ *   attention.
+ *******************************************************************/
+static std::string
+JsonString(const std::string &s)
+{
+  std::string sQuoted = "\"";
+  for (std::string::const_iterator it = s.begin(); it != s.end(); it++)
+  {
+    if (*it == '"' || *it == '\\')
+      sQuoted += '\\';
+    if (static_cast<unsigned char>(*it) < 0x20)
+      sQuoted += ' ';
+    else
+      sQuoted += *it;
+  }
+  return sQuoted + "\"";
+}
+
+
+
+Trace::Trace()
+  : m_fb("Trace")
+  , m_nPid(0)
+  , m_mtx("Trace-mutex")
+  , m_bFirstEvent(true)
+{
+}
+
+
+Trace::~Trace()
+{
+  Stop();
+}
+
+
+Trace&
+Trace::Instance()
+{
+  static Trace instance;
+  return instance;
+}
+
+
+uint64_t
+Trace::Now()
+{
+  timeval now;
+  gettimeofday(&now, 0);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_usec;
+}
+
+
+int
+Trace::Start(const std::string &sFile, int nPid, const std::string &sProcessName)
+{
+  m_nPid = nPid;
+  m_sFile = sFile;
+  if (!m_sFile.empty())
+  {
+    m_file.open(m_sFile.c_str());
+    if (!m_file)
+      return m_fb.Error(E_TRACE_WRITE) << ": Failed to open " << m_sFile << ": " << strerror(errno) << ".";
+    m_file << "{\"traceEvents\": [\n";
+    m_fb.Info(1) << "Writing a trace of the job life cycle to " << m_sFile << ".";
+  }
+
+  std::stringstream ss;
+  ss << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << m_nPid
+     << ", \"args\": {\"name\": " << JsonString(sProcessName) << "}}\n";
+  Append(ss.str());
+  m_bEnabled = true;
+  return 0;
+}
+
+
+/********************************************************************
+ *   Threads which are still running may try to add events after
+ *   the file has been closed.  These are dropped.
+ *******************************************************************/
+int
+Trace::Stop()
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return m_fb.Error(E_TRACE_WRITE);
+  if (!m_file.is_open())
+    return 0;
+  m_bEnabled = false;
+  m_file << "\n]}\n";
+  m_file.close();
+  if (!m_file)
+    return m_fb.Error(E_TRACE_WRITE) << ": Failed to write " << m_sFile << ".";
+  return 0;
+}
+
+
+/********************************************************************
+ *   Threads are numbered in the order they add their first event,
+ *   and named after the category of that event.
+ *******************************************************************/
+int
+Trace::ThreadId(const char *szCategory)
+{
+  if (m_nTid < 0)
+  {
+    m_nTid = __sync_fetch_and_add(&m_nNextTid, 1);
+    std::stringstream ss;
+    ss << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << m_nPid << ", \"tid\": " << m_nTid
+       << ", \"args\": {\"name\": \"" << szCategory << " " << m_nTid << "\"}}\n";
+    Append(ss.str());
+  }
+  return m_nTid;
+}
+
+
+void
+Trace::Add(const char *szName, const char *szCategory, uint64_t nStart, uint64_t nEnd,
+           const std::string &sJobID /*=""*/)
+{
+  std::stringstream ss;
+  ss << "{\"name\": \"" << szName << "\", \"cat\": \"" << szCategory << "\", \"ph\": \"X\", \"ts\": " << nStart
+     << ", \"dur\": " << (nEnd > nStart ? nEnd - nStart : 0) << ", \"pid\": " << m_nPid
+     << ", \"tid\": " << ThreadId(szCategory);
+  if (!sJobID.empty())
+    ss << ", \"args\": {\"job\": " << JsonString(sJobID) << "}";
+  ss << "}\n";
+  Append(ss.str());
+}
+
+
+/********************************************************************
+ *   Events are kept one per line.  In the file, they are separated
+ *   by commas as well.
+ *******************************************************************/
+void
+Trace::Append(const std::string &sEvents)
+{
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return;
+  if (m_sFile.empty())
+  {
+    m_sPending += sEvents;
+    return;
+  }
+  if (!m_file.is_open())
+    return;
+
+  for (size_t nPos = 0, nEnd; nPos < sEvents.size(); nPos = nEnd + 1)
+  {
+    if ((nEnd = sEvents.find('\n', nPos)) == std::string::npos)
+      nEnd = sEvents.size();
+    if (nEnd == nPos)
+      continue;
+    if (!m_bFirstEvent)
+      m_file << ",\n";
+    m_bFirstEvent = false;
+    m_file.write(sEvents.data() + nPos, nEnd - nPos);
+  }
+}
+
+
+std::string
+Trace::TakePending()
+{
+  std::string sEvents;
+  AutoMutex mtx;
+  if (m_mtx.AcquireMutex(mtx))
+    return sEvents;
+  sEvents.swap(m_sPending);
+  return sEvents;
+}